@@ -33,6 +33,19 @@ namespace gamescope
         std::vector<uint32_t> ValidRefreshRates;
     };
 
+    struct GamescopeFrameLatency
+    {
+        gamescope_control_frame_latency_stage eStage;
+        uint32_t uCount;
+        uint32_t uP50;
+        uint32_t uP90;
+        uint32_t uP99;
+        uint32_t uP999;
+        uint32_t uMax;
+        // Bucket upper bound in us -> frame count.
+        std::vector<std::pair<uint32_t, uint32_t>> Histogram;
+    };
+
     class GamescopeCtl
     {
     public:
@@ -41,6 +54,7 @@ namespace gamescope
 
         bool Init( bool bInitControl, bool bInitPrivate );
         bool Execute( std::span<std::string_view> args );
+        std::optional<std::vector<GamescopeFrameLatency>> RequestFrameLatency( uint32_t uFrames );
 
         std::span<GamescopeFeature> GetFeatures() { return std::span<GamescopeFeature>{ m_Features }; }
         const std::optional<GamescopeActiveDisplayInfo> &GetActiveDisplayInfo() { return m_ActiveDisplayInfo; }
@@ -57,12 +71,17 @@ namespace gamescope
         std::vector<GamescopeFeature> m_Features;
         std::optional<GamescopeActiveDisplayInfo> m_ActiveDisplayInfo;
 
+        std::vector<GamescopeFrameLatency> m_FrameLatencies;
+        bool m_bFrameLatencyDone = false;
+
         void Wayland_Registry_Global( wl_registry *pRegistry, uint32_t uName, const char *pInterface, uint32_t uVersion );
         static const wl_registry_listener s_RegistryListener;
 
         void Wayland_GamescopeControl_FeatureSupport( gamescope_control *pGamescopeControl, uint32_t uFeature, uint32_t uVersion, uint32_t uFlags );
         void Wayland_GamescopeControl_ActiveDisplayInfo( gamescope_control *pGamescopeControl, const char *pConnectorName, const char *pDisplayMake, const char *pDisplayModel, uint32_t uDisplayFlags, wl_array *pValidRefreshRatesArray );
         void Wayland_GamescopeControl_ScreenshotTaken( gamescope_control *pGamescopeControl, const char *pPath );
+        void Wayland_GamescopeControl_FrameLatency( gamescope_control *pGamescopeControl, uint32_t uStage, uint32_t uCount, uint32_t uP50, uint32_t uP90, uint32_t uP99, uint32_t uP999, uint32_t uMax, wl_array *pHistogramArray );
+        void Wayland_GamescopeControl_FrameLatencyDone( gamescope_control *pGamescopeControl );
         static const gamescope_control_listener s_GamescopeControlListener;
 
         void Wayland_GamescopePrivate_Log( gamescope_private *pGamescopePrivate, const char *pText );
@@ -134,6 +153,27 @@ namespace gamescope
         return true;
     }
 
+    std::optional<std::vector<GamescopeFrameLatency>> GamescopeCtl::RequestFrameLatency( uint32_t uFrames )
+    {
+        if ( gamescope_control_get_version( m_pGamescopeControl ) < GAMESCOPE_CONTROL_REQUEST_FRAME_LATENCY_SINCE_VERSION )
+        {
+            fprintf( stderr, "This Gamescope does not support frame latency tracking.\n" );
+            return std::nullopt;
+        }
+
+        m_FrameLatencies.clear();
+        m_bFrameLatencyDone = false;
+
+        gamescope_control_request_frame_latency( m_pGamescopeControl, uFrames );
+        while ( !m_bFrameLatencyDone )
+        {
+            if ( wl_display_roundtrip( m_pDisplay ) < 0 )
+                return std::nullopt;
+        }
+
+        return std::move( m_FrameLatencies );
+    }
+
     void GamescopeCtl::Wayland_Registry_Global( wl_registry *pRegistry, uint32_t uName, const char *pInterface, uint32_t uVersion )
     {
         if ( m_bInitControl && !strcmp( pInterface, gamescope_control_interface.name ) )
@@ -187,11 +227,37 @@ namespace gamescope
         fprintf( stderr, "Screenshot taken to: %s\n", pPath );
     }
 
+    void GamescopeCtl::Wayland_GamescopeControl_FrameLatency( gamescope_control *pGamescopeControl, uint32_t uStage, uint32_t uCount, uint32_t uP50, uint32_t uP90, uint32_t uP99, uint32_t uP999, uint32_t uMax, wl_array *pHistogramArray )
+    {
+        const uint32_t *pHistogram = reinterpret_cast<const uint32_t*>( pHistogramArray->data );
+        std::vector<std::pair<uint32_t, uint32_t>> histogram;
+        for ( size_t i = 0; i + 1 < pHistogramArray->size / sizeof( uint32_t ); i += 2 )
+            histogram.emplace_back( pHistogram[i], pHistogram[i + 1] );
+
+        m_FrameLatencies.emplace_back( GamescopeFrameLatency
+        {
+            .eStage    = static_cast<gamescope_control_frame_latency_stage>( uStage ),
+            .uCount    = uCount,
+            .uP50      = uP50,
+            .uP90      = uP90,
+            .uP99      = uP99,
+            .uP999     = uP999,
+            .uMax      = uMax,
+            .Histogram = std::move( histogram ),
+        } );
+    }
+    void GamescopeCtl::Wayland_GamescopeControl_FrameLatencyDone( gamescope_control *pGamescopeControl )
+    {
+        m_bFrameLatencyDone = true;
+    }
+
     const gamescope_control_listener GamescopeCtl::s_GamescopeControlListener =
     {
         .feature_support     = WAYLAND_USERDATA_TO_THIS( GamescopeCtl, Wayland_GamescopeControl_FeatureSupport ),
         .active_display_info = WAYLAND_USERDATA_TO_THIS( GamescopeCtl, Wayland_GamescopeControl_ActiveDisplayInfo ),
         .screenshot_taken    = WAYLAND_USERDATA_TO_THIS( GamescopeCtl, Wayland_GamescopeControl_ScreenshotTaken ),
+        .frame_latency       = WAYLAND_USERDATA_TO_THIS( GamescopeCtl, Wayland_GamescopeControl_FrameLatency ),
+        .frame_latency_done  = WAYLAND_USERDATA_TO_THIS( GamescopeCtl, Wayland_GamescopeControl_FrameLatencyDone ),
     };
 
     void GamescopeCtl::Wayland_GamescopePrivate_Log( gamescope_private *pGamescopePrivate, const char *pText )
@@ -226,15 +292,92 @@ namespace gamescope
                 return "Refresh Cycle Only Change Refresh Rate";
             case GAMESCOPE_CONTROL_FEATURE_MURA_CORRECTION:
                 return "Mura Correction";
+            case GAMESCOPE_CONTROL_FEATURE_LOOK:
+                return "Look";
+            case GAMESCOPE_CONTROL_FEATURE_FRAME_LATENCY:
+                return "Frame Latency";
             default:
                 return "Unknown";
         }
     }
 
+    static std::string_view GetFrameLatencyStageName( gamescope_control_frame_latency_stage eStage )
+    {
+        switch ( eStage )
+        {
+            case GAMESCOPE_CONTROL_FRAME_LATENCY_STAGE_FENCE_WAIT:
+                return "commit -> fence";
+            case GAMESCOPE_CONTROL_FRAME_LATENCY_STAGE_LATCH:
+                return "fence -> latch";
+            case GAMESCOPE_CONTROL_FRAME_LATENCY_STAGE_SUBMIT:
+                return "latch -> submit";
+            case GAMESCOPE_CONTROL_FRAME_LATENCY_STAGE_FLIP:
+                return "submit -> flip";
+            case GAMESCOPE_CONTROL_FRAME_LATENCY_STAGE_TOTAL:
+                return "commit -> flip";
+            default:
+                return "Unknown";
+        }
+    }
+
+    static int PrintFrameLatency( int argc, char *argv[] )
+    {
+        uint32_t uFrames = 0;
+        bool bHistogram = false;
+        for ( int i = 2; i < argc; i++ )
+        {
+            if ( !strcmp( argv[i], "--histogram" ) )
+            {
+                bHistogram = true;
+                continue;
+            }
+
+            std::optional<uint32_t> ouFrames = Parse<uint32_t>( argv[i] );
+            if ( !ouFrames )
+            {
+                fprintf( stderr, "usage: gamescopectl latency [frames] [--histogram]\n" );
+                return 1;
+            }
+            uFrames = *ouFrames;
+        }
+
+        gamescope::GamescopeCtl gamescopeCtl;
+        if ( !gamescopeCtl.Init( true, false ) )
+            return 1;
+
+        auto oFrameLatencies = gamescopeCtl.RequestFrameLatency( uFrames );
+        if ( !oFrameLatencies )
+            return 1;
+
+        fprintf( stdout, "%-16s %8s %8s %8s %8s %8s %8s\n", "stage (us)", "frames", "p50", "p90", "p99", "p99.9", "max" );
+        for ( const GamescopeFrameLatency &latency : *oFrameLatencies )
+        {
+            std::string_view szStageName = GetFrameLatencyStageName( latency.eStage );
+            fprintf( stdout, "%-16.*s %8u %8u %8u %8u %8u %8u\n", (int)szStageName.size(), szStageName.data(),
+                latency.uCount, latency.uP50, latency.uP90, latency.uP99, latency.uP999, latency.uMax );
+        }
+
+        if ( bHistogram )
+        {
+            for ( const GamescopeFrameLatency &latency : *oFrameLatencies )
+            {
+                std::string_view szStageName = GetFrameLatencyStageName( latency.eStage );
+                fprintf( stdout, "\n%.*s:\n", (int)szStageName.size(), szStageName.data() );
+                for ( auto [ uUpperBound, uCount ] : latency.Histogram )
+                    fprintf( stdout, "  <= %8u us: %u\n", uUpperBound, uCount );
+            }
+        }
+
+        return 0;
+    }
+
     static int RunGamescopeCtl( int argc, char *argv[] )
     {
         console_log.bPrefixEnabled = false;
 
+        if ( argc >= 2 && !strcmp( argv[1], "latency" ) )
+            return PrintFrameLatency( argc, argv );
+
         bool bInfoOnly = argc < 2;
 
         gamescope::GamescopeCtl gamescopeCtl;
@@ -269,6 +412,7 @@ namespace gamescope
             }
             fprintf( stdout, "You can execute any debug command in Gamescope using this tool.\n" );
             fprintf( stdout, "For a list of commands and convars, use 'gamescopectl help'\n" );
+            fprintf( stdout, "For a frame latency breakdown, use 'gamescopectl latency [frames] [--histogram]'\n" );
             return 0;
         }
 
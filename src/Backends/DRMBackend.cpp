@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <poll.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cinttypes>
@@ -17,11 +18,13 @@
 #include <cstddef>
 #include <cstdio>
 #include <cstring>
+#include <list>
 #include <map>
 #include <mutex>
 #include <optional>
 #include <span>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -29,9 +32,12 @@
 
 #include "backend.h"
 #include "color_helpers.h"
+#include "Utils/BenchStats.h"
 #include "Utils/Defer.h"
 #include "drm_include.h"
 #include "edid.h"
+#include "FrameTrace.h"
+#include "FrameLatency.h"
 #include "gamescope_shared.h"
 #include "gpuvis_trace_utils.h"
 #include "log.hpp"
@@ -40,6 +46,7 @@
 #include "rendervulkan.hpp"
 #include "steamcompmgr.hpp"
 #include "vblankmanager.hpp"
+#include "Utils/SPSCRing.h"
 #include "wlserver.hpp"
 #include "refresh_rate.h"
 #include <sys/utsname.h>
@@ -54,8 +61,21 @@
 
 #include "gamescope-control-protocol.h"
 
+#if HAVE_DRM_MOCK
+#include "MockKMS.h"
+#endif
+
 static constexpr bool k_bUseCursorPlane = false;
 
+static bool BUsingMockKMS()
+{
+#if HAVE_DRM_MOCK
+	return g_pszDRMMockPreset != nullptr;
+#else
+	return false;
+#endif
+}
+
 extern int g_nPreferredOutputWidth;
 extern int g_nPreferredOutputHeight;
 
@@ -69,9 +89,14 @@ gamescope::ConVar<bool> cv_drm_debug_disable_blend_tf( "drm_debug_disable_blend_
 gamescope::ConVar<bool> cv_drm_debug_disable_ctm( "drm_debug_disable_ctm", false, "CTM chicken bit. (Forces CTM off, does not affect other logic)" );
 gamescope::ConVar<bool> cv_drm_debug_disable_color_encoding( "drm_debug_disable_color_encoding", false, "YUV Color Encoding chicken bit. (Forces COLOR_ENCODING to DEFAULT, does not affect other logic)" );
 gamescope::ConVar<bool> cv_drm_debug_disable_color_range( "drm_debug_disable_color_range", false, "YUV Color Range chicken bit. (Forces COLOR_RANGE to DEFAULT, does not affect other logic)" );
+gamescope::ConVar<bool> cv_drm_debug_full_atomic_requests( "drm_debug_full_atomic_requests", false, "Write every property we manage into each atomic request, not just the ones that changed." );
 gamescope::ConVar<bool> cv_drm_debug_disable_explicit_sync( "drm_debug_disable_explicit_sync", false, "Force disable explicit sync on the DRM backend." );
+gamescope::ConVar<bool> cv_drm_commit_thread( "drm_commit_thread", true, "Submit atomic commits from the KMS commit thread, so the compositor can start on the next frame while one is in flight." );
 gamescope::ConVar<bool> cv_drm_debug_disable_in_fence_fd( "drm_debug_disable_in_fence_fd", false, "Force disable IN_FENCE_FD being set to avoid over-synchronization on the DRM backend." );
 
+gamescope::ConVar<int> cv_drm_liftoff_cache_size( "drm_liftoff_cache_size", 256, "Maximum number of layer configurations remembered by the liftoff plane assignment cache." );
+gamescope::ConVar<int> cv_drm_blob_cache_size( "drm_blob_cache_size", 32, "Maximum number of unused property blobs kept around for identical payloads to reuse." );
+
 gamescope::ConVar<bool> cv_drm_allow_dynamic_modes_for_external_display( "drm_allow_dynamic_modes_for_external_display", false, "Allow dynamic mode/refresh rate switching for external displays." );
 
 int HackyDRMPresent( const FrameInfo_t *pFrameInfo, bool bAsync );
@@ -99,6 +124,9 @@ namespace gamescope
 	class CDRMConnector;
 }
 
+// Number of plane properties we hand to libliftoff per layer, see k_LiftoffPlaneProperties.
+static constexpr uint32_t k_uLiftoffPlanePropertyCount = 22;
+
 struct drm_t {
 	bool bUseLiftoff;
 
@@ -122,10 +150,16 @@ struct drm_t {
 
 	drmModeAtomicReq *req;
 	uint32_t flags;
+	// Property writes in the last request drm_prepare built, including libliftoff's.
+	int props_in_request;
 
 	struct liftoff_device *lo_device;
 	struct liftoff_output *lo_output;
 	struct liftoff_layer *lo_layers[ k_nMaxLayers ];
+	// What we last set on each lo_layer, so a cached plane assignment
+	// can be written to the planes without going through libliftoff.
+	// nullopt for unset properties.
+	std::optional<uint64_t> lo_layer_props[ k_nMaxLayers ][ k_uLiftoffPlanePropertyCount ];
 
 	std::shared_ptr<gamescope::BackendBlob> sdr_static_metadata;
 
@@ -135,6 +169,9 @@ struct drm_t {
 		std::shared_ptr<gamescope::BackendBlob> lut3d_id[ EOTF_Count ];
 		std::shared_ptr<gamescope::BackendBlob> shaperlut_id[ EOTF_Count ];
 		amdgpu_transfer_function output_tf = AMDGPU_TRANSFER_FUNCTION_DEFAULT;
+		// Whether the plane CDRMAtomicProperty values match what was put in the
+		// request. libliftoff writes planes behind their back.
+		bool plane_props_tracked = false;
 	} current, pending;
 
 	// FBs in the atomic request, but not yet submitted to KMS
@@ -305,6 +342,7 @@ namespace gamescope
 			std::optional<CDRMAtomicProperty> CRTC_H;
 			std::optional<CDRMAtomicProperty> zpos;
 			std::optional<CDRMAtomicProperty> alpha;
+			std::optional<CDRMAtomicProperty> pixel_blend_mode;
 			std::optional<CDRMAtomicProperty> rotation;
 			std::optional<CDRMAtomicProperty> COLOR_ENCODING;
 			std::optional<CDRMAtomicProperty> COLOR_RANGE;
@@ -523,13 +561,15 @@ namespace gamescope
 	class CDRMFb final : public CBaseBackendFb
 	{
 	public:
-		CDRMFb( uint32_t uFbId );
+		CDRMFb( uint32_t uFbId, uint64_t ulModifier );
 		~CDRMFb();
 
 		uint32_t GetFbId() const { return m_uFbId; }
+		uint64_t GetModifier() const { return m_ulModifier; }
 	
 	private:
 		uint32_t m_uFbId = 0;
+		uint64_t m_ulModifier = DRM_FORMAT_MOD_INVALID;
 	};
 }
 
@@ -541,6 +581,8 @@ extern bool g_bDebugLayers;
 struct DRMPresentCtx
 {
 	uint64_t ulPendingFlipCount = 0;
+	// From CFrameLatencyTracker, 0 if this flip has no new app frame.
+	uint64_t ulLatencyFrame = 0;
 };
 
 extern gamescope::ConVar<bool> cv_composite_force;
@@ -733,6 +775,8 @@ static void page_flip_handler(int fd, unsigned int frame, unsigned int sec, unsi
 	uint64_t vblanktime = sec * 1'000'000'000lu + usec * 1'000lu;
 	GetVBlankTimer().MarkVBlank( vblanktime, true );
 
+	gamescope::CFrameLatencyTracker::Get().CompleteFrame( pCtx->ulLatencyFrame, vblanktime );
+
 	// TODO: get the fbids_queued instance from data if we ever have more than one in flight
 
 	drm_log.debugf("page_flip_handler %" PRIu64 " delta: %" PRIu64, pCtx->ulPendingFlipCount, vblanktime - ulLastVBlankTime );
@@ -1188,6 +1232,16 @@ bool init_drm(struct drm_t *drm, int width, int height, int refresh)
 
 	drm->device_name = nullptr;
 	dev_t dev_id = 0;
+#if HAVE_DRM_MOCK
+	if ( g_pszDRMMockPreset ) {
+		drm->fd = gamescope::CMockKMSDevice::Get().Open( g_pszDRMMockPreset );
+		if ( drm->fd < 0 )
+		{
+			drm_log.errorf("Could not open mock KMS device");
+			return false;
+		}
+	} else
+#endif
 	if (vulkan_primary_dev_id(&dev_id)) {
 		drmDevice *drm_dev = nullptr;
 		if (drmGetDeviceFromDevId(dev_id, 0, &drm_dev) != 0) {
@@ -1203,11 +1257,14 @@ bool init_drm(struct drm_t *drm, int width, int height, int refresh)
 		drm_log.infof("warning: picking an arbitrary DRM device");
 	}
 
-	drm->fd = wlsession_open_kms( drm->device_name );
-	if ( drm->fd < 0 )
+	if ( !BUsingMockKMS() )
 	{
-		drm_log.errorf("Could not open KMS device");
-		return false;
+		drm->fd = wlsession_open_kms( drm->device_name );
+		if ( drm->fd < 0 )
+		{
+			drm_log.errorf("Could not open KMS device");
+			return false;
+		}
 	}
 
 	if ( !drmIsKMS( drm->fd ) )
@@ -1572,7 +1629,7 @@ gamescope::OwningRc<gamescope::IBackendFb> drm_fbid_from_dmabuf( struct drm_t *d
 
 	drm_log.debugf("make fbid %u", fb_id);
 
-	pBackendFb = new gamescope::CDRMFb( fb_id );
+	pBackendFb = new gamescope::CDRMFb( fb_id, dma_buf->modifier );
 
 out:
 	for ( int i = 0; i < dma_buf->n_planes; i++ ) {
@@ -1692,8 +1749,15 @@ struct LiftoffStateCacheEntry
 		drm_color_range    colorRange;
 		GamescopeAppTextureColorspace colorspace;
 		AlphaBlendingMode_t eAlphaBlendingMode;
+		// Not geometry, but they decide which planes can take the layer.
+		uint32_t uDrmFormat;
+		uint64_t ulModifier;
+		bool bApplyColorMgmt;
+		bool bHasCTM;
 	} layerState[ k_nMaxLayers ];
 
+	GamescopePanelOrientation eOrientation;
+
 	bool operator == (const LiftoffStateCacheEntry& entry) const
 	{
 		return !memcmp(this, &entry, sizeof(LiftoffStateCacheEntry));
@@ -1721,14 +1785,249 @@ struct LiftoffStateCacheEntryKasher
 			hash_combine(hash, k.layerState[i].colorRange);
 			hash_combine(hash, k.layerState[i].colorspace);
 			hash_combine(hash, k.layerState[i].eAlphaBlendingMode);
+			hash_combine(hash, k.layerState[i].uDrmFormat);
+			hash_combine(hash, k.layerState[i].ulModifier);
+			hash_combine(hash, k.layerState[i].bApplyColorMgmt);
+			hash_combine(hash, k.layerState[i].bHasCTM);
 		}
+		hash_combine(hash, k.eOrientation);
 
 		return hash;
   	}
 };
 
+struct LiftoffStateCacheResult
+{
+	// 0 if liftoff could put every layer on a plane, otherwise what drm_prepare_liftoff returned.
+	int nResult;
+	// Plane each layer ended up on when nResult is 0.
+	uint32_t uPlaneIds[ k_nMaxLayers ];
+};
+
+// Remembers which layer configurations liftoff could and couldn't
+// put on planes, and which planes it picked, so we don't have to
+// redo the plane search and TEST_ONLY commits for them every frame.
+// Bounded by drm_liftoff_cache_size, least recently used goes first.
+class CLiftoffStateCache
+{
+public:
+	const LiftoffStateCacheResult *Find( const LiftoffStateCacheEntry &entry )
+	{
+		auto iter = m_Lookup.find( entry );
+		if ( iter == m_Lookup.end() )
+		{
+			m_ulMisses++;
+			return nullptr;
+		}
+
+		m_LRU.splice( m_LRU.begin(), m_LRU, iter->second );
+
+		const LiftoffStateCacheResult *pResult = &iter->second->second;
+		if ( pResult->nResult == 0 )
+			m_ulSuccessHits++;
+		else
+			m_ulFailureHits++;
+		return pResult;
+	}
+
+	void Insert( const LiftoffStateCacheEntry &entry, const LiftoffStateCacheResult &result )
+	{
+		auto iter = m_Lookup.find( entry );
+		if ( iter != m_Lookup.end() )
+		{
+			iter->second->second = result;
+			m_LRU.splice( m_LRU.begin(), m_LRU, iter->second );
+			return;
+		}
+
+		m_LRU.emplace_front( entry, result );
+		m_Lookup.emplace( entry, m_LRU.begin() );
+
+		const size_t uMaxEntries = size_t( std::max( int( cv_drm_liftoff_cache_size ), 1 ) );
+		while ( m_LRU.size() > uMaxEntries )
+		{
+			m_Lookup.erase( m_LRU.back().first );
+			m_LRU.pop_back();
+			m_ulEvictions++;
+		}
+		m_uEntryCount = m_LRU.size();
+	}
+
+	void Clear()
+	{
+		m_Lookup.clear();
+		m_LRU.clear();
+		m_uEntryCount = 0;
+		m_oReplayedEntry = std::nullopt;
+	}
+
+	// The request about to be committed was built from a cached assignment
+	// rather than tested by liftoff.
+	void SetReplayedEntry( std::optional<LiftoffStateCacheEntry> oEntry )
+	{
+		m_oReplayedEntry = std::move( oEntry );
+	}
+
+	// Returns true if a failed commit was one we replayed from the cache,
+	// in which case the entry is dropped and liftoff gets another look next frame.
+	bool OnCommitResult( int nRet )
+	{
+		std::optional<LiftoffStateCacheEntry> oEntry = std::exchange( m_oReplayedEntry, std::nullopt );
+		if ( nRet == 0 || !oEntry )
+			return false;
+
+		auto iter = m_Lookup.find( *oEntry );
+		if ( iter != m_Lookup.end() )
+		{
+			m_LRU.erase( iter->second );
+			m_Lookup.erase( iter );
+			m_uEntryCount = m_LRU.size();
+		}
+		m_ulRejectedReplays++;
+		return true;
+	}
+
+	void PrintStats() const
+	{
+		drm_log.infof( "liftoff cache: %zu/%d entries, success hits: %" PRIu64 ", failure hits: %" PRIu64 ", misses: %" PRIu64 ", evictions: %" PRIu64 ", rejected replays: %" PRIu64,
+			m_uEntryCount.load(), int( cv_drm_liftoff_cache_size ),
+			m_ulSuccessHits.load(), m_ulFailureHits.load(), m_ulMisses.load(), m_ulEvictions.load(), m_ulRejectedReplays.load() );
+	}
+
+private:
+	using LRUList = std::list<std::pair<LiftoffStateCacheEntry, LiftoffStateCacheResult>>;
+	LRUList m_LRU;
+	std::unordered_map<LiftoffStateCacheEntry, LRUList::iterator, LiftoffStateCacheEntryKasher> m_Lookup;
+
+	std::optional<LiftoffStateCacheEntry> m_oReplayedEntry;
+
+	// Counters are read by drm_liftoff_cache_stats from other threads.
+	std::atomic<size_t> m_uEntryCount = { 0 };
+	std::atomic<uint64_t> m_ulSuccessHits = { 0 };
+	std::atomic<uint64_t> m_ulFailureHits = { 0 };
+	std::atomic<uint64_t> m_ulMisses = { 0 };
+	std::atomic<uint64_t> m_ulEvictions = { 0 };
+	std::atomic<uint64_t> m_ulRejectedReplays = { 0 };
+};
+
+CLiftoffStateCache g_LiftoffStateCache;
+
+static gamescope::ConCommand cc_drm_liftoff_cache_stats( "drm_liftoff_cache_stats", "Print liftoff plane assignment cache hit/miss counters",
+[]( std::span<std::string_view> args )
+{
+	g_LiftoffStateCache.PrintStats();
+});
+
+// Hands out one kernel property blob per distinct payload, so sending the
+// same LUT, CTM, mode or HDR metadata again doesn't create another blob.
+// Blobs nobody else holds any more are kept for reuse, bounded by
+// drm_blob_cache_size, least recently used goes first.
+// CreateBackendBlob is called from both the compositor and wlserver threads.
+class CDRMBlobCache
+{
+public:
+	template <typename CreateFn>
+	std::shared_ptr<gamescope::BackendBlob> FindOrCreate( const std::type_info &type, std::span<const uint8_t> data, CreateFn fnCreate )
+	{
+		const size_t uTypeHash = type.hash_code();
+		const size_t uHash = std::hash<std::string_view>{}( std::string_view( reinterpret_cast<const char *>( data.data() ), data.size() ) ) ^ uTypeHash;
+
+		std::unique_lock lock( m_Mutex );
+
+		auto iter = m_Lookup.find( uHash );
+		if ( iter != m_Lookup.end() )
+		{
+			Entry_t &entry = *iter->second;
+			std::span<const uint8_t> entryData = entry.pBlob->GetData();
+
+			if ( entry.uTypeHash == uTypeHash && std::ranges::equal( entryData, data ) )
+			{
+				m_LRU.splice( m_LRU.begin(), m_LRU, iter->second );
+				m_ulHits++;
+				return entry.pBlob;
+			}
+
+			// Hash collision, leave the existing one be.
+			m_ulMisses++;
+			return fnCreate();
+		}
+
+		m_ulMisses++;
+
+		std::shared_ptr<gamescope::BackendBlob> pBlob = fnCreate();
+		if ( !pBlob )
+			return nullptr;
+
+		m_LRU.emplace_front( Entry_t{ uHash, uTypeHash, pBlob } );
+		m_Lookup.emplace( uHash, m_LRU.begin() );
+
+		EvictIdle();
+		return pBlob;
+	}
+
+	void Clear()
+	{
+		std::unique_lock lock( m_Mutex );
+		m_Lookup.clear();
+		m_LRU.clear();
+		m_uEntryCount = 0;
+	}
+
+	void PrintStats() const
+	{
+		drm_log.infof( "blob cache: %zu entries (%d unused max), hits: %" PRIu64 ", misses: %" PRIu64 ", evictions: %" PRIu64,
+			m_uEntryCount.load(), int( cv_drm_blob_cache_size ),
+			m_ulHits.load(), m_ulMisses.load(), m_ulEvictions.load() );
+	}
+
+private:
+	struct Entry_t
+	{
+		size_t uHash;
+		size_t uTypeHash;
+		std::shared_ptr<gamescope::BackendBlob> pBlob;
+	};
+
+	void EvictIdle()
+	{
+		// Only the cache holds on to idle blobs, and it is locked, so they
+		// can't be picked up again while we look.
+		const size_t uMaxIdle = size_t( std::max( int( cv_drm_blob_cache_size ), 0 ) );
+
+		size_t uIdle = 0;
+		for ( auto iter = m_LRU.begin(); iter != m_LRU.end(); )
+		{
+			if ( iter->pBlob.use_count() == 1 && ++uIdle > uMaxIdle )
+			{
+				m_Lookup.erase( iter->uHash );
+				iter = m_LRU.erase( iter );
+				m_ulEvictions++;
+			}
+			else
+				iter++;
+		}
+		m_uEntryCount = m_LRU.size();
+	}
+
+	std::mutex m_Mutex;
+
+	using LRUList = std::list<Entry_t>;
+	LRUList m_LRU;
+	std::unordered_map<size_t, LRUList::iterator> m_Lookup;
+
+	std::atomic<size_t> m_uEntryCount = { 0 };
+	std::atomic<uint64_t> m_ulHits = { 0 };
+	std::atomic<uint64_t> m_ulMisses = { 0 };
+	std::atomic<uint64_t> m_ulEvictions = { 0 };
+};
+
+CDRMBlobCache g_DRMBlobCache;
 
-std::unordered_set<LiftoffStateCacheEntry, LiftoffStateCacheEntryKasher> g_LiftoffStateCache;
+static gamescope::ConCommand cc_drm_blob_cache_stats( "drm_blob_cache_stats", "Print property blob cache hit/miss counters",
+[]( std::span<std::string_view> args )
+{
+	g_DRMBlobCache.PrintStats();
+});
 
 static inline amdgpu_transfer_function colorspace_to_plane_degamma_tf(GamescopeAppTextureColorspace colorspace)
 {
@@ -1867,8 +2166,15 @@ LiftoffStateCacheEntry FrameInfoToLiftoffStateCacheEntry( struct drm_t *drm, con
 			entry.layerState[i].colorspace = frameInfo->layers[ i ].colorspace;
 		}
 		entry.layerState[i].eAlphaBlendingMode = frameInfo->layers[i].eAlphaBlendingMode;
+		entry.layerState[i].uDrmFormat = frameInfo->layers[i].tex->drmFormat();
+		if ( const gamescope::CDRMFb *pDrmFb = static_cast<const gamescope::CDRMFb *>( frameInfo->layers[i].tex->GetBackendFb() ) )
+			entry.layerState[i].ulModifier = pDrmFb->GetModifier();
+		entry.layerState[i].bApplyColorMgmt = frameInfo->layers[i].applyColorMgmt;
+		entry.layerState[i].bHasCTM = frameInfo->layers[i].ctm != nullptr;
 	}
 
+	entry.eOrientation = drm->pConnector ? drm->pConnector->GetCurrentOrientation() : GAMESCOPE_PANEL_ORIENTATION_0;
+
 	return entry;
 }
 
@@ -2002,6 +2308,7 @@ namespace gamescope
 			m_Props.CRTC_H                   = CDRMAtomicProperty::Instantiate( "CRTC_H",                   this, *rawProperties );
 			m_Props.zpos                     = CDRMAtomicProperty::Instantiate( "zpos",                     this, *rawProperties );
 			m_Props.alpha                    = CDRMAtomicProperty::Instantiate( "alpha",                    this, *rawProperties );
+			m_Props.pixel_blend_mode         = CDRMAtomicProperty::Instantiate( "pixel blend mode",         this, *rawProperties );
 			m_Props.rotation                 = CDRMAtomicProperty::Instantiate( "rotation",                 this, *rawProperties );
 			m_Props.COLOR_ENCODING           = CDRMAtomicProperty::Instantiate( "COLOR_ENCODING",           this, *rawProperties );
 			m_Props.COLOR_RANGE              = CDRMAtomicProperty::Instantiate( "COLOR_RANGE",              this, *rawProperties );
@@ -2487,8 +2794,9 @@ namespace gamescope
 	/////////////////////////
 	// CDRMFb
 	/////////////////////////
-	CDRMFb::CDRMFb( uint32_t uFbId )
+	CDRMFb::CDRMFb( uint32_t uFbId, uint64_t ulModifier )
 		: m_uFbId{ uFbId }
+		, m_ulModifier{ ulModifier }
 	{
 
 	}
@@ -2501,21 +2809,153 @@ namespace gamescope
 	}
 }
 
+using PlanePropertyMember_t = std::optional<gamescope::CDRMAtomicProperty> gamescope::CDRMPlane::PlaneProperties::*;
+
+struct LiftoffPlaneProperty_t
+{
+	const char *pszName;
+	PlanePropertyMember_t pMember;
+};
+
+// Every property drm_prepare_liftoff sets on a layer, and where it lives on a plane.
+static const LiftoffPlaneProperty_t k_LiftoffPlaneProperties[] =
+{
+	{ "FB_ID",                &gamescope::CDRMPlane::PlaneProperties::FB_ID },
+	{ "IN_FENCE_FD",          &gamescope::CDRMPlane::PlaneProperties::IN_FENCE_FD },
+	{ "zpos",                 &gamescope::CDRMPlane::PlaneProperties::zpos },
+	{ "alpha",                &gamescope::CDRMPlane::PlaneProperties::alpha },
+	{ "pixel blend mode",     &gamescope::CDRMPlane::PlaneProperties::pixel_blend_mode },
+	{ "SRC_X",                &gamescope::CDRMPlane::PlaneProperties::SRC_X },
+	{ "SRC_Y",                &gamescope::CDRMPlane::PlaneProperties::SRC_Y },
+	{ "SRC_W",                &gamescope::CDRMPlane::PlaneProperties::SRC_W },
+	{ "SRC_H",                &gamescope::CDRMPlane::PlaneProperties::SRC_H },
+	{ "rotation",             &gamescope::CDRMPlane::PlaneProperties::rotation },
+	{ "CRTC_X",               &gamescope::CDRMPlane::PlaneProperties::CRTC_X },
+	{ "CRTC_Y",               &gamescope::CDRMPlane::PlaneProperties::CRTC_Y },
+	{ "CRTC_W",               &gamescope::CDRMPlane::PlaneProperties::CRTC_W },
+	{ "CRTC_H",               &gamescope::CDRMPlane::PlaneProperties::CRTC_H },
+	{ "COLOR_ENCODING",       &gamescope::CDRMPlane::PlaneProperties::COLOR_ENCODING },
+	{ "COLOR_RANGE",          &gamescope::CDRMPlane::PlaneProperties::COLOR_RANGE },
+	{ "AMD_PLANE_DEGAMMA_TF", &gamescope::CDRMPlane::PlaneProperties::AMD_PLANE_DEGAMMA_TF },
+	{ "AMD_PLANE_SHAPER_LUT", &gamescope::CDRMPlane::PlaneProperties::AMD_PLANE_SHAPER_LUT },
+	{ "AMD_PLANE_SHAPER_TF",  &gamescope::CDRMPlane::PlaneProperties::AMD_PLANE_SHAPER_TF },
+	{ "AMD_PLANE_LUT3D",      &gamescope::CDRMPlane::PlaneProperties::AMD_PLANE_LUT3D },
+	{ "AMD_PLANE_BLEND_TF",   &gamescope::CDRMPlane::PlaneProperties::AMD_PLANE_BLEND_TF },
+	{ "AMD_PLANE_CTM",        &gamescope::CDRMPlane::PlaneProperties::AMD_PLANE_CTM },
+};
+static_assert( std::size( k_LiftoffPlaneProperties ) == k_uLiftoffPlanePropertyCount );
+
+static uint32_t drm_liftoff_property_index( const char *pszName )
+{
+	for ( uint32_t i = 0; i < k_uLiftoffPlanePropertyCount; i++ )
+	{
+		if ( !strcmp( k_LiftoffPlaneProperties[i].pszName, pszName ) )
+			return i;
+	}
+
+	assert( !"Add the property to k_LiftoffPlaneProperties" );
+	return 0;
+}
+
+static void drm_layer_set_property( struct drm_t *drm, int nLayer, const char *pszName, uint64_t ulValue )
+{
+	liftoff_layer_set_property( drm->lo_layers[ nLayer ], pszName, ulValue );
+	drm->lo_layer_props[ nLayer ][ drm_liftoff_property_index( pszName ) ] = ulValue;
+}
+
+static void drm_layer_unset_property( struct drm_t *drm, int nLayer, const char *pszName )
+{
+	liftoff_layer_unset_property( drm->lo_layers[ nLayer ], pszName );
+	drm->lo_layer_props[ nLayer ][ drm_liftoff_property_index( pszName ) ] = std::nullopt;
+}
+
+// Write the layer properties straight onto the planes liftoff picked last time
+// we saw this configuration, and turn every other plane off like liftoff would.
+static int drm_replay_liftoff_assignment( struct drm_t *drm, const struct FrameInfo_t *frameInfo, const LiftoffStateCacheResult &result )
+{
+	// Only write what changed since the last commit, unless libliftoff
+	// touched the planes since and we don't know what they hold.
+	const bool bForce = !drm->current.plane_props_tracked || cv_drm_debug_full_atomic_requests;
+
+	for ( std::unique_ptr< gamescope::CDRMPlane > &pPlane : drm->planes )
+	{
+		gamescope::CDRMPlane::PlaneProperties &props = pPlane->GetProperties();
+
+		int nLayer = -1;
+		for ( int i = 0; i < frameInfo->layerCount; i++ )
+		{
+			if ( result.uPlaneIds[ i ] == pPlane->GetObjectId() )
+			{
+				nLayer = i;
+				break;
+			}
+		}
+
+		if ( nLayer < 0 )
+		{
+			if ( props.FB_ID->SetPendingValue( drm->req, 0, bForce ) < 0 ||
+				 props.CRTC_ID->SetPendingValue( drm->req, 0, bForce ) < 0 )
+				return -EINVAL;
+			continue;
+		}
+
+		// Always flip the planes we scan out from, so the CRTC is in the
+		// commit and we get our page flip event.
+		if ( props.CRTC_ID->SetPendingValue( drm->req, drm->pCRTC->GetObjectId(), true ) < 0 )
+			return -EINVAL;
+
+		for ( uint32_t i = 0; i < k_uLiftoffPlanePropertyCount; i++ )
+		{
+			// liftoff only reads zpos to order layers, it never writes it.
+			if ( k_LiftoffPlaneProperties[i].pMember == &gamescope::CDRMPlane::PlaneProperties::zpos )
+				continue;
+
+			std::optional<gamescope::CDRMAtomicProperty> &oProperty = props.*( k_LiftoffPlaneProperties[i].pMember );
+			if ( !oProperty )
+				continue;
+
+			// Unset properties go back to their defaults.
+			const std::optional<uint64_t> &oValue = drm->lo_layer_props[ nLayer ][ i ];
+			const uint64_t ulValue = oValue.value_or( oProperty->GetInitialValue() );
+
+			// Blob properties compare by ID. The kernel keeps an ID reserved
+			// while committed state references the blob, so an unchanged ID
+			// is the same blob.
+			// A fence is consumed by the commit it is in, so it always goes in.
+			const bool bForceProperty = bForce ||
+				k_LiftoffPlaneProperties[i].pMember == &gamescope::CDRMPlane::PlaneProperties::FB_ID ||
+				( k_LiftoffPlaneProperties[i].pMember == &gamescope::CDRMPlane::PlaneProperties::IN_FENCE_FD && int64_t( ulValue ) >= 0 );
+
+			if ( oProperty->SetPendingValue( drm->req, ulValue, bForceProperty ) < 0 )
+				return -EINVAL;
+		}
+	}
+
+	drm->pending.plane_props_tracked = true;
+	return 0;
+}
+
 static int
 drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, bool needs_modeset )
 {
 	auto entry = FrameInfoToLiftoffStateCacheEntry( drm, frameInfo );
 
+	g_LiftoffStateCache.SetReplayedEntry( std::nullopt );
+
 	// If we are modesetting, reset the state cache, we might
 	// move to another CRTC or whatever which might have differing caps.
 	// (same with different modes)
 	if (needs_modeset)
-		g_LiftoffStateCache.clear();
+		g_LiftoffStateCache.Clear();
+
+	const bool bUseCache = is_liftoff_caching_enabled() && !needs_modeset;
 
-	if (is_liftoff_caching_enabled())
+	const LiftoffStateCacheResult *pCachedResult = nullptr;
+	if (bUseCache)
 	{
-		if (g_LiftoffStateCache.count(entry) != 0)
-			return -EINVAL;
+		pCachedResult = g_LiftoffStateCache.Find(entry);
+		if (pCachedResult && pCachedResult->nResult != 0)
+			return pCachedResult->nResult;
 	}
 
 	bool bSinglePlane = frameInfo->layerCount < 2 && cv_drm_single_plane_optimizations;
@@ -2536,26 +2976,26 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 			const int nFence = cv_drm_debug_disable_in_fence_fd ? -1 : g_nAlwaysSignalledSyncFile;
 
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "FB_ID", pDrmFb->GetFbId());
-			liftoff_layer_set_property( drm->lo_layers[ i ], "IN_FENCE_FD", nFence );
+			drm_layer_set_property( drm, i, "FB_ID", pDrmFb->GetFbId());
+			drm_layer_set_property( drm, i, "IN_FENCE_FD", nFence );
 			drm->m_FbIdsInRequest.emplace_back( pDrmFb );
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "zpos", entry.layerState[i].zpos );
-			liftoff_layer_set_property( drm->lo_layers[ i ], "alpha", frameInfo->layers[ i ].opacity * 0xffff);
+			drm_layer_set_property( drm, i, "zpos", entry.layerState[i].zpos );
+			drm_layer_set_property( drm, i, "alpha", frameInfo->layers[ i ].opacity * 0xffff);
 
 			if ( entry.layerState[i].zpos != g_zposBase )
 			{
-				liftoff_layer_set_property( drm->lo_layers[ i ], "pixel blend mode", (uint64_t) frameInfo->layers[i].eAlphaBlendingMode );
+				drm_layer_set_property( drm, i, "pixel blend mode", (uint64_t) frameInfo->layers[i].eAlphaBlendingMode );
 			}
 			else
 			{
-				liftoff_layer_unset_property( drm->lo_layers[ i ], "pixel blend mode" );
+				drm_layer_unset_property( drm, i, "pixel blend mode" );
 			}
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "SRC_X", 0);
-			liftoff_layer_set_property( drm->lo_layers[ i ], "SRC_Y", 0);
-			liftoff_layer_set_property( drm->lo_layers[ i ], "SRC_W", entry.layerState[i].srcW );
-			liftoff_layer_set_property( drm->lo_layers[ i ], "SRC_H", entry.layerState[i].srcH );
+			drm_layer_set_property( drm, i, "SRC_X", 0);
+			drm_layer_set_property( drm, i, "SRC_Y", 0);
+			drm_layer_set_property( drm, i, "SRC_W", entry.layerState[i].srcW );
+			drm_layer_set_property( drm, i, "SRC_H", entry.layerState[i].srcH );
 
 			uint64_t ulOrientation = DRM_MODE_ROTATE_0;
 			switch ( drm->pConnector->GetCurrentOrientation() )
@@ -2574,13 +3014,13 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 				ulOrientation = DRM_MODE_ROTATE_180;
 				break;
 			}
-			liftoff_layer_set_property( drm->lo_layers[ i ], "rotation", ulOrientation );
+			drm_layer_set_property( drm, i, "rotation", ulOrientation );
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "CRTC_X", entry.layerState[i].crtcX);
-			liftoff_layer_set_property( drm->lo_layers[ i ], "CRTC_Y", entry.layerState[i].crtcY);
+			drm_layer_set_property( drm, i, "CRTC_X", entry.layerState[i].crtcX);
+			drm_layer_set_property( drm, i, "CRTC_Y", entry.layerState[i].crtcY);
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "CRTC_W", entry.layerState[i].crtcW);
-			liftoff_layer_set_property( drm->lo_layers[ i ], "CRTC_H", entry.layerState[i].crtcH);
+			drm_layer_set_property( drm, i, "CRTC_W", entry.layerState[i].crtcW);
+			drm_layer_set_property( drm, i, "CRTC_H", entry.layerState[i].crtcH);
 
 			if ( frameInfo->layers[i].applyColorMgmt )
 			{
@@ -2588,20 +3028,20 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 
 				if ( !cv_drm_debug_disable_color_encoding && bYCbCr )
 				{
-					liftoff_layer_set_property( drm->lo_layers[ i ], "COLOR_ENCODING", entry.layerState[i].colorEncoding );
+					drm_layer_set_property( drm, i, "COLOR_ENCODING", entry.layerState[i].colorEncoding );
 				}
 				else
 				{
-					liftoff_layer_unset_property( drm->lo_layers[ i ], "COLOR_ENCODING" );
+					drm_layer_unset_property( drm, i, "COLOR_ENCODING" );
 				}
 
 				if ( !cv_drm_debug_disable_color_range && bYCbCr )
 				{
-					liftoff_layer_set_property( drm->lo_layers[ i ], "COLOR_RANGE",    entry.layerState[i].colorRange );
+					drm_layer_set_property( drm, i, "COLOR_RANGE",    entry.layerState[i].colorRange );
 				}
 				else
 				{
-					liftoff_layer_unset_property( drm->lo_layers[ i ], "COLOR_RANGE" );
+					drm_layer_unset_property( drm, i, "COLOR_RANGE" );
 				}
 
 				if ( drm_supports_color_mgmt( drm ) )
@@ -2625,23 +3065,23 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 
 					bool bUseDegamma = !cv_drm_debug_disable_degamma_tf;
 					if ( bUseDegamma )
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_DEGAMMA_TF", degamma_tf );
+						drm_layer_set_property( drm, i, "AMD_PLANE_DEGAMMA_TF", degamma_tf );
 					else
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_DEGAMMA_TF", 0 );
+						drm_layer_set_property( drm, i, "AMD_PLANE_DEGAMMA_TF", 0 );
 
 					bool bUseShaperAnd3DLUT = !cv_drm_debug_disable_shaper_and_3dlut;
 					if ( bUseShaperAnd3DLUT )
 					{
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_LUT", drm->pending.shaperlut_id[ ColorSpaceToEOTFIndex( entry.layerState[i].colorspace ) ]->GetBlobValue() );
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_TF", shaper_tf );
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_LUT3D", drm->pending.lut3d_id[ ColorSpaceToEOTFIndex( entry.layerState[i].colorspace ) ]->GetBlobValue() );
+						drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_LUT", drm->pending.shaperlut_id[ ColorSpaceToEOTFIndex( entry.layerState[i].colorspace ) ]->GetBlobValue() );
+						drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_TF", shaper_tf );
+						drm_layer_set_property( drm, i, "AMD_PLANE_LUT3D", drm->pending.lut3d_id[ ColorSpaceToEOTFIndex( entry.layerState[i].colorspace ) ]->GetBlobValue() );
 						// Josh: See shaders/colorimetry.h colorspace_blend_tf if you have questions as to why we start doing sRGB for BLEND_TF despite potentially working in Gamma 2.2 space prior.
 					}
 					else
 					{
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_LUT", 0 );
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_TF", 0 );
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_LUT3D", 0 );
+						drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_LUT", 0 );
+						drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_TF", 0 );
+						drm_layer_set_property( drm, i, "AMD_PLANE_LUT3D", 0 );
 					}
 				}
 			}
@@ -2649,51 +3089,67 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 			{
 				if ( drm_supports_color_mgmt( drm ) )
 				{
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_DEGAMMA_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_LUT", 0 );
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_TF", 0 );
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_LUT3D", 0 );
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_CTM", 0 );
+					drm_layer_set_property( drm, i, "AMD_PLANE_DEGAMMA_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+					drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_LUT", 0 );
+					drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_TF", 0 );
+					drm_layer_set_property( drm, i, "AMD_PLANE_LUT3D", 0 );
+					drm_layer_set_property( drm, i, "AMD_PLANE_CTM", 0 );
 				}
 			}
 
 			if ( drm_supports_color_mgmt( drm ) )
 			{
 				if (!cv_drm_debug_disable_blend_tf && !bSinglePlane)
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_BLEND_TF", drm->pending.output_tf );
+					drm_layer_set_property( drm, i, "AMD_PLANE_BLEND_TF", drm->pending.output_tf );
 				else
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_BLEND_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+					drm_layer_set_property( drm, i, "AMD_PLANE_BLEND_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
 
 				if (!cv_drm_debug_disable_ctm && frameInfo->layers[i].ctm != nullptr)
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_CTM", frameInfo->layers[i].ctm->GetBlobValue() );
+					drm_layer_set_property( drm, i, "AMD_PLANE_CTM", frameInfo->layers[i].ctm->GetBlobValue() );
 				else
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_CTM", 0 );
+					drm_layer_set_property( drm, i, "AMD_PLANE_CTM", 0 );
 			}
 		}
 		else
 		{
-			liftoff_layer_set_property( drm->lo_layers[ i ], "FB_ID", 0 );
-			liftoff_layer_set_property( drm->lo_layers[ i ], "IN_FENCE_FD", -1 );
+			drm_layer_set_property( drm, i, "FB_ID", 0 );
+			drm_layer_set_property( drm, i, "IN_FENCE_FD", -1 );
 
-			liftoff_layer_unset_property( drm->lo_layers[ i ], "COLOR_ENCODING" );
-			liftoff_layer_unset_property( drm->lo_layers[ i ], "COLOR_RANGE" );
+			drm_layer_unset_property( drm, i, "COLOR_ENCODING" );
+			drm_layer_unset_property( drm, i, "COLOR_RANGE" );
 
 			if ( drm_supports_color_mgmt( drm ) )
 			{
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_DEGAMMA_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_LUT", 0 );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_TF", 0 );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_LUT3D", 0 );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_BLEND_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_CTM", 0 );
+				drm_layer_set_property( drm, i, "AMD_PLANE_DEGAMMA_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+				drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_LUT", 0 );
+				drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_TF", 0 );
+				drm_layer_set_property( drm, i, "AMD_PLANE_LUT3D", 0 );
+				drm_layer_set_property( drm, i, "AMD_PLANE_BLEND_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+				drm_layer_set_property( drm, i, "AMD_PLANE_CTM", 0 );
 			}
 		}
 	}
 
+	if ( pCachedResult )
+	{
+		// Seen this before and it worked, skip the plane search and
+		// TEST_ONLY commits. If the kernel disagrees at commit time
+		// the entry gets dropped, see CLiftoffStateCache::OnCommitResult.
+		int ret = drm_replay_liftoff_assignment( drm, frameInfo, *pCachedResult );
+		if ( ret == 0 )
+		{
+			g_LiftoffStateCache.SetReplayedEntry( entry );
+			drm_log.debugf( "can drm present %i layers (cached)", frameInfo->layerCount );
+		}
+		return ret;
+	}
+
 	struct liftoff_output_apply_options lo_options = {
 		.timeout_ns = std::numeric_limits<int64_t>::max()
 	};
 
+	drm->pending.plane_props_tracked = false;
+
 	int ret = liftoff_output_apply( drm->lo_output, drm->req, drm->flags, &lo_options);
 
 	// The NVIDIA 555 series drivers started advertising DRM_CAP_SYNCOBJ, but do
@@ -2709,7 +3165,7 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 		attempted_in_fence_fallback = true;
 		for ( int i = 0; i < frameInfo->layerCount; i++ )
 		{
-			liftoff_layer_set_property( drm->lo_layers[ i ], "IN_FENCE_FD", -1 );
+			drm_layer_set_property( drm, i, "IN_FENCE_FD", -1 );
 		}
 
 		ret = liftoff_output_apply( drm->lo_output, drm->req, drm->flags, &lo_options );
@@ -2728,13 +3184,19 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 			ret = -EINVAL;
 	}
 
-	// If we aren't modesetting and we got -EINVAL, that means that we
-	// probably can't do this layout, so add it to our state cache so we don't
-	// try it again.
-	if (!needs_modeset)
+	// If we aren't modesetting, remember how this went. -EINVAL means that we
+	// probably can't do this layout so we don't try it again, and success
+	// gives us the plane assignment to reuse next time.
+	if (bUseCache && (ret == 0 || ret == -EINVAL))
 	{
-		if (ret == -EINVAL)
-			g_LiftoffStateCache.insert(entry);
+		LiftoffStateCacheResult result{};
+		result.nResult = ret;
+		for ( int i = 0; ret == 0 && i < frameInfo->layerCount; i++ )
+		{
+			struct liftoff_plane *pPlane = liftoff_layer_get_plane( drm->lo_layers[ i ] );
+			result.uPlaneIds[ i ] = pPlane ? liftoff_plane_get_id( pPlane ) : 0;
+		}
+		g_LiftoffStateCache.Insert(entry, result);
 	}
 
 	if ( ret == 0 )
@@ -2780,6 +3242,39 @@ void drm_rollback( struct drm_t *drm )
 	}
 }
 
+void drm_apply_committed_state( struct drm_t *drm )
+{
+	drm->current = drm->pending;
+
+	for ( std::unique_ptr< gamescope::CDRMCRTC > &pCRTC : drm->crtcs )
+	{
+		for ( std::optional<gamescope::CDRMAtomicProperty> &oProperty : pCRTC->GetProperties() )
+		{
+			if ( oProperty )
+				oProperty->OnCommit();
+		}
+	}
+
+	for ( std::unique_ptr< gamescope::CDRMPlane > &pPlane : drm->planes )
+	{
+		for ( std::optional<gamescope::CDRMAtomicProperty> &oProperty : pPlane->GetProperties() )
+		{
+			if ( oProperty )
+				oProperty->OnCommit();
+		}
+	}
+
+	for ( auto &iter : drm->connectors )
+	{
+		gamescope::CDRMConnector *pConnector = &iter.second;
+		for ( std::optional<gamescope::CDRMAtomicProperty> &oProperty : pConnector->GetProperties() )
+		{
+			if ( oProperty )
+				oProperty->OnCommit();
+		}
+	}
+}
+
 /* Prepares an atomic commit for the provided scene-graph. Returns 0 on success,
  * negative errno on failure or if the scene-graph can't be presented directly. */
 int drm_prepare( struct drm_t *drm, bool async, const struct FrameInfo_t *frameInfo )
@@ -2875,7 +3370,7 @@ int drm_prepare( struct drm_t *drm, bool async, const struct FrameInfo_t *frameI
 			flags |= DRM_MODE_PAGE_FLIP_ASYNC;
 	}
 
-	bool bForceInRequest = needs_modeset;
+	bool bForceInRequest = needs_modeset || cv_drm_debug_full_atomic_requests;
 
 	if ( needs_modeset )
 	{
@@ -3002,6 +3497,12 @@ int drm_prepare( struct drm_t *drm, bool async, const struct FrameInfo_t *frameI
 		if ( needs_modeset )
 			drm->needs_modeset = true;
 	}
+	else
+	{
+		drm->props_in_request = drmModeAtomicGetCursor( drm->req );
+		drm_log.debugf( "atomic request has %d properties", drm->props_in_request );
+		gpuvis_trace_printf( "atomic request has %d properties", drm->props_in_request );
+	}
 
 	return ret;
 }
@@ -3328,6 +3829,131 @@ std::span<const uint32_t> drm_get_valid_refresh_rates( struct drm_t *drm )
 
 namespace gamescope
 {
+	struct DRMCommit_t
+	{
+		drmModeAtomicReq *pReq;
+		uint32_t uFlags;
+		DRMPresentCtx *pPresentCtx;
+		bool bPageFlip;
+		// Vblank wakeup this frame was painted for, for the draw time.
+		uint64_t ulWakeupTime;
+
+		// Filled in once the ioctl returns.
+		int nResult;
+		uint64_t ulCommitStart;
+		uint64_t ulCommitEnd;
+	};
+
+	// Runs drmModeAtomicCommit on its own thread, so the compositor can
+	// get on with the next frame while the ioctl and flip are in flight.
+	//
+	// Only the ioctl happens here. The compositor reaps the result and does
+	// all the drm_t bookkeeping itself, so nothing else is shared.
+	// At most one commit is outstanding: drm_prepare needs the outcome of
+	// the last one before it can build the next request.
+	class CDRMCommitThread
+	{
+	public:
+		~CDRMCommitThread()
+		{
+			Stop();
+		}
+
+		void Start()
+		{
+			// Inherits the compositor's scheduling, so this is realtime with --rt.
+			m_Thread = std::thread( [this]() { this->Run(); } );
+		}
+
+		// Compositor thread only, once nothing is in flight.
+		void Stop()
+		{
+			if ( !m_Thread.joinable() )
+				return;
+
+			m_bStopping = true;
+			m_uWakeups++;
+			m_uWakeups.notify_one();
+			m_Thread.join();
+		}
+
+		// Compositor thread only.
+		void Submit( DRMCommit_t commit )
+		{
+			assert( !BInFlight() );
+
+			bool bPushed = m_SubmitRing.Push( commit );
+			assert( bPushed );
+			(void) bPushed;
+
+			m_uSubmitted++;
+			m_uWakeups++;
+			m_uWakeups.notify_one();
+		}
+
+		// Compositor thread only.
+		// Returns the outstanding commit once its ioctl has returned.
+		std::optional<DRMCommit_t> Reap( bool bWait )
+		{
+			if ( !BInFlight() )
+				return std::nullopt;
+
+			if ( bWait )
+				m_uCompleted.wait( m_uReaped );
+
+			std::optional<DRMCommit_t> oCommit = m_DoneRing.Pop();
+			if ( oCommit )
+				m_uReaped++;
+
+			return oCommit;
+		}
+
+		bool BInFlight() const { return m_uSubmitted != m_uReaped; }
+
+	private:
+		void Run()
+		{
+			pthread_setname_np( pthread_self(), "gamescope-kms-commit" );
+
+			while ( !m_bStopping )
+			{
+				uint32_t uWakeups = m_uWakeups.load();
+
+				while ( std::optional<DRMCommit_t> oCommit = m_SubmitRing.Pop() )
+				{
+					DRMCommit_t commit = *oCommit;
+
+					commit.ulCommitStart = get_time_in_nanos();
+					commit.nResult = drmModeAtomicCommit( g_DRM.fd, commit.pReq, commit.uFlags, commit.pPresentCtx );
+					commit.ulCommitEnd = get_time_in_nanos();
+
+					bool bPushed = m_DoneRing.Push( commit );
+					assert( bPushed );
+					(void) bPushed;
+
+					m_uCompleted++;
+					m_uCompleted.notify_all();
+				}
+
+				if ( !m_bStopping )
+					m_uWakeups.wait( uWakeups );
+			}
+		}
+
+		std::thread m_Thread;
+
+		CSPSCRing<DRMCommit_t, 4> m_SubmitRing;
+		CSPSCRing<DRMCommit_t, 4> m_DoneRing;
+
+		std::atomic<bool> m_bStopping = { false };
+		std::atomic<uint32_t> m_uWakeups = { 0u };
+		std::atomic<uint32_t> m_uCompleted = { 0u };
+
+		// Compositor side.
+		uint32_t m_uSubmitted = 0;
+		uint32_t m_uReaped = 0;
+	};
+
 	class CDRMBackend;
 
 	class CDRMBackend final : public CBaseBackend
@@ -3339,6 +3965,10 @@ namespace gamescope
 
 		virtual ~CDRMBackend()
 		{
+			FinishInFlightCommit( true );
+			m_CommitThread.Stop();
+			g_DRMBlobCache.Clear();
+
 			if ( g_DRM.fd != -1 )
 				finish_drm( &g_DRM );
 		}
@@ -3357,7 +3987,11 @@ namespace gamescope
 				return false;
 			}
 
-			return init_drm( &g_DRM, g_nPreferredOutputWidth, g_nPreferredOutputHeight, g_nNestedRefresh );
+			if ( !init_drm( &g_DRM, g_nPreferredOutputWidth, g_nPreferredOutputHeight, g_nNestedRefresh ) )
+				return false;
+
+			m_CommitThread.Start();
+			return true;
 		}
 
 		virtual bool PostInit() override
@@ -3399,6 +4033,23 @@ namespace gamescope
 			drm_log.debugf( "CDRMBackend::Present Begin: %lu -> delta: %lu", ulNow, ulNow - s_ulLastTime );
 			s_ulLastTime = ulNow;
 
+			// The last frame may still be in flight. Everything up to here
+			// overlapped with it, but drm_prepare needs its outcome, and we
+			// can't queue another flip (or reuse its output image) until it lands.
+			FinishInFlightCommit( true );
+			WaitForPendingFlips();
+
+			// paint_all's frame info goes away once we return, so hold on to
+			// its blobs until this frame's commit has been reaped too.
+			m_InFlightBlobs.clear();
+			for ( int i = 0; i < pFrameInfo->layerCount; i++ )
+			{
+				if ( pFrameInfo->layers[i].ctm )
+					m_InFlightBlobs.push_back( pFrameInfo->layers[i].ctm );
+				if ( pFrameInfo->layers[i].hdr_metadata_blob )
+					m_InFlightBlobs.push_back( pFrameInfo->layers[i].hdr_metadata_blob );
+			}
+
 			bool bWantsPartialComposite = pFrameInfo->layerCount >= 3 && !kDisablePartialComposition;
 
 			static bool s_bWasFirstFrame = true;
@@ -3461,6 +4112,8 @@ namespace gamescope
 			if ( !bDoComposite )
 			{
 				// Scanout + Planes Path
+				gamescope::CFrameTraceRecorder::Get().NotePresentPath( gamescope::k_EFrameTracePresentPath_Scanout );
+
 				m_bWasPartialCompsiting = false;
 				m_bWasCompositing = false;
 				if ( pFrameInfo->layerCount == 2 )
@@ -3507,6 +4160,10 @@ namespace gamescope
 				}
 			}
 
+			gamescope::CFrameTraceRecorder::Get().NotePresentPath( bNeedsFullComposite
+				? gamescope::k_EFrameTracePresentPath_Composite
+				: gamescope::k_EFrameTracePresentPath_PartialComposite );
+
 			// If we ever promoted from partial -> full, for the first frame
 			// do NOT defer this partial composition.
 			// We were already stalling for the full composition before, so it's not an issue
@@ -3549,6 +4206,8 @@ namespace gamescope
 
 			vulkan_wait( *oCompositeResult, true );
 
+			GetVBlankTimer().UpdateLastGPUTime( g_device.gpuTime( *oCompositeResult ).value_or( 0 ) );
+
 			FrameInfo_t presentCompFrameInfo = {};
 			presentCompFrameInfo.allowVRR = pFrameInfo->allowVRR;
 			presentCompFrameInfo.outputEncodingEOTF = pFrameInfo->outputEncodingEOTF;
@@ -3678,36 +4337,43 @@ namespace gamescope
 			if ( bForceModeset )
 				g_DRM.needs_modeset = true;
 			g_DRM.out_of_date = std::max<int>( g_DRM.out_of_date, bForce ? 2 : 1 );
-			g_DRM.paused = !wlsession_active();
+			g_DRM.paused = !BUsingMockKMS() && !wlsession_active();
 		}
 
 		virtual bool PollState() override
 		{
+			// Reap a finished commit promptly so current state (eg. VRR_ENABLED)
+			// is up to date. If we need to re-probe, wait for it, as that can
+			// drop connectors and reset property state.
+			FinishInFlightCommit( g_DRM.out_of_date != 0 );
 			return drm_poll_state( &g_DRM );
 		}
 
 		virtual std::shared_ptr<BackendBlob> CreateBackendBlob( const std::type_info &type, std::span<const uint8_t> data ) override
 		{
-			uint32_t uBlob = 0;
-			if ( type == typeid( glm::mat3x4 ) )
+			return g_DRMBlobCache.FindOrCreate( type, data, [&]() -> std::shared_ptr<BackendBlob>
 			{
-				assert( data.size() == sizeof( glm::mat3x4 ) );
+				uint32_t uBlob = 0;
+				if ( type == typeid( glm::mat3x4 ) )
+				{
+					assert( data.size() == sizeof( glm::mat3x4 ) );
 
-				drm_color_ctm2 ctm2;
-				const float *pData = reinterpret_cast<const float *>( data.data() );
-				for ( uint32_t i = 0; i < 12; i++ )
-					ctm2.matrix[i] = drm_calc_s31_32( pData[i] );
+					drm_color_ctm2 ctm2;
+					const float *pData = reinterpret_cast<const float *>( data.data() );
+					for ( uint32_t i = 0; i < 12; i++ )
+						ctm2.matrix[i] = drm_calc_s31_32( pData[i] );
 
-				if ( drmModeCreatePropertyBlob( g_DRM.fd, reinterpret_cast<const void *>( &ctm2 ), sizeof( ctm2 ), &uBlob ) != 0 )
-					return nullptr;
-			}
-			else
-			{
-				if ( drmModeCreatePropertyBlob( g_DRM.fd, data.data(), data.size(), &uBlob ) != 0 )
-					return nullptr;
-			}
+					if ( drmModeCreatePropertyBlob( g_DRM.fd, reinterpret_cast<const void *>( &ctm2 ), sizeof( ctm2 ), &uBlob ) != 0 )
+						return nullptr;
+				}
+				else
+				{
+					if ( drmModeCreatePropertyBlob( g_DRM.fd, data.data(), data.size(), &uBlob ) != 0 )
+						return nullptr;
+				}
 
-			return std::make_shared<BackendBlob>( data, uBlob, true );
+				return std::make_shared<BackendBlob>( data, uBlob, true );
+			} );
 		}
 
 		virtual OwningRc<IBackendFb> ImportDmabufToBackend( wlr_buffer *pBuffer, wlr_dmabuf_attributes *pDmaBuf ) override
@@ -3768,7 +4434,8 @@ namespace gamescope
 
         virtual bool IsSessionBased() const override
 		{
-			return true;
+			// The mock device needs no seat or DRM master.
+			return !BUsingMockKMS();
 		}
 
 		virtual bool SupportsExplicitSync() const override
@@ -3810,6 +4477,8 @@ namespace gamescope
 
 		virtual bool HackTemporarySetDynamicRefresh( int nRefresh ) override
 		{
+			// A failed in-flight commit would roll back the pending mode.
+			FinishInFlightCommit( true );
 			return drm_set_refresh( &g_DRM, nRefresh );
 		}
 
@@ -3837,6 +4506,13 @@ namespace gamescope
 		uint32_t m_uNextPresentCtx = 0;
 		DRMPresentCtx m_PresentCtxs[3];
 
+		CDRMCommitThread m_CommitThread;
+		// Outcome of a threaded commit that failed after its Present had
+		// already returned, reported by the next Present.
+		int m_nUnreportedCommitResult = 0;
+		// Blobs from the last presented frame, which its request may reference.
+		std::vector<std::shared_ptr<BackendBlob>> m_InFlightBlobs;
+
 		bool SupportsColorManagement() const
 		{
 			return drm_supports_color_mgmt( &g_DRM );
@@ -3845,18 +4521,14 @@ namespace gamescope
 		int Commit( const FrameInfo_t *pFrameInfo )
 		{
 			drm_t *drm = &g_DRM;
-			int ret = 0;
 
 			assert( drm->req != nullptr );
 
-			defer( if ( drm->req != nullptr ) { drmModeAtomicFree( drm->req ); drm->req = nullptr; } );
-
 			bool isPageFlip = drm->flags & DRM_MODE_PAGE_FLIP_EVENT;
-			uint32_t uNewPendingFlipCount = 0;
 
 			if ( isPageFlip )
 			{
-				uNewPendingFlipCount = ++drm->uPendingFlipCount;
+				++drm->uPendingFlipCount;
 
 				// Do it before the commit, as otherwise the pageflip handler could
 				// potentially beat us to the refcount checks.
@@ -3871,19 +4543,80 @@ namespace gamescope
 			uint32_t uCurrentPresentCtx = m_uNextPresentCtx;
 			m_uNextPresentCtx = ( m_uNextPresentCtx + 1 ) % 3;
 			m_PresentCtxs[uCurrentPresentCtx].ulPendingFlipCount = GetCurrentConnector()->PresentationFeedback().m_uQueuedPresents;
+			m_PresentCtxs[uCurrentPresentCtx].ulLatencyFrame = gamescope::CFrameLatencyTracker::Get().TakePendingFrame();
 
 			drm_log.debugf("flip commit %" PRIu64, (uint64_t)GetCurrentConnector()->PresentationFeedback().m_uQueuedPresents);
 			gpuvis_trace_printf( "flip commit %" PRIu64, (uint64_t)GetCurrentConnector()->PresentationFeedback().m_uQueuedPresents );
 
-			ret = drmModeAtomicCommit(drm->fd, drm->req, drm->flags, &m_PresentCtxs[uCurrentPresentCtx] );
+			DRMCommit_t commit =
+			{
+				.pReq = drm->req,
+				.uFlags = drm->flags,
+				.pPresentCtx = &m_PresentCtxs[uCurrentPresentCtx],
+				.bPageFlip = isPageFlip,
+				.ulWakeupTime = g_SteamCompMgrVBlankTime.ulWakeupTime,
+			};
+			drm->req = nullptr;
+
+			if ( cv_drm_commit_thread )
+			{
+				// The outcome gets picked up by FinishInFlightCommit. We can't
+				// know it yet, so report the last commit's instead: if that one
+				// failed, the caller skips its post-present work for this frame
+				// rather than counting one more frame than made it to the screen.
+				m_CommitThread.Submit( commit );
+				return std::exchange( m_nUnreportedCommitResult, 0 );
+			}
+
+			commit.ulCommitStart = get_time_in_nanos();
+			commit.nResult = drmModeAtomicCommit( drm->fd, commit.pReq, commit.uFlags, commit.pPresentCtx );
+			commit.ulCommitEnd = get_time_in_nanos();
+
+			int ret = OnCommitDone( commit );
+			if ( ret == 0 )
+				WaitForPendingFlips();
+
+			return ret;
+		}
+
+		void FinishInFlightCommit( bool bWait )
+		{
+			if ( std::optional<DRMCommit_t> oCommit = m_CommitThread.Reap( bWait ) )
+			{
+				if ( int ret = OnCommitDone( *oCommit ); ret != 0 )
+					m_nUnreportedCommitResult = ret;
+			}
+		}
+
+		void WaitForPendingFlips()
+		{
+			uint32_t uPendingFlipCount;
+			while ( ( uPendingFlipCount = g_DRM.uPendingFlipCount ) != 0 )
+				g_DRM.uPendingFlipCount.wait( uPendingFlipCount );
+		}
+
+		int OnCommitDone( const DRMCommit_t &commit )
+		{
+			drm_t *drm = &g_DRM;
+			int ret = commit.nResult;
+
+			drmModeAtomicFree( commit.pReq );
+
+			GetVBlankTimer().UpdateLastCommitTime( commit.ulCommitEnd - commit.ulCommitStart );
+
 			if ( ret != 0 )
 			{
-				drm_log.errorf_errno( "flip error" );
+				drm_log.errorf( "flip error: %s", strerror( -ret ) );
+
+				// Assignments replayed from the liftoff cache were never TEST_ONLY'd,
+				// so whatever the kernel rejects one with (-EINVAL, -ERANGE, -ENOSPC...),
+				// forget it and let liftoff redo it rather than aborting.
+				const bool bRejectedLiftoffReplay = g_LiftoffStateCache.OnCommitResult( ret );
 
-				if ( ret != -EBUSY && ret != -EACCES )
+				if ( ret != -EBUSY && ret != -EACCES && !bRejectedLiftoffReplay )
 				{
 					drm_log.errorf( "fatal flip error, aborting" );
-					if ( isPageFlip )
+					if ( commit.bPageFlip )
 						drm->uPendingFlipCount--;
 					abort();
 				}
@@ -3901,44 +4634,21 @@ namespace gamescope
 
 				GetCurrentConnector()->PresentationFeedback().m_uQueuedPresents--;
 
-				if ( isPageFlip )
+				if ( commit.bPageFlip )
+				{
 					drm->uPendingFlipCount--;
+					drm->uPendingFlipCount.notify_all();
+				}
 
 				return ret;
 			} else {
 				// Our request went through!
+				g_LiftoffStateCache.OnCommitResult( ret );
+
 				// Clear what we swapped with (what was previously queued)
 				drm->m_FbIdsInRequest.clear();
 
-				drm->current = drm->pending;
-
-				for ( std::unique_ptr< gamescope::CDRMCRTC > &pCRTC : drm->crtcs )
-				{
-					for ( std::optional<gamescope::CDRMAtomicProperty> &oProperty : pCRTC->GetProperties() )
-					{
-						if ( oProperty )
-							oProperty->OnCommit();
-					}
-				}
-
-				for ( std::unique_ptr< gamescope::CDRMPlane > &pPlane : drm->planes )
-				{
-					for ( std::optional<gamescope::CDRMAtomicProperty> &oProperty : pPlane->GetProperties() )
-					{
-						if ( oProperty )
-							oProperty->OnCommit();
-					}
-				}
-
-				for ( auto &iter : drm->connectors )
-				{
-					gamescope::CDRMConnector *pConnector = &iter.second;
-					for ( std::optional<gamescope::CDRMAtomicProperty> &oProperty : pConnector->GetProperties() )
-					{
-						if ( oProperty )
-							oProperty->OnCommit();
-					}
-				}
+				drm_apply_committed_state( drm );
 			}
 
 			// Update the draw time
@@ -3946,14 +4656,7 @@ namespace gamescope
 			// is queued and would end up being the new page flip, rather than here.
 			// However, the page flip handler is called when the page flip occurs,
 			// not when it is successfully queued.
-			GetVBlankTimer().UpdateLastDrawTime( get_time_in_nanos() - g_SteamCompMgrVBlankTime.ulWakeupTime );
-
-			if ( isPageFlip )
-			{
-				// Wait for bPendingFlip to change from true -> false.
-				drm->uPendingFlipCount.wait( uNewPendingFlipCount );
-				assert( drm->uPendingFlipCount == 0 );
-			}
+			GetVBlankTimer().UpdateLastDrawTime( commit.ulCommitEnd - commit.ulWakeupTime );
 
 			return ret;
 		}
@@ -3976,3 +4679,233 @@ int HackyDRMPresent( const FrameInfo_t *pFrameInfo, bool bAsync )
 	return static_cast<gamescope::CDRMBackend *>( GetBackend() )->Present( pFrameInfo, bAsync );
 }
 
+
+#if HAVE_DRM_MOCK
+namespace gamescope
+{
+	static LogScope s_DRMBenchLog( "drm_bench" );
+
+	struct DRMBenchLayer_t
+	{
+		uint32_t uWidth;
+		uint32_t uHeight;
+		uint32_t uDrmFormat;
+		int nZPos;
+		// On-screen size, 0 for 1:1.
+		uint32_t uDisplayWidth = 0;
+		uint32_t uDisplayHeight = 0;
+		int32_t nX = 0;
+		int32_t nY = 0;
+		float flOpacity = 1.0f;
+	};
+
+	struct DRMBenchScenario_t
+	{
+		const char *pszName;
+		std::vector<DRMBenchLayer_t> layers;
+	};
+
+	static const DRMBenchScenario_t k_DRMBenchScenarios[] =
+	{
+		{ "1 layer, native", {
+			{ 1920, 1080, DRM_FORMAT_XRGB8888, g_zposBase } } },
+		{ "1 layer, 720p upscaled", {
+			{ 1280, 720, DRM_FORMAT_XRGB2101010, g_zposBase, 1920, 1080 } } },
+		{ "2 layers, app + overlay", {
+			{ 1920, 1080, DRM_FORMAT_XRGB8888, g_zposBase },
+			{ 1920, 1080, DRM_FORMAT_ARGB8888, g_zposOverlay, 0, 0, 0, 0, 0.8f } } },
+		{ "3 layers, app + overlay + cursor", {
+			{ 1920, 1080, DRM_FORMAT_XRGB8888, g_zposBase },
+			{ 1920, 1080, DRM_FORMAT_ARGB8888, g_zposOverlay, 0, 0, 0, 0, 0.8f },
+			{ 64, 64, DRM_FORMAT_ARGB8888, g_zposCursor, 0, 0, 960, 540 } } },
+		{ "3 layers, NV12 video + overlay + cursor", {
+			{ 1920, 1080, DRM_FORMAT_NV12, g_zposBase },
+			{ 1920, 1080, DRM_FORMAT_ARGB8888, g_zposOverlay, 0, 0, 0, 0, 0.8f },
+			{ 64, 64, DRM_FORMAT_ARGB8888, g_zposCursor, 0, 0, 960, 540 } } },
+		{ "5 layers, over the plane budget", {
+			{ 1920, 1080, DRM_FORMAT_XRGB8888, g_zposBase },
+			{ 1280, 720, DRM_FORMAT_ARGB8888, g_zposExternalOverlay, 0, 0, 320, 180 },
+			{ 1920, 1080, DRM_FORMAT_ARGB8888, g_zposOverlay, 0, 0, 0, 0, 0.8f },
+			{ 64, 64, DRM_FORMAT_ARGB8888, g_zposCursor, 0, 0, 960, 540 },
+			{ 1920, 1080, DRM_FORMAT_ARGB8888, g_zposMuraCorrection } } },
+	};
+
+	// A sampled texture backed by an FB on the mock device. The mock
+	// never reads the memory, so any GEM handle will do.
+	static OwningRc<CVulkanTexture> CreateDRMBenchTexture( uint32_t uWidth, uint32_t uHeight, uint32_t uDrmFormat )
+	{
+		const bool bNV12 = uDrmFormat == DRM_FORMAT_NV12;
+		uint32_t uHandles[4] = { 1, bNV12 ? 1u : 0u };
+		uint32_t uPitches[4] = { bNV12 ? uWidth : uWidth * 4, bNV12 ? uWidth : 0u };
+		uint32_t uOffsets[4] = { 0, bNV12 ? uWidth * uHeight : 0u };
+		uint64_t ulModifiers[4] = { DRM_FORMAT_MOD_LINEAR, bNV12 ? DRM_FORMAT_MOD_LINEAR : 0 };
+
+		uint32_t uFbId = 0;
+		if ( drmModeAddFB2WithModifiers( g_DRM.fd, uWidth, uHeight, uDrmFormat, uHandles, uPitches, uOffsets, ulModifiers, &uFbId, DRM_MODE_FB_MODIFIERS ) != 0 )
+		{
+			s_DRMBenchLog.errorf_errno( "drmModeAddFB2WithModifiers failed" );
+			return nullptr;
+		}
+
+		CVulkanTexture::createFlags texCreateFlags;
+		texCreateFlags.bSampled = true;
+
+		OwningRc<CVulkanTexture> pTexture = new CVulkanTexture();
+		if ( !pTexture->BInit( uWidth, uHeight, 1u, uDrmFormat, texCreateFlags, nullptr, 0, 0, nullptr, new CDRMFb( uFbId, DRM_FORMAT_MOD_LINEAR ) ) )
+		{
+			s_DRMBenchLog.errorf( "Failed to create %ux%u texture of format 0x%x", uWidth, uHeight, uDrmFormat );
+			return nullptr;
+		}
+
+		return pTexture;
+	}
+
+	static bool BuildDRMBenchFrame( const DRMBenchScenario_t &scenario, std::vector<OwningRc<CVulkanTexture>> *pTextures, FrameInfo_t *pOutFrameInfo )
+	{
+		FrameInfo_t &frameInfo = *pOutFrameInfo;
+		frameInfo = FrameInfo_t{};
+		frameInfo.outputEncodingEOTF = EOTF_Gamma22;
+		frameInfo.layerCount = int( scenario.layers.size() );
+
+		for ( size_t i = 0; i < scenario.layers.size(); i++ )
+		{
+			const DRMBenchLayer_t &benchLayer = scenario.layers[i];
+
+			OwningRc<CVulkanTexture> pTexture = CreateDRMBenchTexture( benchLayer.uWidth, benchLayer.uHeight, benchLayer.uDrmFormat );
+			if ( !pTexture )
+				return false;
+
+			FrameInfo_t::Layer_t &layer = frameInfo.layers[i];
+			layer.tex = pTexture.get();
+			layer.zpos = benchLayer.nZPos;
+			layer.opacity = benchLayer.flOpacity;
+			layer.offset = vec2_t{ float( -benchLayer.nX ), float( -benchLayer.nY ) };
+			layer.scale.x = benchLayer.uDisplayWidth ? float( benchLayer.uWidth ) / benchLayer.uDisplayWidth : 1.0f;
+			layer.scale.y = benchLayer.uDisplayHeight ? float( benchLayer.uHeight ) / benchLayer.uDisplayHeight : 1.0f;
+			layer.colorspace = GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB;
+
+			pTextures->push_back( std::move( pTexture ) );
+		}
+
+		return true;
+	}
+
+	static void DiscardDRMBenchRequest()
+	{
+		drm_rollback( &g_DRM );
+
+		drmModeAtomicFree( g_DRM.req );
+		g_DRM.req = nullptr;
+
+		g_DRM.m_FbIdsInRequest.clear();
+	}
+
+	// Commits the prepared request synchronously and without a flip event,
+	// so the bench doesn't need the page flip handler.
+	static int CommitDRMBenchRequest()
+	{
+		const uint32_t uFlags = g_DRM.flags & ~( DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK );
+		int ret = drmModeAtomicCommit( g_DRM.fd, g_DRM.req, uFlags, nullptr );
+		g_LiftoffStateCache.OnCommitResult( ret );
+
+		if ( ret != 0 )
+		{
+			DiscardDRMBenchRequest();
+			return ret;
+		}
+
+		drm_apply_committed_state( &g_DRM );
+		drmModeAtomicFree( g_DRM.req );
+		g_DRM.req = nullptr;
+		g_DRM.m_FbIdsInRequest.clear();
+		return 0;
+	}
+
+	int RunDRMCommitBenchmark( uint32_t uIterations )
+	{
+		if ( !g_pszDRMMockPreset || !g_DRM.pCRTC )
+		{
+			s_DRMBenchLog.errorf( "The DRM commit benchmark needs the DRM backend on a mock device" );
+			return 1;
+		}
+
+		CMockKMSDevice &mock = CMockKMSDevice::Get();
+
+		// Light up the CRTC first, so every measured frame is a plain flip
+		// rather than a modeset.
+		{
+			std::vector<OwningRc<CVulkanTexture>> textures;
+			FrameInfo_t frameInfo;
+			if ( !BuildDRMBenchFrame( k_DRMBenchScenarios[0], &textures, &frameInfo ) )
+				return 1;
+
+			if ( drm_prepare( &g_DRM, false, &frameInfo ) != 0 )
+			{
+				s_DRMBenchLog.errorf( "Initial modeset was rejected" );
+				return 1;
+			}
+
+			if ( int ret = CommitDRMBenchRequest(); ret != 0 )
+			{
+				s_DRMBenchLog.errorf( "Initial modeset failed: %s", strerror( -ret ) );
+				return 1;
+			}
+		}
+
+		fprintf( stdout, "DRM commit benchmark: mock '%s', %u frames per scenario\n", g_pszDRMMockPreset, uIterations );
+
+		for ( const DRMBenchScenario_t &scenario : k_DRMBenchScenarios )
+		{
+			std::vector<OwningRc<CVulkanTexture>> textures;
+			FrameInfo_t frameInfo;
+			if ( !BuildDRMBenchFrame( scenario, &textures, &frameInfo ) )
+				return 1;
+
+			// Warm runs hit the liftoff state cache after the first frame,
+			// cold runs pay for a full liftoff plane assignment every frame.
+			for ( bool bCold : { false, true } )
+			{
+				std::vector<uint64_t> prepare;
+				prepare.reserve( uIterations );
+				uint32_t uScanout = 0;
+				uint64_t ulProps = 0;
+				const uint64_t ulTestCommitsBefore = mock.GetTestCommitCount();
+
+				g_LiftoffStateCache.Clear();
+				for ( uint32_t i = 0; i < uIterations; i++ )
+				{
+					if ( bCold )
+						g_LiftoffStateCache.Clear();
+
+					uint64_t ulStart = get_time_in_nanos();
+					int ret = drm_prepare( &g_DRM, false, &frameInfo );
+					prepare.push_back( get_time_in_nanos() - ulStart );
+
+					// drm_prepare already cleaned up after itself if it failed.
+					// Commit the rest, as requests only carry what changed
+					// since the last commit.
+					if ( ret == 0 )
+					{
+						const int nProps = g_DRM.props_in_request;
+						if ( CommitDRMBenchRequest() == 0 )
+						{
+							uScanout++;
+							ulProps += nProps;
+						}
+					}
+				}
+
+				const double flTestCommits = double( mock.GetTestCommitCount() - ulTestCommitsBefore ) / std::max( uIterations, 1u );
+				const double flProps = double( ulProps ) / std::max( uScanout, 1u );
+				fprintf( stdout, "  %s, %s cache: %u/%u scanned out, %.2f TEST_ONLY commits/frame, %.1f properties/request\n",
+					scenario.pszName, bCold ? "cold" : "warm", uScanout, uIterations, flTestCommits, flProps );
+				PrintBenchStat( "prepare", std::move( prepare ) );
+			}
+		}
+
+		fprintf( stdout, "  %" PRIu64 " commits rejected by the mock device\n", mock.GetRejectedCommitCount() );
+
+		return 0;
+	}
+}
+#endif
@@ -0,0 +1,1097 @@
+#include <sys/stat.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include "MockKMS.h"
+#include "log.hpp"
+
+#ifndef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+#define DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP 0x15
+#endif
+
+const char *g_pszDRMMockPreset = nullptr;
+
+namespace gamescope
+{
+    static LogScope s_MockKMSLog( "mock_kms" );
+
+    static_assert( sizeof( drmModeModeInfo ) == sizeof( drm_mode_modeinfo ) );
+
+    template <typename T>
+    static T *UserPtr( uint64_t ulPtr )
+    {
+        return reinterpret_cast<T *>( static_cast<uintptr_t>( ulPtr ) );
+    }
+
+    // Same convention as the kernel: always report the real count,
+    // only copy as much as userspace made room for.
+    template <typename T>
+    static void CopyToUser( uint64_t ulPtr, uint32_t *puCount, const T *pData, size_t zCount )
+    {
+        if ( ulPtr && *puCount && zCount )
+            memcpy( UserPtr<T>( ulPtr ), pData, std::min<size_t>( *puCount, zCount ) * sizeof( T ) );
+        *puCount = uint32_t( zCount );
+    }
+
+    static void CopyStringToUser( char *pszDest, __kernel_size_t *pzLength, const char *pszSrc )
+    {
+        const size_t zLength = strlen( pszSrc );
+        if ( pszDest && *pzLength )
+            memcpy( pszDest, pszSrc, std::min<size_t>( *pzLength, zLength ) );
+        *pzLength = zLength;
+    }
+
+    static drmModeModeInfo MakeMode( uint32_t uClock, uint16_t uHDisplay, uint16_t uHSyncStart, uint16_t uHSyncEnd, uint16_t uHTotal,
+                                     uint16_t uVDisplay, uint16_t uVSyncStart, uint16_t uVSyncEnd, uint16_t uVTotal, uint32_t uType )
+    {
+        drmModeModeInfo mode{};
+        mode.clock = uClock;
+        mode.hdisplay = uHDisplay;
+        mode.hsync_start = uHSyncStart;
+        mode.hsync_end = uHSyncEnd;
+        mode.htotal = uHTotal;
+        mode.vdisplay = uVDisplay;
+        mode.vsync_start = uVSyncStart;
+        mode.vsync_end = uVSyncEnd;
+        mode.vtotal = uVTotal;
+        mode.vrefresh = ( uClock * 1000u + ( uHTotal * uVTotal ) / 2 ) / ( uHTotal * uVTotal );
+        mode.flags = DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC;
+        mode.type = DRM_MODE_TYPE_DRIVER | uType;
+        snprintf( mode.name, sizeof( mode.name ), "%ux%u", uHDisplay, uVDisplay );
+        return mode;
+    }
+
+    static std::vector<uint8_t> MakeInFormatsBlob( const MockKMSPlaneConfig_t &plane )
+    {
+        // One drm_format_modifier covers up to 64 formats.
+        assert( plane.formats.size() <= 64 );
+
+        const size_t zFormatsOffset = sizeof( drm_format_modifier_blob );
+        const size_t zModifiersOffset = ( zFormatsOffset + plane.formats.size() * sizeof( uint32_t ) + 7 ) & ~size_t( 7 );
+        std::vector<uint8_t> data( zModifiersOffset + plane.modifiers.size() * sizeof( drm_format_modifier ) );
+
+        drm_format_modifier_blob header{};
+        header.version = FORMAT_BLOB_CURRENT;
+        header.count_formats = uint32_t( plane.formats.size() );
+        header.formats_offset = uint32_t( zFormatsOffset );
+        header.count_modifiers = uint32_t( plane.modifiers.size() );
+        header.modifiers_offset = uint32_t( zModifiersOffset );
+        memcpy( data.data(), &header, sizeof( header ) );
+        memcpy( data.data() + zFormatsOffset, plane.formats.data(), plane.formats.size() * sizeof( uint32_t ) );
+
+        const uint64_t ulFormatMask = plane.formats.size() == 64 ? ~0ull : ( 1ull << plane.formats.size() ) - 1;
+        for ( size_t i = 0; i < plane.modifiers.size(); i++ )
+        {
+            drm_format_modifier modifier{};
+            modifier.formats = ulFormatMask;
+            modifier.modifier = plane.modifiers[i];
+            memcpy( data.data() + zModifiersOffset + i * sizeof( modifier ), &modifier, sizeof( modifier ) );
+        }
+
+        return data;
+    }
+
+    static const std::vector<std::pair<uint64_t, std::string>> k_AMDTransferFunctions =
+    {
+        { AMDGPU_TRANSFER_FUNCTION_DEFAULT,          "Default" },
+        { AMDGPU_TRANSFER_FUNCTION_SRGB_EOTF,        "sRGB EOTF" },
+        { AMDGPU_TRANSFER_FUNCTION_BT709_INV_OETF,   "BT.709 inv_OETF" },
+        { AMDGPU_TRANSFER_FUNCTION_PQ_EOTF,          "PQ (Perceptual Quantizer) EOTF" },
+        { AMDGPU_TRANSFER_FUNCTION_IDENTITY,         "Identity" },
+        { AMDGPU_TRANSFER_FUNCTION_GAMMA22_EOTF,     "Gamma 2.2 EOTF" },
+        { AMDGPU_TRANSFER_FUNCTION_GAMMA24_EOTF,     "Gamma 2.4 EOTF" },
+        { AMDGPU_TRANSFER_FUNCTION_GAMMA26_EOTF,     "Gamma 2.6 EOTF" },
+        { AMDGPU_TRANSFER_FUNCTION_SRGB_INV_EOTF,    "sRGB inv_EOTF" },
+        { AMDGPU_TRANSFER_FUNCTION_BT709_OETF,       "BT.709 OETF" },
+        { AMDGPU_TRANSFER_FUNCTION_PQ_INV_EOTF,      "PQ (Perceptual Quantizer) inv_EOTF" },
+        { AMDGPU_TRANSFER_FUNCTION_GAMMA22_INV_EOTF, "Gamma 2.2 inv_EOTF" },
+        { AMDGPU_TRANSFER_FUNCTION_GAMMA24_INV_EOTF, "Gamma 2.4 inv_EOTF" },
+        { AMDGPU_TRANSFER_FUNCTION_GAMMA26_INV_EOTF, "Gamma 2.6 inv_EOTF" },
+    };
+
+    /////////////////////////
+    // MockKMSConfig_t
+    /////////////////////////
+
+    /*static*/ std::optional<MockKMSConfig_t> MockKMSConfig_t::FromPreset( std::string_view svPreset )
+    {
+        static const std::vector<uint32_t> k_RGBFormats =
+        {
+            DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888, DRM_FORMAT_XBGR8888, DRM_FORMAT_ABGR8888,
+            DRM_FORMAT_XRGB2101010, DRM_FORMAT_ARGB2101010, DRM_FORMAT_XBGR2101010, DRM_FORMAT_ABGR2101010,
+        };
+
+        MockKMSConfig_t config;
+        config.sName = svPreset;
+        config.modes =
+        {
+            MakeMode( 148500, 1920, 2008, 2052, 2200, 1080, 1084, 1089, 1125, DRM_MODE_TYPE_PREFERRED ),
+            MakeMode(  74250, 1280, 1390, 1430, 1650,  720,  725,  730,  750, 0 ),
+        };
+
+        if ( svPreset == "amd" )
+        {
+            // Roughly a DCN pipe: primary + two overlays sharing one
+            // color pipeline and format list, and a fixed-size cursor.
+            MockKMSPlaneConfig_t universal;
+            universal.formats = k_RGBFormats;
+            universal.formats.insert( universal.formats.end(), { DRM_FORMAT_XBGR16161616F, DRM_FORMAT_ABGR16161616F, DRM_FORMAT_NV12, DRM_FORMAT_P010 } );
+            universal.modifiers = { DRM_FORMAT_MOD_LINEAR };
+            universal.bYCbCr = true;
+            universal.bColorMgmt = true;
+
+            MockKMSPlaneConfig_t primary = universal;
+            primary.uType = DRM_PLANE_TYPE_PRIMARY;
+
+            MockKMSPlaneConfig_t cursor;
+            cursor.uType = DRM_PLANE_TYPE_CURSOR;
+            cursor.formats = { DRM_FORMAT_ARGB8888 };
+            cursor.modifiers = { DRM_FORMAT_MOD_LINEAR };
+            cursor.bScaling = false;
+            cursor.bAlpha = false;
+            cursor.bBlendMode = false;
+            cursor.bRotation = false;
+
+            config.planes = { primary, universal, universal, cursor };
+            config.uMaxActivePlanes = 4;
+            config.bAsyncPageFlip = true;
+            config.bVRR = true;
+            config.bColorMgmt = true;
+        }
+        else if ( svPreset == "generic" )
+        {
+            // A simple display engine: fixed-size primary, one scaling
+            // overlay and a cursor, no color management or async flips.
+            MockKMSPlaneConfig_t primary;
+            primary.uType = DRM_PLANE_TYPE_PRIMARY;
+            primary.formats = { DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888, DRM_FORMAT_XRGB2101010, DRM_FORMAT_ARGB2101010 };
+            primary.modifiers = { DRM_FORMAT_MOD_LINEAR };
+            primary.bScaling = false;
+            primary.bAlpha = false;
+            primary.bBlendMode = false;
+            primary.bRotation = false;
+
+            MockKMSPlaneConfig_t overlay;
+            overlay.formats = { DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888, DRM_FORMAT_NV12 };
+            overlay.modifiers = { DRM_FORMAT_MOD_LINEAR };
+            overlay.bYCbCr = true;
+            overlay.bRotation = false;
+
+            MockKMSPlaneConfig_t cursor;
+            cursor.uType = DRM_PLANE_TYPE_CURSOR;
+            cursor.formats = { DRM_FORMAT_ARGB8888 };
+            cursor.modifiers = { DRM_FORMAT_MOD_LINEAR };
+            cursor.bScaling = false;
+            cursor.bAlpha = false;
+            cursor.bBlendMode = false;
+            cursor.bRotation = false;
+
+            config.planes = { primary, overlay, cursor };
+            config.uMaxActivePlanes = 3;
+        }
+        else
+        {
+            return std::nullopt;
+        }
+
+        return config;
+    }
+
+    /////////////////////////
+    // CMockKMSDevice
+    /////////////////////////
+
+    /*static*/ CMockKMSDevice &CMockKMSDevice::Get()
+    {
+        static CMockKMSDevice s_Instance;
+        return s_Instance;
+    }
+
+    int CMockKMSDevice::Open( std::string_view svPreset )
+    {
+        std::optional<MockKMSConfig_t> oConfig = MockKMSConfig_t::FromPreset( svPreset );
+        if ( !oConfig )
+        {
+            s_MockKMSLog.errorf( "Unknown preset '%.*s', expected 'amd' or 'generic'", int( svPreset.size() ), svPreset.data() );
+            return -1;
+        }
+
+        int nFd;
+        {
+            std::unique_lock lock( m_Mutex );
+
+            if ( BIsOpen() )
+            {
+                s_MockKMSLog.errorf( "Device is already open" );
+                return -1;
+            }
+
+            // The read end stands in for the DRM fd: it is pollable, and
+            // page-flip events written to the other end are what
+            // drmHandleEvent reads back.
+            int nFds[2];
+            if ( pipe2( nFds, O_CLOEXEC ) != 0 )
+            {
+                s_MockKMSLog.errorf_errno( "pipe2 failed" );
+                return -1;
+            }
+            // Never stall a commit on a full pipe.
+            fcntl( nFds[1], F_SETFL, O_NONBLOCK );
+
+            // libliftoff dups the fd, so recognize it by inode rather than number.
+            struct stat fdStat;
+            if ( fstat( nFds[0], &fdStat ) != 0 )
+            {
+                s_MockKMSLog.errorf_errno( "fstat failed" );
+                close( nFds[0] );
+                close( nFds[1] );
+                return -1;
+            }
+
+            m_Config = std::move( *oConfig );
+            m_Device = fdStat.st_dev;
+            m_Inode = fdStat.st_ino;
+            m_nWriteFd = nFds[1];
+            CreateObjects();
+
+            nFd = nFds[0];
+            m_nReadFd = nFd;
+        }
+
+        // If libdrm binds drmIoctl internally (-Bsymbolic), our definition
+        // never sees its calls and the device would look empty.
+        if ( !drmIsKMS( nFd ) || m_ulIoctls == 0 )
+        {
+            s_MockKMSLog.errorf( "drmIoctl could not be interposed, libdrm calls are bypassing the mock device" );
+            return -1;
+        }
+
+        s_MockKMSLog.infof( "Opened mock KMS device with preset '%s' (%zu planes)", m_Config.sName.c_str(), m_Config.planes.size() );
+        return nFd;
+    }
+
+    bool CMockKMSDevice::BOwnsFd( int nFd ) const
+    {
+        const int nReadFd = m_nReadFd.load( std::memory_order_relaxed );
+        if ( nReadFd < 0 || nFd < 0 )
+            return false;
+
+        if ( nFd == nReadFd )
+            return true;
+
+        struct stat fdStat;
+        if ( fstat( nFd, &fdStat ) != 0 )
+            return false;
+
+        return fdStat.st_dev == m_Device && fdStat.st_ino == m_Inode;
+    }
+
+    /*static*/ CMockKMSDevice::Property_t CMockKMSDevice::RangeProperty( const char *pszName, uint64_t ulMin, uint64_t ulMax, uint32_t uFlags )
+    {
+        return Property_t{ .sName = pszName, .uFlags = DRM_MODE_PROP_RANGE | uFlags, .values = { ulMin, ulMax } };
+    }
+
+    /*static*/ CMockKMSDevice::Property_t CMockKMSDevice::SignedRangeProperty( const char *pszName, int64_t lMin, int64_t lMax )
+    {
+        return Property_t{ .sName = pszName, .uFlags = DRM_MODE_PROP_SIGNED_RANGE, .values = { uint64_t( lMin ), uint64_t( lMax ) } };
+    }
+
+    /*static*/ CMockKMSDevice::Property_t CMockKMSDevice::EnumProperty( const char *pszName, std::vector<std::pair<uint64_t, std::string>> enums, uint32_t uFlags )
+    {
+        return Property_t{ .sName = pszName, .uFlags = DRM_MODE_PROP_ENUM | uFlags, .enums = std::move( enums ) };
+    }
+
+    /*static*/ CMockKMSDevice::Property_t CMockKMSDevice::BitmaskProperty( const char *pszName, std::vector<std::pair<uint64_t, std::string>> enums )
+    {
+        return Property_t{ .sName = pszName, .uFlags = DRM_MODE_PROP_BITMASK, .enums = std::move( enums ) };
+    }
+
+    /*static*/ CMockKMSDevice::Property_t CMockKMSDevice::ObjectProperty( const char *pszName, uint32_t uObjectType )
+    {
+        return Property_t{ .sName = pszName, .uFlags = DRM_MODE_PROP_OBJECT | DRM_MODE_PROP_ATOMIC, .values = { uObjectType } };
+    }
+
+    /*static*/ CMockKMSDevice::Property_t CMockKMSDevice::BlobProperty( const char *pszName, uint32_t uBlobSize, bool bBlobArray, uint32_t uFlags )
+    {
+        return Property_t{ .sName = pszName, .uFlags = DRM_MODE_PROP_BLOB | uFlags, .uBlobSize = uBlobSize, .bBlobArray = bBlobArray };
+    }
+
+    uint32_t CMockKMSDevice::CreateObject( uint32_t uType )
+    {
+        uint32_t uId = m_uNextId++;
+        m_State[ uId ].uType = uType;
+        return uId;
+    }
+
+    void CMockKMSDevice::AttachProperty( uint32_t uObjectId, Property_t prop, uint64_t ulValue )
+    {
+        // Like the kernel, one property object is shared by every
+        // KMS object exposing a property of that name.
+        auto iter = m_PropertyIds.find( prop.sName );
+        uint32_t uPropId;
+        if ( iter != m_PropertyIds.end() )
+        {
+            uPropId = iter->second;
+        }
+        else
+        {
+            uPropId = m_uNextId++;
+            prop.bModeset = prop.sName == "ACTIVE" || prop.sName == "MODE_ID" || prop.sName == "CRTC_ID";
+            prop.bAsync = prop.sName == "FB_ID" || prop.sName == "IN_FENCE_FD";
+            m_PropertyIds.emplace( prop.sName, uPropId );
+            m_Properties.emplace( uPropId, std::move( prop ) );
+        }
+
+        m_State[ uObjectId ].props.push_back( PropertyValue_t{ uPropId, ulValue } );
+    }
+
+    uint32_t CMockKMSDevice::CreateBlob( const void *pData, size_t zSize )
+    {
+        uint32_t uBlobId = m_uNextId++;
+        const uint8_t *pBytes = reinterpret_cast<const uint8_t *>( pData );
+        m_Blobs.emplace( uBlobId, std::vector<uint8_t>( pBytes, pBytes + zSize ) );
+        return uBlobId;
+    }
+
+    void CMockKMSDevice::CreateObjects()
+    {
+        m_uCRTCId = CreateObject( DRM_MODE_OBJECT_CRTC );
+        m_uEncoderId = CreateObject( DRM_MODE_OBJECT_ENCODER );
+        m_uConnectorId = CreateObject( DRM_MODE_OBJECT_CONNECTOR );
+
+        AttachProperty( m_uConnectorId, BlobProperty( "EDID", 0, false, DRM_MODE_PROP_IMMUTABLE ), 0 );
+        AttachProperty( m_uConnectorId, ObjectProperty( "CRTC_ID", DRM_MODE_OBJECT_CRTC ), 0 );
+        AttachProperty( m_uConnectorId, RangeProperty( "non-desktop", 0, 1, DRM_MODE_PROP_IMMUTABLE ), 0 );
+        AttachProperty( m_uConnectorId, EnumProperty( "content type", { { 0, "No Data" }, { 1, "Graphics" }, { 2, "Photo" }, { 3, "Cinema" }, { 4, "Game" } } ), 0 );
+        AttachProperty( m_uConnectorId, EnumProperty( "Broadcast RGB", { { 0, "Automatic" }, { 1, "Full" }, { 2, "Limited 16:235" } } ), 0 );
+        if ( m_Config.bVRR )
+            AttachProperty( m_uConnectorId, RangeProperty( "vrr_capable", 0, 1, DRM_MODE_PROP_IMMUTABLE ), 1 );
+
+        AttachProperty( m_uCRTCId, RangeProperty( "ACTIVE", 0, 1, DRM_MODE_PROP_ATOMIC ), 0 );
+        AttachProperty( m_uCRTCId, BlobProperty( "MODE_ID", sizeof( drm_mode_modeinfo ), false, DRM_MODE_PROP_ATOMIC ), 0 );
+        AttachProperty( m_uCRTCId, RangeProperty( "OUT_FENCE_PTR", 0, UINT64_MAX, DRM_MODE_PROP_ATOMIC ), 0 );
+        if ( m_Config.bVRR )
+            AttachProperty( m_uCRTCId, RangeProperty( "VRR_ENABLED", 0, 1 ), 0 );
+        if ( m_Config.bColorMgmt )
+        {
+            AttachProperty( m_uCRTCId, BlobProperty( "DEGAMMA_LUT", sizeof( drm_color_lut ), true ), 0 );
+            AttachProperty( m_uCRTCId, RangeProperty( "DEGAMMA_LUT_SIZE", 0, UINT32_MAX, DRM_MODE_PROP_IMMUTABLE ), 4096 );
+            AttachProperty( m_uCRTCId, BlobProperty( "CTM", sizeof( drm_color_ctm ), false ), 0 );
+            AttachProperty( m_uCRTCId, BlobProperty( "GAMMA_LUT", sizeof( drm_color_lut ), true ), 0 );
+            AttachProperty( m_uCRTCId, RangeProperty( "GAMMA_LUT_SIZE", 0, UINT32_MAX, DRM_MODE_PROP_IMMUTABLE ), 4096 );
+            AttachProperty( m_uCRTCId, EnumProperty( "AMD_CRTC_REGAMMA_TF", k_AMDTransferFunctions ), AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+        }
+
+        for ( size_t i = 0; i < m_Config.planes.size(); i++ )
+        {
+            const MockKMSPlaneConfig_t &plane = m_Config.planes[i];
+            const std::vector<uint8_t> inFormats = MakeInFormatsBlob( plane );
+
+            uint32_t uPlaneId = CreateObject( DRM_MODE_OBJECT_PLANE );
+            m_PlaneIds.push_back( uPlaneId );
+            m_PlaneConfigs[ uPlaneId ] = &plane;
+
+            AttachProperty( uPlaneId, EnumProperty( "type", { { DRM_PLANE_TYPE_OVERLAY, "Overlay" }, { DRM_PLANE_TYPE_PRIMARY, "Primary" }, { DRM_PLANE_TYPE_CURSOR, "Cursor" } }, DRM_MODE_PROP_IMMUTABLE ), plane.uType );
+            AttachProperty( uPlaneId, BlobProperty( "IN_FORMATS", 0, false, DRM_MODE_PROP_IMMUTABLE ), CreateBlob( inFormats.data(), inFormats.size() ) );
+            AttachProperty( uPlaneId, ObjectProperty( "FB_ID", DRM_MODE_OBJECT_FB ), 0 );
+            AttachProperty( uPlaneId, SignedRangeProperty( "IN_FENCE_FD", -1, INT32_MAX ), uint64_t( -1 ) );
+            AttachProperty( uPlaneId, ObjectProperty( "CRTC_ID", DRM_MODE_OBJECT_CRTC ), 0 );
+            AttachProperty( uPlaneId, RangeProperty( "SRC_X", 0, UINT32_MAX, DRM_MODE_PROP_ATOMIC ), 0 );
+            AttachProperty( uPlaneId, RangeProperty( "SRC_Y", 0, UINT32_MAX, DRM_MODE_PROP_ATOMIC ), 0 );
+            AttachProperty( uPlaneId, RangeProperty( "SRC_W", 0, UINT32_MAX, DRM_MODE_PROP_ATOMIC ), 0 );
+            AttachProperty( uPlaneId, RangeProperty( "SRC_H", 0, UINT32_MAX, DRM_MODE_PROP_ATOMIC ), 0 );
+            AttachProperty( uPlaneId, SignedRangeProperty( "CRTC_X", INT32_MIN, INT32_MAX ), 0 );
+            AttachProperty( uPlaneId, SignedRangeProperty( "CRTC_Y", INT32_MIN, INT32_MAX ), 0 );
+            AttachProperty( uPlaneId, RangeProperty( "CRTC_W", 0, INT32_MAX, DRM_MODE_PROP_ATOMIC ), 0 );
+            AttachProperty( uPlaneId, RangeProperty( "CRTC_H", 0, INT32_MAX, DRM_MODE_PROP_ATOMIC ), 0 );
+            AttachProperty( uPlaneId, RangeProperty( "zpos", 0, m_Config.planes.size() - 1 ), i );
+
+            if ( plane.bAlpha )
+                AttachProperty( uPlaneId, RangeProperty( "alpha", 0, 0xffff ), 0xffff );
+            if ( plane.bBlendMode )
+                AttachProperty( uPlaneId, EnumProperty( "pixel blend mode", { { 0, "Pre-multiplied" }, { 1, "Coverage" }, { 2, "None" } } ), 0 );
+            if ( plane.bRotation )
+            {
+                AttachProperty( uPlaneId, BitmaskProperty( "rotation",
+                    { { 0, "rotate-0" }, { 1, "rotate-90" }, { 2, "rotate-180" }, { 3, "rotate-270" }, { 4, "reflect-x" }, { 5, "reflect-y" } } ), DRM_MODE_ROTATE_0 );
+            }
+            if ( plane.bYCbCr )
+            {
+                AttachProperty( uPlaneId, EnumProperty( "COLOR_ENCODING",
+                    { { DRM_COLOR_YCBCR_BT601, "ITU-R BT.601 YCbCr" }, { DRM_COLOR_YCBCR_BT709, "ITU-R BT.709 YCbCr" }, { DRM_COLOR_YCBCR_BT2020, "ITU-R BT.2020 YCbCr" } } ), DRM_COLOR_YCBCR_BT709 );
+                AttachProperty( uPlaneId, EnumProperty( "COLOR_RANGE",
+                    { { DRM_COLOR_YCBCR_LIMITED_RANGE, "YCbCr limited range" }, { DRM_COLOR_YCBCR_FULL_RANGE, "YCbCr full range" } } ), DRM_COLOR_YCBCR_LIMITED_RANGE );
+            }
+            if ( plane.bColorMgmt )
+            {
+                AttachProperty( uPlaneId, EnumProperty( "AMD_PLANE_DEGAMMA_TF", k_AMDTransferFunctions ), AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+                AttachProperty( uPlaneId, BlobProperty( "AMD_PLANE_DEGAMMA_LUT", sizeof( drm_color_lut ), true ), 0 );
+                // 3x4 S31.32 matrix.
+                AttachProperty( uPlaneId, BlobProperty( "AMD_PLANE_CTM", 12 * sizeof( uint64_t ), false ), 0 );
+                AttachProperty( uPlaneId, RangeProperty( "AMD_PLANE_HDR_MULT", 0, UINT64_MAX ), 0x100000000ull );
+                AttachProperty( uPlaneId, BlobProperty( "AMD_PLANE_SHAPER_LUT", sizeof( drm_color_lut ), true ), 0 );
+                AttachProperty( uPlaneId, EnumProperty( "AMD_PLANE_SHAPER_TF", k_AMDTransferFunctions ), AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+                AttachProperty( uPlaneId, BlobProperty( "AMD_PLANE_LUT3D", sizeof( drm_color_lut ), true ), 0 );
+                AttachProperty( uPlaneId, EnumProperty( "AMD_PLANE_BLEND_TF", k_AMDTransferFunctions ), AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+                AttachProperty( uPlaneId, BlobProperty( "AMD_PLANE_BLEND_LUT", sizeof( drm_color_lut ), true ), 0 );
+            }
+        }
+    }
+
+    const CMockKMSDevice::PropertyValue_t *CMockKMSDevice::FindValue( const State_t &state, uint32_t uObjectId, std::string_view svName ) const
+    {
+        auto objIter = state.find( uObjectId );
+        auto propIter = m_PropertyIds.find( std::string( svName ) );
+        if ( objIter == state.end() || propIter == m_PropertyIds.end() )
+            return nullptr;
+
+        for ( const PropertyValue_t &value : objIter->second.props )
+        {
+            if ( value.uPropId == propIter->second )
+                return &value;
+        }
+        return nullptr;
+    }
+
+    uint64_t CMockKMSDevice::GetValue( const State_t &state, uint32_t uObjectId, std::string_view svName ) const
+    {
+        const PropertyValue_t *pValue = FindValue( state, uObjectId, svName );
+        return pValue ? pValue->ulValue : 0;
+    }
+
+    int CMockKMSDevice::ValidateValue( const Property_t &prop, uint64_t ulValue ) const
+    {
+        if ( prop.uFlags & DRM_MODE_PROP_RANGE )
+        {
+            if ( ulValue < prop.values[0] || ulValue > prop.values[1] )
+                return -EINVAL;
+        }
+        else if ( prop.uFlags & DRM_MODE_PROP_ENUM )
+        {
+            if ( std::none_of( prop.enums.begin(), prop.enums.end(), [=]( const auto &e ){ return e.first == ulValue; } ) )
+                return -EINVAL;
+        }
+        else if ( prop.uFlags & DRM_MODE_PROP_BITMASK )
+        {
+            uint64_t ulMask = 0;
+            for ( const auto &e : prop.enums )
+                ulMask |= 1ull << e.first;
+            if ( ulValue & ~ulMask )
+                return -EINVAL;
+        }
+        else if ( prop.uFlags & DRM_MODE_PROP_BLOB )
+        {
+            if ( ulValue == 0 )
+                return 0;
+
+            auto iter = m_Blobs.find( uint32_t( ulValue ) );
+            if ( iter == m_Blobs.end() )
+                return -EINVAL;
+
+            const size_t zSize = iter->second.size();
+            if ( prop.uBlobSize && ( prop.bBlobArray ? zSize % prop.uBlobSize != 0 : zSize != prop.uBlobSize ) )
+                return -EINVAL;
+        }
+        else if ( ( prop.uFlags & DRM_MODE_PROP_EXTENDED_TYPE ) == DRM_MODE_PROP_SIGNED_RANGE )
+        {
+            if ( int64_t( ulValue ) < int64_t( prop.values[0] ) || int64_t( ulValue ) > int64_t( prop.values[1] ) )
+                return -EINVAL;
+        }
+        else if ( ( prop.uFlags & DRM_MODE_PROP_EXTENDED_TYPE ) == DRM_MODE_PROP_OBJECT )
+        {
+            if ( ulValue == 0 )
+                return 0;
+
+            if ( prop.values[0] == DRM_MODE_OBJECT_FB )
+                return m_Fbs.contains( uint32_t( ulValue ) ) ? 0 : -ENOENT;
+
+            auto iter = m_State.find( uint32_t( ulValue ) );
+            if ( iter == m_State.end() || iter->second.uType != prop.values[0] )
+                return -ENOENT;
+        }
+
+        return 0;
+    }
+
+    int CMockKMSDevice::BuildState( const drm_mode_atomic *pAtomic, State_t *pOutState, bool *pbTouchesCRTC ) const
+    {
+        const uint32_t uFlags = pAtomic->flags;
+        if ( uFlags & ~DRM_MODE_ATOMIC_FLAGS )
+            return -EINVAL;
+        if ( ( uFlags & DRM_MODE_ATOMIC_TEST_ONLY ) && ( uFlags & DRM_MODE_PAGE_FLIP_EVENT ) )
+            return -EINVAL;
+
+        const bool bAsync = !!( uFlags & DRM_MODE_PAGE_FLIP_ASYNC );
+        if ( bAsync && !m_Config.bAsyncPageFlip )
+            return -EINVAL;
+
+        const uint32_t *pObjs = UserPtr<const uint32_t>( pAtomic->objs_ptr );
+        const uint32_t *pCountProps = UserPtr<const uint32_t>( pAtomic->count_props_ptr );
+        const uint32_t *pProps = UserPtr<const uint32_t>( pAtomic->props_ptr );
+        const uint64_t *pValues = UserPtr<const uint64_t>( pAtomic->prop_values_ptr );
+
+        State_t &state = *pOutState;
+        state = m_State;
+
+        bool bModeset = false;
+        *pbTouchesCRTC = false;
+
+        uint32_t uPropIndex = 0;
+        for ( uint32_t i = 0; i < pAtomic->count_objs; i++ )
+        {
+            auto objIter = state.find( pObjs[i] );
+            if ( objIter == state.end() )
+                return -ENOENT;
+            Object_t &object = objIter->second;
+
+            const uint64_t ulOldCRTC = GetValue( state, pObjs[i], "CRTC_ID" );
+
+            for ( uint32_t j = 0; j < pCountProps[i]; j++, uPropIndex++ )
+            {
+                const uint32_t uPropId = pProps[ uPropIndex ];
+                const uint64_t ulValue = pValues[ uPropIndex ];
+
+                auto propIter = m_Properties.find( uPropId );
+                if ( propIter == m_Properties.end() )
+                    return -ENOENT;
+                const Property_t &prop = propIter->second;
+
+                auto valueIter = std::find_if( object.props.begin(), object.props.end(), [=]( const PropertyValue_t &value ){ return value.uPropId == uPropId; } );
+                if ( valueIter == object.props.end() || ( prop.uFlags & DRM_MODE_PROP_IMMUTABLE ) )
+                {
+                    s_MockKMSLog.debugf( "rejecting commit: %s is not settable on object %u", prop.sName.c_str(), pObjs[i] );
+                    return -EINVAL;
+                }
+
+                if ( int nRet = ValidateValue( prop, ulValue ); nRet != 0 )
+                {
+                    s_MockKMSLog.debugf( "rejecting commit: invalid %s = %" PRIu64 " on object %u", prop.sName.c_str(), ulValue, pObjs[i] );
+                    return nRet;
+                }
+
+                if ( valueIter->ulValue != ulValue )
+                {
+                    if ( bAsync && !prop.bAsync )
+                    {
+                        s_MockKMSLog.debugf( "rejecting commit: %s changed in an async flip", prop.sName.c_str() );
+                        return -EINVAL;
+                    }
+
+                    if ( prop.bModeset && object.uType != DRM_MODE_OBJECT_PLANE )
+                        bModeset = true;
+                }
+
+                valueIter->ulValue = ulValue;
+            }
+
+            // Planes and connectors pull their old and new CRTC into the commit.
+            if ( object.uType == DRM_MODE_OBJECT_CRTC || ulOldCRTC == m_uCRTCId || GetValue( state, pObjs[i], "CRTC_ID" ) == m_uCRTCId )
+                *pbTouchesCRTC = true;
+        }
+
+        if ( bModeset && !( uFlags & DRM_MODE_ATOMIC_ALLOW_MODESET ) )
+        {
+            s_MockKMSLog.debugf( "rejecting commit: modeset without ALLOW_MODESET" );
+            return -EINVAL;
+        }
+
+        return 0;
+    }
+
+    int CMockKMSDevice::CheckState( const State_t &state, uint32_t uFlags, bool bTouchesCRTC ) const
+    {
+        const bool bActive = GetValue( state, m_uCRTCId, "ACTIVE" ) != 0;
+        const bool bHasMode = GetValue( state, m_uCRTCId, "MODE_ID" ) != 0;
+        const bool bConnected = GetValue( state, m_uConnectorId, "CRTC_ID" ) == m_uCRTCId;
+
+        if ( ( bActive && !bHasMode ) || bConnected != bHasMode )
+        {
+            s_MockKMSLog.debugf( "rejecting commit: CRTC active %d, mode %d, connected %d", bActive, bHasMode, bConnected );
+            return -EINVAL;
+        }
+
+        if ( ( uFlags & DRM_MODE_PAGE_FLIP_EVENT ) && bTouchesCRTC && !bActive )
+        {
+            s_MockKMSLog.debugf( "rejecting commit: requesting event but off" );
+            return -EINVAL;
+        }
+
+        uint32_t uActivePlanes = 0;
+        bool bPrimaryActive = false;
+        for ( uint32_t uPlaneId : m_PlaneIds )
+        {
+            const MockKMSPlaneConfig_t &plane = *m_PlaneConfigs.at( uPlaneId );
+
+            const uint64_t ulFbId = GetValue( state, uPlaneId, "FB_ID" );
+            const uint64_t ulCRTCId = GetValue( state, uPlaneId, "CRTC_ID" );
+            if ( !ulFbId != !ulCRTCId )
+            {
+                s_MockKMSLog.debugf( "rejecting commit: plane %u has FB_ID %" PRIu64 " but CRTC_ID %" PRIu64, uPlaneId, ulFbId, ulCRTCId );
+                return -EINVAL;
+            }
+
+            if ( !ulFbId )
+                continue;
+
+            if ( !bActive )
+            {
+                s_MockKMSLog.debugf( "rejecting commit: plane %u enabled on an inactive CRTC", uPlaneId );
+                return -EINVAL;
+            }
+
+            uActivePlanes++;
+            if ( plane.uType == DRM_PLANE_TYPE_PRIMARY )
+                bPrimaryActive = true;
+
+            const Fb_t &fb = m_Fbs.at( uint32_t( ulFbId ) );
+            if ( std::find( plane.formats.begin(), plane.formats.end(), fb.uFormat ) == plane.formats.end() ||
+                 ( fb.ulModifier != DRM_FORMAT_MOD_INVALID && std::find( plane.modifiers.begin(), plane.modifiers.end(), fb.ulModifier ) == plane.modifiers.end() ) )
+            {
+                s_MockKMSLog.debugf( "rejecting commit: plane %u can't scan out format 0x%x modifier 0x%" PRIx64, uPlaneId, fb.uFormat, fb.ulModifier );
+                return -EINVAL;
+            }
+
+            const uint64_t ulSrcX = GetValue( state, uPlaneId, "SRC_X" );
+            const uint64_t ulSrcY = GetValue( state, uPlaneId, "SRC_Y" );
+            const uint64_t ulSrcW = GetValue( state, uPlaneId, "SRC_W" );
+            const uint64_t ulSrcH = GetValue( state, uPlaneId, "SRC_H" );
+            if ( ulSrcX + ulSrcW > uint64_t( fb.uWidth ) << 16 || ulSrcY + ulSrcH > uint64_t( fb.uHeight ) << 16 )
+            {
+                s_MockKMSLog.debugf( "rejecting commit: plane %u source outside of its FB", uPlaneId );
+                return -ENOSPC;
+            }
+
+            uint64_t ulCRTCW = GetValue( state, uPlaneId, "CRTC_W" );
+            uint64_t ulCRTCH = GetValue( state, uPlaneId, "CRTC_H" );
+            if ( GetValue( state, uPlaneId, "rotation" ) & ( DRM_MODE_ROTATE_90 | DRM_MODE_ROTATE_270 ) )
+                std::swap( ulCRTCW, ulCRTCH );
+
+            const uint64_t ulSrcPixelsW = ulSrcW >> 16;
+            const uint64_t ulSrcPixelsH = ulSrcH >> 16;
+            if ( !ulSrcPixelsW || !ulSrcPixelsH || !ulCRTCW || !ulCRTCH )
+            {
+                s_MockKMSLog.debugf( "rejecting commit: plane %u has an empty rect", uPlaneId );
+                return -EINVAL;
+            }
+
+            const bool bScaled = ulSrcPixelsW != ulCRTCW || ulSrcPixelsH != ulCRTCH;
+            const bool bScaleInRange =
+                ulSrcPixelsW <= ulCRTCW * plane.uMaxDownscale && ulCRTCW <= ulSrcPixelsW * plane.uMaxUpscale &&
+                ulSrcPixelsH <= ulCRTCH * plane.uMaxDownscale && ulCRTCH <= ulSrcPixelsH * plane.uMaxUpscale;
+            if ( bScaled && ( !plane.bScaling || !bScaleInRange ) )
+            {
+                s_MockKMSLog.debugf( "rejecting commit: plane %u can't scale %" PRIu64 "x%" PRIu64 " -> %" PRIu64 "x%" PRIu64,
+                    uPlaneId, ulSrcPixelsW, ulSrcPixelsH, ulCRTCW, ulCRTCH );
+                return -EINVAL;
+            }
+        }
+
+        if ( uActivePlanes > m_Config.uMaxActivePlanes )
+        {
+            s_MockKMSLog.debugf( "rejecting commit: %u planes enabled, limit is %u", uActivePlanes, m_Config.uMaxActivePlanes );
+            return -EINVAL;
+        }
+
+        if ( bActive && m_Config.bRequirePrimary && !bPrimaryActive )
+        {
+            s_MockKMSLog.debugf( "rejecting commit: CRTC active without its primary plane" );
+            return -EINVAL;
+        }
+
+        return 0;
+    }
+
+    int CMockKMSDevice::Ioctl( unsigned long ulRequest, void *pArg )
+    {
+        m_ulIoctls++;
+
+        std::unique_lock lock( m_Mutex );
+
+        int nRet;
+        switch ( ulRequest )
+        {
+            case DRM_IOCTL_VERSION:                 nRet = GetVersion( reinterpret_cast<drm_version *>( pArg ) ); break;
+            case DRM_IOCTL_GET_CAP:                 nRet = GetCap( reinterpret_cast<drm_get_cap *>( pArg ) ); break;
+            case DRM_IOCTL_SET_CLIENT_CAP:          nRet = SetClientCap( reinterpret_cast<drm_set_client_cap *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_GETRESOURCES:       nRet = GetResources( reinterpret_cast<drm_mode_card_res *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_GETPLANERESOURCES:  nRet = GetPlaneResources( reinterpret_cast<drm_mode_get_plane_res *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_GETPLANE:           nRet = GetPlane( reinterpret_cast<drm_mode_get_plane *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_GETCRTC:            nRet = GetCRTC( reinterpret_cast<drm_mode_crtc *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_GETENCODER:         nRet = GetEncoder( reinterpret_cast<drm_mode_get_encoder *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_GETCONNECTOR:       nRet = GetConnector( reinterpret_cast<drm_mode_get_connector *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_OBJ_GETPROPERTIES:  nRet = GetObjectProperties( reinterpret_cast<drm_mode_obj_get_properties *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_GETPROPERTY:        nRet = GetProperty( reinterpret_cast<drm_mode_get_property *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_GETPROPBLOB:        nRet = GetBlob( reinterpret_cast<drm_mode_get_blob *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_CREATEPROPBLOB:     nRet = CreateBlob( reinterpret_cast<drm_mode_create_blob *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_DESTROYPROPBLOB:    nRet = DestroyBlob( reinterpret_cast<drm_mode_destroy_blob *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_ATOMIC:             nRet = AtomicCommit( reinterpret_cast<drm_mode_atomic *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_ADDFB2:             nRet = AddFB2( reinterpret_cast<drm_mode_fb_cmd2 *>( pArg ) ); break;
+            case DRM_IOCTL_MODE_RMFB:               nRet = RemoveFB( *reinterpret_cast<unsigned int *>( pArg ) ); break;
+            case DRM_IOCTL_PRIME_FD_TO_HANDLE:
+                // Nothing is ever read through the handle, so any unique value will do.
+                reinterpret_cast<drm_prime_handle *>( pArg )->handle = m_uNextHandle++;
+                nRet = 0;
+                break;
+            case DRM_IOCTL_GEM_CLOSE:
+                nRet = 0;
+                break;
+            default:
+                s_MockKMSLog.debugf( "Unhandled ioctl 0x%lx", ulRequest );
+                nRet = -ENOTTY;
+                break;
+        }
+
+        if ( nRet < 0 )
+        {
+            errno = -nRet;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    int CMockKMSDevice::GetVersion( drm_version *pVersion )
+    {
+        pVersion->version_major = 1;
+        pVersion->version_minor = 0;
+        pVersion->version_patchlevel = 0;
+        CopyStringToUser( pVersion->name, &pVersion->name_len, "gamescope_mock" );
+        CopyStringToUser( pVersion->date, &pVersion->date_len, "0" );
+        CopyStringToUser( pVersion->desc, &pVersion->desc_len, m_Config.sName.c_str() );
+        return 0;
+    }
+
+    int CMockKMSDevice::GetCap( drm_get_cap *pCap )
+    {
+        switch ( pCap->capability )
+        {
+            case DRM_CAP_PRIME:                  pCap->value = DRM_PRIME_CAP_IMPORT | DRM_PRIME_CAP_EXPORT; return 0;
+            case DRM_CAP_TIMESTAMP_MONOTONIC:    pCap->value = 1; return 0;
+            case DRM_CAP_CURSOR_WIDTH:           pCap->value = 64; return 0;
+            case DRM_CAP_CURSOR_HEIGHT:          pCap->value = 64; return 0;
+            case DRM_CAP_ADDFB2_MODIFIERS:       pCap->value = 1; return 0;
+            case DRM_CAP_CRTC_IN_VBLANK_EVENT:   pCap->value = 1; return 0;
+            case DRM_CAP_ASYNC_PAGE_FLIP:        pCap->value = m_Config.bAsyncPageFlip; return 0;
+            case DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP: pCap->value = m_Config.bAsyncPageFlip; return 0;
+            // No syncobj ioctls, so the backend goes without IN_FENCE_FD.
+            case DRM_CAP_SYNCOBJ:                pCap->value = 0; return 0;
+            case DRM_CAP_SYNCOBJ_TIMELINE:       pCap->value = 0; return 0;
+            default:                             return -EINVAL;
+        }
+    }
+
+    int CMockKMSDevice::SetClientCap( drm_set_client_cap *pCap )
+    {
+        switch ( pCap->capability )
+        {
+            case DRM_CLIENT_CAP_UNIVERSAL_PLANES:
+            case DRM_CLIENT_CAP_ATOMIC:
+            case DRM_CLIENT_CAP_ASPECT_RATIO:
+                return pCap->value <= 1 ? 0 : -EINVAL;
+            default:
+                return -EINVAL;
+        }
+    }
+
+    int CMockKMSDevice::GetResources( drm_mode_card_res *pRes )
+    {
+        CopyToUser<uint32_t>( pRes->fb_id_ptr, &pRes->count_fbs, nullptr, 0 );
+        CopyToUser( pRes->crtc_id_ptr, &pRes->count_crtcs, &m_uCRTCId, 1 );
+        CopyToUser( pRes->connector_id_ptr, &pRes->count_connectors, &m_uConnectorId, 1 );
+        CopyToUser( pRes->encoder_id_ptr, &pRes->count_encoders, &m_uEncoderId, 1 );
+        pRes->min_width = 1;
+        pRes->max_width = 16384;
+        pRes->min_height = 1;
+        pRes->max_height = 16384;
+        return 0;
+    }
+
+    int CMockKMSDevice::GetPlaneResources( drm_mode_get_plane_res *pRes )
+    {
+        CopyToUser( pRes->plane_id_ptr, &pRes->count_planes, m_PlaneIds.data(), m_PlaneIds.size() );
+        return 0;
+    }
+
+    int CMockKMSDevice::GetPlane( drm_mode_get_plane *pPlane )
+    {
+        auto iter = m_PlaneConfigs.find( pPlane->plane_id );
+        if ( iter == m_PlaneConfigs.end() )
+            return -ENOENT;
+
+        pPlane->crtc_id = GetValue( m_State, pPlane->plane_id, "CRTC_ID" );
+        pPlane->fb_id = GetValue( m_State, pPlane->plane_id, "FB_ID" );
+        pPlane->possible_crtcs = 1u;
+        pPlane->gamma_size = 0;
+        CopyToUser( pPlane->format_type_ptr, &pPlane->count_format_types, iter->second->formats.data(), iter->second->formats.size() );
+        return 0;
+    }
+
+    int CMockKMSDevice::GetCRTC( drm_mode_crtc *pCRTC )
+    {
+        if ( pCRTC->crtc_id != m_uCRTCId )
+            return -ENOENT;
+
+        pCRTC->fb_id = 0;
+        for ( uint32_t uPlaneId : m_PlaneIds )
+        {
+            if ( m_PlaneConfigs[ uPlaneId ]->uType == DRM_PLANE_TYPE_PRIMARY && GetValue( m_State, uPlaneId, "CRTC_ID" ) == m_uCRTCId )
+                pCRTC->fb_id = GetValue( m_State, uPlaneId, "FB_ID" );
+        }
+
+        pCRTC->x = 0;
+        pCRTC->y = 0;
+        pCRTC->gamma_size = m_Config.bColorMgmt ? 256 : 0;
+        pCRTC->mode_valid = GetValue( m_State, m_uCRTCId, "MODE_ID" ) != 0;
+        pCRTC->mode = pCRTC->mode_valid ? m_CurrentMode : drm_mode_modeinfo{};
+        return 0;
+    }
+
+    int CMockKMSDevice::GetEncoder( drm_mode_get_encoder *pEncoder )
+    {
+        if ( pEncoder->encoder_id != m_uEncoderId )
+            return -ENOENT;
+
+        pEncoder->encoder_type = DRM_MODE_ENCODER_TMDS;
+        pEncoder->crtc_id = GetValue( m_State, m_uConnectorId, "CRTC_ID" );
+        pEncoder->possible_crtcs = 1u;
+        pEncoder->possible_clones = 0;
+        return 0;
+    }
+
+    int CMockKMSDevice::GetConnector( drm_mode_get_connector *pConnector )
+    {
+        if ( pConnector->connector_id != m_uConnectorId )
+            return -ENOENT;
+
+        const Object_t &object = m_State.at( m_uConnectorId );
+        std::vector<uint32_t> propIds;
+        std::vector<uint64_t> propValues;
+        for ( const PropertyValue_t &value : object.props )
+        {
+            propIds.push_back( value.uPropId );
+            propValues.push_back( value.ulValue );
+        }
+
+        uint32_t uPropCount = pConnector->count_props;
+        CopyToUser( pConnector->props_ptr, &uPropCount, propIds.data(), propIds.size() );
+        CopyToUser( pConnector->prop_values_ptr, &pConnector->count_props, propValues.data(), propValues.size() );
+        CopyToUser( pConnector->encoders_ptr, &pConnector->count_encoders, &m_uEncoderId, 1 );
+        CopyToUser( pConnector->modes_ptr, &pConnector->count_modes, reinterpret_cast<const drm_mode_modeinfo *>( m_Config.modes.data() ), m_Config.modes.size() );
+
+        pConnector->encoder_id = GetValue( m_State, m_uConnectorId, "CRTC_ID" ) ? m_uEncoderId : 0;
+        pConnector->connector_type = m_Config.uConnectorType;
+        pConnector->connector_type_id = 1;
+        pConnector->connection = DRM_MODE_CONNECTED;
+        pConnector->mm_width = m_Config.uWidthMM;
+        pConnector->mm_height = m_Config.uHeightMM;
+        pConnector->subpixel = DRM_MODE_SUBPIXEL_UNKNOWN;
+        return 0;
+    }
+
+    int CMockKMSDevice::GetObjectProperties( drm_mode_obj_get_properties *pProps )
+    {
+        auto iter = m_State.find( pProps->obj_id );
+        if ( iter == m_State.end() || ( pProps->obj_type != DRM_MODE_OBJECT_ANY && pProps->obj_type != iter->second.uType ) )
+            return -ENOENT;
+
+        std::vector<uint32_t> propIds;
+        std::vector<uint64_t> propValues;
+        for ( const PropertyValue_t &value : iter->second.props )
+        {
+            propIds.push_back( value.uPropId );
+            propValues.push_back( value.ulValue );
+        }
+
+        uint32_t uPropCount = pProps->count_props;
+        CopyToUser( pProps->props_ptr, &uPropCount, propIds.data(), propIds.size() );
+        CopyToUser( pProps->prop_values_ptr, &pProps->count_props, propValues.data(), propValues.size() );
+        return 0;
+    }
+
+    int CMockKMSDevice::GetProperty( drm_mode_get_property *pProp )
+    {
+        auto iter = m_Properties.find( pProp->prop_id );
+        if ( iter == m_Properties.end() )
+            return -ENOENT;
+
+        const Property_t &prop = iter->second;
+        pProp->flags = prop.uFlags;
+        memset( pProp->name, 0, sizeof( pProp->name ) );
+        strncpy( pProp->name, prop.sName.c_str(), sizeof( pProp->name ) - 1 );
+
+        if ( prop.uFlags & ( DRM_MODE_PROP_ENUM | DRM_MODE_PROP_BITMASK ) )
+        {
+            std::vector<uint64_t> values;
+            std::vector<drm_mode_property_enum> enums;
+            for ( const auto &e : prop.enums )
+            {
+                drm_mode_property_enum propEnum{};
+                propEnum.value = e.first;
+                strncpy( propEnum.name, e.second.c_str(), sizeof( propEnum.name ) - 1 );
+                values.push_back( e.first );
+                enums.push_back( propEnum );
+            }
+
+            CopyToUser( pProp->values_ptr, &pProp->count_values, values.data(), values.size() );
+            CopyToUser( pProp->enum_blob_ptr, &pProp->count_enum_blobs, enums.data(), enums.size() );
+        }
+        else
+        {
+            CopyToUser( pProp->values_ptr, &pProp->count_values, prop.values.data(), prop.values.size() );
+            pProp->count_enum_blobs = 0;
+        }
+
+        return 0;
+    }
+
+    int CMockKMSDevice::GetBlob( drm_mode_get_blob *pBlob )
+    {
+        auto iter = m_Blobs.find( pBlob->blob_id );
+        if ( iter == m_Blobs.end() )
+            return -ENOENT;
+
+        if ( pBlob->data && pBlob->length >= iter->second.size() )
+            memcpy( UserPtr<void>( pBlob->data ), iter->second.data(), iter->second.size() );
+        pBlob->length = uint32_t( iter->second.size() );
+        return 0;
+    }
+
+    int CMockKMSDevice::CreateBlob( drm_mode_create_blob *pBlob )
+    {
+        if ( !pBlob->length )
+            return -EINVAL;
+
+        pBlob->blob_id = CreateBlob( UserPtr<const void>( pBlob->data ), pBlob->length );
+        return 0;
+    }
+
+    int CMockKMSDevice::DestroyBlob( drm_mode_destroy_blob *pBlob )
+    {
+        return m_Blobs.erase( pBlob->blob_id ) ? 0 : -ENOENT;
+    }
+
+    int CMockKMSDevice::AtomicCommit( drm_mode_atomic *pAtomic )
+    {
+        const uint32_t uFlags = pAtomic->flags;
+        const bool bTestOnly = !!( uFlags & DRM_MODE_ATOMIC_TEST_ONLY );
+
+        m_ulAtomicCommits++;
+        if ( bTestOnly )
+            m_ulTestCommits++;
+
+        State_t newState;
+        bool bTouchesCRTC = false;
+        int nRet = BuildState( pAtomic, &newState, &bTouchesCRTC );
+        if ( nRet == 0 )
+            nRet = CheckState( newState, uFlags, bTouchesCRTC );
+
+        if ( nRet != 0 )
+        {
+            m_ulRejectedCommits++;
+            return nRet;
+        }
+
+        if ( bTestOnly )
+            return 0;
+
+        const uint64_t ulModeId = GetValue( newState, m_uCRTCId, "MODE_ID" );
+        if ( ulModeId && ulModeId != GetValue( m_State, m_uCRTCId, "MODE_ID" ) )
+            memcpy( &m_CurrentMode, m_Blobs.at( uint32_t( ulModeId ) ).data(), sizeof( m_CurrentMode ) );
+
+        m_State = std::move( newState );
+
+        // Fences are consumed by the commit, not part of the state.
+        for ( uint32_t uPlaneId : m_PlaneIds )
+        {
+            if ( PropertyValue_t *pValue = const_cast<PropertyValue_t *>( FindValue( m_State, uPlaneId, "IN_FENCE_FD" ) ) )
+                pValue->ulValue = uint64_t( -1 );
+        }
+
+        if ( ( uFlags & DRM_MODE_PAGE_FLIP_EVENT ) && bTouchesCRTC )
+            SendFlipEvent( pAtomic->user_data );
+
+        return 0;
+    }
+
+    int CMockKMSDevice::AddFB2( drm_mode_fb_cmd2 *pCmd )
+    {
+        if ( !pCmd->width || !pCmd->height || !pCmd->handles[0] )
+            return -EINVAL;
+
+        Fb_t fb;
+        fb.uWidth = pCmd->width;
+        fb.uHeight = pCmd->height;
+        fb.uFormat = pCmd->pixel_format;
+        fb.ulModifier = ( pCmd->flags & DRM_MODE_FB_MODIFIERS ) ? pCmd->modifier[0] : DRM_FORMAT_MOD_INVALID;
+
+        pCmd->fb_id = m_uNextId++;
+        m_Fbs.emplace( pCmd->fb_id, fb );
+        return 0;
+    }
+
+    int CMockKMSDevice::RemoveFB( uint32_t uFbId )
+    {
+        if ( !m_Fbs.erase( uFbId ) )
+            return -ENOENT;
+
+        // The kernel turns off any plane still scanning it out.
+        for ( uint32_t uPlaneId : m_PlaneIds )
+        {
+            if ( GetValue( m_State, uPlaneId, "FB_ID" ) != uFbId )
+                continue;
+
+            const_cast<PropertyValue_t *>( FindValue( m_State, uPlaneId, "FB_ID" ) )->ulValue = 0;
+            const_cast<PropertyValue_t *>( FindValue( m_State, uPlaneId, "CRTC_ID" ) )->ulValue = 0;
+        }
+
+        return 0;
+    }
+
+    void CMockKMSDevice::SendFlipEvent( uint64_t ulUserData )
+    {
+        // Flips complete immediately, stamped with the time they were queued.
+        timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+
+        drm_event_vblank event{};
+        event.base.type = DRM_EVENT_FLIP_COMPLETE;
+        event.base.length = sizeof( event );
+        event.user_data = ulUserData;
+        event.tv_sec = uint32_t( now.tv_sec );
+        event.tv_usec = uint32_t( now.tv_nsec / 1'000 );
+        event.sequence = ++m_uFlipSequence;
+        event.crtc_id = m_uCRTCId;
+
+        if ( write( m_nWriteFd, &event, sizeof( event ) ) != ssize_t( sizeof( event ) ) )
+            s_MockKMSLog.errorf_errno( "Failed to queue page-flip event" );
+    }
+}
+
+// Interposes libdrm's drmIoctl. Everything on the mock device's fd is
+// handled in-process; the rest goes to the real implementation.
+extern "C" int drmIoctl( int fd, unsigned long request, void *arg )
+{
+    gamescope::CMockKMSDevice &mock = gamescope::CMockKMSDevice::Get();
+    if ( mock.BOwnsFd( fd ) )
+        return mock.Ioctl( request, arg );
+
+    using PFN_drmIoctl = int (*)( int, unsigned long, void * );
+    static PFN_drmIoctl s_pfnRealIoctl = reinterpret_cast<PFN_drmIoctl>( dlsym( RTLD_NEXT, "drmIoctl" ) );
+    if ( !s_pfnRealIoctl )
+    {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    return s_pfnRealIoctl( fd, request, arg );
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "drm_include.h"
+
+// Preset name from --drm-mock, or nullptr to use real hardware.
+extern const char *g_pszDRMMockPreset;
+
+namespace gamescope
+{
+    struct MockKMSPlaneConfig_t
+    {
+        uint32_t uType = DRM_PLANE_TYPE_OVERLAY;
+        std::vector<uint32_t> formats;
+        // Every format is advertised with each of these in IN_FORMATS.
+        std::vector<uint64_t> modifiers;
+
+        bool bScaling = true;
+        // Scale limits as whole factors, like most display engines.
+        uint32_t uMaxDownscale = 4;
+        uint32_t uMaxUpscale = 16;
+
+        bool bAlpha = true;
+        bool bBlendMode = true;
+        bool bRotation = true;
+        bool bYCbCr = false;
+        // AMD_PLANE_* color pipeline.
+        bool bColorMgmt = false;
+    };
+
+    struct MockKMSConfig_t
+    {
+        std::string sName;
+
+        uint32_t uConnectorType = DRM_MODE_CONNECTOR_DisplayPort;
+        uint32_t uWidthMM = 527;
+        uint32_t uHeightMM = 296;
+        std::vector<drmModeModeInfo> modes;
+
+        std::vector<MockKMSPlaneConfig_t> planes;
+        // Most planes that may scan out at once, standing in for
+        // bandwidth/pipe limits a real driver enforces in atomic_check.
+        uint32_t uMaxActivePlanes = 4;
+        bool bRequirePrimary = true;
+
+        bool bAsyncPageFlip = false;
+        bool bVRR = false;
+        // GAMMA_LUT/DEGAMMA_LUT/CTM and AMD_CRTC_REGAMMA_TF.
+        bool bColorMgmt = false;
+
+        static std::optional<MockKMSConfig_t> FromPreset( std::string_view svPreset );
+    };
+
+    // An in-process stand-in for a KMS device, so the DRM backend (and
+    // libliftoff underneath it) can run without a GPU or DRM master.
+    //
+    // It works at the drmIoctl level: MockKMS.cpp interposes drmIoctl and
+    // routes anything issued on the fd returned by Open here, so every
+    // libdrm call -- including libliftoff's test commits -- sees the mock.
+    // Page-flip events are written to that fd for drmHandleEvent.
+    class CMockKMSDevice
+    {
+    public:
+        static CMockKMSDevice &Get();
+
+        // Returns the fake DRM fd, or -1 on failure.
+        int Open( std::string_view svPreset );
+
+        bool BIsOpen() const { return m_nReadFd.load( std::memory_order_relaxed ) >= 0; }
+        bool BOwnsFd( int nFd ) const;
+
+        // Same contract as ioctl(2): 0, or -1 with errno set.
+        int Ioctl( unsigned long ulRequest, void *pArg );
+
+        uint64_t GetAtomicCommitCount() const { return m_ulAtomicCommits; }
+        uint64_t GetTestCommitCount() const { return m_ulTestCommits; }
+        uint64_t GetRejectedCommitCount() const { return m_ulRejectedCommits; }
+        uint64_t GetIoctlCount() const { return m_ulIoctls; }
+
+    private:
+        struct Property_t
+        {
+            std::string sName;
+            uint32_t uFlags = 0;
+            // Range min/max, or the object type for object properties.
+            std::vector<uint64_t> values;
+            std::vector<std::pair<uint64_t, std::string>> enums;
+            // Blob properties only: exact size, or element size if bBlobArray.
+            uint32_t uBlobSize = 0;
+            bool bBlobArray = false;
+            // Changing it on a CRTC or connector needs ALLOW_MODESET.
+            bool bModeset = false;
+            // May change in a PAGE_FLIP_ASYNC commit.
+            bool bAsync = false;
+        };
+
+        struct PropertyValue_t
+        {
+            uint32_t uPropId;
+            uint64_t ulValue;
+        };
+
+        struct Object_t
+        {
+            uint32_t uType = 0;
+            std::vector<PropertyValue_t> props;
+        };
+
+        struct Fb_t
+        {
+            uint32_t uWidth;
+            uint32_t uHeight;
+            uint32_t uFormat;
+            uint64_t ulModifier;
+        };
+
+        using State_t = std::unordered_map<uint32_t, Object_t>;
+
+        static Property_t RangeProperty( const char *pszName, uint64_t ulMin, uint64_t ulMax, uint32_t uFlags = 0 );
+        static Property_t SignedRangeProperty( const char *pszName, int64_t lMin, int64_t lMax );
+        static Property_t EnumProperty( const char *pszName, std::vector<std::pair<uint64_t, std::string>> enums, uint32_t uFlags = 0 );
+        static Property_t BitmaskProperty( const char *pszName, std::vector<std::pair<uint64_t, std::string>> enums );
+        static Property_t ObjectProperty( const char *pszName, uint32_t uObjectType );
+        static Property_t BlobProperty( const char *pszName, uint32_t uBlobSize, bool bBlobArray, uint32_t uFlags = 0 );
+
+        void CreateObjects();
+        uint32_t CreateObject( uint32_t uType );
+        void AttachProperty( uint32_t uObjectId, Property_t prop, uint64_t ulValue );
+        uint32_t CreateBlob( const void *pData, size_t zSize );
+
+        const PropertyValue_t *FindValue( const State_t &state, uint32_t uObjectId, std::string_view svName ) const;
+        uint64_t GetValue( const State_t &state, uint32_t uObjectId, std::string_view svName ) const;
+        int ValidateValue( const Property_t &prop, uint64_t ulValue ) const;
+        int BuildState( const drm_mode_atomic *pAtomic, State_t *pOutState, bool *pbTouchesCRTC ) const;
+        int CheckState( const State_t &state, uint32_t uFlags, bool bTouchesCRTC ) const;
+
+        int GetVersion( drm_version *pVersion );
+        int GetCap( drm_get_cap *pCap );
+        int SetClientCap( drm_set_client_cap *pCap );
+        int GetResources( drm_mode_card_res *pRes );
+        int GetPlaneResources( drm_mode_get_plane_res *pRes );
+        int GetPlane( drm_mode_get_plane *pPlane );
+        int GetCRTC( drm_mode_crtc *pCRTC );
+        int GetEncoder( drm_mode_get_encoder *pEncoder );
+        int GetConnector( drm_mode_get_connector *pConnector );
+        int GetObjectProperties( drm_mode_obj_get_properties *pProps );
+        int GetProperty( drm_mode_get_property *pProp );
+        int GetBlob( drm_mode_get_blob *pBlob );
+        int CreateBlob( drm_mode_create_blob *pBlob );
+        int DestroyBlob( drm_mode_destroy_blob *pBlob );
+        int AtomicCommit( drm_mode_atomic *pAtomic );
+        int AddFB2( drm_mode_fb_cmd2 *pCmd );
+        int RemoveFB( uint32_t uFbId );
+
+        void SendFlipEvent( uint64_t ulUserData );
+
+        std::atomic<int> m_nReadFd = { -1 };
+        int m_nWriteFd = -1;
+        dev_t m_Device = 0;
+        ino_t m_Inode = 0;
+
+        mutable std::mutex m_Mutex;
+
+        MockKMSConfig_t m_Config;
+
+        uint32_t m_uNextId = 1;
+        uint32_t m_uNextHandle = 1;
+        uint32_t m_uFlipSequence = 0;
+
+        uint32_t m_uCRTCId = 0;
+        uint32_t m_uEncoderId = 0;
+        uint32_t m_uConnectorId = 0;
+        std::vector<uint32_t> m_PlaneIds;
+        std::unordered_map<uint32_t, const MockKMSPlaneConfig_t *> m_PlaneConfigs;
+
+        std::unordered_map<uint32_t, Property_t> m_Properties;
+        std::unordered_map<std::string, uint32_t> m_PropertyIds;
+        std::unordered_map<uint32_t, std::vector<uint8_t>> m_Blobs;
+        std::unordered_map<uint32_t, Fb_t> m_Fbs;
+        State_t m_State;
+        // MODE_ID of m_State, kept so GETCRTC works after the blob is destroyed.
+        drm_mode_modeinfo m_CurrentMode = {};
+
+        std::atomic<uint64_t> m_ulAtomicCommits = { 0u };
+        std::atomic<uint64_t> m_ulTestCommits = { 0u };
+        std::atomic<uint64_t> m_ulRejectedCommits = { 0u };
+        std::atomic<uint64_t> m_ulIoctls = { 0u };
+    };
+
+    // Times drm_prepare -- the liftoff plane assignment and property
+    // writes, including its TEST_ONLY commits -- for a set of layer
+    // stacks against the mock device, committing each frame so requests
+    // only carry what changed. Defined in DRMBackend.cpp.
+    //
+    // Expects the DRM backend to be up on a mock device.
+    int RunDRMCommitBenchmark( uint32_t uIterations );
+}
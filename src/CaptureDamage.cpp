@@ -0,0 +1,99 @@
+#include "CaptureDamage.h"
+
+namespace gamescope
+{
+    //
+    // DamageRect_t
+    //
+
+    DamageRect_t DamageRect_t::Union( const DamageRect_t &other ) const
+    {
+        if ( IsEmpty() )
+            return other;
+        if ( other.IsEmpty() )
+            return *this;
+
+        return DamageRect_t
+        {
+            std::min( nX0, other.nX0 ),
+            std::min( nY0, other.nY0 ),
+            std::max( nX1, other.nX1 ),
+            std::max( nY1, other.nY1 ),
+        };
+    }
+
+    DamageRect_t DamageRect_t::Intersect( const DamageRect_t &other ) const
+    {
+        DamageRect_t result
+        {
+            std::max( nX0, other.nX0 ),
+            std::max( nY0, other.nY0 ),
+            std::min( nX1, other.nX1 ),
+            std::min( nY1, other.nY1 ),
+        };
+
+        if ( result.IsEmpty() )
+            return DamageRect_t{};
+
+        return result;
+    }
+
+    bool DamageRect_t::Contains( const DamageRect_t &other ) const
+    {
+        if ( other.IsEmpty() )
+            return true;
+
+        return nX0 <= other.nX0 && nY0 <= other.nY0 &&
+               nX1 >= other.nX1 && nY1 >= other.nY1;
+    }
+
+    DamageRect_t DamageRect_t::SnapToTiles( int32_t nTileSize, int32_t nWidth, int32_t nHeight ) const
+    {
+        if ( IsEmpty() )
+            return DamageRect_t{};
+
+        auto RoundDown = [ nTileSize ]( int32_t nValue ) { return nValue >= 0 ? nValue / nTileSize * nTileSize : -( ( -nValue + nTileSize - 1 ) / nTileSize * nTileSize ); };
+        auto RoundUp   = [ nTileSize ]( int32_t nValue ) { return nValue >= 0 ? ( nValue + nTileSize - 1 ) / nTileSize * nTileSize : -( -nValue / nTileSize * nTileSize ); };
+
+        DamageRect_t snapped
+        {
+            RoundDown( nX0 ),
+            RoundDown( nY0 ),
+            RoundUp( nX1 ),
+            RoundUp( nY1 ),
+        };
+
+        return snapped.Intersect( FromSize( nWidth, nHeight ) );
+    }
+
+    //
+    // CDamageHistory
+    //
+
+    void CDamageHistory::Add( uint64_t ulSerial, const DamageRect_t &rect )
+    {
+        if ( m_uCount == k_uMaxEntries )
+            m_ulEvictedSerial = m_Entries[ m_uNext ].ulSerial;
+        else
+            m_uCount++;
+
+        m_Entries[ m_uNext ] = Entry_t{ ulSerial, rect };
+        m_uNext = ( m_uNext + 1 ) % k_uMaxEntries;
+    }
+
+    std::optional<DamageRect_t> CDamageHistory::GetDamageSince( uint64_t ulSerial, uint64_t ulUpToSerial ) const
+    {
+        if ( ulSerial < m_ulEvictedSerial )
+            return std::nullopt;
+
+        DamageRect_t damage{};
+        for ( uint32_t i = 0; i < m_uCount; i++ )
+        {
+            const Entry_t &entry = m_Entries[i];
+            if ( entry.ulSerial > ulSerial && entry.ulSerial <= ulUpToSerial )
+                damage = damage.Union( entry.rect );
+        }
+
+        return damage;
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+
+namespace gamescope
+{
+    // Half-open rectangle, [nX0, nX1) x [nY0, nY1).
+    struct DamageRect_t
+    {
+        int32_t nX0 = 0;
+        int32_t nY0 = 0;
+        int32_t nX1 = 0;
+        int32_t nY1 = 0;
+
+        static DamageRect_t FromSize( int32_t nWidth, int32_t nHeight ) { return DamageRect_t{ 0, 0, nWidth, nHeight }; }
+
+        int32_t Width() const { return nX1 - nX0; }
+        int32_t Height() const { return nY1 - nY0; }
+        bool IsEmpty() const { return nX1 <= nX0 || nY1 <= nY0; }
+
+        DamageRect_t Union( const DamageRect_t &other ) const;
+        DamageRect_t Intersect( const DamageRect_t &other ) const;
+        bool Contains( const DamageRect_t &other ) const;
+
+        // Grows the rect to whole nTileSize tiles, clipped to nWidth x nHeight.
+        DamageRect_t SnapToTiles( int32_t nTileSize, int32_t nWidth, int32_t nHeight ) const;
+
+        bool operator == ( const DamageRect_t &other ) const = default;
+    };
+
+    // Damage of the last few serials (commits or capture frames), so we
+    // can answer "what changed since serial N" without keeping regions
+    // around forever.
+    class CDamageHistory
+    {
+    public:
+        static constexpr uint32_t k_uMaxEntries = 16;
+
+        // Serials must be increasing.
+        void Add( uint64_t ulSerial, const DamageRect_t &rect );
+
+        // Union of everything added after ulSerial, up to and including ulUpToSerial.
+        // Returns nullopt if part of that range already fell out of the history,
+        // in which case callers should assume everything changed.
+        std::optional<DamageRect_t> GetDamageSince( uint64_t ulSerial, uint64_t ulUpToSerial = UINT64_MAX ) const;
+
+    private:
+        struct Entry_t
+        {
+            uint64_t ulSerial;
+            DamageRect_t rect;
+        };
+
+        std::array<Entry_t, k_uMaxEntries> m_Entries{};
+        uint32_t m_uCount = 0;
+        uint32_t m_uNext = 0;
+        // Newest serial we no longer have an entry for.
+        uint64_t m_ulEvictedSerial = 0;
+    };
+}
@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "CompositeBench.h"
+#include "FrameTrace.h"
+#include "rendervulkan.hpp"
+#include "steamcompmgr.hpp"
+#include "log.hpp"
+#include "Utils/BenchStats.h"
+
+namespace gamescope
+{
+    static LogScope s_BenchLog( "composite_bench" );
+
+    struct CompositeBenchScenario_t
+    {
+        std::string sName;
+        std::vector<FrameTraceFrame_t> frames;
+    };
+
+    struct CompositeBenchSample_t
+    {
+        uint64_t ulRecordNs;
+        uint64_t ulSubmitNs;
+        uint64_t ulGPUNs;
+    };
+
+    struct CompositeBenchPathCounts_t
+    {
+        uint32_t uScanout = 0;
+        uint32_t uComposite = 0;
+        uint32_t uPartialComposite = 0;
+    };
+
+    class CCompositeBenchResources
+    {
+    public:
+        Rc<CVulkanTexture> GetTexture( uint32_t uLayer, const FrameTraceLayer_t &layer )
+        {
+            auto key = std::make_tuple( uLayer, layer.uTexWidth, layer.uTexHeight, layer.uDrmFormat );
+            auto iter = m_Textures.find( key );
+            if ( iter != m_Textures.end() )
+                return iter->second.get();
+
+            OwningRc<CVulkanTexture> pTexture = CreateTexture( layer.uTexWidth, layer.uTexHeight, layer.uDrmFormat );
+            Rc<CVulkanTexture> pResult = pTexture.get();
+            m_Textures.emplace( key, std::move( pTexture ) );
+            return pResult;
+        }
+
+        void GetLuts( Rc<CVulkanTexture> *pOutShaper, Rc<CVulkanTexture> *pOut3D )
+        {
+            if ( !m_pShaperLut )
+            {
+                m_pShaperLut = vulkan_create_1d_lut( s_nLutSize1d );
+                m_p3DLut = vulkan_create_3d_lut( s_nLutEdgeSize3d, s_nLutEdgeSize3d, s_nLutEdgeSize3d );
+
+                // Contents don't matter for timing, only that they are bound.
+                std::vector<uint16_t> lut1d( s_nLutSize1d * 4 );
+                std::vector<uint16_t> lut3d( s_nLutEdgeSize3d * s_nLutEdgeSize3d * s_nLutEdgeSize3d * 4 );
+                vulkan_update_luts( m_pShaperLut, m_p3DLut, lut1d.data(), lut3d.data() );
+            }
+
+            *pOutShaper = m_pShaperLut;
+            *pOut3D = m_p3DLut;
+        }
+
+    private:
+        static OwningRc<CVulkanTexture> CreateTexture( uint32_t uWidth, uint32_t uHeight, uint32_t uDrmFormat )
+        {
+            CVulkanTexture::createFlags texCreateFlags;
+            texCreateFlags.bSampled = true;
+            texCreateFlags.bTransferDst = true;
+
+            OwningRc<CVulkanTexture> pTexture = new CVulkanTexture();
+            if ( !pTexture->BInit( uWidth, uHeight, 1u, uDrmFormat, texCreateFlags ) )
+            {
+                s_BenchLog.errorf( "Failed to create %ux%u texture of format 0x%x", uWidth, uHeight, uDrmFormat );
+                return nullptr;
+            }
+
+            // Get it out of UNDEFINED so we can sample from it.
+            auto cmdBuffer = g_device.commandBuffer();
+            cmdBuffer->discardImage( pTexture.get() );
+            cmdBuffer->insertBarrier();
+            g_device.wait( g_device.submit( std::move( cmdBuffer ) ) );
+
+            return pTexture;
+        }
+
+        std::map<std::tuple<uint32_t, uint32_t, uint32_t, uint32_t>, OwningRc<CVulkanTexture>> m_Textures;
+        Rc<CVulkanTexture> m_pShaperLut;
+        Rc<CVulkanTexture> m_p3DLut;
+    };
+
+    static bool DeserializeFrameInfo( const FrameTraceFrame_t &frame, CCompositeBenchResources &resources, FrameInfo_t *pOutFrameInfo )
+    {
+        FrameInfo_t &frameInfo = *pOutFrameInfo;
+        frameInfo = FrameInfo_t{};
+
+        frameInfo.useFSRLayer0 = !!( frame.uFlags & FrameTraceFrameFlag::UseFSR );
+        frameInfo.useNISLayer0 = !!( frame.uFlags & FrameTraceFrameFlag::UseNIS );
+        frameInfo.bFadingOut = !!( frame.uFlags & FrameTraceFrameFlag::FadingOut );
+        frameInfo.allowVRR = !!( frame.uFlags & FrameTraceFrameFlag::AllowVRR );
+        frameInfo.applyOutputColorMgmt = !!( frame.uFlags & FrameTraceFrameFlag::ApplyOutputColorMgmt );
+        frameInfo.blurLayer0 = BlurMode( std::min<uint8_t>( frame.eBlurMode, BLUR_MODE_ALWAYS ) );
+        frameInfo.blurRadius = frame.uBlurRadius;
+        frameInfo.outputEncodingEOTF = EOTF( std::min<uint8_t>( frame.eOutputEOTF, EOTF_Count - 1 ) );
+
+        for ( uint32_t i = 0; i < EOTF_Count; i++ )
+        {
+            if ( frame.uShaperLutId[i] || frame.uLut3DId[i] )
+                resources.GetLuts( &frameInfo.shaperLut[i], &frameInfo.lut3D[i] );
+        }
+
+        frameInfo.layerCount = frame.uLayerCount;
+        for ( uint32_t i = 0; i < frame.uLayerCount; i++ )
+        {
+            const FrameTraceLayer_t &traceLayer = frame.layers[i];
+            FrameInfo_t::Layer_t &layer = frameInfo.layers[i];
+
+            if ( !traceLayer.uTexWidth || !traceLayer.uTexHeight )
+                return false;
+
+            layer.tex = resources.GetTexture( i, traceLayer );
+            if ( !layer.tex )
+                return false;
+
+            layer.offset = vec2_t{ traceLayer.flOffsetX, traceLayer.flOffsetY };
+            layer.scale = vec2_t{ traceLayer.flScaleX, traceLayer.flScaleY };
+            layer.opacity = traceLayer.flOpacity;
+            layer.zpos = traceLayer.nZpos;
+            layer.filter = GamescopeUpscaleFilter( traceLayer.eFilter );
+            layer.colorspace = GamescopeAppTextureColorspace( std::min<uint32_t>( traceLayer.eColorspace, GamescopeAppTextureColorspace_Count - 1 ) );
+            layer.eAlphaBlendingMode = AlphaBlendingMode_t( std::min<uint32_t>( traceLayer.eAlphaBlendingMode, ALPHA_BLENDING_MODE_NONE ) );
+            layer.blackBorder = !!( traceLayer.uFlags & FrameTraceLayerFlag::BlackBorder );
+            layer.applyColorMgmt = !!( traceLayer.uFlags & FrameTraceLayerFlag::ApplyColorMgmt );
+        }
+
+        // FSR/NIS sample layer 0 directly, make sure we actually have one.
+        if ( frameInfo.layerCount == 0 )
+        {
+            frameInfo.useFSRLayer0 = false;
+            frameInfo.useNISLayer0 = false;
+            frameInfo.blurLayer0 = BLUR_MODE_OFF;
+        }
+
+        return true;
+    }
+
+    static FrameTraceLayer_t MakeFullscreenLayer( uint32_t uWidth, uint32_t uHeight, uint32_t uDrmFormat, uint32_t uZpos, GamescopeAppTextureColorspace eColorspace = GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB, float flOpacity = 1.0f )
+    {
+        return FrameTraceLayer_t
+        {
+            .uTexWidth = uWidth,
+            .uTexHeight = uHeight,
+            .uDrmFormat = uDrmFormat,
+            .flOffsetX = 0.0f,
+            .flOffsetY = 0.0f,
+            .flScaleX = float( uWidth ) / float( g_nOutputWidth ),
+            .flScaleY = float( uHeight ) / float( g_nOutputHeight ),
+            .flOpacity = flOpacity,
+            .nZpos = int32_t( uZpos ),
+            .eFilter = uint8_t( GamescopeUpscaleFilter::LINEAR ),
+            .eColorspace = uint8_t( eColorspace ),
+            .eAlphaBlendingMode = ALPHA_BLENDING_MODE_PREMULTIPLIED,
+            .uFlags = FrameTraceLayerFlag::ApplyColorMgmt,
+        };
+    }
+
+    static std::vector<CompositeBenchScenario_t> MakeSyntheticScenarios( uint32_t uIterations )
+    {
+        const uint32_t uW = g_nOutputWidth;
+        const uint32_t uH = g_nOutputHeight;
+        const uint32_t uGameW = uW * 2 / 3;
+        const uint32_t uGameH = uH * 2 / 3;
+
+        auto MakeScenario = [ & ]( const char *pszName, std::initializer_list<FrameTraceLayer_t> layers, uint16_t uFlags = 0, BlurMode eBlur = BLUR_MODE_OFF ) -> CompositeBenchScenario_t
+        {
+            FrameTraceFrame_t frame{};
+            frame.uOutputWidth = uW;
+            frame.uOutputHeight = uH;
+            frame.uFlags = uFlags | FrameTraceFrameFlag::ApplyOutputColorMgmt;
+            frame.eBlurMode = uint8_t( eBlur );
+            frame.uBlurRadius = eBlur != BLUR_MODE_OFF ? 5 : 0;
+            frame.eOutputEOTF = EOTF_Gamma22;
+            for ( uint32_t i = 0; i < EOTF_Count; i++ )
+            {
+                frame.uShaperLutId[i] = 1;
+                frame.uLut3DId[i] = 1;
+            }
+            for ( const FrameTraceLayer_t &layer : layers )
+                frame.layers[ frame.uLayerCount++ ] = layer;
+
+            return CompositeBenchScenario_t{ pszName, std::vector<FrameTraceFrame_t>( uIterations, frame ) };
+        };
+
+        const FrameTraceLayer_t overlay = MakeFullscreenLayer( uW, uH, DRM_FORMAT_ARGB8888, g_zposOverlay, GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB, 0.8f );
+
+        return
+        {
+            MakeScenario( "1 layer, native", { MakeFullscreenLayer( uW, uH, DRM_FORMAT_XRGB8888, g_zposBase ) } ),
+            MakeScenario( "1 layer, linear upscale", { MakeFullscreenLayer( uGameW, uGameH, DRM_FORMAT_XRGB8888, g_zposBase ) } ),
+            MakeScenario( "1 layer, FSR", { MakeFullscreenLayer( uGameW, uGameH, DRM_FORMAT_XRGB8888, g_zposBase ) }, FrameTraceFrameFlag::UseFSR ),
+            MakeScenario( "1 layer, NIS", { MakeFullscreenLayer( uGameW, uGameH, DRM_FORMAT_XRGB8888, g_zposBase ) }, FrameTraceFrameFlag::UseNIS ),
+            MakeScenario( "3 layers, override + overlay", {
+                MakeFullscreenLayer( uW, uH, DRM_FORMAT_XRGB8888, g_zposBase ),
+                MakeFullscreenLayer( uW, uH, DRM_FORMAT_ARGB8888, g_zposOverride ),
+                overlay } ),
+            MakeScenario( "2 layers, conditional blur", {
+                MakeFullscreenLayer( uW, uH, DRM_FORMAT_XRGB8888, g_zposBase ),
+                overlay }, 0, BLUR_MODE_COND ),
+            MakeScenario( "2 layers, NV12 video + overlay", {
+                MakeFullscreenLayer( uW, uH, DRM_FORMAT_NV12, g_zposBase ),
+                overlay } ),
+            MakeScenario( "2 layers, scRGB + overlay", {
+                MakeFullscreenLayer( uW, uH, DRM_FORMAT_ABGR16161616F, g_zposBase, GAMESCOPE_APP_TEXTURE_COLORSPACE_SCRGB ),
+                overlay } ),
+        };
+    }
+
+    static void PrintScenario( const CompositeBenchScenario_t &scenario, const std::vector<CompositeBenchSample_t> &samples, const CompositeBenchPathCounts_t &counts )
+    {
+        std::vector<uint64_t> record, submit, gpu;
+        for ( const CompositeBenchSample_t &sample : samples )
+        {
+            record.push_back( sample.ulRecordNs );
+            submit.push_back( sample.ulSubmitNs );
+            if ( sample.ulGPUNs )
+                gpu.push_back( sample.ulGPUNs );
+        }
+
+        fprintf( stdout, "%s (%zu frames)\n", scenario.sName.c_str(), samples.size() );
+        fprintf( stdout, "    paths    composite %u  partial %u  scanout %u\n", counts.uComposite, counts.uPartialComposite, counts.uScanout );
+        PrintBenchStat( "record", std::move( record ) );
+        PrintBenchStat( "submit", std::move( submit ) );
+        PrintBenchStat( "gpu", std::move( gpu ) );
+    }
+
+    static bool RunScenario( const CompositeBenchScenario_t &scenario, CCompositeBenchResources &resources )
+    {
+        std::vector<CompositeBenchSample_t> samples;
+        samples.reserve( scenario.frames.size() );
+
+        CompositeBenchPathCounts_t counts;
+
+        // Don't let the first pipeline compiles skew the numbers.
+        bool bWarm = false;
+
+        for ( size_t i = 0; i < scenario.frames.size(); i++ )
+        {
+            const FrameTraceFrame_t &frame = scenario.frames[i];
+
+            FrameInfo_t frameInfo;
+            if ( !DeserializeFrameInfo( frame, resources, &frameInfo ) )
+            {
+                s_BenchLog.errorf( "%s: frame %zu could not be rebuilt, skipping", scenario.sName.c_str(), i );
+                continue;
+            }
+
+            // Follow the decision the backend made when this was recorded.
+            // Scanout frames never touched Vulkan, so there is nothing to time.
+            bool bPartial = false;
+            switch ( frame.ePresentPath )
+            {
+                case k_EFrameTracePresentPath_Scanout:
+                    counts.uScanout++;
+                    continue;
+                case k_EFrameTracePresentPath_PartialComposite:
+                    bPartial = frameInfo.layerCount > 1;
+                    break;
+                default:
+                    break;
+            }
+
+            if ( bPartial )
+            {
+                // Mirror the DRM backend: the base plane is scanned out and
+                // the shaper/3D LUTs are applied at scanout.
+                for ( int j = 1; j < frameInfo.layerCount; j++ )
+                    frameInfo.layers[j - 1] = frameInfo.layers[j];
+                frameInfo.layerCount -= 1;
+                frameInfo.layers[ frameInfo.layerCount ] = FrameInfo_t::Layer_t{};
+
+                for ( uint32_t nEOTF = 0; nEOTF < EOTF_Count; nEOTF++ )
+                {
+                    frameInfo.shaperLut[ nEOTF ] = nullptr;
+                    frameInfo.lut3D[ nEOTF ] = nullptr;
+                }
+
+                counts.uPartialComposite++;
+            }
+            else
+            {
+                counts.uComposite++;
+            }
+
+            currentOutputWidth = frame.uOutputWidth ? std::min( frame.uOutputWidth, g_nOutputWidth ) : g_nOutputWidth;
+            currentOutputHeight = frame.uOutputHeight ? std::min( frame.uOutputHeight, g_nOutputHeight ) : g_nOutputHeight;
+
+            uint64_t ulStart = get_time_in_nanos();
+            std::optional<uint64_t> oSequence = vulkan_composite( &frameInfo, nullptr, bPartial );
+            uint64_t ulEnd = get_time_in_nanos();
+
+            if ( !oSequence )
+            {
+                s_BenchLog.errorf( "%s: vulkan_composite failed on frame %zu", scenario.sName.c_str(), i );
+                return false;
+            }
+
+            uint64_t ulSubmitNs = g_device.lastSubmitTime();
+
+            vulkan_wait( *oSequence, true );
+
+            if ( !bWarm )
+            {
+                bWarm = true;
+                continue;
+            }
+
+            samples.push_back( CompositeBenchSample_t
+            {
+                .ulRecordNs = ( ulEnd - ulStart ) - std::min( ulSubmitNs, ulEnd - ulStart ),
+                .ulSubmitNs = ulSubmitNs,
+                .ulGPUNs = g_device.gpuTime( *oSequence ).value_or( 0 ),
+            } );
+        }
+
+        PrintScenario( scenario, samples, counts );
+        return true;
+    }
+
+    int RunCompositeBenchmark( const char *pszTrace, uint32_t uIterations )
+    {
+        uIterations = std::max( uIterations, 2u );
+
+        std::vector<CompositeBenchScenario_t> scenarios;
+        if ( !strcmp( pszTrace, "synthetic" ) )
+        {
+            scenarios = MakeSyntheticScenarios( uIterations );
+        }
+        else
+        {
+            CompositeBenchScenario_t scenario{ pszTrace };
+            if ( !ReadFrameTrace( pszTrace, scenario.frames ) )
+                return 1;
+
+            if ( scenario.frames.empty() )
+            {
+                s_BenchLog.errorf( "'%s' contains no frames", pszTrace );
+                return 1;
+            }
+
+            scenarios.push_back( std::move( scenario ) );
+        }
+
+        if ( !g_device.supportsTimestamps() )
+            s_BenchLog.warnf( "Device does not support timestamp queries, GPU times will not be reported." );
+
+        fprintf( stdout, "Composite benchmark: %ux%u output\n", g_nOutputWidth, g_nOutputHeight );
+
+        CCompositeBenchResources resources;
+        for ( const CompositeBenchScenario_t &scenario : scenarios )
+        {
+            if ( !RunScenario( scenario, resources ) )
+                return 1;
+        }
+
+        return 0;
+    }
+}
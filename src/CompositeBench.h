@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+
+namespace gamescope
+{
+    // Replays a recorded frame trace (or a built-in set of synthetic layer
+    // stacks if pszTrace is "synthetic") through vulkan_composite and prints
+    // CPU record, submit and GPU time per frame.
+    //
+    // Expects Vulkan and the output to already be initialized.
+    int RunCompositeBenchmark( const char *pszTrace, uint32_t uIterations );
+}
@@ -0,0 +1,174 @@
+#include <cstdint>
+
+#include "FocusPriority.h"
+#include "win32_styles.h"
+
+namespace gamescope
+{
+    static bool FocusWindowHasGameId( const FocusWindowState_t &w )
+    {
+        return w.uAppID != 0;
+    }
+
+    bool FocusWindowIsUseless( const FocusWindowState_t &w )
+    {
+        // Windows that are 1x1 are pretty useless for override redirects.
+        // Just ignore them.
+        // Fixes the Xbox Login in Age of Empires 2: DE.
+        return w.nWidth == 1 && w.nHeight == 1;
+    }
+
+    bool FocusWindowIsOverrideRedirect( const FocusWindowState_t &w )
+    {
+        if ( !w.bXWayland )
+            return false;
+
+        return w.bOverrideRedirect && !w.bIgnoreOverrideRedirect && !FocusWindowIsUseless( w );
+    }
+
+    bool FocusWindowSkipAndNotFullscreen( const FocusWindowState_t &w )
+    {
+        return w.bSkipTaskbar && w.bSkipPager && !w.bFullscreen;
+    }
+
+    bool FocusWindowMaybeADropdown( const FocusWindowState_t &w )
+    {
+        if ( !w.bXWayland )
+            return false;
+
+        // Josh:
+        // Right now we don't get enough info from Wine
+        // about the true nature of windows to distringuish
+        // something like the Fallout 4 Options menu from the
+        // Warframe language dropdown. Until we get more stuff
+        // exposed for that, there is this workaround to let that work.
+        if ( w.uAppID == 230410 && w.bMaybeADropdown && w.ulTransientFor && ( w.bSkipPager || w.bSkipTaskbar ) )
+            return !FocusWindowIsUseless( w );
+
+        // Work around Antichamber splash screen until we hook up
+        // the Proton window style deduction.
+        if ( w.uAppID == 219890 )
+            return false;
+
+        // The Launcher in Witcher 2 (20920) has a clear window with WS_EX_LAYERED on top of it.
+        //
+        // The Age of Empires 2 Launcher also has a WS_EX_LAYERED window to separate controls
+        // from its backing, which this seems to handle, although we seemingly don't handle
+        // it's transparency yet, which I do not understand.
+        //
+        // Layered windows are windows that are meant to be transparent
+        // with alpha blending + visual fx.
+        // https://docs.microsoft.com/en-us/windows/win32/winmsg/window-features
+        //
+        // TODO: Come back to me for original Age of Empires HD launcher.
+        // Does that use it? It wants blending!
+        //
+        // Only do this if we have CONTROLPARENT right now. Some other apps, such as the
+        // Street Fighter V (310950) Splash Screen also use LAYERED and TOOLWINDOW, and we don't
+        // want that to be overlayed.
+        // Ignore LAYERED if it's marked as top-level with WS_EX_APPWINDOW.
+        // TODO: Find more apps using LAYERED.
+        const uint32_t validLayered = WS_EX_CONTROLPARENT | WS_EX_LAYERED;
+        const uint32_t invalidLayered = WS_EX_APPWINDOW;
+        if ( w.bHasHwndStyleEx &&
+            ( ( w.uHwndStyleEx & validLayered   ) == validLayered ) &&
+            ( ( w.uHwndStyleEx & invalidLayered ) == 0 ) )
+            return true;
+
+        // Josh:
+        // The logic here is as follows. The window will be treated as a dropdown if:
+        //
+        // If this window has a fixed position on the screen + static gravity:
+        //  - If the window has either skipPage or skipTaskbar
+        //    - If the window isn't a dialog, always treat it as a dropdown, as it's
+        //      probably meant to be some form of popup.
+        //    - If the window is a dialog
+        //      - If the window has transient for, disregard it, as it is trying to redirecting us elsewhere
+        //        ie. a settings menu dialog popup or something.
+        //      - If the window has both skip taskbar and pager, treat it as a dialog.
+        bool bValidMaybeADropdown =
+            w.bMaybeADropdown && ( ( !w.bDialog || ( !w.ulTransientFor && FocusWindowSkipAndNotFullscreen( w ) ) ) && ( w.bSkipPager || w.bSkipTaskbar ) );
+        return ( bValidMaybeADropdown || FocusWindowIsOverrideRedirect( w ) ) && !FocusWindowIsUseless( w );
+    }
+
+    bool FocusWindowIsDisabled( const FocusWindowState_t &w )
+    {
+        if ( !w.bHasHwndStyle )
+            return false;
+
+        return !!( w.uHwndStyle & WS_DISABLED );
+    }
+
+    bool FocusWindowIsCandidate( const FocusWindowState_t &w )
+    {
+        if ( w.bSysTrayIcon || w.bOverlay || w.bExternalOverlay )
+            return false;
+
+        // Translucent windows only count for the streaming client.
+        return w.bViewable && w.bInputOutput &&
+            ( FocusWindowHasGameId( w ) || w.bSteam || w.bSteamStreamingClient ) &&
+            ( w.uOpacity > 0 || w.bSteamStreamingClient );
+    }
+
+    /* Returns true if a's focus priority > b's.
+     *
+     * This function establishes a list of criteria to decide which window should
+     * have focus. The first criteria has higher priority. If the first criteria
+     * is a tie, fallback to the second one, then the third, and so on.
+     *
+     * The general workflow is:
+     *
+     *     if ( windows don't have the same criteria value )
+     *         return true if a should be focused;
+     *     // This is a tie, fallback to the next criteria
+     */
+    bool IsFocusPriorityGreater( const FocusWindowState_t &a, const FocusWindowState_t &b )
+    {
+        if ( FocusWindowHasGameId( a ) != FocusWindowHasGameId( b ) )
+            return FocusWindowHasGameId( a );
+
+        // We allow using an override redirect window in some cases, but if we have
+        // a choice between two windows we always prefer the non-override redirect
+        // one.
+        if ( FocusWindowIsOverrideRedirect( a ) != FocusWindowIsOverrideRedirect( b ) )
+            return !FocusWindowIsOverrideRedirect( a );
+
+        // If the window is 1x1 then prefer anything else we have.
+        if ( FocusWindowIsUseless( a ) != FocusWindowIsUseless( b ) )
+            return !FocusWindowIsUseless( a );
+
+        if ( FocusWindowMaybeADropdown( a ) != FocusWindowMaybeADropdown( b ) )
+            return !FocusWindowMaybeADropdown( a );
+
+        if ( FocusWindowIsDisabled( a ) != FocusWindowIsDisabled( b ) )
+            return !FocusWindowIsDisabled( a );
+
+        // Wine sets SKIP_TASKBAR and SKIP_PAGER hints for WS_EX_NOACTIVATE windows.
+        // See https://github.com/Plagman/gamescope/issues/87
+        if ( FocusWindowSkipAndNotFullscreen( a ) != FocusWindowSkipAndNotFullscreen( b ) )
+            return !FocusWindowSkipAndNotFullscreen( a );
+
+        // Prefer normal windows over dialogs
+        // if we are an override redirect/dropdown window.
+        if ( FocusWindowMaybeADropdown( a ) && FocusWindowMaybeADropdown( b ) &&
+            a.bDialog != b.bDialog )
+            return !a.bDialog;
+
+        if ( !a.bXWayland )
+            return true;
+
+        // Attempt to tie-break dropdowns by transient-for.
+        if ( FocusWindowMaybeADropdown( a ) && FocusWindowMaybeADropdown( b ) &&
+            !a.ulTransientFor != !b.ulTransientFor )
+            return !a.ulTransientFor;
+
+        if ( FocusWindowHasGameId( a ) && a.ulMapSequence != b.ulMapSequence )
+            return a.ulMapSequence > b.ulMapSequence;
+
+        // The damage sequences are only relevant for game windows.
+        if ( FocusWindowHasGameId( a ) && a.ulDamageSequence != b.ulDamageSequence )
+            return a.ulDamageSequence > b.ulDamageSequence;
+
+        return false;
+    }
+}
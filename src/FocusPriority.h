@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace gamescope
+{
+    // Everything focus ranking looks at for one window, copied out of
+    // steamcompmgr_win_t so the rules can run without steamcompmgr
+    // (eg. in gamescope_focus_bench).
+    struct FocusWindowState_t
+    {
+        uint32_t uAppID = 0;
+        bool bXWayland = true;
+
+        // Whether it can take focus at all.
+        bool bSysTrayIcon = false;
+        bool bOverlay = false;
+        bool bExternalOverlay = false;
+        bool bViewable = false;
+        bool bInputOutput = true;
+        bool bSteam = false;
+        bool bSteamStreamingClient = false;
+        uint32_t uOpacity = 0;
+
+        // How it ranks.
+        int32_t nWidth = 0;
+        int32_t nHeight = 0;
+        bool bOverrideRedirect = false;
+        bool bIgnoreOverrideRedirect = false;
+        bool bMaybeADropdown = false;
+        bool bDialog = false;
+        bool bSkipTaskbar = false;
+        bool bSkipPager = false;
+        bool bFullscreen = false;
+        bool bHasHwndStyle = false;
+        uint32_t uHwndStyle = 0;
+        bool bHasHwndStyleEx = false;
+        uint32_t uHwndStyleEx = 0;
+        uint64_t ulTransientFor = 0;
+        uint64_t ulMapSequence = 0;
+        uint64_t ulDamageSequence = 0;
+
+        // Increases along the stacking list. Only breaks ties, the same way
+        // stable sorting the list did.
+        uint64_t ulStackKey = 0;
+    };
+
+    bool FocusWindowIsUseless( const FocusWindowState_t &w );
+    bool FocusWindowIsOverrideRedirect( const FocusWindowState_t &w );
+    bool FocusWindowSkipAndNotFullscreen( const FocusWindowState_t &w );
+    bool FocusWindowMaybeADropdown( const FocusWindowState_t &w );
+    bool FocusWindowIsDisabled( const FocusWindowState_t &w );
+    bool FocusWindowIsCandidate( const FocusWindowState_t &w );
+
+    bool IsFocusPriorityGreater( const FocusWindowState_t &a, const FocusWindowState_t &b );
+
+    // Focus candidates in priority order, kept sorted as windows change.
+    //
+    // Anything that can change a window's candidacy or rank marks it dirty,
+    // and Update only re-ranks those: a binary search out and back in, so
+    // the cost follows the windows that changed rather than all of them.
+    template <typename T>
+    class CFocusCandidateSet
+    {
+    public:
+        void MarkDirty( T pWindow ) { m_Dirty.insert( pWindow ); }
+
+        // pWindow is about to go away, drop it now rather than on Update.
+        void Remove( T pWindow )
+        {
+            m_Dirty.erase( pWindow );
+            Unlink( pWindow );
+        }
+
+        // fnGetState( T ) returns the window's current FocusWindowState_t.
+        template <typename GetStateFn>
+        const std::vector<T> &Update( GetStateFn fnGetState )
+        {
+            for ( T pWindow : m_Dirty )
+            {
+                Unlink( pWindow );
+
+                FocusWindowState_t state = fnGetState( pWindow );
+                if ( FocusWindowIsCandidate( state ) )
+                    Link( pWindow, state );
+            }
+            m_Dirty.clear();
+
+            return m_Windows;
+        }
+
+        const std::vector<T> &GetWindows() const { return m_Windows; }
+
+    private:
+        // Strict total order as long as stack keys are unique.
+        static bool IsRankedBefore( const FocusWindowState_t &a, const FocusWindowState_t &b )
+        {
+            if ( IsFocusPriorityGreater( a, b ) )
+                return true;
+            if ( IsFocusPriorityGreater( b, a ) )
+                return false;
+            return a.ulStackKey < b.ulStackKey;
+        }
+
+        void Link( T pWindow, const FocusWindowState_t &state )
+        {
+            auto iter = std::upper_bound( m_States.begin(), m_States.end(), state, IsRankedBefore );
+            const size_t uIndex = size_t( iter - m_States.begin() );
+
+            m_States.insert( iter, state );
+            m_Windows.insert( m_Windows.begin() + uIndex, pWindow );
+            m_Ranked.emplace( pWindow, state );
+        }
+
+        void Unlink( T pWindow )
+        {
+            auto rankedIter = m_Ranked.find( pWindow );
+            if ( rankedIter == m_Ranked.end() )
+                return;
+
+            auto iter = std::lower_bound( m_States.begin(), m_States.end(), rankedIter->second, IsRankedBefore );
+            size_t uIndex = size_t( iter - m_States.begin() );
+            // Only walks if two windows ever share a stack key.
+            while ( uIndex < m_Windows.size() && m_Windows[ uIndex ] != pWindow )
+                uIndex++;
+
+            if ( uIndex < m_Windows.size() )
+            {
+                m_States.erase( m_States.begin() + uIndex );
+                m_Windows.erase( m_Windows.begin() + uIndex );
+            }
+            m_Ranked.erase( rankedIter );
+        }
+
+        // Parallel, sorted by IsRankedBefore.
+        std::vector<FocusWindowState_t> m_States;
+        std::vector<T> m_Windows;
+
+        // What each ranked window was sorted with, to find it again.
+        std::unordered_map<T, FocusWindowState_t> m_Ranked;
+        std::unordered_set<T> m_Dirty;
+    };
+}
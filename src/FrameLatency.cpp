@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <bit>
+
+#include "FrameLatency.h"
+
+namespace gamescope
+{
+    //
+    // CLatencyHistogram
+    //
+
+    uint32_t CLatencyHistogram::BucketForValue( uint64_t ulMicros )
+    {
+        if ( ulMicros < k_uLinearBuckets )
+            return uint32_t( ulMicros );
+
+        ulMicros = std::min<uint64_t>( ulMicros, ( 1ull << k_uMaxExponent ) - 1 );
+
+        const uint32_t uExponent = uint32_t( std::bit_width( ulMicros ) ) - 1;
+        const uint32_t uShift = uExponent - k_uSubBucketBits;
+        const uint32_t uSubBucket = uint32_t( ulMicros >> uShift ) & ( k_uSubBuckets - 1 );
+
+        return k_uLinearBuckets + ( uExponent - k_uSubBucketBits - 1 ) * k_uSubBuckets + uSubBucket;
+    }
+
+    uint64_t CLatencyHistogram::BucketUpperBound( uint32_t uBucket )
+    {
+        if ( uBucket < k_uLinearBuckets )
+            return uBucket;
+
+        const uint32_t uIndex = uBucket - k_uLinearBuckets;
+        const uint32_t uShift = uIndex / k_uSubBuckets + 1;
+        const uint64_t ulLowerBound = uint64_t( k_uSubBuckets + uIndex % k_uSubBuckets ) << uShift;
+
+        return ulLowerBound + ( 1ull << uShift ) - 1;
+    }
+
+    void CLatencyHistogram::AddSample( uint64_t ulMicros )
+    {
+        m_uBuckets[ BucketForValue( ulMicros ) ]++;
+        m_ulCount++;
+        m_ulMax = std::max( m_ulMax, ulMicros );
+    }
+
+    uint64_t CLatencyHistogram::GetPercentile( uint32_t uPermille ) const
+    {
+        if ( !m_ulCount )
+            return 0;
+
+        // Rank of the sample we want, 1-based.
+        const uint64_t ulRank = std::max<uint64_t>( ( m_ulCount * std::min( uPermille, 1000u ) + 999 ) / 1000, 1 );
+
+        uint64_t ulSeen = 0;
+        for ( uint32_t i = 0; i < k_uBucketCount; i++ )
+        {
+            ulSeen += m_uBuckets[i];
+            if ( ulSeen >= ulRank )
+                return std::min( BucketUpperBound( i ), m_ulMax );
+        }
+
+        return m_ulMax;
+    }
+
+    //
+    // CFrameLatencyTracker
+    //
+
+    CFrameLatencyTracker &CFrameLatencyTracker::Get()
+    {
+        static CFrameLatencyTracker s_Tracker;
+        return s_Tracker;
+    }
+
+    void CFrameLatencyTracker::SubmitFrame( const FrameLatencyStamps_t &stamps )
+    {
+        // Only ever called from the steamcompmgr thread.
+        const uint64_t ulFrame = m_ulLastFrame.load( std::memory_order_relaxed ) + 1;
+        FrameSlot_t &slot = m_Slots[ ulFrame % k_uMaxFrames ];
+
+        slot.ulFrame.store( 0, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+
+        slot.ulArrivalTime.store( stamps.ulArrivalTime, std::memory_order_relaxed );
+        slot.ulFenceSignalTime.store( stamps.ulFenceSignalTime, std::memory_order_relaxed );
+        slot.ulLatchTime.store( stamps.ulLatchTime, std::memory_order_relaxed );
+        slot.ulSubmitTime.store( stamps.ulSubmitTime, std::memory_order_relaxed );
+        slot.ulFlipTime.store( 0, std::memory_order_relaxed );
+
+        slot.ulFrame.store( ulFrame, std::memory_order_release );
+        m_ulLastFrame.store( ulFrame, std::memory_order_release );
+        m_ulPendingFrame.store( ulFrame, std::memory_order_release );
+    }
+
+    void CFrameLatencyTracker::CompleteFrame( uint64_t ulFrame, uint64_t ulFlipTime )
+    {
+        if ( !ulFrame )
+            return;
+
+        FrameSlot_t &slot = m_Slots[ ulFrame % k_uMaxFrames ];
+
+        // The ring lapped us, nothing to complete.
+        if ( slot.ulFrame.load( std::memory_order_acquire ) != ulFrame )
+            return;
+
+        slot.ulFlipTime.store( ulFlipTime, std::memory_order_release );
+    }
+
+    std::array<CLatencyHistogram, k_EFrameLatencyStage_Count> CFrameLatencyTracker::GetHistograms( uint32_t uFrames ) const
+    {
+        std::array<CLatencyHistogram, k_EFrameLatencyStage_Count> histograms;
+
+        const uint64_t ulLastFrame = m_ulLastFrame.load( std::memory_order_acquire );
+        const uint64_t ulFrameCount = std::min<uint64_t>( uFrames ? uFrames : k_uMaxFrames, std::min<uint64_t>( ulLastFrame, k_uMaxFrames ) );
+
+        for ( uint64_t ulFrame = ulLastFrame - ulFrameCount + 1; ulFrame <= ulLastFrame; ulFrame++ )
+        {
+            const FrameSlot_t &slot = m_Slots[ ulFrame % k_uMaxFrames ];
+
+            if ( slot.ulFrame.load( std::memory_order_acquire ) != ulFrame )
+                continue;
+
+            const uint64_t ulArrivalTime = slot.ulArrivalTime.load( std::memory_order_relaxed );
+            const uint64_t ulFenceSignalTime = slot.ulFenceSignalTime.load( std::memory_order_relaxed );
+            const uint64_t ulLatchTime = slot.ulLatchTime.load( std::memory_order_relaxed );
+            const uint64_t ulSubmitTime = slot.ulSubmitTime.load( std::memory_order_relaxed );
+            const uint64_t ulFlipTime = slot.ulFlipTime.load( std::memory_order_acquire );
+
+            // Overwritten while we were reading it.
+            std::atomic_thread_fence( std::memory_order_acquire );
+            if ( slot.ulFrame.load( std::memory_order_relaxed ) != ulFrame )
+                continue;
+
+            // Still in flight, or was never flipped (eg. the commit failed).
+            if ( !ulFlipTime )
+                continue;
+
+            auto DeltaMicros = []( uint64_t ulFrom, uint64_t ulTo ) -> uint64_t
+            {
+                return ulTo > ulFrom ? ( ulTo - ulFrom ) / 1'000 : 0;
+            };
+
+            histograms[ k_EFrameLatencyStage_FenceWait ].AddSample( DeltaMicros( ulArrivalTime, ulFenceSignalTime ) );
+            histograms[ k_EFrameLatencyStage_Latch ].AddSample( DeltaMicros( ulFenceSignalTime, ulLatchTime ) );
+            histograms[ k_EFrameLatencyStage_Submit ].AddSample( DeltaMicros( ulLatchTime, ulSubmitTime ) );
+            histograms[ k_EFrameLatencyStage_Flip ].AddSample( DeltaMicros( ulSubmitTime, ulFlipTime ) );
+            histograms[ k_EFrameLatencyStage_Total ].AddSample( DeltaMicros( ulArrivalTime, ulFlipTime ) );
+        }
+
+        return histograms;
+    }
+}
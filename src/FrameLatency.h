@@ -0,0 +1,109 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace gamescope
+{
+    // Matches gamescope_control.frame_latency_stage.
+    enum EFrameLatencyStage : uint32_t
+    {
+        // Commit arrival -> acquire fence signalled.
+        k_EFrameLatencyStage_FenceWait,
+        // Fence signalled -> latched by steamcompmgr.
+        k_EFrameLatencyStage_Latch,
+        // Latched -> handed to the backend for presentation.
+        k_EFrameLatencyStage_Submit,
+        // Handed to the backend -> KMS page flip.
+        k_EFrameLatencyStage_Flip,
+        // Commit arrival -> KMS page flip.
+        k_EFrameLatencyStage_Total,
+
+        k_EFrameLatencyStage_Count,
+    };
+
+    struct FrameLatencyStamps_t
+    {
+        uint64_t ulArrivalTime = 0;
+        uint64_t ulFenceSignalTime = 0;
+        uint64_t ulLatchTime = 0;
+        uint64_t ulSubmitTime = 0;
+    };
+
+    // Log-linear histogram in microseconds, in the style of HdrHistogram:
+    // exact below k_uLinearBuckets, then k_uSubBuckets buckets per power of two
+    // (~12% precision) up to about a second.
+    class CLatencyHistogram
+    {
+    public:
+        static constexpr uint32_t k_uSubBucketBits = 3;
+        static constexpr uint32_t k_uSubBuckets = 1u << k_uSubBucketBits;
+        static constexpr uint32_t k_uLinearBuckets = k_uSubBuckets * 2;
+        static constexpr uint32_t k_uMaxExponent = 20;
+        static constexpr uint32_t k_uBucketCount = k_uLinearBuckets + ( k_uMaxExponent - k_uSubBucketBits - 1 ) * k_uSubBuckets;
+
+        static uint32_t BucketForValue( uint64_t ulMicros );
+        // Largest value that lands in the bucket.
+        static uint64_t BucketUpperBound( uint32_t uBucket );
+
+        void AddSample( uint64_t ulMicros );
+
+        uint64_t GetCount() const { return m_ulCount; }
+        uint64_t GetMax() const { return m_ulMax; }
+        // Upper bound of the bucket containing the percentile, clamped to the max. uPermille is 0-1000.
+        uint64_t GetPercentile( uint32_t uPermille ) const;
+
+        const std::array<uint32_t, k_uBucketCount> &GetBuckets() const { return m_uBuckets; }
+
+    private:
+        std::array<uint32_t, k_uBucketCount> m_uBuckets = {};
+        uint64_t m_ulCount = 0;
+        uint64_t m_ulMax = 0;
+    };
+
+    // Tracks when each app frame moves through gamescope, from the client's commit
+    // to the page flip that put it on screen.
+    //
+    // Frames are written by the steamcompmgr thread at submit time, completed by the
+    // KMS flip thread and read by whoever asks for a summary, all without locks:
+    // each ring slot is tagged with its frame number and readers discard slots
+    // that changed under them.
+    class CFrameLatencyTracker
+    {
+    public:
+        static constexpr uint32_t k_uMaxFrames = 1024;
+
+        static CFrameLatencyTracker &Get();
+
+        // Called right before handing a frame containing a new app commit to the backend.
+        void SubmitFrame( const FrameLatencyStamps_t &stamps );
+        // Called by backends that get flip events, when they commit. Returns 0 if
+        // nothing new was submitted since the last call.
+        uint64_t TakePendingFrame() { return m_ulPendingFrame.exchange( 0 ); }
+        // Called from the flip handler with what TakePendingFrame returned.
+        void CompleteFrame( uint64_t ulFrame, uint64_t ulFlipTime );
+
+        // Histograms over the last uFrames submitted frames that made it to the screen.
+        // 0 means everything still in the ring.
+        std::array<CLatencyHistogram, k_EFrameLatencyStage_Count> GetHistograms( uint32_t uFrames ) const;
+
+    private:
+        struct FrameSlot_t
+        {
+            // Frame number stored here, 0 while being written.
+            std::atomic<uint64_t> ulFrame = { 0 };
+            std::atomic<uint64_t> ulArrivalTime = { 0 };
+            std::atomic<uint64_t> ulFenceSignalTime = { 0 };
+            std::atomic<uint64_t> ulLatchTime = { 0 };
+            std::atomic<uint64_t> ulSubmitTime = { 0 };
+            // 0 until the frame hits the screen.
+            std::atomic<uint64_t> ulFlipTime = { 0 };
+        };
+
+        std::array<FrameSlot_t, k_uMaxFrames> m_Slots;
+        std::atomic<uint64_t> m_ulLastFrame = { 0 };
+        std::atomic<uint64_t> m_ulPendingFrame = { 0 };
+    };
+}
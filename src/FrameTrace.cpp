@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "FrameTrace.h"
+#include "rendervulkan.hpp"
+#include "log.hpp"
+
+namespace gamescope
+{
+    static LogScope s_FrameTraceLog( "frametrace" );
+
+    uint32_t CFrameTraceIdMap::GetId( CVulkanTexture *pTexture )
+    {
+        if ( !pTexture )
+            return 0;
+
+        auto [ iter, bInserted ] = m_Ids.try_emplace( pTexture->serial(), m_uNextId );
+        if ( bInserted )
+            m_uNextId++;
+
+        return iter->second;
+    }
+
+    void CFrameTraceIdMap::Forget( uint64_t ulSerial )
+    {
+        m_Ids.erase( ulSerial );
+    }
+
+    void CFrameTraceIdMap::Clear()
+    {
+        m_Ids.clear();
+        m_uNextId = 1;
+    }
+
+    void SerializeFrameInfo( const FrameInfo_t *pFrameInfo, uint64_t ulTimestampNs, uint32_t uOutputWidth, uint32_t uOutputHeight, CFrameTraceIdMap &idMap, FrameTraceFrame_t *pOutFrame )
+    {
+        static_assert( k_uFrameTraceMaxLayers == k_nMaxLayers );
+
+        FrameTraceFrame_t &frame = *pOutFrame;
+        frame = FrameTraceFrame_t{};
+
+        frame.ulTimestampNs = ulTimestampNs;
+        frame.uOutputWidth = uOutputWidth;
+        frame.uOutputHeight = uOutputHeight;
+
+        for ( uint32_t i = 0; i < EOTF_Count; i++ )
+        {
+            frame.uShaperLutId[i] = idMap.GetId( pFrameInfo->shaperLut[i].get() );
+            frame.uLut3DId[i] = idMap.GetId( pFrameInfo->lut3D[i].get() );
+        }
+
+        if ( pFrameInfo->useFSRLayer0 )
+            frame.uFlags |= FrameTraceFrameFlag::UseFSR;
+        if ( pFrameInfo->useNISLayer0 )
+            frame.uFlags |= FrameTraceFrameFlag::UseNIS;
+        if ( pFrameInfo->bFadingOut )
+            frame.uFlags |= FrameTraceFrameFlag::FadingOut;
+        if ( pFrameInfo->allowVRR )
+            frame.uFlags |= FrameTraceFrameFlag::AllowVRR;
+        if ( pFrameInfo->applyOutputColorMgmt )
+            frame.uFlags |= FrameTraceFrameFlag::ApplyOutputColorMgmt;
+
+        frame.eBlurMode = uint8_t( pFrameInfo->blurLayer0 );
+        frame.eOutputEOTF = uint8_t( pFrameInfo->outputEncodingEOTF );
+        frame.uBlurRadius = uint8_t( std::clamp( pFrameInfo->blurRadius, 0, 255 ) );
+        frame.uLayerCount = uint8_t( std::clamp( pFrameInfo->layerCount, 0, int( k_uFrameTraceMaxLayers ) ) );
+
+        for ( uint32_t i = 0; i < frame.uLayerCount; i++ )
+        {
+            const FrameInfo_t::Layer_t &layer = pFrameInfo->layers[i];
+            FrameTraceLayer_t &traceLayer = frame.layers[i];
+
+            if ( layer.tex )
+            {
+                traceLayer.uTexWidth = layer.tex->width();
+                traceLayer.uTexHeight = layer.tex->height();
+                traceLayer.uDrmFormat = layer.tex->drmFormat();
+                traceLayer.uTexId = idMap.GetId( layer.tex.get() );
+            }
+
+            traceLayer.flOffsetX = layer.offset.x;
+            traceLayer.flOffsetY = layer.offset.y;
+            traceLayer.flScaleX = layer.scale.x;
+            traceLayer.flScaleY = layer.scale.y;
+            traceLayer.flOpacity = layer.opacity;
+            traceLayer.nZpos = layer.zpos;
+
+            traceLayer.eFilter = uint8_t( layer.filter );
+            traceLayer.eColorspace = uint8_t( layer.colorspace );
+            traceLayer.eAlphaBlendingMode = uint8_t( layer.eAlphaBlendingMode );
+
+            if ( layer.blackBorder )
+                traceLayer.uFlags |= FrameTraceLayerFlag::BlackBorder;
+            if ( layer.applyColorMgmt )
+                traceLayer.uFlags |= FrameTraceLayerFlag::ApplyColorMgmt;
+            if ( layer.ctm )
+                traceLayer.uFlags |= FrameTraceLayerFlag::HasCTM;
+            if ( layer.hdr_metadata_blob )
+                traceLayer.uFlags |= FrameTraceLayerFlag::HasHDRMetadata;
+        }
+    }
+
+    bool ReadFrameTrace( const char *pszPath, std::vector<FrameTraceFrame_t> &outFrames )
+    {
+        FILE *pFile = fopen( pszPath, "rb" );
+        if ( !pFile )
+        {
+            s_FrameTraceLog.errorf_errno( "Failed to open trace '%s'", pszPath );
+            return false;
+        }
+
+        FrameTraceHeader_t header;
+        if ( fread( &header, sizeof( header ), 1, pFile ) != 1 ||
+             header.uMagic != k_uFrameTraceMagic ||
+             header.uVersion != k_uFrameTraceVersion ||
+             header.uFrameSize != sizeof( FrameTraceFrame_t ) ||
+             header.uCapacity == 0 )
+        {
+            s_FrameTraceLog.errorf( "'%s' is not a frame trace (or is from a different version)", pszPath );
+            fclose( pFile );
+            return false;
+        }
+
+        std::vector<FrameTraceFrame_t> slots( std::min<uint64_t>( header.ulFramesWritten, header.uCapacity ) );
+        size_t uRead = fread( slots.data(), sizeof( FrameTraceFrame_t ), slots.size(), pFile );
+        fclose( pFile );
+
+        // Tolerate a truncated tail, eg. if we were killed mid-write.
+        slots.resize( uRead );
+
+        // Unwrap the ring so the oldest frame comes first.
+        size_t uOldest = header.ulFramesWritten > header.uCapacity ? header.ulFramesWritten % header.uCapacity : 0;
+        if ( uOldest >= slots.size() )
+            uOldest = 0;
+
+        outFrames.clear();
+        outFrames.reserve( slots.size() );
+        outFrames.insert( outFrames.end(), slots.begin() + uOldest, slots.end() );
+        outFrames.insert( outFrames.end(), slots.begin(), slots.begin() + uOldest );
+
+        for ( FrameTraceFrame_t &frame : outFrames )
+            frame.uLayerCount = std::min<uint8_t>( frame.uLayerCount, k_uFrameTraceMaxLayers );
+
+        return true;
+    }
+
+    bool WriteFrameTrace( const char *pszPath, std::span<const FrameTraceFrame_t> frames )
+    {
+        FILE *pFile = fopen( pszPath, "wb" );
+        if ( !pFile )
+        {
+            s_FrameTraceLog.errorf_errno( "Failed to open trace '%s' for writing", pszPath );
+            return false;
+        }
+
+        FrameTraceHeader_t header =
+        {
+            .uMagic = k_uFrameTraceMagic,
+            .uVersion = k_uFrameTraceVersion,
+            .uFrameSize = sizeof( FrameTraceFrame_t ),
+            .uCapacity = uint32_t( std::max<size_t>( frames.size(), 1 ) ),
+            .ulFramesWritten = frames.size(),
+        };
+
+        bool bSuccess = fwrite( &header, sizeof( header ), 1, pFile ) == 1 &&
+                        fwrite( frames.data(), sizeof( FrameTraceFrame_t ), frames.size(), pFile ) == frames.size();
+        bSuccess = fclose( pFile ) == 0 && bSuccess;
+
+        if ( !bSuccess )
+            s_FrameTraceLog.errorf_errno( "Failed to write trace '%s'", pszPath );
+
+        return bSuccess;
+    }
+
+    CFrameTraceRecorder &CFrameTraceRecorder::Get()
+    {
+        // Never destroyed, textures torn down during static destruction
+        // still call ForgetTexture.
+        static CFrameTraceRecorder *s_pRecorder = new CFrameTraceRecorder;
+        return *s_pRecorder;
+    }
+
+    bool CFrameTraceRecorder::StartRecording( const char *pszPath, uint32_t uCapacity )
+    {
+        std::unique_lock lock( m_Mutex );
+
+        StopRecordingLocked( lock );
+
+        int nFd = open( pszPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+        if ( nFd < 0 )
+        {
+            s_FrameTraceLog.errorf_errno( "Failed to open trace '%s' for writing", pszPath );
+            return false;
+        }
+
+        FrameTraceHeader_t header =
+        {
+            .uMagic = k_uFrameTraceMagic,
+            .uVersion = k_uFrameTraceVersion,
+            .uFrameSize = sizeof( FrameTraceFrame_t ),
+            .uCapacity = std::max( uCapacity, 1u ),
+            .ulFramesWritten = 0,
+        };
+
+        if ( pwrite( nFd, &header, sizeof( header ), 0 ) != sizeof( header ) )
+        {
+            s_FrameTraceLog.errorf_errno( "Failed to write trace header to '%s'", pszPath );
+            close( nFd );
+            return false;
+        }
+
+        m_nFd = nFd;
+        m_sPath = pszPath;
+        m_uCapacity = header.uCapacity;
+        m_ulFramesWritten = 0;
+        m_ulFramesDropped = 0;
+        m_PendingFrames.reserve( k_uMaxPendingFrames );
+        m_IdMap.Clear();
+        m_Writer = std::thread( [this]() { WriterThread(); } );
+        m_bRecording = true;
+
+        s_FrameTraceLog.infof( "Recording up to %u frames to '%s'", m_uCapacity, pszPath );
+        return true;
+    }
+
+    void CFrameTraceRecorder::StopRecording()
+    {
+        std::unique_lock lock( m_Mutex );
+        StopRecordingLocked( lock );
+    }
+
+    void CFrameTraceRecorder::StopRecordingLocked( std::unique_lock<std::mutex> &lock )
+    {
+        if ( m_nFd < 0 || m_bStopping )
+            return;
+
+        m_bRecording = false;
+        m_bStopping = true;
+
+        // The writer drains what's pending before it exits.
+        lock.unlock();
+        m_FramesAvailable.notify_all();
+        m_Writer.join();
+        lock.lock();
+
+        close( m_nFd );
+        m_nFd = -1;
+        m_bStopping = false;
+        m_PendingFrames.clear();
+        m_IdMap.Clear();
+
+        if ( m_ulFramesDropped )
+            s_FrameTraceLog.errorf( "Dropped %lu frames, the writer couldn't keep up", m_ulFramesDropped );
+        s_FrameTraceLog.infof( "Stopped recording to '%s' after %lu frames", m_sPath.c_str(), m_ulFramesWritten );
+    }
+
+    void CFrameTraceRecorder::ForgetTexture( uint64_t ulSerial )
+    {
+        if ( !m_bRecording )
+            return;
+
+        std::unique_lock lock( m_Mutex );
+        m_IdMap.Forget( ulSerial );
+    }
+
+    void CFrameTraceRecorder::WriterThread()
+    {
+        pthread_setname_np( pthread_self(), "gamescope-trace" );
+
+        std::vector<FrameTraceFrame_t> frames;
+        frames.reserve( k_uMaxPendingFrames );
+
+        std::unique_lock lock( m_Mutex );
+        for ( ;; )
+        {
+            m_FramesAvailable.wait( lock, [this]() { return !m_PendingFrames.empty() || m_bStopping; } );
+            if ( m_PendingFrames.empty() )
+                return;
+
+            frames.swap( m_PendingFrames );
+
+            lock.unlock();
+            const bool bSuccess = WriteFrames( frames );
+            if ( !bSuccess )
+                s_FrameTraceLog.errorf_errno( "Failed to write to trace '%s'", m_sPath.c_str() );
+            frames.clear();
+            lock.lock();
+
+            if ( !bSuccess )
+            {
+                m_bRecording = false;
+                m_PendingFrames.clear();
+                return;
+            }
+        }
+    }
+
+    bool CFrameTraceRecorder::WriteFrames( std::span<const FrameTraceFrame_t> frames )
+    {
+        // One write per contiguous run of slots, the ring wraps at most once per batch.
+        while ( !frames.empty() )
+        {
+            const uint32_t uSlot = uint32_t( m_ulFramesWritten % m_uCapacity );
+            const size_t uCount = std::min<size_t>( frames.size(), m_uCapacity - uSlot );
+            const size_t uSize = uCount * sizeof( FrameTraceFrame_t );
+
+            off_t ulSlotOffset = sizeof( FrameTraceHeader_t ) + off_t( uSlot ) * sizeof( FrameTraceFrame_t );
+            if ( pwrite( m_nFd, frames.data(), uSize, ulSlotOffset ) != ssize_t( uSize ) )
+                return false;
+
+            m_ulFramesWritten += uCount;
+            frames = frames.subspan( uCount );
+        }
+
+        // Update the count after the slots so a reader never sees a frame that isn't there yet.
+        return pwrite( m_nFd, &m_ulFramesWritten, sizeof( m_ulFramesWritten ), offsetof( FrameTraceHeader_t, ulFramesWritten ) ) == sizeof( m_ulFramesWritten );
+    }
+
+    void CFrameTraceRecorder::RecordFrame( const FrameInfo_t *pFrameInfo, uint64_t ulTimestampNs, uint32_t uOutputWidth, uint32_t uOutputHeight )
+    {
+        EFrameTracePresentPath ePresentPath = m_ePresentPath;
+        m_ePresentPath = k_EFrameTracePresentPath_Unknown;
+
+        if ( !m_bRecording )
+            return;
+
+        std::unique_lock lock( m_Mutex );
+        if ( !m_bRecording )
+            return;
+
+        if ( m_PendingFrames.size() >= k_uMaxPendingFrames )
+        {
+            m_ulFramesDropped++;
+            return;
+        }
+
+        FrameTraceFrame_t &frame = m_PendingFrames.emplace_back();
+        SerializeFrameInfo( pFrameInfo, ulTimestampNs, uOutputWidth, uOutputHeight, m_IdMap, &frame );
+        frame.ePresentPath = ePresentPath;
+
+        // Batch up writes rather than waking the writer every frame.
+        const bool bWake = m_PendingFrames.size() >= k_uMaxPendingFrames / 4;
+        lock.unlock();
+
+        if ( bWake )
+            m_FramesAvailable.notify_one();
+    }
+}
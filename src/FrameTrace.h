@@ -0,0 +1,181 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "color_helpers.h"
+
+struct FrameInfo_t;
+class CVulkanTexture;
+
+namespace gamescope
+{
+    // Fixed-size, pointer-free description of a FrameInfo_t so composition
+    // can be recorded to disk and replayed through vulkan_composite later.
+    //
+    // File layout is a FrameTraceHeader_t followed by uCapacity frame slots.
+    // Frames are written as a ring: frame N lives in slot N % uCapacity.
+
+    static constexpr uint32_t k_uFrameTraceMagic = 0x54465347; // 'GSFT'
+    static constexpr uint32_t k_uFrameTraceVersion = 1;
+    static constexpr uint32_t k_uFrameTraceMaxLayers = 6;
+
+    namespace FrameTraceLayerFlag
+    {
+        static constexpr uint8_t BlackBorder = 1u << 0;
+        static constexpr uint8_t ApplyColorMgmt = 1u << 1;
+        static constexpr uint8_t HasCTM = 1u << 2;
+        static constexpr uint8_t HasHDRMetadata = 1u << 3;
+    }
+
+    namespace FrameTraceFrameFlag
+    {
+        static constexpr uint16_t UseFSR = 1u << 0;
+        static constexpr uint16_t UseNIS = 1u << 1;
+        static constexpr uint16_t FadingOut = 1u << 2;
+        static constexpr uint16_t AllowVRR = 1u << 3;
+        static constexpr uint16_t ApplyOutputColorMgmt = 1u << 4;
+    }
+
+    // How the backend ended up displaying a frame.
+    enum EFrameTracePresentPath : uint8_t
+    {
+        // Backend didn't say, replayed as a full composite.
+        k_EFrameTracePresentPath_Unknown,
+        k_EFrameTracePresentPath_Scanout,
+        k_EFrameTracePresentPath_Composite,
+        // Base plane scanned out, everything above it composited.
+        k_EFrameTracePresentPath_PartialComposite,
+    };
+
+    struct FrameTraceLayer_t
+    {
+        uint32_t uTexWidth;
+        uint32_t uTexHeight;
+        uint32_t uDrmFormat;
+        // Stable within a trace, lets the replayer tell buffers apart.
+        uint32_t uTexId;
+
+        float flOffsetX;
+        float flOffsetY;
+        float flScaleX;
+        float flScaleY;
+        float flOpacity;
+        int32_t nZpos;
+
+        uint8_t eFilter;
+        uint8_t eColorspace;
+        uint8_t eAlphaBlendingMode;
+        uint8_t uFlags;
+    };
+    static_assert( sizeof( FrameTraceLayer_t ) == 44 );
+
+    struct FrameTraceFrame_t
+    {
+        uint64_t ulTimestampNs;
+
+        uint32_t uOutputWidth;
+        uint32_t uOutputHeight;
+
+        uint32_t uShaperLutId[ EOTF_Count ];
+        uint32_t uLut3DId[ EOTF_Count ];
+
+        uint16_t uFlags;
+        uint8_t eBlurMode;
+        uint8_t eOutputEOTF;
+        uint8_t uBlurRadius;
+        uint8_t uLayerCount;
+        uint8_t ePresentPath;
+        uint8_t uPad;
+
+        FrameTraceLayer_t layers[ k_uFrameTraceMaxLayers ];
+    };
+
+    struct FrameTraceHeader_t
+    {
+        uint32_t uMagic;
+        uint32_t uVersion;
+        uint32_t uFrameSize;
+        uint32_t uCapacity;
+        uint64_t ulFramesWritten;
+    };
+
+    // Texture and LUT identities are resolved through this so traces
+    // never contain pointers. Keyed on the texture serial, so a new texture
+    // at a recycled address doesn't inherit an old id.
+    class CFrameTraceIdMap
+    {
+    public:
+        uint32_t GetId( CVulkanTexture *pTexture );
+        // The texture is gone, its serial will never be seen again.
+        void Forget( uint64_t ulSerial );
+        void Clear();
+
+    private:
+        std::unordered_map<uint64_t, uint32_t> m_Ids;
+        uint32_t m_uNextId = 1;
+    };
+
+    // Streams presented frames into a ring file on disk.
+    // Started and stopped with the frametrace_record/frametrace_stop commands.
+    //
+    // RecordFrame only serializes into memory, a writer thread does the I/O.
+    class CFrameTraceRecorder
+    {
+    public:
+        // Frames waiting for the writer before new ones get dropped.
+        static constexpr uint32_t k_uMaxPendingFrames = 256;
+
+        static CFrameTraceRecorder &Get();
+
+        bool StartRecording( const char *pszPath, uint32_t uCapacity );
+        // Flushes whatever the writer hasn't got to yet.
+        void StopRecording();
+        bool IsRecording() const { return m_bRecording; }
+
+        // Called by the backend during Present.
+        void NotePresentPath( EFrameTracePresentPath ePath ) { m_ePresentPath = ePath; }
+
+        void RecordFrame( const FrameInfo_t *pFrameInfo, uint64_t ulTimestampNs, uint32_t uOutputWidth, uint32_t uOutputHeight );
+
+        // Called when a texture is destroyed, from any thread.
+        void ForgetTexture( uint64_t ulSerial );
+
+    private:
+        void StopRecordingLocked( std::unique_lock<std::mutex> &lock );
+        void WriterThread();
+        bool WriteFrames( std::span<const FrameTraceFrame_t> frames );
+
+        std::mutex m_Mutex;
+        std::condition_variable m_FramesAvailable;
+        std::atomic<bool> m_bRecording = { false };
+        bool m_bStopping = false;
+
+        std::thread m_Writer;
+        std::vector<FrameTraceFrame_t> m_PendingFrames;
+        uint64_t m_ulFramesDropped = 0;
+
+        // Only touched by the writer while it runs.
+        int m_nFd = -1;
+        std::string m_sPath;
+        uint32_t m_uCapacity = 0;
+        uint64_t m_ulFramesWritten = 0;
+
+        CFrameTraceIdMap m_IdMap;
+
+        EFrameTracePresentPath m_ePresentPath = k_EFrameTracePresentPath_Unknown;
+    };
+
+    void SerializeFrameInfo( const FrameInfo_t *pFrameInfo, uint64_t ulTimestampNs, uint32_t uOutputWidth, uint32_t uOutputHeight, CFrameTraceIdMap &idMap, FrameTraceFrame_t *pOutFrame );
+
+    // Reads frames back in recorded order, unwrapping the ring.
+    bool ReadFrameTrace( const char *pszPath, std::vector<FrameTraceFrame_t> &outFrames );
+    bool WriteFrameTrace( const char *pszPath, std::span<const FrameTraceFrame_t> frames );
+}
@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+#include "ScreenshotBench.h"
+#include "ScreenshotEncoder.h"
+#include "rendervulkan.hpp"
+#include "steamcompmgr.hpp"
+#include "log.hpp"
+#include "Utils/BenchStats.h"
+
+namespace gamescope
+{
+    static LogScope s_BenchLog( "screenshot_bench" );
+
+    struct ScreenshotBenchResolution_t
+    {
+        uint32_t uWidth;
+        uint32_t uHeight;
+    };
+
+    static constexpr ScreenshotBenchResolution_t k_BenchResolutions[] =
+    {
+        { 1920, 1080 },
+        { 2560, 1440 },
+        { 3840, 2160 },
+    };
+
+    struct ScreenshotBenchSample_t
+    {
+        uint64_t ulGPUNs;
+        uint64_t ulEncodeNs;
+    };
+
+    // Something with gradients and a bit of noise, so the encoder
+    // isn't timed on a trivially compressible image.
+    static OwningRc<CVulkanTexture> CreateSourceTexture( uint32_t uWidth, uint32_t uHeight )
+    {
+        std::vector<uint32_t> pixels( size_t( uWidth ) * uHeight );
+        uint32_t uNoise = 0x12345678;
+        for ( uint32_t y = 0; y < uHeight; y++ )
+        {
+            for ( uint32_t x = 0; x < uWidth; x++ )
+            {
+                uNoise = uNoise * 1664525u + 1013904223u;
+                uint32_t uR = ( x * 255 / uWidth ) ^ ( ( uNoise >> 24 ) & 0x7 );
+                uint32_t uG = ( y * 255 / uHeight ) ^ ( ( uNoise >> 16 ) & 0x7 );
+                uint32_t uB = ( ( x + y ) & 0xff );
+                pixels[ size_t( y ) * uWidth + x ] = 0xff000000 | ( uR << 16 ) | ( uG << 8 ) | uB;
+            }
+        }
+
+        CVulkanTexture::createFlags texCreateFlags;
+        texCreateFlags.bSampled = true;
+        return vulkan_create_texture_from_bits( uWidth, uHeight, uWidth, uHeight, DRM_FORMAT_XRGB8888, texCreateFlags, pixels.data() );
+    }
+
+    static bool RunResolution( const ScreenshotBenchResolution_t &res, bool bGPUConvert, uint32_t uIterations, const std::string &szPath )
+    {
+        OwningRc<CVulkanTexture> pSource = CreateSourceTexture( res.uWidth, res.uHeight );
+        if ( !pSource )
+        {
+            s_BenchLog.errorf( "Failed to create %ux%u source texture", res.uWidth, res.uHeight );
+            return false;
+        }
+
+        FrameInfo_t frameInfo{};
+        frameInfo.applyOutputColorMgmt = false;
+        frameInfo.outputEncodingEOTF = EOTF_Gamma22;
+        frameInfo.layerCount = 1;
+        FrameInfo_t::Layer_t &layer = frameInfo.layers[0];
+        layer.tex = pSource.get();
+        layer.scale = vec2_t{ 1.0f, 1.0f };
+        layer.opacity = 1.0f;
+        layer.zpos = g_zposBase;
+        layer.filter = GamescopeUpscaleFilter::LINEAR;
+        layer.colorspace = GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB;
+
+        std::vector<ScreenshotBenchSample_t> samples;
+        samples.reserve( uIterations );
+
+        // Don't let the first pipeline compiles and allocations skew the numbers.
+        for ( uint32_t i = 0; i <= uIterations; i++ )
+        {
+            uint64_t ulStart = get_time_in_nanos();
+
+            Rc<CVulkanTexture> pScreenshotTexture;
+            std::optional<uint64_t> oSequence;
+            if ( bGPUConvert )
+            {
+                Rc<CVulkanTexture> pIntermediate = vulkan_acquire_screenshot_intermediate_texture( res.uWidth, res.uHeight, DRM_FORMAT_XBGR16161616F );
+                pScreenshotTexture = vulkan_acquire_screenshot_texture( res.uWidth, res.uHeight * 3, false, DRM_FORMAT_R16 );
+                if ( !pIntermediate || !pScreenshotTexture )
+                    return false;
+
+                oSequence = vulkan_screenshot( &frameInfo, pIntermediate, nullptr );
+                if ( oSequence )
+                    oSequence = vulkan_screenshot_to_planar_gbr( pIntermediate, pScreenshotTexture );
+            }
+            else
+            {
+                pScreenshotTexture = vulkan_acquire_screenshot_texture( res.uWidth, res.uHeight, false, DRM_FORMAT_XRGB2101010 );
+                if ( !pScreenshotTexture )
+                    return false;
+
+                oSequence = vulkan_screenshot( &frameInfo, pScreenshotTexture, nullptr );
+            }
+
+            if ( !oSequence )
+            {
+                s_BenchLog.errorf( "vulkan_screenshot failed" );
+                return false;
+            }
+
+            vulkan_wait( *oSequence, true );
+            uint64_t ulGPUDone = get_time_in_nanos();
+
+            bool bEncoded = CScreenshotEncoder::BEncodeJob( ScreenshotJob_t
+            {
+                .szPath     = szPath,
+                .pTexture   = pScreenshotTexture,
+                .ulSequence = *oSequence,
+            } );
+            uint64_t ulEnd = get_time_in_nanos();
+
+            if ( !bEncoded )
+                return false;
+
+            if ( i == 0 )
+                continue;
+
+            samples.push_back( ScreenshotBenchSample_t
+            {
+                .ulGPUNs = ulGPUDone - ulStart,
+                .ulEncodeNs = ulEnd - ulGPUDone,
+            } );
+        }
+
+        std::vector<uint64_t> gpu, encode, total;
+        for ( const ScreenshotBenchSample_t &sample : samples )
+        {
+            gpu.push_back( sample.ulGPUNs );
+            encode.push_back( sample.ulEncodeNs );
+            total.push_back( sample.ulGPUNs + sample.ulEncodeNs );
+        }
+
+        fprintf( stdout, "%ux%u, %s (%zu shots)\n", res.uWidth, res.uHeight, bGPUConvert ? "GPU planar" : "CPU unpack", samples.size() );
+        PrintBenchStat( "gpu", std::move( gpu ), true );
+        PrintBenchStat( "encode", std::move( encode ), true );
+        PrintBenchStat( "total", std::move( total ), true );
+        return true;
+    }
+
+    int RunScreenshotBenchmark( uint32_t uIterations )
+    {
+        uIterations = std::max( uIterations, 1u );
+
+        std::error_code ec;
+        const std::string szPath = ( std::filesystem::temp_directory_path( ec ) / "gamescope_screenshot_bench.avif" ).string();
+
+        const uint32_t uOldOutputWidth = currentOutputWidth;
+        const uint32_t uOldOutputHeight = currentOutputHeight;
+
+        bool bSuccess = true;
+        for ( const ScreenshotBenchResolution_t &res : k_BenchResolutions )
+        {
+            // vulkan_screenshot composites currentOutput-sized frames.
+            currentOutputWidth = res.uWidth;
+            currentOutputHeight = res.uHeight;
+
+            for ( bool bGPUConvert : { false, true } )
+            {
+                if ( !RunResolution( res, bGPUConvert, uIterations, szPath ) )
+                {
+                    s_BenchLog.errorf( "%ux%u %s failed", res.uWidth, res.uHeight, bGPUConvert ? "GPU planar" : "CPU unpack" );
+                    bSuccess = false;
+                    break;
+                }
+            }
+
+            if ( !bSuccess )
+                break;
+        }
+
+        currentOutputWidth = uOldOutputWidth;
+        currentOutputHeight = uOldOutputHeight;
+
+        std::filesystem::remove( szPath, ec );
+        return bSuccess ? 0 : 1;
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+
+namespace gamescope
+{
+    // Times the AVIF screenshot path end to end at 1080p, 1440p and 4K,
+    // comparing the CPU 2101010 unpack with the GPU planar conversion.
+    // Prints the GPU (composite + convert) and encode stages separately.
+    //
+    // Expects Vulkan and the output to already be initialized.
+    int RunScreenshotBenchmark( uint32_t uIterations );
+}
@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <cstdio>
+#include <pthread.h>
+#include <thread>
+#include <vector>
+
+#include "ScreenshotEncoder.h"
+#include "convar.h"
+#include "log.hpp"
+#include "Utils/Defer.h"
+
+#if HAVE_AVIF
+#include "avif/avif.h"
+#endif
+
+#include <stb_image_write.h>
+
+static LogScope s_ScreenshotLog( "screenshot" );
+
+namespace gamescope
+{
+    static ConVar<int> cv_screenshot_encode_threads{ "screenshot_encode_threads", 2, "Number of screenshot encoder threads. Takes effect when the first screenshot is taken." };
+#if HAVE_AVIF
+    static ConVar<int> cv_screenshot_avif_speed{ "screenshot_avif_speed", AVIF_SPEED_FASTEST, "AVIF encoder speed, 0 (slowest, smallest) to 10 (fastest)." };
+    static ConVar<int> cv_screenshot_avif_quality{ "screenshot_avif_quality", AVIF_QUALITY_LOSSLESS, "AVIF screenshot quality, 0-100. 100 is lossless." };
+#endif
+    static ConVar<int> cv_screenshot_png_compression{ "screenshot_png_compression", 8, "zlib compression level for PNG screenshots, 0-9.",
+    []( ConVar<int> &cvar )
+    {
+        stbi_write_png_compression_level = std::clamp( int( cvar ), 0, 9 );
+    }, true };
+
+    CScreenshotEncoder &CScreenshotEncoder::Get()
+    {
+        static CScreenshotEncoder s_Instance;
+        return s_Instance;
+    }
+
+    CScreenshotEncoder::~CScreenshotEncoder()
+    {
+        Shutdown();
+    }
+
+    void CScreenshotEncoder::Shutdown()
+    {
+        {
+            std::unique_lock lock{ m_Mutex };
+            m_bStopping = true;
+        }
+        m_JobAvailable.notify_all();
+
+        for ( std::thread &worker : m_Workers )
+        {
+            if ( worker.joinable() )
+                worker.join();
+        }
+        m_Workers.clear();
+    }
+
+    bool CScreenshotEncoder::BIsQueueFull()
+    {
+        std::unique_lock lock{ m_Mutex };
+        return m_Jobs.size() >= k_uMaxQueuedJobs;
+    }
+
+    bool CScreenshotEncoder::BQueueJob( ScreenshotJob_t job )
+    {
+        {
+            std::unique_lock lock{ m_Mutex };
+            if ( m_bStopping )
+                return false;
+
+            if ( m_Jobs.size() >= k_uMaxQueuedJobs )
+            {
+                s_ScreenshotLog.errorf( "Encoder queue is full, dropping screenshot %s", job.szPath.c_str() );
+                return false;
+            }
+
+            if ( !m_bStarted )
+            {
+                StartWorkers();
+                m_bStarted = true;
+            }
+
+            m_Jobs.push_back( std::move( job ) );
+        }
+
+        m_JobAvailable.notify_one();
+        return true;
+    }
+
+    void CScreenshotEncoder::StartWorkers()
+    {
+        const uint32_t uThreadCount = uint32_t( std::max( int( cv_screenshot_encode_threads ), 1 ) );
+        for ( uint32_t i = 0; i < uThreadCount; i++ )
+            m_Workers.emplace_back( [this, i]() { WorkerThread( i ); } );
+    }
+
+    void CScreenshotEncoder::WorkerThread( uint32_t uIndex )
+    {
+        char szThreadName[16];
+        snprintf( szThreadName, sizeof( szThreadName ), "gamescope-scr%u", uIndex );
+        pthread_setname_np( pthread_self(), szThreadName );
+
+        for ( ;; )
+        {
+            ScreenshotJob_t job;
+            {
+                std::unique_lock lock{ m_Mutex };
+                m_JobAvailable.wait( lock, [this]() { return !m_Jobs.empty() || m_bStopping; } );
+                if ( m_Jobs.empty() )
+                    return;
+
+                job = std::move( m_Jobs.front() );
+                m_Jobs.pop_front();
+            }
+
+            vulkan_wait_timeline( job.ulSequence );
+
+            const bool bSuccess = BEncodeJob( job );
+
+            if ( bSuccess )
+                s_ScreenshotLog.infof( "Screenshot saved to %s", job.szPath.c_str() );
+            else
+                s_ScreenshotLog.errorf( "Failed to save screenshot to %s", job.szPath.c_str() );
+
+            // Give the staging texture back before telling anyone we're done.
+            job.pTexture = nullptr;
+
+            if ( job.fnFinished )
+                job.fnFinished( bSuccess );
+        }
+    }
+
+    bool CScreenshotEncoder::BEncodeJob( const ScreenshotJob_t &job )
+    {
+        switch ( job.pTexture->format() )
+        {
+            case VK_FORMAT_R16_UNORM:
+            case VK_FORMAT_A2R10G10B10_UNORM_PACK32:
+                return BEncodeAVIF( job );
+            case VK_FORMAT_B8G8R8A8_UNORM:
+                return BEncodePNG( job );
+            case VK_FORMAT_G8_B8R8_2PLANE_420_UNORM:
+                return BWriteNV12( job );
+            default:
+                s_ScreenshotLog.errorf( "Don't know how to encode format %u for %s", uint32_t( job.pTexture->format() ), job.szPath.c_str() );
+                return false;
+        }
+    }
+
+    bool CScreenshotEncoder::BEncodeAVIF( const ScreenshotJob_t &job )
+    {
+#if HAVE_AVIF
+        const uint8_t *pMappedData = job.pTexture->mappedData();
+        const uint32_t uRowPitch = job.pTexture->rowPitch();
+
+        // R16 is the GPU-converted planar layout from vulkan_screenshot_to_planar_gbr,
+        // anything else is packed 2101010 we have to split up ourselves.
+        const bool bPlanar = job.pTexture->format() == VK_FORMAT_R16_UNORM;
+        const uint32_t uWidth = job.pTexture->width();
+        const uint32_t uHeight = bPlanar ? job.pTexture->height() / 3 : job.pTexture->height();
+
+        avifResult eResult = AVIF_RESULT_OK;
+
+        avifImage *pAvifImage = avifImageCreate( uWidth, uHeight, 10, AVIF_PIXEL_FORMAT_YUV444 );
+        defer( avifImageDestroy( pAvifImage ) );
+        pAvifImage->yuvRange = AVIF_RANGE_FULL;
+        pAvifImage->colorPrimaries = job.bHDR ? AVIF_COLOR_PRIMARIES_BT2020 : AVIF_COLOR_PRIMARIES_BT709;
+        pAvifImage->transferCharacteristics = job.bHDR ? AVIF_TRANSFER_CHARACTERISTICS_SMPTE2084 : AVIF_TRANSFER_CHARACTERISTICS_SRGB;
+        // We are not actually using YUV, but storing raw GBR (yes not RGB) data
+        // This does not compress as well, but is always lossless!
+        pAvifImage->matrixCoefficients = AVIF_MATRIX_COEFFICIENTS_IDENTITY;
+
+        if ( job.bScreenBuffer )
+        {
+            // When dumping the screen output buffer for debugging,
+            // mark the primaries as UNKNOWN as stuff has likely been transformed
+            // to native if HDR on Deck OLED etc.
+            // We want everything to be seen unadulterated by a viewer/image editor.
+            pAvifImage->colorPrimaries = AVIF_COLOR_PRIMARIES_UNKNOWN;
+        }
+
+        if ( job.bHDR )
+        {
+            pAvifImage->clli.maxCLL = job.uMaxCLLNits;
+            pAvifImage->clli.maxPALL = job.uMaxFALLNits;
+        }
+
+        if ( bPlanar )
+        {
+            // Already in libavif's layout, point it straight at the mapped planes.
+            // The image doesn't own them, so avifImageDestroy leaves them alone.
+            static constexpr int k_nPlaneChannels[] = { AVIF_CHAN_Y, AVIF_CHAN_U, AVIF_CHAN_V };
+            for ( uint32_t i = 0; i < 3; i++ )
+            {
+                pAvifImage->yuvPlanes[ k_nPlaneChannels[i] ] = const_cast<uint8_t *>( &pMappedData[ size_t( i ) * uHeight * uRowPitch ] );
+                pAvifImage->yuvRowBytes[ k_nPlaneChannels[i] ] = uRowPitch;
+            }
+            pAvifImage->imageOwnsYUVPlanes = AVIF_FALSE;
+        }
+        else
+        {
+            if ( ( eResult = avifImageAllocatePlanes( pAvifImage, AVIF_PLANES_YUV ) ) != AVIF_RESULT_OK )
+            {
+                s_ScreenshotLog.errorf( "Failed to allocate avif planes: %u", eResult );
+                return false;
+            }
+
+            // With the identity matrix, Y/U/V are just G/B/R, so unpack the
+            // 2101010 rows straight into the planes instead of going through an
+            // intermediate RGB copy and avifImageRGBToYUV.
+            for ( uint32_t y = 0; y < uHeight; y++ )
+            {
+                const uint32_t *pInRow = (const uint32_t *)&pMappedData[ y * uRowPitch ];
+                uint16_t *pOutG = (uint16_t *)&pAvifImage->yuvPlanes[ AVIF_CHAN_Y ][ y * pAvifImage->yuvRowBytes[ AVIF_CHAN_Y ] ];
+                uint16_t *pOutB = (uint16_t *)&pAvifImage->yuvPlanes[ AVIF_CHAN_U ][ y * pAvifImage->yuvRowBytes[ AVIF_CHAN_U ] ];
+                uint16_t *pOutR = (uint16_t *)&pAvifImage->yuvPlanes[ AVIF_CHAN_V ][ y * pAvifImage->yuvRowBytes[ AVIF_CHAN_V ] ];
+
+                for ( uint32_t x = 0; x < uWidth; x++ )
+                {
+                    const uint32_t uInPixel = pInRow[x];
+                    pOutR[x] = ( uInPixel >> 20 ) & 0b1111111111;
+                    pOutG[x] = ( uInPixel >> 10 ) & 0b1111111111;
+                    pOutB[x] = ( uInPixel >> 0 )  & 0b1111111111;
+                }
+            }
+        }
+
+        avifEncoder *pEncoder = avifEncoderCreate();
+        defer( avifEncoderDestroy( pEncoder ) );
+        pEncoder->quality = std::clamp( int( cv_screenshot_avif_quality ), AVIF_QUALITY_WORST, AVIF_QUALITY_BEST );
+        pEncoder->qualityAlpha = AVIF_QUALITY_LOSSLESS;
+        pEncoder->speed = std::clamp( int( cv_screenshot_avif_speed ), AVIF_SPEED_SLOWEST, AVIF_SPEED_FASTEST );
+
+        if ( ( eResult = avifEncoderAddImage( pEncoder, pAvifImage, 1, AVIF_ADD_IMAGE_FLAG_SINGLE ) ) != AVIF_RESULT_OK )
+        {
+            s_ScreenshotLog.errorf( "Failed to add image to avif encoder: %u", eResult );
+            return false;
+        }
+
+        avifRWData avifOutput = AVIF_DATA_EMPTY;
+        defer( avifRWDataFree( &avifOutput ) );
+        if ( ( eResult = avifEncoderFinish( pEncoder, &avifOutput ) ) != AVIF_RESULT_OK )
+        {
+            s_ScreenshotLog.errorf( "Failed to finish encoder: %u", eResult );
+            return false;
+        }
+
+        FILE *pScreenshotFile = fopen( job.szPath.c_str(), "wb" );
+        if ( !pScreenshotFile )
+        {
+            s_ScreenshotLog.errorf_errno( "Failed to fopen file: %s", job.szPath.c_str() );
+            return false;
+        }
+
+        const bool bWritten = fwrite( avifOutput.data, 1, avifOutput.size, pScreenshotFile ) == avifOutput.size;
+        return fclose( pScreenshotFile ) == 0 && bWritten;
+#else
+        s_ScreenshotLog.errorf( "Built without AVIF support" );
+        return false;
+#endif
+    }
+
+    bool CScreenshotEncoder::BEncodePNG( const ScreenshotJob_t &job )
+    {
+        const uint32_t uWidth = job.pTexture->width();
+        const uint32_t uHeight = job.pTexture->height();
+        const uint8_t *pMappedData = job.pTexture->mappedData();
+
+        // Swizzle BGRx to RGB, dropping the alpha channel rather than
+        // writing out a constant one.
+        constexpr uint32_t kCompCnt = 3;
+        const uint32_t uPitch = uWidth * kCompCnt;
+        std::vector<uint8_t> imageData( size_t( uPitch ) * uHeight );
+        for ( uint32_t y = 0; y < uHeight; y++ )
+        {
+            const uint8_t *pInRow = &pMappedData[ y * job.pTexture->rowPitch() ];
+            uint8_t *pOutRow = &imageData[ y * uPitch ];
+            for ( uint32_t x = 0; x < uWidth; x++ )
+            {
+                pOutRow[ x * kCompCnt + 0 ] = pInRow[ x * 4 + 2 ];
+                pOutRow[ x * kCompCnt + 1 ] = pInRow[ x * 4 + 1 ];
+                pOutRow[ x * kCompCnt + 2 ] = pInRow[ x * 4 + 0 ];
+            }
+        }
+
+        FILE *pScreenshotFile = fopen( job.szPath.c_str(), "wb" );
+        if ( !pScreenshotFile )
+        {
+            s_ScreenshotLog.errorf_errno( "Failed to fopen file: %s", job.szPath.c_str() );
+            return false;
+        }
+
+        // Write through our own FILE, stbi_write_png would hide write errors.
+        struct PNGWriteContext_t
+        {
+            FILE *pFile;
+            bool bOk;
+        } context{ pScreenshotFile, true };
+
+        auto WriteFunc = []( void *pContext, void *pData, int nSize )
+        {
+            PNGWriteContext_t *pWriteContext = (PNGWriteContext_t *)pContext;
+            if ( fwrite( pData, 1, nSize, pWriteContext->pFile ) != size_t( nSize ) )
+                pWriteContext->bOk = false;
+        };
+        const bool bWritten = stbi_write_png_to_func( WriteFunc, &context, uWidth, uHeight, kCompCnt, imageData.data(), uPitch ) && context.bOk;
+
+        return fclose( pScreenshotFile ) == 0 && bWritten;
+    }
+
+    bool CScreenshotEncoder::BWriteNV12( const ScreenshotJob_t &job )
+    {
+        FILE *pFile = fopen( job.szPath.c_str(), "wb" );
+        if ( !pFile )
+        {
+            s_ScreenshotLog.errorf_errno( "Failed to fopen file: %s", job.szPath.c_str() );
+            return false;
+        }
+
+        fwrite( job.pTexture->mappedData(), 1, job.pTexture->totalSize(), pFile );
+        fclose( pFile );
+
+        char szCmd[4096];
+        snprintf( szCmd, sizeof( szCmd ), "ffmpeg -f rawvideo -pixel_format nv12 -video_size %dx%d -i %s %s_encoded.png", job.pTexture->width(), job.pTexture->height(), job.szPath.c_str(), job.szPath.c_str() );
+
+        /* Above call may fail, ffmpeg returns 0 on success */
+        int nRet = system( szCmd );
+        if ( nRet )
+        {
+            s_ScreenshotLog.infof( "Ffmpeg call return status %i", nRet );
+            return false;
+        }
+
+        return true;
+    }
+}
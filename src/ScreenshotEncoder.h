@@ -0,0 +1,74 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rendervulkan.hpp"
+
+namespace gamescope
+{
+    struct ScreenshotJob_t
+    {
+        std::string szPath;
+
+        // Mappable staging texture, keeps its screenshot image slot busy
+        // until the job is done with it. R16 textures hold planar GBR from
+        // vulkan_screenshot_to_planar_gbr.
+        Rc<CVulkanTexture> pTexture;
+        // Submission that fills pTexture, waited on by the worker.
+        uint64_t ulSequence = 0;
+
+        bool bHDR = false;
+        // Dump of the output buffer, don't tag primaries so viewers show it unadulterated.
+        bool bScreenBuffer = false;
+        uint16_t uMaxCLLNits = 0;
+        uint16_t uMaxFALLNits = 0;
+
+        // Called on the worker thread once the job is done, successfully or not.
+        std::function<void( bool bSuccess )> fnFinished;
+    };
+
+    // Fixed pool of threads encoding screenshots off the steamcompmgr thread,
+    // fed through a bounded queue so a burst can't pile up unbounded work.
+    class CScreenshotEncoder
+    {
+    public:
+        static constexpr uint32_t k_uMaxQueuedJobs = 8;
+
+        static CScreenshotEncoder &Get();
+
+        ~CScreenshotEncoder();
+
+        // Finishes the queued jobs and joins the workers.
+        void Shutdown();
+
+        // Check BIsQueueFull before doing the GPU work for a job,
+        // queueing into a full queue fails and drops it.
+        bool BIsQueueFull();
+        bool BQueueJob( ScreenshotJob_t job );
+
+        // Encodes and writes out a job whose texture is ready to read, on the calling thread.
+        static bool BEncodeJob( const ScreenshotJob_t &job );
+
+    private:
+        void StartWorkers();
+        void WorkerThread( uint32_t uIndex );
+
+        static bool BEncodeAVIF( const ScreenshotJob_t &job );
+        static bool BEncodePNG( const ScreenshotJob_t &job );
+        static bool BWriteNV12( const ScreenshotJob_t &job );
+
+        std::mutex m_Mutex;
+        std::condition_variable m_JobAvailable;
+        std::deque<ScreenshotJob_t> m_Jobs;
+        std::vector<std::thread> m_Workers;
+        bool m_bStarted = false;
+        bool m_bStopping = false;
+    };
+}
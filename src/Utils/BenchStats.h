@@ -0,0 +1,48 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace gamescope
+{
+    // Shared by the in-process benchmarks (--composite-bench and friends).
+
+    // Reorders values.
+    inline uint64_t BenchPercentile( std::vector<uint64_t> &values, double flPercentile )
+    {
+        if ( values.empty() )
+            return 0;
+
+        size_t uIndex = std::min( values.size() - 1, size_t( flPercentile * ( values.size() - 1 ) + 0.5 ) );
+        std::nth_element( values.begin(), values.begin() + uIndex, values.end() );
+        return values[ uIndex ];
+    }
+
+    // Prints avg/p50/p99/max of a set of nanosecond timings, in microseconds
+    // or milliseconds.
+    inline void PrintBenchStat( const char *pszName, std::vector<uint64_t> values, bool bMilliseconds = false )
+    {
+        if ( values.empty() )
+        {
+            fprintf( stdout, "    %-8s n/a\n", pszName );
+            return;
+        }
+
+        const double flScale = bMilliseconds ? 1'000'000.0 : 1'000.0;
+        const char *pszUnit = bMilliseconds ? "ms" : "us";
+
+        uint64_t ulSum = 0;
+        for ( uint64_t ulValue : values )
+            ulSum += ulValue;
+
+        double flAvg = double( ulSum ) / values.size() / flScale;
+        double flMax = *std::max_element( values.begin(), values.end() ) / flScale;
+        double flP50 = BenchPercentile( values, 0.50 ) / flScale;
+        double flP99 = BenchPercentile( values, 0.99 ) / flScale;
+
+        fprintf( stdout, "    %-8s avg %9.2f%s  p50 %9.2f%s  p99 %9.2f%s  max %9.2f%s\n", pszName,
+            flAvg, pszUnit, flP50, pszUnit, flP99, pszUnit, flMax, pszUnit );
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+
+#include "NonCopyable.h"
+
+namespace gamescope
+{
+    // Bounded single-producer, single-consumer queue.
+    // Push and Pop never allocate or lock, so the producer can sit on a hot path.
+    template <typename T, size_t Size>
+    class CSPSCRing : public NonCopyable
+    {
+        static_assert( Size && ( Size & ( Size - 1 ) ) == 0, "Size must be a power of two" );
+        static_assert( std::is_trivially_copyable_v<T> );
+
+    public:
+        // Producer only. Returns false if the ring is full.
+        bool Push( const T &value )
+        {
+            const size_t uHead = m_uHead.load( std::memory_order_relaxed );
+            if ( uHead - m_uCachedTail == Size )
+            {
+                m_uCachedTail = m_uTail.load( std::memory_order_acquire );
+                if ( uHead - m_uCachedTail == Size )
+                    return false;
+            }
+
+            m_Items[ uHead & ( Size - 1 ) ] = value;
+            m_uHead.store( uHead + 1, std::memory_order_release );
+            return true;
+        }
+
+        // Consumer only.
+        std::optional<T> Pop()
+        {
+            const size_t uTail = m_uTail.load( std::memory_order_relaxed );
+            if ( uTail == m_uCachedHead )
+            {
+                m_uCachedHead = m_uHead.load( std::memory_order_acquire );
+                if ( uTail == m_uCachedHead )
+                    return std::nullopt;
+            }
+
+            T value = m_Items[ uTail & ( Size - 1 ) ];
+            m_uTail.store( uTail + 1, std::memory_order_release );
+            return value;
+        }
+
+    private:
+        // Keep the producer and consumer sides on separate cache lines.
+        static constexpr size_t k_uCacheLineSize = 64;
+
+        alignas( k_uCacheLineSize ) std::atomic<size_t> m_uHead = { 0 };
+        size_t m_uCachedTail = 0;
+
+        alignas( k_uCacheLineSize ) std::atomic<size_t> m_uTail = { 0 };
+        size_t m_uCachedHead = 0;
+
+        alignas( k_uCacheLineSize ) std::array<T, Size> m_Items{};
+    };
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "NonCopyable.h"
+
+namespace gamescope
+{
+    // Publishes a small value from one writer to any number of readers.
+    // Readers never block the writer, they retry if they raced with a Store.
+    // Writers must be serialized by the caller.
+    template <typename T>
+    class CSeqLock : public NonCopyable
+    {
+        static_assert( std::is_trivially_copyable_v<T> );
+
+    public:
+        void Store( const T &value )
+        {
+            std::array<uint64_t, k_uWords> words{};
+            memcpy( words.data(), &value, sizeof( T ) );
+
+            const uint32_t uSeq = m_uSeq.load( std::memory_order_relaxed );
+            m_uSeq.store( uSeq + 1, std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_release );
+
+            for ( size_t i = 0; i < k_uWords; i++ )
+                m_Words[i].store( words[i], std::memory_order_relaxed );
+
+            m_uSeq.store( uSeq + 2, std::memory_order_release );
+        }
+
+        T Load() const
+        {
+            std::array<uint64_t, k_uWords> words;
+
+            uint32_t uSeq0, uSeq1;
+            do
+            {
+                uSeq0 = m_uSeq.load( std::memory_order_acquire );
+
+                for ( size_t i = 0; i < k_uWords; i++ )
+                    words[i] = m_Words[i].load( std::memory_order_relaxed );
+
+                std::atomic_thread_fence( std::memory_order_acquire );
+                uSeq1 = m_uSeq.load( std::memory_order_relaxed );
+            } while ( ( uSeq0 & 1 ) || uSeq0 != uSeq1 );
+
+            T value;
+            memcpy( &value, words.data(), sizeof( T ) );
+            return value;
+        }
+
+    private:
+        static constexpr size_t k_uWords = ( sizeof( T ) + sizeof( uint64_t ) - 1 ) / sizeof( uint64_t );
+
+        std::atomic<uint32_t> m_uSeq = { 0 };
+        std::array<std::atomic<uint64_t>, k_uWords> m_Words{};
+    };
+}
@@ -0,0 +1,177 @@
+#include <algorithm>
+
+#include "VBlankScheduler.h"
+#include "refresh_rate.h"
+
+namespace gamescope
+{
+    void CTimingDistribution::AddSample( uint64_t ulNanos )
+    {
+        m_ulSamples[ m_uNextSample ] = ulNanos;
+        m_uNextSample = ( m_uNextSample + 1 ) % kMaxSamples;
+        m_uSampleCount = std::min( m_uSampleCount + 1, kMaxSamples );
+    }
+
+    uint64_t CTimingDistribution::GetPercentile( uint32_t uPercentile ) const
+    {
+        if ( !m_uSampleCount )
+            return 0;
+
+        std::array<uint64_t, kMaxSamples> ulSorted = m_ulSamples;
+        size_t uIndex = ( ( m_uSampleCount - 1 ) * std::min( uPercentile, 100u ) ) / 100;
+        std::nth_element( ulSorted.begin(), ulSorted.begin() + uIndex, ulSorted.begin() + m_uSampleCount );
+        return ulSorted[ uIndex ];
+    }
+
+    VBlankOffset_t CVBlankScheduler::CalcWakeupOffset( const VBlankSchedulerState_t &state, bool bPreemptive )
+    {
+        const int32_t nRefreshRate = state.nRefreshmHz;
+        const uint64_t ulRefreshInterval = mHzToRefreshCycle( nRefreshRate );
+
+        if ( !state.bVRR )
+        {
+            // The redzone is relative to 60Hz for external displays.
+            // Scale it by our target refresh so we don't miss submitting for
+            // vblank in DRM.
+            // (This fixes wonky frame-pacing on 4K@30Hz screens)
+            //
+            // TODO(Josh): Is this fudging still needed with our SteamOS kernel patches
+            // to not account for vertical front porch when dealing with the vblank
+            // drm_commit is going to target?
+            // Need to re-test that.
+            uint64_t ulRedZone = state.bInternalDisplay
+                ? m_Tunables.ulRedZone
+                : std::min<uint64_t>( m_Tunables.ulRedZone, ( m_Tunables.ulRedZone * 60'000 * nRefreshRate ) / 60'000 );
+
+            const uint64_t ulDecayAlpha = m_Tunables.ulRateOfDecayPercentage; // eg. 980 = 98%
+
+            uint64_t ulDrawTime = m_ulLastDrawTime;
+            /// See comment of ulDrawTimeMinCompositing.
+            if ( state.bCompositing )
+                ulDrawTime = std::max( ulDrawTime, m_Tunables.ulDrawTimeMinCompositing );
+
+            uint64_t ulNewRollingDrawTime;
+            // This is a rolling average when ulDrawTime < m_ulRollingMaxDrawTime,
+            // and a maximum when ulDrawTime > m_ulRollingMaxDrawTime.
+            //
+            // This allows us to deal with spikes in the draw buffer time very easily.
+            // eg. if we suddenly spike up (eg. because of test commits taking a stupid long time),
+            // we will then be able to deal with spikes in the long term, even if several commits after
+            // we get back into a good state and then regress again.
+
+            // If we go over half of our deadzone, be more defensive about things and
+            // spike up back to our current drawtime (sawtooth).
+            if ( int64_t( ulDrawTime ) - int64_t( ulRedZone / 2 ) > int64_t( m_ulRollingMaxDrawTime ) )
+                ulNewRollingDrawTime = ulDrawTime;
+            else
+                ulNewRollingDrawTime = ( ( ulDecayAlpha * m_ulRollingMaxDrawTime ) + ( kVBlankRateOfDecayMax - ulDecayAlpha ) * ulDrawTime ) / kVBlankRateOfDecayMax;
+
+            // If we need to offset for our draw more than half of our vblank, something is very wrong.
+            // Clamp our max time to half of the vblank if we can.
+            ulNewRollingDrawTime = std::min( ulNewRollingDrawTime, ulRefreshInterval - ulRedZone );
+
+            // If this is not a pre-emptive re-arming, then update
+            // the rolling internal max draw time for next time.
+            if ( !bPreemptive )
+                m_ulRollingMaxDrawTime = ulNewRollingDrawTime;
+
+            VBlankOffset_t offset =
+            {
+                .ulOffset = ulNewRollingDrawTime + ulRedZone,
+                .ulDrawTime = ulDrawTime,
+                .ulRedZone = ulRedZone,
+            };
+
+            // The rolling peak above is still kept up to date so we
+            // can fall back to it until we have enough samples.
+            if ( std::optional<uint64_t> oSplitDrawTime = CalcSplitModelDrawTime( state ) )
+            {
+                offset.ulRedZone = std::min( m_Tunables.ulSplitMargin, ulRefreshInterval );
+                offset.ulDrawTime = std::min( *oSplitDrawTime, ulRefreshInterval - offset.ulRedZone );
+                offset.ulOffset = offset.ulDrawTime + offset.ulRedZone;
+            }
+
+            return offset;
+        }
+        else
+        {
+            // See above.
+            if ( !bPreemptive )
+            {
+                // Reset the max draw time to default, it is unused for VRR.
+                m_ulRollingMaxDrawTime = kStartingVBlankDrawTime;
+            }
+
+            uint64_t ulRedZone = kVRRFlushingTime;
+
+            uint64_t ulDrawTime = 0;
+            /// See comment of ulDrawTimeMinCompositing.
+            if ( std::optional<uint64_t> oSplitDrawTime = CalcSplitModelDrawTime( state ) )
+                ulDrawTime = *oSplitDrawTime;
+            else if ( state.bCompositing )
+                ulDrawTime = std::max( ulDrawTime, m_Tunables.ulDrawTimeMinCompositing );
+
+            return VBlankOffset_t
+            {
+                .ulOffset = ulDrawTime + ulRedZone,
+                .ulDrawTime = ulDrawTime,
+                .ulRedZone = ulRedZone,
+            };
+        }
+    }
+
+    void CVBlankScheduler::UpdateLastDrawTime( uint64_t ulNanos )
+    {
+        m_ulLastDrawTime = ulNanos;
+
+        uint64_t ulGPUTime = m_ulPendingGPUTime.exchange( 0 );
+        uint64_t ulCommitTime = m_ulPendingCommitTime.exchange( 0 );
+
+        std::unique_lock lock( m_TimingMutex );
+        if ( ulGPUTime )
+            m_GPUTimes.AddSample( ulGPUTime );
+        m_CommitTimes.AddSample( ulCommitTime );
+        m_CPUTimes.AddSample( ulNanos - std::min( ulNanos, ulGPUTime + ulCommitTime ) );
+    }
+
+    void CVBlankScheduler::UpdateLastGPUTime( uint64_t ulNanos )
+    {
+        m_ulPendingGPUTime = ulNanos;
+    }
+
+    void CVBlankScheduler::UpdateLastCommitTime( uint64_t ulNanos )
+    {
+        m_ulPendingCommitTime = ulNanos;
+    }
+
+    std::optional<uint64_t> CVBlankScheduler::CalcSplitModelDrawTime( const VBlankSchedulerState_t &state )
+    {
+        if ( !m_Tunables.bSplitTiming )
+            return std::nullopt;
+
+        std::unique_lock lock( m_TimingMutex );
+
+        if ( m_CPUTimes.GetSampleCount() < kMinSplitTimingSamples )
+            return std::nullopt;
+
+        uint64_t ulGPUTime = 0;
+        if ( state.bCompositing )
+        {
+            // No timestamp queries (or no composites yet), keep the fixed minimum.
+            if ( m_GPUTimes.GetSampleCount() < kMinSplitTimingSamples )
+                return std::nullopt;
+
+            ulGPUTime = m_GPUTimes.GetPercentile( m_Tunables.uSplitGPUPercentile );
+        }
+
+        // With VRR we only need to cover the composite itself, see kVRRFlushingTime.
+        if ( state.bVRR )
+            return ulGPUTime;
+
+        // Summing percentiles over-estimates the percentile of the sum,
+        // which is the safe direction to be wrong in.
+        return m_CPUTimes.GetPercentile( m_Tunables.uSplitCPUPercentile ) +
+               ulGPUTime +
+               m_CommitTimes.GetPercentile( m_Tunables.uSplitCommitPercentile );
+    }
+}
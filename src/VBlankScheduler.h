@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace gamescope
+{
+    // Window of recent timing samples that can be queried by percentile.
+    class CTimingDistribution
+    {
+    public:
+        static constexpr size_t kMaxSamples = 128;
+
+        void AddSample( uint64_t ulNanos );
+        size_t GetSampleCount() const { return m_uSampleCount; }
+        // uPercentile is 0-100.
+        uint64_t GetPercentile( uint32_t uPercentile ) const;
+
+    private:
+        std::array<uint64_t, kMaxSamples> m_ulSamples = {};
+        size_t m_uSampleCount = 0;
+        size_t m_uNextSample = 0;
+    };
+
+    struct VBlankSchedulerTunables_t
+    {
+        // See CVBlankScheduler for what these mean.
+        uint64_t ulRedZone;
+        uint64_t ulDrawTimeMinCompositing;
+        uint64_t ulRateOfDecayPercentage;
+
+        bool bSplitTiming = false;
+        uint32_t uSplitCPUPercentile = 99;
+        uint32_t uSplitGPUPercentile = 99;
+        uint32_t uSplitCommitPercentile = 99;
+        uint64_t ulSplitMargin = 500'000ul;
+    };
+
+    // Everything about the outside world the scheduler needs for one decision.
+    struct VBlankSchedulerState_t
+    {
+        int32_t nRefreshmHz = 0;
+        bool bVRR = false;
+        bool bInternalDisplay = true;
+        bool bCompositing = false;
+    };
+
+    struct VBlankOffset_t
+    {
+        // How long before vblank we want to wake up.
+        uint64_t ulOffset = 0;
+        // The parts that make up ulOffset.
+        uint64_t ulDrawTime = 0;
+        uint64_t ulRedZone = 0;
+    };
+
+    // The pure part of CVBlankTimer: turns draw time feedback into a wakeup
+    // offset before vblank. No clocks, backends or convars, so it can be
+    // driven by a simulator.
+    class CVBlankScheduler
+    {
+    public:
+        static constexpr uint64_t kMilliSecInNanoSecs = 1'000'000ul;
+        // VBlank timer defaults and starting values.
+        // Anything time-related is nanoseconds unless otherwise specified.
+        static constexpr uint64_t kStartingVBlankDrawTime = 3'000'000ul;
+        static constexpr uint64_t kDefaultMinVBlankTime = 350'000ul;
+        static constexpr uint64_t kDefaultVBlankRedZone = 1'650'000ul;
+        static constexpr uint64_t kDefaultVBlankDrawTimeMinCompositing = 2'400'000ul;
+        static constexpr uint64_t kDefaultVBlankRateOfDecayPercentage = 980ul; // 98%
+        static constexpr uint64_t kVBlankRateOfDecayMax = 1000ul; // 100%
+
+        static constexpr uint64_t kVRRFlushingTime = 300'000;
+
+        // Samples needed in each distribution before the split model kicks in.
+        static constexpr size_t kMinSplitTimingSamples = 16;
+
+        VBlankOffset_t CalcWakeupOffset( const VBlankSchedulerState_t &state, bool bPreemptive );
+
+        void UpdateLastDrawTime( uint64_t ulNanos );
+        // Optional breakdown of the next UpdateLastDrawTime, used by
+        // the split timing model. Reset after every draw.
+        void UpdateLastGPUTime( uint64_t ulNanos );
+        void UpdateLastCommitTime( uint64_t ulNanos );
+
+        VBlankSchedulerTunables_t &Tunables() { return m_Tunables; }
+        uint64_t GetRollingMaxDrawTime() const { return m_ulRollingMaxDrawTime; }
+
+    private:
+        std::optional<uint64_t> CalcSplitModelDrawTime( const VBlankSchedulerState_t &state );
+
+        VBlankSchedulerTunables_t m_Tunables =
+        {
+            // The leeway we always apply to our buffer.
+            // 0.3ms by default. (kDefaultVBlankRedZone)
+            .ulRedZone = kDefaultVBlankRedZone,
+
+            // The minimum drawtime to use when we are compositing.
+            // Getting closer and closer to vblank when compositing means that we can get into
+            // a feedback loop with our GPU clocks. Pick a sane minimum draw time.
+            // 2.4ms by default. (kDefaultVBlankDrawTimeMinCompositing)
+            .ulDrawTimeMinCompositing = kDefaultVBlankDrawTimeMinCompositing,
+
+            // The rate of decay (as a percentage) of the rolling average -> current draw time
+            // 930 = 93%.
+            // 93% by default. (kDefaultVBlankRateOfDecayPercentage)
+            .ulRateOfDecayPercentage = kDefaultVBlankRateOfDecayPercentage,
+        };
+
+        // This is the last time a 'draw' took from wake-up to page flip.
+        // 3ms by default to get the ball rolling.
+        // This is calculated by steamcompmgr/drm and fed-back to the vblank timer.
+        std::atomic<uint64_t> m_ulLastDrawTime = { kStartingVBlankDrawTime };
+
+        // This accounts for some time we cannot account for (which (I think) is the drm_commit -> triggering the pageflip)
+        // It would be nice to make this lower if we can find a way to track that effectively
+        // Perhaps the missing time is spent elsewhere, but given we track from the pipe write
+        // to after the return from `drm_commit` -- I am very doubtful.
+        // 1.3ms by default. (kDefaultMinVBlankTime)
+        uint64_t m_ulMinVBlankTime = kDefaultMinVBlankTime;
+
+        // Internal rolling peak exponential avg. draw time.
+        // This is updated in CalcWakeupOffset when not
+        // doing pre-emptive timer re-arms.
+        uint64_t m_ulRollingMaxDrawTime = kStartingVBlankDrawTime;
+
+        // Split timing model.
+        // Each draw is broken into CPU (everything not covered below),
+        // GPU composite (from timestamp queries) and KMS commit time,
+        // and the wakeup offset is built from a percentile of each.
+        std::mutex m_TimingMutex;
+        CTimingDistribution m_CPUTimes;
+        // Only composited frames land here.
+        CTimingDistribution m_GPUTimes;
+        CTimingDistribution m_CommitTimes;
+        std::atomic<uint64_t> m_ulPendingGPUTime = { 0 };
+        std::atomic<uint64_t> m_ulPendingCommitTime = { 0 };
+    };
+}
@@ -66,6 +66,8 @@ void commit_t::OnPollIn()
 
 void commit_t::Signal()
 {
+    fence_signal_time = get_time_in_nanos();
+
     uint64_t frametime;
     if ( m_bMangoNudge )
     {
@@ -74,6 +74,12 @@ struct commit_t final : public gamescope::RcObject, public gamescope::IWaitable,
 	uint64_t earliest_present_time = 0;
 	uint64_t present_margin = 0;
 
+	// For CFrameLatencyTracker.
+	uint64_t arrival_time = 0;
+	uint64_t fence_signal_time = 0;
+	uint64_t latch_time = 0;
+	bool latency_submitted = false;
+
 	std::mutex m_WaitableCommitStateMutex;
 	int m_nCommitFence = -1;
 	bool m_bMangoNudge = false;
@@ -0,0 +1,312 @@
+// Benchmark for focus candidate ranking.
+//
+// Builds thousands of synthetic windows (games, Steam, dropdowns, override
+// redirects, dialogs, ...) and changes one at a time the way map/unmap,
+// damage and property events do. After every change it re-ranks with the
+// old full rebuild (filter + stable sort of every window) and with
+// CFocusCandidateSet, checks both agree and reports how long each took.
+// Everything is deterministic for a given seed.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <getopt.h>
+
+#include "FocusPriority.h"
+#include "win32_styles.h"
+
+using namespace gamescope;
+
+enum class EBenchChange
+{
+    Map,
+    Damage,
+    Property,
+    Mixed,
+};
+
+struct BenchWorkload_t
+{
+    const char *pszName;
+    EBenchChange eChange;
+};
+
+struct BenchResult_t
+{
+    uint32_t uCandidates = 0;
+    uint32_t uMismatches = 0;
+    std::vector<uint64_t> fullTimes;
+    std::vector<uint64_t> incrementalTimes;
+};
+
+static const BenchWorkload_t s_Workloads[] =
+{
+    { "map-unmap", EBenchChange::Map },
+    { "damage", EBenchChange::Damage },
+    { "property", EBenchChange::Property },
+    { "mixed", EBenchChange::Mixed },
+};
+
+static constexpr uint64_t k_ulStackKeyGap = 1ull << 32;
+
+static uint64_t GetTimeNanos()
+{
+    return uint64_t( std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch() ).count() );
+}
+
+static bool RandomChance( std::mt19937_64 &rng, double flChance )
+{
+    return std::bernoulli_distribution( flChance )( rng );
+}
+
+static void RandomizeProperties( std::mt19937_64 &rng, FocusWindowState_t &w )
+{
+    w.bOverrideRedirect = RandomChance( rng, 0.10 );
+    w.bMaybeADropdown = RandomChance( rng, 0.10 );
+    w.bDialog = RandomChance( rng, 0.10 );
+    w.bSkipTaskbar = RandomChance( rng, 0.15 );
+    w.bSkipPager = w.bSkipTaskbar && RandomChance( rng, 0.75 );
+    w.bFullscreen = RandomChance( rng, 0.20 );
+    w.ulTransientFor = RandomChance( rng, 0.10 ) ? 1 : 0;
+    w.uOpacity = RandomChance( rng, 0.02 ) ? 0 : 0xffffffff;
+
+    w.bHasHwndStyle = RandomChance( rng, 0.30 );
+    w.uHwndStyle = RandomChance( rng, 0.10 ) ? WS_DISABLED : 0;
+    w.bHasHwndStyleEx = w.bHasHwndStyle;
+    w.uHwndStyleEx = RandomChance( rng, 0.05 ) ? ( WS_EX_CONTROLPARENT | WS_EX_LAYERED ) : 0;
+
+    if ( RandomChance( rng, 0.03 ) )
+    {
+        w.nWidth = 1;
+        w.nHeight = 1;
+    }
+    else
+    {
+        w.nWidth = std::uniform_int_distribution<int32_t>( 64, 3840 )( rng );
+        w.nHeight = std::uniform_int_distribution<int32_t>( 64, 2160 )( rng );
+    }
+}
+
+static std::vector<FocusWindowState_t> MakeWindows( uint32_t uWindows, std::mt19937_64 &rng, uint64_t &ulSequence )
+{
+    std::vector<FocusWindowState_t> windows( uWindows );
+    for ( uint32_t i = 0; i < uWindows; i++ )
+    {
+        FocusWindowState_t &w = windows[ i ];
+
+        // Mostly game windows from a handful of apps, some Steam, some nobody.
+        double flKind = std::uniform_real_distribution<double>( 0.0, 1.0 )( rng );
+        if ( flKind < 0.6 )
+            w.uAppID = std::uniform_int_distribution<uint32_t>( 1, 16 )( rng ) * 10;
+        else if ( flKind < 0.7 )
+            w.bSteam = true;
+        else if ( flKind < 0.72 )
+            w.bSteamStreamingClient = true;
+
+        w.bSysTrayIcon = RandomChance( rng, 0.01 );
+        w.bOverlay = RandomChance( rng, 0.01 );
+        w.bViewable = RandomChance( rng, 0.8 );
+        w.bInputOutput = !RandomChance( rng, 0.02 );
+        w.ulMapSequence = ulSequence++;
+        w.ulStackKey = ( 1ull << 62 ) + i * k_ulStackKeyGap;
+
+        RandomizeProperties( rng, w );
+    }
+    return windows;
+}
+
+// What GetPossibleFocusWindows did before: filter the stacking list, then
+// stable sort all of it.
+static void FullRebuild( const std::vector<FocusWindowState_t> &windows, std::vector<uint32_t> &out )
+{
+    out.clear();
+    for ( uint32_t i = 0; i < windows.size(); i++ )
+    {
+        if ( FocusWindowIsCandidate( windows[ i ] ) )
+            out.push_back( i );
+    }
+
+    std::stable_sort( out.begin(), out.end(), [&]( uint32_t a, uint32_t b )
+    {
+        return IsFocusPriorityGreater( windows[ a ], windows[ b ] );
+    });
+}
+
+static void ApplyChange( std::mt19937_64 &rng, EBenchChange eChange, FocusWindowState_t &w, uint64_t &ulSequence )
+{
+    if ( eChange == EBenchChange::Mixed )
+        eChange = EBenchChange( std::uniform_int_distribution<int>( 0, 2 )( rng ) );
+
+    switch ( eChange )
+    {
+        case EBenchChange::Map:
+            w.bViewable = !w.bViewable;
+            if ( w.bViewable )
+            {
+                w.ulMapSequence = ulSequence++;
+                w.ulDamageSequence = 0;
+            }
+            break;
+        case EBenchChange::Damage:
+            w.ulDamageSequence = ulSequence++;
+            break;
+        case EBenchChange::Property:
+        default:
+            RandomizeProperties( rng, w );
+            break;
+    }
+}
+
+static BenchResult_t RunWorkload( const BenchWorkload_t &workload, uint32_t uWindows, uint32_t uUpdates, uint64_t ulSeed )
+{
+    std::mt19937_64 rng( ulSeed );
+    uint64_t ulSequence = 1;
+
+    std::vector<FocusWindowState_t> windows = MakeWindows( uWindows, rng, ulSequence );
+    auto fnGetState = [&]( uint32_t uWindow ) { return windows[ uWindow ]; };
+
+    CFocusCandidateSet<uint32_t> candidates;
+    for ( uint32_t i = 0; i < uWindows; i++ )
+        candidates.MarkDirty( i );
+    candidates.Update( fnGetState );
+
+    // Damage only ever re-ranks game windows.
+    std::vector<uint32_t> changeable;
+    for ( uint32_t i = 0; i < uWindows; i++ )
+    {
+        if ( workload.eChange != EBenchChange::Damage || windows[ i ].uAppID )
+            changeable.push_back( i );
+    }
+
+    BenchResult_t result;
+    if ( changeable.empty() )
+        return result;
+
+    std::vector<uint32_t> fullOrder;
+    std::uniform_int_distribution<size_t> windowDist( 0, changeable.size() - 1 );
+
+    for ( uint32_t i = 0; i < uUpdates; i++ )
+    {
+        uint32_t uWindow = changeable[ windowDist( rng ) ];
+
+        ApplyChange( rng, workload.eChange, windows[ uWindow ], ulSequence );
+
+        uint64_t ulStart = GetTimeNanos();
+        FullRebuild( windows, fullOrder );
+        uint64_t ulFullEnd = GetTimeNanos();
+
+        candidates.MarkDirty( uWindow );
+        const std::vector<uint32_t> &incrementalOrder = candidates.Update( fnGetState );
+        uint64_t ulIncrementalEnd = GetTimeNanos();
+
+        result.fullTimes.push_back( ulFullEnd - ulStart );
+        result.incrementalTimes.push_back( ulIncrementalEnd - ulFullEnd );
+
+        if ( incrementalOrder != fullOrder )
+            result.uMismatches++;
+
+        result.uCandidates = uint32_t( fullOrder.size() );
+    }
+
+    return result;
+}
+
+static void GetStats( std::vector<uint64_t> &times, double *pflAvgUs, double *pflP99Us )
+{
+    std::sort( times.begin(), times.end() );
+
+    double flSum = 0.0;
+    for ( uint64_t ulTime : times )
+        flSum += ulTime;
+
+    *pflAvgUs = flSum / times.size() / 1'000.0;
+    *pflP99Us = times[ size_t( ( times.size() - 1 ) * 0.99 ) ] / 1'000.0;
+}
+
+static void PrintResult( const BenchWorkload_t &workload, BenchResult_t &result )
+{
+    if ( result.fullTimes.empty() )
+    {
+        fprintf( stdout, "%-12s no windows to change\n", workload.pszName );
+        return;
+    }
+
+    double flFullAvg, flFullP99, flIncrementalAvg, flIncrementalP99;
+    GetStats( result.fullTimes, &flFullAvg, &flFullP99 );
+    GetStats( result.incrementalTimes, &flIncrementalAvg, &flIncrementalP99 );
+
+    fprintf( stdout, "%-12s %10u %12.2f %12.2f %12.2f %12.2f %9.1fx %10u\n",
+        workload.pszName,
+        result.uCandidates,
+        flFullAvg,
+        flFullP99,
+        flIncrementalAvg,
+        flIncrementalP99,
+        flIncrementalAvg > 0.0 ? flFullAvg / flIncrementalAvg : 0.0,
+        result.uMismatches );
+}
+
+static void PrintUsage( const char *pszArgv0 )
+{
+    fprintf( stderr,
+        "usage: %s [options]\n"
+        "  --windows <n>       synthetic windows to rank. Default: 4000\n"
+        "  --updates <n>       single window changes per workload. Default: 2000\n"
+        "  --seed <n>          seed for the synthetic windows. Default: 1\n",
+        pszArgv0 );
+}
+
+int main( int argc, char *argv[] )
+{
+    static const struct option s_Options[] =
+    {
+        { "windows", required_argument, nullptr, 'w' },
+        { "updates", required_argument, nullptr, 'u' },
+        { "seed", required_argument, nullptr, 's' },
+        { "help", no_argument, nullptr, 'h' },
+        {},
+    };
+
+    uint32_t uWindows = 4000;
+    uint32_t uUpdates = 2000;
+    uint64_t ulSeed = 1;
+
+    int nOpt;
+    while ( ( nOpt = getopt_long( argc, argv, "w:u:s:h", s_Options, nullptr ) ) != -1 )
+    {
+        switch ( nOpt )
+        {
+            case 'w': uWindows = uint32_t( strtoul( optarg, nullptr, 10 ) ); break;
+            case 'u': uUpdates = uint32_t( strtoul( optarg, nullptr, 10 ) ); break;
+            case 's': ulSeed = strtoull( optarg, nullptr, 10 ); break;
+            default:
+                PrintUsage( argv[0] );
+                return nOpt == 'h' ? 0 : 1;
+        }
+    }
+
+    if ( !uWindows || !uUpdates )
+    {
+        fprintf( stderr, "Need at least one window and one update\n" );
+        return 1;
+    }
+
+    fprintf( stdout, "%u windows, %u updates per workload\n", uWindows, uUpdates );
+    fprintf( stdout, "%-12s %10s %12s %12s %12s %12s %10s %10s\n",
+        "workload", "candidates", "full avg us", "full p99 us", "incr avg us", "incr p99 us", "speedup", "mismatches" );
+
+    uint32_t uMismatches = 0;
+    for ( const BenchWorkload_t &workload : s_Workloads )
+    {
+        BenchResult_t result = RunWorkload( workload, uWindows, uUpdates, ulSeed );
+        PrintResult( workload, result );
+        uMismatches += result.uMismatches;
+    }
+
+    return uMismatches ? 1 : 0;
+}
@@ -39,6 +39,13 @@
 #include "pipewire.hpp"
 #endif
 
+#if HAVE_DRM_MOCK
+#include "Backends/MockKMS.h"
+#endif
+
+#include "CompositeBench.h"
+#include "ScreenshotBench.h"
+
 #include <wayland-client.h>
 
 using namespace std::literals;
@@ -113,6 +120,7 @@ const struct option *gamescope_options = (struct option[]){
 
 	// wlserver options
 	{ "xwayland-count", required_argument, nullptr, 0 },
+	{ "pipewire-streams", required_argument, nullptr, 0 },
 
 	// steamcompmgr options
 	{ "cursor", required_argument, nullptr, 0 },
@@ -144,6 +152,13 @@ const struct option *gamescope_options = (struct option[]){
 	{ "hdr-debug-force-support", no_argument, nullptr, 0 },
 	{ "hdr-debug-force-output", no_argument, nullptr, 0 },
 	{ "hdr-debug-heatmap", no_argument, nullptr, 0 },
+	{ "composite-bench", required_argument, nullptr, 0 },
+	{ "composite-bench-iterations", required_argument, nullptr, 0 },
+	{ "screenshot-bench", required_argument, nullptr, 0 },
+#if HAVE_DRM_MOCK
+	{ "drm-mock", required_argument, nullptr, 0 },
+	{ "drm-bench", required_argument, nullptr, 0 },
+#endif
 
 	{ "reshade-effect", required_argument, nullptr, 0 },
 	{ "reshade-technique-idx", required_argument, nullptr, 0 },
@@ -192,6 +207,7 @@ const char usage[] =
 	"  -C, --hide-cursor-delay        hide cursor image after delay\n"
 	"  -e, --steam                    enable Steam integration\n"
 	"  --xwayland-count               create N xwayland servers\n"
+	"  --pipewire-streams             create N PipeWire capture streams\n"
 	"  --prefer-vk-device             prefer Vulkan device for compositing (ex: 1002:7300)\n"
 	"  --force-orientation            rotate the internal display (left, right, normal, upsidedown)\n"
 	"  --force-windows-fullscreen     force windows inside of gamescope to be the size of the nested display (fullscreen)\n"
@@ -223,6 +239,10 @@ const char usage[] =
 	"  --default-touch-mode           0: hover, 1: left, 2: right, 3: middle, 4: passthrough\n"
 	"  --generate-drm-mode            DRM mode generation algorithm (cvt, fixed)\n"
 	"  --immediate-flips              Enable immediate flips, may result in tearing\n"
+#if HAVE_DRM_MOCK
+	"  --drm-mock                     drive an in-process fake KMS device instead of real hardware (amd, generic)\n"
+	"  --drm-bench                    time N frames of DRM commit preparation per layer setup against --drm-mock (default amd), print timings and exit.\n"
+#endif
 	"\n"
 #if HAVE_OPENVR
 	"VR mode options:\n"
@@ -256,7 +276,13 @@ const char usage[] =
 	"  --disable-xres                 disable XRes for PID lookup\n"
 	"  --hdr-debug-force-support      forces support for HDR, etc even if the display doesn't support it. HDR clients will be outputted as SDR still in that case.\n"
 	"  --hdr-debug-force-output       forces support and output to HDR10 PQ even if the output does not support it (will look very wrong if it doesn't)\n"
-	"  --hdr-debug-heatmap            displays a heatmap-style debug view of HDR luminence across the scene in nits."
+	"  --hdr-debug-heatmap            displays a heatmap-style debug view of HDR luminence across the scene in nits.\n"
+	"  --composite-bench              replay a frame trace (or 'synthetic') through the compositor, print timings and exit.\n"
+	"                                 Uses the headless backend unless --backend is given.\n"
+	"                                 Traces are recorded with the frametrace_record command.\n"
+	"  --composite-bench-iterations   frames to composite per synthetic benchmark scenario. Default: 240\n"
+	"  --screenshot-bench             time N AVIF screenshots at 1080p, 1440p and 4K with CPU and GPU conversion, print timings and exit.\n"
+	"                                 Uses the headless backend unless --backend is given."
 	"\n"
 	"Reshade shader options:\n"
 	"  --reshade-effect               sets the name of a reshade shader to use in either /usr/share/gamescope/reshade/Shaders or ~/.local/share/gamescope/reshade/Shaders\n"
@@ -308,6 +334,7 @@ gamescope::GamescopeModeGeneration g_eGamescopeModeGeneration = gamescope::GAMES
 bool g_bBorderlessOutputWindow = false;
 
 int g_nXWaylandCount = 1;
+int g_nPipewireStreamCount = 1;
 
 float g_flMaxWindowScale = FLT_MAX;
 
@@ -690,6 +717,13 @@ bool g_bRt = false;
 int g_argc;
 char **g_argv;
 
+static const char *g_pszCompositeBench = nullptr;
+static uint32_t g_uCompositeBenchIterations = 240;
+static uint32_t g_uScreenshotBenchIterations = 0;
+#if HAVE_DRM_MOCK
+static uint32_t g_uDRMBenchIterations = 0;
+#endif
+
 int main(int argc, char **argv)
 {
 	g_argc = argc;
@@ -772,6 +806,8 @@ int main(int argc, char **argv)
 					g_bForceDisableColorMgmt = true;
 				} else if (strcmp(opt_name, "xwayland-count") == 0) {
 					g_nXWaylandCount = parse_integer( optarg, opt_name );
+				} else if (strcmp(opt_name, "pipewire-streams") == 0) {
+					g_nPipewireStreamCount = parse_integer( optarg, opt_name );
 				} else if (strcmp(opt_name, "composite-debug") == 0) {
 					cv_composite_debug |= CompositeDebugFlag::Markers;
 					cv_composite_debug |= CompositeDebugFlag::PlaneBorders;
@@ -804,6 +840,18 @@ int main(int argc, char **argv)
 					cv_adaptive_sync = true;
 				} else if (strcmp(opt_name, "expose-wayland") == 0) {
 					g_bExposeWayland = true;
+				} else if (strcmp(opt_name, "composite-bench") == 0) {
+					g_pszCompositeBench = optarg;
+				} else if (strcmp(opt_name, "composite-bench-iterations") == 0) {
+					g_uCompositeBenchIterations = parse_integer( optarg, opt_name );
+				} else if (strcmp(opt_name, "screenshot-bench") == 0) {
+					g_uScreenshotBenchIterations = parse_integer( optarg, opt_name );
+#if HAVE_DRM_MOCK
+				} else if (strcmp(opt_name, "drm-mock") == 0) {
+					g_pszDRMMockPreset = optarg;
+				} else if (strcmp(opt_name, "drm-bench") == 0) {
+					g_uDRMBenchIterations = parse_integer( optarg, opt_name );
+#endif
 				} else if (strcmp(opt_name, "backend") == 0) {
 					eCurrentBackend = parse_backend_name( optarg );
 				} else if (strcmp(opt_name, "cursor-scale-height") == 0) {
@@ -866,6 +914,17 @@ int main(int argc, char **argv)
 	g_pOriginalDisplay = getenv("DISPLAY");
 	g_pOriginalWaylandDisplay = getenv("WAYLAND_DISPLAY");
 
+	if ( eCurrentBackend == gamescope::GamescopeBackend::Auto && ( g_pszCompositeBench || g_uScreenshotBenchIterations ) )
+		eCurrentBackend = gamescope::GamescopeBackend::Headless;
+
+#if HAVE_DRM_MOCK
+	if ( g_uDRMBenchIterations && !g_pszDRMMockPreset )
+		g_pszDRMMockPreset = "amd";
+
+	if ( g_pszDRMMockPreset )
+		eCurrentBackend = gamescope::GamescopeBackend::DRM;
+#endif
+
 	if ( eCurrentBackend == gamescope::GamescopeBackend::Auto )
 	{
 		if ( g_pOriginalWaylandDisplay != NULL )
@@ -943,12 +1002,23 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+#if HAVE_DRM_MOCK
+	if ( g_uDRMBenchIterations )
+		return gamescope::RunDRMCommitBenchmark( g_uDRMBenchIterations );
+#endif
+
 	if ( !vulkan_make_output() )
 	{
 		fprintf( stderr, "vulkan_make_output failed\n" );
 		return 1;
 	}
 
+	if ( g_pszCompositeBench )
+		return gamescope::RunCompositeBenchmark( g_pszCompositeBench, g_uCompositeBenchIterations );
+
+	if ( g_uScreenshotBenchIterations )
+		return gamescope::RunScreenshotBenchmark( g_uScreenshotBenchIterations );
+
 	// Prevent our clients from connecting to the parent compositor
 	unsetenv("WAYLAND_DISPLAY");
 
@@ -69,6 +69,7 @@ extern bool g_bExposeWayland;
 extern bool g_bRt;
 
 extern int g_nXWaylandCount;
+extern int g_nPipewireStreamCount;
 
 extern uint32_t g_preferVendorID;
 extern uint32_t g_preferDeviceID;
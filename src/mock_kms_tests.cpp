@@ -0,0 +1,345 @@
+// Regression tests for the mock KMS device and libliftoff running on top of it.
+// Built with -Ddrm_mock=true, run by `meson test`.
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+#include "Backends/MockKMS.h"
+
+#include <libliftoff.h>
+
+static int s_nFailures = 0;
+
+#define MOCK_KMS_CHECK( expr ) \
+    do { \
+        if ( !( expr ) ) \
+        { \
+            fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr ); \
+            s_nFailures++; \
+        } \
+    } while ( 0 )
+
+struct MockKMSTestDevice_t
+{
+    int nFd = -1;
+    uint32_t uCRTCId = 0;
+    uint32_t uConnectorId = 0;
+    uint32_t uPrimaryPlaneId = 0;
+    uint32_t uCursorPlaneId = 0;
+    drmModeModeInfo mode{};
+};
+
+static uint32_t GetPropertyId( int nFd, uint32_t uObjectId, uint32_t uObjectType, std::string_view svName )
+{
+    drmModeObjectProperties *pProps = drmModeObjectGetProperties( nFd, uObjectId, uObjectType );
+    if ( !pProps )
+        return 0;
+
+    uint32_t uPropId = 0;
+    for ( uint32_t i = 0; i < pProps->count_props && !uPropId; i++ )
+    {
+        drmModePropertyRes *pProp = drmModeGetProperty( nFd, pProps->props[i] );
+        if ( pProp && svName == pProp->name )
+            uPropId = pProp->prop_id;
+        drmModeFreeProperty( pProp );
+    }
+
+    drmModeFreeObjectProperties( pProps );
+    return uPropId;
+}
+
+static uint64_t GetPropertyValue( int nFd, uint32_t uObjectId, uint32_t uObjectType, std::string_view svName )
+{
+    const uint32_t uPropId = GetPropertyId( nFd, uObjectId, uObjectType, svName );
+
+    drmModeObjectProperties *pProps = drmModeObjectGetProperties( nFd, uObjectId, uObjectType );
+    if ( !pProps )
+        return 0;
+
+    uint64_t ulValue = 0;
+    for ( uint32_t i = 0; i < pProps->count_props; i++ )
+    {
+        if ( pProps->props[i] == uPropId )
+            ulValue = pProps->prop_values[i];
+    }
+
+    drmModeFreeObjectProperties( pProps );
+    return ulValue;
+}
+
+static void AddPlaneProperty( const MockKMSTestDevice_t &dev, drmModeAtomicReq *pReq, uint32_t uPlaneId, std::string_view svName, uint64_t ulValue )
+{
+    drmModeAtomicAddProperty( pReq, uPlaneId, GetPropertyId( dev.nFd, uPlaneId, DRM_MODE_OBJECT_PLANE, svName ), ulValue );
+}
+
+static void AddPlane( const MockKMSTestDevice_t &dev, drmModeAtomicReq *pReq, uint32_t uPlaneId, uint32_t uFbId,
+                      uint32_t uSrcW, uint32_t uSrcH, uint32_t uCRTCW, uint32_t uCRTCH )
+{
+    AddPlaneProperty( dev, pReq, uPlaneId, "FB_ID", uFbId );
+    AddPlaneProperty( dev, pReq, uPlaneId, "CRTC_ID", uFbId ? dev.uCRTCId : 0 );
+    AddPlaneProperty( dev, pReq, uPlaneId, "SRC_X", 0 );
+    AddPlaneProperty( dev, pReq, uPlaneId, "SRC_Y", 0 );
+    AddPlaneProperty( dev, pReq, uPlaneId, "SRC_W", uint64_t( uSrcW ) << 16 );
+    AddPlaneProperty( dev, pReq, uPlaneId, "SRC_H", uint64_t( uSrcH ) << 16 );
+    AddPlaneProperty( dev, pReq, uPlaneId, "CRTC_X", 0 );
+    AddPlaneProperty( dev, pReq, uPlaneId, "CRTC_Y", 0 );
+    AddPlaneProperty( dev, pReq, uPlaneId, "CRTC_W", uCRTCW );
+    AddPlaneProperty( dev, pReq, uPlaneId, "CRTC_H", uCRTCH );
+}
+
+static uint32_t CreateFb( const MockKMSTestDevice_t &dev, uint32_t uWidth, uint32_t uHeight, uint32_t uFormat, uint64_t ulModifier )
+{
+    // The mock never touches the memory, any GEM handle will do.
+    uint32_t uHandles[4] = { 1 };
+    uint32_t uPitches[4] = { uWidth * 4 };
+    uint32_t uOffsets[4] = { 0 };
+    uint64_t ulModifiers[4] = { ulModifier };
+
+    uint32_t uFbId = 0;
+    if ( drmModeAddFB2WithModifiers( dev.nFd, uWidth, uHeight, uFormat, uHandles, uPitches, uOffsets, ulModifiers, &uFbId, DRM_MODE_FB_MODIFIERS ) != 0 )
+        return 0;
+    return uFbId;
+}
+
+static int Commit( const MockKMSTestDevice_t &dev, drmModeAtomicReq *pReq, uint32_t uFlags )
+{
+    return drmModeAtomicCommit( dev.nFd, pReq, uFlags, nullptr );
+}
+
+static bool OpenDevice( std::string_view svPreset, MockKMSTestDevice_t *pDev )
+{
+    pDev->nFd = gamescope::CMockKMSDevice::Get().Open( svPreset );
+    if ( pDev->nFd < 0 )
+        return false;
+
+    drmSetClientCap( pDev->nFd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1 );
+    drmSetClientCap( pDev->nFd, DRM_CLIENT_CAP_ATOMIC, 1 );
+
+    drmModeRes *pRes = drmModeGetResources( pDev->nFd );
+    MOCK_KMS_CHECK( pRes && pRes->count_crtcs == 1 && pRes->count_connectors == 1 );
+    if ( !pRes || !pRes->count_crtcs || !pRes->count_connectors )
+        return false;
+    pDev->uCRTCId = pRes->crtcs[0];
+    pDev->uConnectorId = pRes->connectors[0];
+    drmModeFreeResources( pRes );
+
+    drmModeConnector *pConnector = drmModeGetConnector( pDev->nFd, pDev->uConnectorId );
+    MOCK_KMS_CHECK( pConnector && pConnector->connection == DRM_MODE_CONNECTED && pConnector->count_modes > 0 );
+    if ( !pConnector || !pConnector->count_modes )
+        return false;
+    pDev->mode = pConnector->modes[0];
+    drmModeFreeConnector( pConnector );
+
+    drmModePlaneRes *pPlaneRes = drmModeGetPlaneResources( pDev->nFd );
+    MOCK_KMS_CHECK( pPlaneRes && pPlaneRes->count_planes > 0 );
+    for ( uint32_t i = 0; pPlaneRes && i < pPlaneRes->count_planes; i++ )
+    {
+        const uint64_t ulType = GetPropertyValue( pDev->nFd, pPlaneRes->planes[i], DRM_MODE_OBJECT_PLANE, "type" );
+        if ( ulType == DRM_PLANE_TYPE_PRIMARY )
+            pDev->uPrimaryPlaneId = pPlaneRes->planes[i];
+        else if ( ulType == DRM_PLANE_TYPE_CURSOR )
+            pDev->uCursorPlaneId = pPlaneRes->planes[i];
+    }
+    drmModeFreePlaneResources( pPlaneRes );
+
+    MOCK_KMS_CHECK( pDev->uPrimaryPlaneId != 0 );
+    MOCK_KMS_CHECK( pDev->uCursorPlaneId != 0 );
+    return pDev->uPrimaryPlaneId != 0;
+}
+
+// Lights up the CRTC with a full-screen primary plane.
+static void TestModeset( const MockKMSTestDevice_t &dev, uint32_t uFbId )
+{
+    uint32_t uModeBlob = 0;
+    MOCK_KMS_CHECK( drmModeCreatePropertyBlob( dev.nFd, &dev.mode, sizeof( dev.mode ), &uModeBlob ) == 0 );
+
+    drmModeAtomicReq *pReq = drmModeAtomicAlloc();
+    drmModeAtomicAddProperty( pReq, dev.uConnectorId, GetPropertyId( dev.nFd, dev.uConnectorId, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID" ), dev.uCRTCId );
+    drmModeAtomicAddProperty( pReq, dev.uCRTCId, GetPropertyId( dev.nFd, dev.uCRTCId, DRM_MODE_OBJECT_CRTC, "MODE_ID" ), uModeBlob );
+    drmModeAtomicAddProperty( pReq, dev.uCRTCId, GetPropertyId( dev.nFd, dev.uCRTCId, DRM_MODE_OBJECT_CRTC, "ACTIVE" ), 1 );
+    AddPlane( dev, pReq, dev.uPrimaryPlaneId, uFbId, dev.mode.hdisplay, dev.mode.vdisplay, dev.mode.hdisplay, dev.mode.vdisplay );
+
+    // A modeset needs ALLOW_MODESET.
+    MOCK_KMS_CHECK( Commit( dev, pReq, DRM_MODE_ATOMIC_TEST_ONLY ) == -EINVAL );
+    MOCK_KMS_CHECK( Commit( dev, pReq, DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET ) == 0 );
+    MOCK_KMS_CHECK( Commit( dev, pReq, DRM_MODE_ATOMIC_ALLOW_MODESET ) == 0 );
+    MOCK_KMS_CHECK( GetPropertyValue( dev.nFd, dev.uCRTCId, DRM_MODE_OBJECT_CRTC, "ACTIVE" ) == 1 );
+
+    drmModeAtomicFree( pReq );
+}
+
+static void TestRejectedCommits( const MockKMSTestDevice_t &dev, uint32_t uFbId )
+{
+    const uint32_t uWidth = dev.mode.hdisplay;
+    const uint32_t uHeight = dev.mode.vdisplay;
+
+    // FB without a CRTC.
+    {
+        drmModeAtomicReq *pReq = drmModeAtomicAlloc();
+        AddPlaneProperty( dev, pReq, dev.uPrimaryPlaneId, "CRTC_ID", 0 );
+        MOCK_KMS_CHECK( Commit( dev, pReq, DRM_MODE_ATOMIC_TEST_ONLY ) == -EINVAL );
+        drmModeAtomicFree( pReq );
+    }
+
+    // Source rect outside of the FB.
+    {
+        drmModeAtomicReq *pReq = drmModeAtomicAlloc();
+        AddPlane( dev, pReq, dev.uPrimaryPlaneId, uFbId, uWidth + 1, uHeight, uWidth, uHeight );
+        MOCK_KMS_CHECK( Commit( dev, pReq, DRM_MODE_ATOMIC_TEST_ONLY ) == -ENOSPC );
+        drmModeAtomicFree( pReq );
+    }
+
+    // Past the plane's downscale limit.
+    {
+        drmModeAtomicReq *pReq = drmModeAtomicAlloc();
+        AddPlane( dev, pReq, dev.uPrimaryPlaneId, uFbId, uWidth, uHeight, uWidth / 8, uHeight / 8 );
+        MOCK_KMS_CHECK( Commit( dev, pReq, DRM_MODE_ATOMIC_TEST_ONLY ) == -EINVAL );
+        drmModeAtomicFree( pReq );
+    }
+
+    // The cursor can't scale.
+    {
+        const uint32_t uCursorFbId = CreateFb( dev, 64, 64, DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_LINEAR );
+        MOCK_KMS_CHECK( uCursorFbId != 0 );
+
+        drmModeAtomicReq *pReq = drmModeAtomicAlloc();
+        AddPlane( dev, pReq, dev.uCursorPlaneId, uCursorFbId, 64, 64, 64, 64 );
+        MOCK_KMS_CHECK( Commit( dev, pReq, DRM_MODE_ATOMIC_TEST_ONLY ) == 0 );
+        drmModeAtomicFree( pReq );
+
+        pReq = drmModeAtomicAlloc();
+        AddPlane( dev, pReq, dev.uCursorPlaneId, uCursorFbId, 64, 64, 128, 128 );
+        MOCK_KMS_CHECK( Commit( dev, pReq, DRM_MODE_ATOMIC_TEST_ONLY ) == -EINVAL );
+        drmModeAtomicFree( pReq );
+
+        drmModeRmFB( dev.nFd, uCursorFbId );
+    }
+
+    // Same format, but a modifier no plane can scan out.
+    {
+        const uint32_t uTiledFbId = CreateFb( dev, uWidth, uHeight, DRM_FORMAT_XRGB8888, I915_FORMAT_MOD_X_TILED );
+        MOCK_KMS_CHECK( uTiledFbId != 0 );
+
+        drmModeAtomicReq *pReq = drmModeAtomicAlloc();
+        AddPlane( dev, pReq, dev.uPrimaryPlaneId, uTiledFbId, uWidth, uHeight, uWidth, uHeight );
+        MOCK_KMS_CHECK( Commit( dev, pReq, DRM_MODE_ATOMIC_TEST_ONLY ) == -EINVAL );
+        drmModeAtomicFree( pReq );
+
+        drmModeRmFB( dev.nFd, uTiledFbId );
+    }
+}
+
+static void TestFlipEvent( const MockKMSTestDevice_t &dev, uint32_t uFbId )
+{
+    drmModeAtomicReq *pReq = drmModeAtomicAlloc();
+    AddPlane( dev, pReq, dev.uPrimaryPlaneId, uFbId, dev.mode.hdisplay, dev.mode.vdisplay, dev.mode.hdisplay, dev.mode.vdisplay );
+    MOCK_KMS_CHECK( drmModeAtomicCommit( dev.nFd, pReq, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK, reinterpret_cast<void *>( uintptr_t( 0x1234 ) ) ) == 0 );
+    drmModeAtomicFree( pReq );
+
+    static uintptr_t s_ulFlipUserData = 0;
+    drmEventContext eventContext{};
+    eventContext.version = 3;
+    eventContext.page_flip_handler2 = []( int, unsigned int, unsigned int, unsigned int, unsigned int, void *pUserData )
+    {
+        s_ulFlipUserData = reinterpret_cast<uintptr_t>( pUserData );
+    };
+    MOCK_KMS_CHECK( drmHandleEvent( dev.nFd, &eventContext ) == 0 );
+    MOCK_KMS_CHECK( s_ulFlipUserData == 0x1234 );
+}
+
+// libliftoff must only put layers on planes that can take their format
+// and modifier, anything else falls back to composition.
+static void TestLiftoff( const MockKMSTestDevice_t &dev )
+{
+    const uint32_t uWidth = dev.mode.hdisplay;
+    const uint32_t uHeight = dev.mode.vdisplay;
+
+    liftoff_device *pDevice = liftoff_device_create( dev.nFd );
+    MOCK_KMS_CHECK( pDevice != nullptr );
+    if ( !pDevice )
+        return;
+    MOCK_KMS_CHECK( liftoff_device_register_all_planes( pDevice ) == 0 );
+
+    liftoff_output *pOutput = liftoff_output_create( pDevice, dev.uCRTCId );
+    MOCK_KMS_CHECK( pOutput != nullptr );
+
+    auto CreateLayer = [&]( uint32_t uFbId, uint32_t uZpos, uint32_t uLayerW, uint32_t uLayerH )
+    {
+        liftoff_layer *pLayer = liftoff_layer_create( pOutput );
+        liftoff_layer_set_property( pLayer, "FB_ID", uFbId );
+        liftoff_layer_set_property( pLayer, "zpos", uZpos );
+        liftoff_layer_set_property( pLayer, "SRC_X", 0 );
+        liftoff_layer_set_property( pLayer, "SRC_Y", 0 );
+        liftoff_layer_set_property( pLayer, "SRC_W", uint64_t( uLayerW ) << 16 );
+        liftoff_layer_set_property( pLayer, "SRC_H", uint64_t( uLayerH ) << 16 );
+        liftoff_layer_set_property( pLayer, "CRTC_X", 0 );
+        liftoff_layer_set_property( pLayer, "CRTC_Y", 0 );
+        liftoff_layer_set_property( pLayer, "CRTC_W", uLayerW );
+        liftoff_layer_set_property( pLayer, "CRTC_H", uLayerH );
+        return pLayer;
+    };
+
+    const uint32_t uBaseFbId = CreateFb( dev, uWidth, uHeight, DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_LINEAR );
+    const uint32_t uOverlayFbId = CreateFb( dev, uWidth / 2, uHeight / 2, DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_LINEAR );
+    const uint32_t uTiledFbId = CreateFb( dev, uWidth / 2, uHeight / 2, DRM_FORMAT_ARGB8888, I915_FORMAT_MOD_X_TILED );
+    MOCK_KMS_CHECK( uBaseFbId && uOverlayFbId && uTiledFbId );
+
+    liftoff_layer *pBase = CreateLayer( uBaseFbId, 0, uWidth, uHeight );
+    liftoff_layer *pOverlay = CreateLayer( uOverlayFbId, 1, uWidth / 2, uHeight / 2 );
+
+    drmModeAtomicReq *pReq = drmModeAtomicAlloc();
+    MOCK_KMS_CHECK( liftoff_output_apply( pOutput, pReq, 0, nullptr ) == 0 );
+    MOCK_KMS_CHECK( Commit( dev, pReq, 0 ) == 0 );
+    MOCK_KMS_CHECK( liftoff_layer_get_plane( pBase ) != nullptr );
+    MOCK_KMS_CHECK( liftoff_layer_get_plane( pOverlay ) != nullptr );
+    MOCK_KMS_CHECK( !liftoff_output_needs_composition( pOutput ) );
+    drmModeAtomicFree( pReq );
+
+    // Same size and format, only the modifier changes.
+    liftoff_layer_set_property( pOverlay, "FB_ID", uTiledFbId );
+
+    pReq = drmModeAtomicAlloc();
+    MOCK_KMS_CHECK( liftoff_output_apply( pOutput, pReq, 0, nullptr ) == 0 );
+    MOCK_KMS_CHECK( Commit( dev, pReq, 0 ) == 0 );
+    MOCK_KMS_CHECK( liftoff_layer_get_plane( pOverlay ) == nullptr );
+    MOCK_KMS_CHECK( liftoff_layer_needs_composition( pOverlay ) );
+    drmModeAtomicFree( pReq );
+
+    liftoff_layer_destroy( pOverlay );
+    liftoff_layer_destroy( pBase );
+    liftoff_output_destroy( pOutput );
+    liftoff_device_destroy( pDevice );
+
+    drmModeRmFB( dev.nFd, uTiledFbId );
+    drmModeRmFB( dev.nFd, uOverlayFbId );
+    drmModeRmFB( dev.nFd, uBaseFbId );
+}
+
+int main()
+{
+    printf( "mock_kms_tests\n" );
+
+    MockKMSTestDevice_t dev;
+    if ( !OpenDevice( "amd", &dev ) )
+    {
+        fprintf( stderr, "Failed to open the mock KMS device\n" );
+        return 1;
+    }
+
+    const uint32_t uFbId = CreateFb( dev, dev.mode.hdisplay, dev.mode.vdisplay, DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_LINEAR );
+    MOCK_KMS_CHECK( uFbId != 0 );
+
+    TestModeset( dev, uFbId );
+    TestRejectedCommits( dev, uFbId );
+    TestFlipEvent( dev, uFbId );
+    TestLiftoff( dev );
+
+    const gamescope::CMockKMSDevice &mock = gamescope::CMockKMSDevice::Get();
+    printf( "%" PRIu64 " commits (%" PRIu64 " TEST_ONLY, %" PRIu64 " rejected), %d failures\n",
+        mock.GetAtomicCommitCount(), mock.GetTestCommitCount(), mock.GetRejectedCommitCount(), s_nFailures );
+
+    return s_nFailures ? 1 : 0;
+}
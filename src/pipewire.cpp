@@ -6,6 +6,7 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <thread>
 #include <vector>
@@ -18,32 +19,34 @@
 
 static LogScope pwr_log("pipewire");
 
-static struct pipewire_state pipewire_state = { .stream_node_id = SPA_ID_INVALID };
+static struct pipewire_state pipewire_state = {};
 static int nudgePipe[2] = { -1, -1 };
 
-// Pending buffer for PipeWire → steamcompmgr
-static std::atomic<struct pipewire_buffer *> out_buffer;
-// Pending buffer for steamcompmgr → PipeWire
-static std::atomic<struct pipewire_buffer *> in_buffer;
-
-// Requested capture size
-static uint32_t s_nRequestedWidth;
-static uint32_t s_nRequestedHeight;
-static uint32_t s_nCaptureWidth;
-static uint32_t s_nCaptureHeight;
 static uint32_t s_nOutputWidth;
 static uint32_t s_nOutputHeight;
 
+// NV12 and P010: a full-size luma plane followed by a half-size interleaved chroma plane.
+static bool is_yuv420_format(uint32_t spa_format)
+{
+	return spa_format == SPA_VIDEO_FORMAT_NV12 || spa_format == SPA_VIDEO_FORMAT_P010_10LE;
+}
+
+static off_t get_shm_size(uint32_t spa_format, int stride, uint32_t height)
+{
+	off_t size = stride * height;
+	if (is_yuv420_format(spa_format)) {
+		size += stride * ((height + 1) / 2);
+	}
+	return size;
+}
+
 static void destroy_buffer(struct pipewire_buffer *buffer) {
 	assert(buffer->buffer == nullptr);
 
 	switch (buffer->type) {
 	case SPA_DATA_MemFd:
 	{
-		off_t size = buffer->shm.stride * buffer->video_info.size.height;
-		if (buffer->video_info.format == SPA_VIDEO_FORMAT_NV12) {
-			size += buffer->shm.stride * ((buffer->video_info.size.height + 1) / 2);
-		}
+		off_t size = get_shm_size(buffer->video_info.format, buffer->shm.stride, buffer->video_info.size.height);
 		munmap(buffer->shm.data, size);
 		close(buffer->shm.fd);
 		break;
@@ -57,9 +60,9 @@ static void destroy_buffer(struct pipewire_buffer *buffer) {
 	// If out_buffer == buffer, then set it to nullptr.
 	// We don't care about the result.
 	struct pipewire_buffer *buffer1 = buffer;
-	out_buffer.compare_exchange_strong(buffer1, nullptr);
+	buffer->stream->out_buffer.compare_exchange_strong(buffer1, nullptr);
 	struct pipewire_buffer *buffer2 = buffer;
-	in_buffer.compare_exchange_strong(buffer2, nullptr);
+	buffer->stream->in_buffer.compare_exchange_strong(buffer2, nullptr);
 
 	delete buffer;
 }
@@ -69,28 +72,57 @@ void pipewire_destroy_buffer(struct pipewire_buffer *buffer)
 	destroy_buffer(buffer);
 }
 
-static void calculate_capture_size()
+static void calculate_capture_size(struct pipewire_stream *stream)
 {
-	s_nCaptureWidth = s_nOutputWidth;
-	s_nCaptureHeight = s_nOutputHeight;
+	stream->capture_width = s_nOutputWidth;
+	stream->capture_height = s_nOutputHeight;
 
-	if (s_nRequestedWidth > 0 && s_nRequestedHeight > 0 &&
-	    (s_nOutputWidth > s_nRequestedWidth || s_nOutputHeight > s_nRequestedHeight)) {
+	const uint32_t nRequestedWidth = stream->requested_width;
+	const uint32_t nRequestedHeight = stream->requested_height;
+	if (nRequestedWidth > 0 && nRequestedHeight > 0 &&
+	    (s_nOutputWidth > nRequestedWidth || s_nOutputHeight > nRequestedHeight)) {
 		// Need to clamp to the smallest dimension
-		float flRatioW = static_cast<float>(s_nRequestedWidth) / s_nOutputWidth;
-		float flRatioH = static_cast<float>(s_nRequestedHeight) / s_nOutputHeight;
+		float flRatioW = static_cast<float>(nRequestedWidth) / s_nOutputWidth;
+		float flRatioH = static_cast<float>(nRequestedHeight) / s_nOutputHeight;
 		if (flRatioW <= flRatioH) {
-			s_nCaptureWidth = s_nRequestedWidth;
-			s_nCaptureHeight = static_cast<uint32_t>(ceilf(flRatioW * s_nOutputHeight));
+			stream->capture_width = nRequestedWidth;
+			stream->capture_height = static_cast<uint32_t>(ceilf(flRatioW * s_nOutputHeight));
 		} else {
-			s_nCaptureWidth = static_cast<uint32_t>(ceilf(flRatioH * s_nOutputWidth));
-			s_nCaptureHeight = s_nRequestedHeight;
+			stream->capture_width = static_cast<uint32_t>(ceilf(flRatioH * s_nOutputWidth));
+			stream->capture_height = nRequestedHeight;
 		}
 	}
 }
 
-static void build_format_params(struct spa_pod_builder *builder, spa_video_format format, std::vector<const struct spa_pod *> &params) {
-	struct spa_rectangle size = SPA_RECTANGLE(s_nCaptureWidth, s_nCaptureHeight);
+static void build_yuv_color_params(struct spa_pod_builder *builder, spa_video_format format) {
+	if (format == SPA_VIDEO_FORMAT_NV12) {
+		spa_pod_builder_add(builder,
+			SPA_FORMAT_VIDEO_colorMatrix, SPA_POD_CHOICE_ENUM_Id(3,
+							SPA_VIDEO_COLOR_MATRIX_BT601,
+							SPA_VIDEO_COLOR_MATRIX_BT601,
+							SPA_VIDEO_COLOR_MATRIX_BT709),
+			SPA_FORMAT_VIDEO_colorRange, SPA_POD_CHOICE_ENUM_Id(3,
+							SPA_VIDEO_COLOR_RANGE_16_235,
+							SPA_VIDEO_COLOR_RANGE_16_235,
+							SPA_VIDEO_COLOR_RANGE_0_255),
+			0);
+	} else if (format == SPA_VIDEO_FORMAT_P010_10LE) {
+		// BT.2020 means PQ-encoded HDR, see k_EStreamColorspace_BT2020_PQ.
+		spa_pod_builder_add(builder,
+			SPA_FORMAT_VIDEO_colorMatrix, SPA_POD_CHOICE_ENUM_Id(3,
+							SPA_VIDEO_COLOR_MATRIX_BT709,
+							SPA_VIDEO_COLOR_MATRIX_BT709,
+							SPA_VIDEO_COLOR_MATRIX_BT2020),
+			SPA_FORMAT_VIDEO_colorRange, SPA_POD_CHOICE_ENUM_Id(3,
+							SPA_VIDEO_COLOR_RANGE_16_235,
+							SPA_VIDEO_COLOR_RANGE_16_235,
+							SPA_VIDEO_COLOR_RANGE_0_255),
+			0);
+	}
+}
+
+static void build_format_params(struct pipewire_stream *stream, struct spa_pod_builder *builder, spa_video_format format, std::vector<const struct spa_pod *> &params) {
+	struct spa_rectangle size = SPA_RECTANGLE(stream->capture_width, stream->capture_height);
 	struct spa_rectangle min_requested_size = { 0, 0 };
 	struct spa_rectangle max_requested_size = { UINT32_MAX, UINT32_MAX };
 	struct spa_fraction framerate = SPA_FRACTION(0, 1);
@@ -106,19 +138,9 @@ static void build_format_params(struct spa_pod_builder *builder, spa_video_forma
 		SPA_FORMAT_VIDEO_framerate, SPA_POD_Fraction(&framerate),
 		SPA_FORMAT_VIDEO_requested_size, SPA_POD_CHOICE_RANGE_Rectangle( &min_requested_size, &min_requested_size, &max_requested_size ),
 		SPA_FORMAT_VIDEO_gamescope_focus_appid, SPA_POD_CHOICE_RANGE_Long( 0ll, INT64_MIN, INT64_MAX ),
+		SPA_FORMAT_VIDEO_gamescope_framerate_divisor, SPA_POD_CHOICE_RANGE_Int( 1, 1, INT32_MAX ),
 		0);
-	if (format == SPA_VIDEO_FORMAT_NV12) {
-		spa_pod_builder_add(builder,
-			SPA_FORMAT_VIDEO_colorMatrix, SPA_POD_CHOICE_ENUM_Id(3,
-							SPA_VIDEO_COLOR_MATRIX_BT601,
-							SPA_VIDEO_COLOR_MATRIX_BT601,
-							SPA_VIDEO_COLOR_MATRIX_BT709),
-			SPA_FORMAT_VIDEO_colorRange, SPA_POD_CHOICE_ENUM_Id(3,
-							SPA_VIDEO_COLOR_RANGE_16_235,
-							SPA_VIDEO_COLOR_RANGE_16_235,
-							SPA_VIDEO_COLOR_RANGE_0_255),
-			0);
-	}
+	build_yuv_color_params(builder, format);
 	spa_pod_builder_prop(builder, SPA_FORMAT_VIDEO_modifier, SPA_POD_PROP_FLAG_MANDATORY);
 	spa_pod_builder_push_choice(builder, &choice_frame, SPA_CHOICE_Enum, 0);
 	spa_pod_builder_long(builder, modifier); // default
@@ -135,19 +157,9 @@ static void build_format_params(struct spa_pod_builder *builder, spa_video_forma
 		SPA_FORMAT_VIDEO_framerate, SPA_POD_Fraction(&framerate),
 		SPA_FORMAT_VIDEO_requested_size, SPA_POD_CHOICE_RANGE_Rectangle( &min_requested_size, &min_requested_size, &max_requested_size ),
 		SPA_FORMAT_VIDEO_gamescope_focus_appid, SPA_POD_CHOICE_RANGE_Long( 0ll, INT64_MIN, INT64_MAX ),
+		SPA_FORMAT_VIDEO_gamescope_framerate_divisor, SPA_POD_CHOICE_RANGE_Int( 1, 1, INT32_MAX ),
 		0);
-	if (format == SPA_VIDEO_FORMAT_NV12) {
-		spa_pod_builder_add(builder,
-			SPA_FORMAT_VIDEO_colorMatrix, SPA_POD_CHOICE_ENUM_Id(3,
-							SPA_VIDEO_COLOR_MATRIX_BT601,
-							SPA_VIDEO_COLOR_MATRIX_BT601,
-							SPA_VIDEO_COLOR_MATRIX_BT709),
-			SPA_FORMAT_VIDEO_colorRange, SPA_POD_CHOICE_ENUM_Id(3,
-							SPA_VIDEO_COLOR_RANGE_16_235,
-							SPA_VIDEO_COLOR_RANGE_16_235,
-							SPA_VIDEO_COLOR_RANGE_0_255),
-			0);
-	}
+	build_yuv_color_params(builder, format);
 	params.push_back((const struct spa_pod *) spa_pod_builder_pop(builder, &obj_frame));
 
 //	for (auto& param : params)
@@ -155,19 +167,20 @@ static void build_format_params(struct spa_pod_builder *builder, spa_video_forma
 }
 
 
-static std::vector<const struct spa_pod *> build_format_params(struct spa_pod_builder *builder)
+static std::vector<const struct spa_pod *> build_format_params(struct pipewire_stream *stream, struct spa_pod_builder *builder)
 {
 	std::vector<const struct spa_pod *> params;
 
-	build_format_params(builder, SPA_VIDEO_FORMAT_BGRx, params);
-	build_format_params(builder, SPA_VIDEO_FORMAT_NV12, params);
+	build_format_params(stream, builder, SPA_VIDEO_FORMAT_BGRx, params);
+	build_format_params(stream, builder, SPA_VIDEO_FORMAT_NV12, params);
+	build_format_params(stream, builder, SPA_VIDEO_FORMAT_P010_10LE, params);
 
 	return params;
 }
 
-static void request_buffer(struct pipewire_state *state)
+static void request_buffer(struct pipewire_stream *stream)
 {
-	struct pw_buffer *pw_buffer = pw_stream_dequeue_buffer(state->stream);
+	struct pw_buffer *pw_buffer = pw_stream_dequeue_buffer(stream->stream);
 	if (!pw_buffer) {
 		pwr_log.errorf("warning: out of buffers");
 		return;
@@ -178,11 +191,26 @@ static void request_buffer(struct pipewire_state *state)
 
 	// Past this exchange, the PipeWire thread shares the buffer with the
 	// steamcompmgr thread
-	struct pipewire_buffer *old = out_buffer.exchange(buffer);
+	struct pipewire_buffer *old = stream->out_buffer.exchange(buffer);
 	assert(old == nullptr);
 }
 
-static void copy_buffer(struct pipewire_state *state, struct pipewire_buffer *buffer)
+static void copy_plane(uint8_t *pDst, size_t uDstStride, const uint8_t *pSrc, size_t uSrcPitch, uint32_t uRows)
+{
+	if (uDstStride == uSrcPitch) {
+		memcpy(pDst, pSrc, uDstStride * uRows);
+		return;
+	}
+
+	for (uint32_t i = 0; i < uRows; i++) {
+		memcpy(
+			&pDst[i * uDstStride],
+			&pSrc[i * uSrcPitch],
+			std::min(uDstStride, uSrcPitch));
+	}
+}
+
+static void copy_buffer(struct pipewire_stream *stream, struct pipewire_buffer *buffer)
 {
 	gamescope::OwningRc<CVulkanTexture> &tex = buffer->texture;
 	assert(tex != nullptr);
@@ -196,7 +224,7 @@ static void copy_buffer(struct pipewire_state *state, struct pipewire_buffer *bu
 	if (header != nullptr) {
 		header->pts = -1;
 		header->flags = needs_reneg ? SPA_META_HEADER_FLAG_CORRUPTED : 0;
-		header->seq = state->seq++;
+		header->seq = stream->seq++;
 		header->dts_offset = 0;
 	}
 
@@ -205,58 +233,67 @@ static void copy_buffer(struct pipewire_state *state, struct pipewire_buffer *bu
 		*requested_size_scale = ((float)tex->width() / g_nOutputWidth);
 	}
 
-	struct spa_chunk *chunk = spa_buffer->datas[0].chunk;
-	chunk->flags = needs_reneg ? SPA_CHUNK_FLAG_CORRUPTED : 0;
+	struct spa_meta *damage_meta = spa_buffer_find_meta(spa_buffer, SPA_META_VideoDamage);
+	if (damage_meta != nullptr) {
+		gamescope::DamageRect_t damage = buffer->damage && !needs_reneg
+			? *buffer->damage
+			: gamescope::DamageRect_t::FromSize(tex->width(), tex->height());
+
+		struct spa_meta_region *regions = (struct spa_meta_region *) damage_meta->data;
+		uint32_t region_count = damage_meta->size / sizeof(*regions);
+		uint32_t i = 0;
+		if (!damage.IsEmpty() && i < region_count) {
+			regions[i++].region = SPA_REGION(damage.nX0, damage.nY0, (uint32_t)damage.Width(), (uint32_t)damage.Height());
+		}
+		// A zero-sized region terminates the list.
+		if (i < region_count) {
+			regions[i].region = SPA_REGION(0, 0, 0, 0);
+		}
+	}
 
 	struct wlr_dmabuf_attributes dmabuf;
 	switch (buffer->type) {
 	case SPA_DATA_MemFd:
+	{
+		struct spa_chunk *chunk = spa_buffer->datas[0].chunk;
+		chunk->flags = needs_reneg ? SPA_CHUNK_FLAG_CORRUPTED : 0;
 		chunk->offset = 0;
-		chunk->size = state->video_info.size.height * buffer->shm.stride;
-		if (state->video_info.format == SPA_VIDEO_FORMAT_NV12) {
-			chunk->size += ((state->video_info.size.height + 1)/2 * buffer->shm.stride);
-		}
+		chunk->size = get_shm_size(stream->video_info.format, buffer->shm.stride, stream->video_info.size.height);
 		chunk->stride = buffer->shm.stride;
 
 		if (!needs_reneg) {
 			uint8_t *pMappedData = tex->mappedData();
 
-			if (state->video_info.format == SPA_VIDEO_FORMAT_NV12) {
-				for (uint32_t i = 0; i < tex->height(); i++) {
-					const uint32_t lumaPwOffset = 0;
-					memcpy(
-						&buffer->shm.data[lumaPwOffset      + i * buffer->shm.stride],
-						&pMappedData     [tex->lumaOffset() + i * tex->lumaRowPitch()],
-						std::min<size_t>(buffer->shm.stride, tex->lumaRowPitch()));
-				}
-
-				for (uint32_t i = 0; i < (tex->height() + 1) / 2; i++) {
-					const uint32_t chromaPwOffset = tex->height() * buffer->shm.stride;
-					memcpy(
-						&buffer->shm.data[chromaPwOffset      + i * buffer->shm.stride],
-						&pMappedData     [tex->chromaOffset() + i * tex->chromaRowPitch()],
-						std::min<size_t>(buffer->shm.stride, tex->chromaRowPitch()));
-				}
+			if (is_yuv420_format(stream->video_info.format)) {
+				copy_plane(buffer->shm.data, buffer->shm.stride,
+					&pMappedData[tex->lumaOffset()], tex->lumaRowPitch(),
+					tex->height());
+				copy_plane(&buffer->shm.data[tex->height() * buffer->shm.stride], buffer->shm.stride,
+					&pMappedData[tex->chromaOffset()], tex->chromaRowPitch(),
+					(tex->height() + 1) / 2);
 			}
 			else
 			{
-				for (uint32_t i = 0; i < tex->height(); i++) {
-					memcpy(
-						&buffer->shm.data[i * buffer->shm.stride],
-						&pMappedData     [i * tex->rowPitch()],
-						std::min<size_t>(buffer->shm.stride, tex->rowPitch()));
-				}
+				copy_plane(buffer->shm.data, buffer->shm.stride,
+					pMappedData, tex->rowPitch(),
+					tex->height());
 			}
 		}
 		break;
+	}
 	case SPA_DATA_DmaBuf:
+		// Zero-copy: the consumer reads the texture we just rendered into.
 		dmabuf = tex->dmabuf();
-		assert(dmabuf.n_planes == 1);
-		chunk->offset = dmabuf.offset[0];
-		chunk->stride = dmabuf.stride[0];
-		chunk->size = dmabuf.height * chunk->stride;
-		if (state->video_info.format == SPA_VIDEO_FORMAT_NV12) {
-			chunk->size += ((dmabuf.height + 1)/2 * chunk->stride);
+		assert(dmabuf.n_planes <= (int)spa_buffer->n_datas);
+		for (int i = 0; i < dmabuf.n_planes; i++) {
+			// Chroma planes are half height for 4:2:0.
+			const uint32_t uPlaneHeight = i == 0 ? dmabuf.height : (dmabuf.height + 1) / 2;
+
+			struct spa_chunk *chunk = spa_buffer->datas[i].chunk;
+			chunk->flags = needs_reneg ? SPA_CHUNK_FLAG_CORRUPTED : 0;
+			chunk->offset = dmabuf.offset[i];
+			chunk->stride = dmabuf.stride[i];
+			chunk->size = uPlaneHeight * chunk->stride;
 		}
 		break;
 	default:
@@ -264,35 +301,25 @@ static void copy_buffer(struct pipewire_state *state, struct pipewire_buffer *bu
 	}
 }
 
-static void dispatch_nudge(struct pipewire_state *state, int fd)
+static void renegotiate_stream(struct pipewire_stream *stream)
 {
-	while (true) {
-		static char buf[1024];
-		if (read(fd, buf, sizeof(buf)) < 0) {
-			if (errno != EAGAIN)
-				pwr_log.errorf_errno("dispatch_nudge: read failed");
-			break;
-		}
-	}
+	if (stream->capture_width == stream->video_info.size.width && stream->capture_height == stream->video_info.size.height)
+		return;
 
-	if (g_nOutputWidth != s_nOutputWidth || g_nOutputHeight != s_nOutputHeight) {
-		s_nOutputWidth = g_nOutputWidth;
-		s_nOutputHeight = g_nOutputHeight;
-		calculate_capture_size();
-	}
-	if (s_nCaptureWidth != state->video_info.size.width || s_nCaptureHeight != state->video_info.size.height) {
-		pwr_log.debugf("renegotiating stream params (size: %dx%d)", s_nCaptureWidth, s_nCaptureHeight);
+	pwr_log.debugf("renegotiating stream %u params (size: %dx%d)", stream->index, stream->capture_width, stream->capture_height);
 
-		uint8_t buf[4096];
-		struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(buf, sizeof(buf));
-		std::vector<const struct spa_pod *> format_params = build_format_params(&builder);
-		int ret = pw_stream_update_params(state->stream, format_params.data(), format_params.size());
-		if (ret < 0) {
-			pwr_log.errorf("pw_stream_update_params failed");
-		}
+	uint8_t buf[4096];
+	struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(buf, sizeof(buf));
+	std::vector<const struct spa_pod *> format_params = build_format_params(stream, &builder);
+	int ret = pw_stream_update_params(stream->stream, format_params.data(), format_params.size());
+	if (ret < 0) {
+		pwr_log.errorf("pw_stream_update_params failed");
 	}
+}
 
-	struct pipewire_buffer *buffer = in_buffer.exchange(nullptr);
+static void dispatch_stream_buffer(struct pipewire_stream *stream)
+{
+	struct pipewire_buffer *buffer = stream->in_buffer.exchange(nullptr);
 	if (buffer != nullptr) {
 		// We now completely own the buffer, it's no longer shared with the
 		// steamcompmgr thread.
@@ -300,9 +327,9 @@ static void dispatch_nudge(struct pipewire_state *state, int fd)
 		buffer->copying = false;
 
 		if (buffer->buffer != nullptr) {
-			copy_buffer(state, buffer);
+			copy_buffer(stream, buffer);
 
-			int ret = pw_stream_queue_buffer(state->stream, buffer->buffer);
+			int ret = pw_stream_queue_buffer(stream->stream, buffer->buffer);
 			if (ret < 0) {
 				pwr_log.errorf("pw_stream_queue_buffer failed");
 			}
@@ -312,26 +339,51 @@ static void dispatch_nudge(struct pipewire_state *state, int fd)
 	}
 }
 
+static void dispatch_nudge(struct pipewire_state *state, int fd)
+{
+	while (true) {
+		static char buf[1024];
+		if (read(fd, buf, sizeof(buf)) < 0) {
+			if (errno != EAGAIN)
+				pwr_log.errorf_errno("dispatch_nudge: read failed");
+			break;
+		}
+	}
+
+	const bool bOutputSizeChanged = g_nOutputWidth != s_nOutputWidth || g_nOutputHeight != s_nOutputHeight;
+	if (bOutputSizeChanged) {
+		s_nOutputWidth = g_nOutputWidth;
+		s_nOutputHeight = g_nOutputHeight;
+	}
+
+	for (auto &stream : state->streams) {
+		if (bOutputSizeChanged)
+			calculate_capture_size(stream.get());
+		renegotiate_stream(stream.get());
+		dispatch_stream_buffer(stream.get());
+	}
+}
+
 static void stream_handle_state_changed(void *data, enum pw_stream_state old_stream_state, enum pw_stream_state stream_state, const char *error)
 {
-	struct pipewire_state *state = (struct pipewire_state *) data;
+	struct pipewire_stream *stream = (struct pipewire_stream *) data;
 
-	pwr_log.infof("stream state changed: %s", pw_stream_state_as_string(stream_state));
+	pwr_log.infof("stream %u state changed: %s", stream->index, pw_stream_state_as_string(stream_state));
 
 	switch (stream_state) {
 	case PW_STREAM_STATE_PAUSED:
-		if (state->stream_node_id == SPA_ID_INVALID) {
-			state->stream_node_id = pw_stream_get_node_id(state->stream);
+		if (stream->stream_node_id == SPA_ID_INVALID) {
+			stream->stream_node_id = pw_stream_get_node_id(stream->stream);
 		}
-		state->streaming = false;
-		state->seq = 0;
+		stream->streaming = false;
+		stream->seq = 0;
 		break;
 	case PW_STREAM_STATE_STREAMING:
-		state->streaming = true;
+		stream->streaming = true;
 		break;
 	case PW_STREAM_STATE_ERROR:
 	case PW_STREAM_STATE_UNCONNECTED:
-		state->running = false;
+		stream->state->running = false;
 		break;
 	default:
 		break;
@@ -340,51 +392,55 @@ static void stream_handle_state_changed(void *data, enum pw_stream_state old_str
 
 static void stream_handle_param_changed(void *data, uint32_t id, const struct spa_pod *param)
 {
-	struct pipewire_state *state = (struct pipewire_state *) data;
+	struct pipewire_stream *stream = (struct pipewire_stream *) data;
 
 	if (param == nullptr || id != SPA_PARAM_Format)
 		return;
 
 	struct spa_gamescope gamescope_info{};
 
-	int ret = spa_format_video_raw_parse_with_gamescope(param, &state->video_info, &gamescope_info);
+	int ret = spa_format_video_raw_parse_with_gamescope(param, &stream->video_info, &gamescope_info);
 	if (ret < 0) {
 		pwr_log.errorf("spa_format_video_raw_parse failed");
 		return;
 	}
-	s_nRequestedWidth = gamescope_info.requested_size.width;
-	s_nRequestedHeight = gamescope_info.requested_size.height;
-	calculate_capture_size();
+	stream->requested_width = gamescope_info.requested_size.width;
+	stream->requested_height = gamescope_info.requested_size.height;
+	calculate_capture_size(stream);
 
-	state->gamescope_info = gamescope_info;
+	if (gamescope_info.framerate_divisor < 1)
+		gamescope_info.framerate_divisor = 1;
+
+	stream->gamescope_info = gamescope_info;
 
 	int bpp = 4;
-	if (state->video_info.format == SPA_VIDEO_FORMAT_NV12) {
+	if (stream->video_info.format == SPA_VIDEO_FORMAT_NV12) {
 		bpp = 1;
+	} else if (stream->video_info.format == SPA_VIDEO_FORMAT_P010_10LE) {
+		bpp = 2;
 	}
 
-	state->shm_stride = SPA_ROUND_UP_N(state->video_info.size.width * bpp, 4);
+	stream->shm_stride = SPA_ROUND_UP_N(stream->video_info.size.width * bpp, 4);
 
 	const struct spa_pod_prop *modifier_prop = spa_pod_find_prop(param, nullptr, SPA_FORMAT_VIDEO_modifier);
-	state->dmabuf = modifier_prop != nullptr;
+	stream->dmabuf = modifier_prop != nullptr;
 
 	uint8_t buf[1024];
 	struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(buf, sizeof(buf));
 
 	int buffers = 4;
-	int shm_size = state->shm_stride * state->video_info.size.height;
-	if (state->video_info.format == SPA_VIDEO_FORMAT_NV12) {
-		shm_size += ((state->video_info.size.height + 1) / 2) * state->shm_stride;
-	}
-	int data_type = state->dmabuf ? (1 << SPA_DATA_DmaBuf) : (1 << SPA_DATA_MemFd);
+	int shm_size = get_shm_size(stream->video_info.format, stream->shm_stride, stream->video_info.size.height);
+	int data_type = stream->dmabuf ? (1 << SPA_DATA_DmaBuf) : (1 << SPA_DATA_MemFd);
+	// Shared memory packs both planes into one block, DMA-BUFs get one per plane.
+	int blocks = stream->dmabuf && is_yuv420_format(stream->video_info.format) ? 2 : 1;
 
 	const struct spa_pod *buffers_param =
 		(const struct spa_pod *) spa_pod_builder_add_object(&builder,
 		SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
 		SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(buffers, 1, 8),
-		SPA_PARAM_BUFFERS_blocks, SPA_POD_Int(1),
+		SPA_PARAM_BUFFERS_blocks, SPA_POD_Int(blocks),
 		SPA_PARAM_BUFFERS_size, SPA_POD_Int(shm_size),
-		SPA_PARAM_BUFFERS_stride, SPA_POD_Int(state->shm_stride),
+		SPA_PARAM_BUFFERS_stride, SPA_POD_Int(stream->shm_stride),
 		SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(data_type));
 	const struct spa_pod *meta_param =
 		(const struct spa_pod *) spa_pod_builder_add_object(&builder,
@@ -396,17 +452,27 @@ static void stream_handle_param_changed(void *data, uint32_t id, const struct sp
 		SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
 		SPA_PARAM_META_type, SPA_POD_Id(SPA_META_requested_size_scale),
 		SPA_PARAM_META_size, SPA_POD_Int(sizeof(float)));
-	const struct spa_pod *params[] = { buffers_param, meta_param, scale_param };
-
-	ret = pw_stream_update_params(state->stream, params, sizeof(params) / sizeof(params[0]));
+	const struct spa_pod *damage_param =
+		(const struct spa_pod *) spa_pod_builder_add_object(&builder,
+		SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+		SPA_PARAM_META_type, SPA_POD_Id(SPA_META_VideoDamage),
+		SPA_PARAM_META_size, SPA_POD_CHOICE_RANGE_Int(
+			sizeof(struct spa_meta_region) * 16,
+			sizeof(struct spa_meta_region),
+			sizeof(struct spa_meta_region) * 16));
+	const struct spa_pod *params[] = { buffers_param, meta_param, scale_param, damage_param };
+
+	ret = pw_stream_update_params(stream->stream, params, sizeof(params) / sizeof(params[0]));
 	if (ret != 0) {
 		pwr_log.errorf("pw_stream_update_params failed");
 	}
 
-	pwr_log.debugf("format changed (size: %dx%d, requested %dx%d, format %d, stride %d, size: %d, dmabuf: %d)",
-		state->video_info.size.width, state->video_info.size.height,
-		s_nRequestedWidth, s_nRequestedHeight,
-		state->video_info.format, state->shm_stride, shm_size, state->dmabuf);
+	pwr_log.debugf("stream %u format changed (size: %dx%d, requested %dx%d, format %d, stride %d, size: %d, dmabuf: %d, framerate divisor: %d)",
+		stream->index,
+		stream->video_info.size.width, stream->video_info.size.height,
+		stream->requested_width, stream->requested_height,
+		stream->video_info.format, stream->shm_stride, shm_size, stream->dmabuf,
+		stream->gamescope_info.framerate_divisor);
 }
 
 static void randname(char *buf)
@@ -445,6 +511,7 @@ uint32_t spa_format_to_drm(uint32_t spa_format)
 	switch (spa_format)
 	{
 		case SPA_VIDEO_FORMAT_NV12: return DRM_FORMAT_NV12;
+		case SPA_VIDEO_FORMAT_P010_10LE: return DRM_FORMAT_P010;
 		default:
 		case SPA_VIDEO_FORMAT_BGR: return DRM_FORMAT_XRGB8888;
 	}
@@ -452,23 +519,24 @@ uint32_t spa_format_to_drm(uint32_t spa_format)
 
 static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffer)
 {
-	struct pipewire_state *state = (struct pipewire_state *) user_data;
+	struct pipewire_stream *stream = (struct pipewire_stream *) user_data;
 
 	struct spa_buffer *spa_buffer = pw_buffer->buffer;
 	struct spa_data *spa_data = &spa_buffer->datas[0];
 
 	struct pipewire_buffer *buffer = new pipewire_buffer();
 	buffer->buffer = pw_buffer;
-	buffer->video_info = state->video_info;
-	buffer->gamescope_info = state->gamescope_info;
+	buffer->video_info = stream->video_info;
+	buffer->gamescope_info = stream->gamescope_info;
+	buffer->stream = stream;
 
 	bool is_dmabuf = (spa_data->type & (1 << SPA_DATA_DmaBuf)) != 0;
 	bool is_memfd = (spa_data->type & (1 << SPA_DATA_MemFd)) != 0;
 
 	EStreamColorspace colorspace = k_EStreamColorspace_Unknown;
-	switch (state->video_info.color_matrix) {
+	switch (stream->video_info.color_matrix) {
 	case SPA_VIDEO_COLOR_MATRIX_BT601:
-		switch (state->video_info.color_range) {
+		switch (stream->video_info.color_range) {
 		case SPA_VIDEO_COLOR_RANGE_16_235:
 			colorspace = k_EStreamColorspace_BT601;
 			break;
@@ -480,7 +548,7 @@ static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffe
 		}
 		break;
 	case SPA_VIDEO_COLOR_MATRIX_BT709:
-		switch (state->video_info.color_range) {
+		switch (stream->video_info.color_range) {
 		case SPA_VIDEO_COLOR_RANGE_16_235:
 			colorspace = k_EStreamColorspace_BT709;
 			break;
@@ -491,23 +559,32 @@ static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffe
 			break;
 		}
 		break;
+	case SPA_VIDEO_COLOR_MATRIX_BT2020:
+		// Always PQ, SDR output gets PQ-encoded during the capture conversion.
+		colorspace = k_EStreamColorspace_BT2020_PQ;
+		break;
 	default:
 		break;
 	}
 
-	uint32_t drmFormat = spa_format_to_drm(state->video_info.format);
+	uint32_t drmFormat = spa_format_to_drm(stream->video_info.format);
 
 	buffer->texture = new CVulkanTexture();
 	CVulkanTexture::createFlags screenshotImageFlags;
-	screenshotImageFlags.bMappable = true;
+	// Only the shm path reads the texture back on the CPU, DMA-BUF consumers
+	// import it directly so it can stay in device-local memory.
+	screenshotImageFlags.bMappable = !is_dmabuf;
 	screenshotImageFlags.bTransferDst = true;
+	// Streams sharing a capture get copied to/from each other.
+	screenshotImageFlags.bTransferSrc = true;
 	screenshotImageFlags.bStorage = true;
-	if (is_dmabuf || drmFormat == DRM_FORMAT_NV12)
+	if (is_dmabuf || is_yuv420_format(stream->video_info.format))
 	{
 		screenshotImageFlags.bExportable = true;
-		screenshotImageFlags.bLinear = true; // TODO: support multi-planar DMA-BUF export via PipeWire
+		// We only advertise DRM_FORMAT_MOD_LINEAR, see build_format_params.
+		screenshotImageFlags.bLinear = true;
 	}
-	bool bImageInitSuccess = buffer->texture->BInit( s_nCaptureWidth, s_nCaptureHeight, 1u, drmFormat, screenshotImageFlags );
+	bool bImageInitSuccess = buffer->texture->BInit( stream->capture_width, stream->capture_height, 1u, drmFormat, screenshotImageFlags );
 	if ( !bImageInitSuccess )
 	{
 		pwr_log.errorf("Failed to initialize pipewire texture");
@@ -517,9 +594,9 @@ static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffe
 
 	if (is_dmabuf) {
 		const struct wlr_dmabuf_attributes dmabuf = buffer->texture->dmabuf();
-		if (dmabuf.n_planes != 1)
+		if (dmabuf.n_planes > (int)spa_buffer->n_datas)
 		{
-			pwr_log.errorf("dmabuf.n_planes != 1");
+			pwr_log.errorf("dmabuf has %d planes, but PipeWire gave us %u datas", dmabuf.n_planes, spa_buffer->n_datas);
 			goto error;
 		}
 
@@ -531,12 +608,16 @@ static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffe
 
 		buffer->type = SPA_DATA_DmaBuf;
 
-		spa_data->type = SPA_DATA_DmaBuf;
-		spa_data->flags = SPA_DATA_FLAG_READABLE;
-		spa_data->fd = dmabuf.fd[0];
-		spa_data->mapoffset = dmabuf.offset[0];
-		spa_data->maxsize = size;
-		spa_data->data = nullptr;
+		// The planes share one allocation, each data gets its own dup of the FD.
+		for (int i = 0; i < dmabuf.n_planes; i++) {
+			struct spa_data *plane_data = &spa_buffer->datas[i];
+			plane_data->type = SPA_DATA_DmaBuf;
+			plane_data->flags = SPA_DATA_FLAG_READABLE;
+			plane_data->fd = dmabuf.fd[i];
+			plane_data->mapoffset = dmabuf.offset[i];
+			plane_data->maxsize = size - dmabuf.offset[i];
+			plane_data->data = nullptr;
+		}
 	} else if (is_memfd) {
 		int fd = anonymous_shm_open();
 		if (fd < 0) {
@@ -544,10 +625,7 @@ static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffe
 			goto error;
 		}
 
-		off_t size = state->shm_stride * state->video_info.size.height;
-		if (state->video_info.format == SPA_VIDEO_FORMAT_NV12) {
-			size += state->shm_stride * ((state->video_info.size.height + 1) / 2);
-		}
+		off_t size = get_shm_size(stream->video_info.format, stream->shm_stride, stream->video_info.size.height);
 		if (ftruncate(fd, size) != 0) {
 			pwr_log.errorf_errno("ftruncate failed");
 			close(fd);
@@ -562,7 +640,7 @@ static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffe
 		}
 
 		buffer->type = SPA_DATA_MemFd;
-		buffer->shm.stride = state->shm_stride;
+		buffer->shm.stride = stream->shm_stride;
 		buffer->shm.data = (uint8_t *) data;
 		buffer->shm.fd = fd;
 
@@ -655,12 +733,55 @@ static void run_pipewire(struct pipewire_state *state)
 	}
 
 	pwr_log.infof("exiting");
-	pw_stream_destroy(state->stream);
+	for (auto &stream : state->streams)
+		pw_stream_destroy(stream->stream);
 	pw_core_disconnect(state->core);
 	pw_context_destroy(state->context);
 	pw_loop_destroy(state->loop);
 }
 
+static bool create_stream(struct pipewire_state *state, uint32_t index)
+{
+	std::unique_ptr<pipewire_stream> stream = std::make_unique<pipewire_stream>();
+	stream->state = state;
+	stream->index = index;
+	stream->stream_node_id = SPA_ID_INVALID;
+
+	// Keep the first stream's name stable for existing consumers.
+	char name[64];
+	if (index == 0)
+		snprintf(name, sizeof(name), "gamescope");
+	else
+		snprintf(name, sizeof(name), "gamescope-%u", index);
+
+	stream->stream = pw_stream_new(state->core, name,
+		pw_properties_new(
+			PW_KEY_MEDIA_CLASS, "Video/Source",
+			nullptr));
+	if (!stream->stream) {
+		pwr_log.errorf("pw_stream_new failed");
+		return false;
+	}
+
+	pw_stream_add_listener(stream->stream, &stream->stream_hook, &stream_events, stream.get());
+
+	calculate_capture_size(stream.get());
+
+	uint8_t buf[4096];
+	struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(buf, sizeof(buf));
+	std::vector<const struct spa_pod *> format_params = build_format_params(stream.get(), &builder);
+
+	enum pw_stream_flags flags = (enum pw_stream_flags)(PW_STREAM_FLAG_DRIVER | PW_STREAM_FLAG_ALLOC_BUFFERS);
+	int ret = pw_stream_connect(stream->stream, PW_DIRECTION_OUTPUT, PW_ID_ANY, flags, format_params.data(), format_params.size());
+	if (ret != 0) {
+		pwr_log.errorf("pw_stream_connect failed");
+		return false;
+	}
+
+	state->streams.push_back(std::move(stream));
+	return true;
+}
+
 bool init_pipewire(void)
 {
 	struct pipewire_state *state = &pipewire_state;
@@ -690,45 +811,27 @@ bool init_pipewire(void)
 		return false;
 	}
 
-	state->stream = pw_stream_new(state->core, "gamescope",
-		pw_properties_new(
-			PW_KEY_MEDIA_CLASS, "Video/Source",
-			nullptr));
-	if (!state->stream) {
-		pwr_log.errorf("pw_stream_new failed");
-		return false;
-	}
-
-	static struct spa_hook stream_hook;
-	pw_stream_add_listener(state->stream, &stream_hook, &stream_events, state);
-
-	s_nRequestedWidth = 0;
-	s_nRequestedHeight = 0;
 	s_nOutputWidth = g_nOutputWidth;
 	s_nOutputHeight = g_nOutputHeight;
-	calculate_capture_size();
 
-	uint8_t buf[4096];
-	struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(buf, sizeof(buf));
-	std::vector<const struct spa_pod *> format_params = build_format_params(&builder);
-
-	enum pw_stream_flags flags = (enum pw_stream_flags)(PW_STREAM_FLAG_DRIVER | PW_STREAM_FLAG_ALLOC_BUFFERS);
-	int ret = pw_stream_connect(state->stream, PW_DIRECTION_OUTPUT, PW_ID_ANY, flags, format_params.data(), format_params.size());
-	if (ret != 0) {
-		pwr_log.errorf("pw_stream_connect failed");
-		return false;
+	const uint32_t uStreamCount = std::max(g_nPipewireStreamCount, 1);
+	for (uint32_t i = 0; i < uStreamCount; i++) {
+		if (!create_stream(state, i))
+			return false;
 	}
 
 	state->running = true;
-	while (state->stream_node_id == SPA_ID_INVALID) {
-		int ret = pw_loop_iterate(state->loop, -1);
-		if (ret < 0) {
-			pwr_log.errorf("pw_loop_iterate failed");
-			return false;
+	for (auto &stream : state->streams) {
+		while (stream->stream_node_id == SPA_ID_INVALID) {
+			int ret = pw_loop_iterate(state->loop, -1);
+			if (ret < 0) {
+				pwr_log.errorf("pw_loop_iterate failed");
+				return false;
+			}
 		}
-	}
 
-	pwr_log.infof("stream available on node ID: %u", state->stream_node_id);
+		pwr_log.infof("stream %u available on node ID: %u", stream->index, stream->stream_node_id);
+	}
 
 	std::thread thread(run_pipewire, state);
 	thread.detach();
@@ -736,29 +839,49 @@ bool init_pipewire(void)
 	return true;
 }
 
-uint32_t get_pipewire_stream_node_id(void)
+uint32_t get_pipewire_stream_count(void)
 {
-	return pipewire_state.stream_node_id;
+	return pipewire_state.streams.size();
+}
+
+uint32_t get_pipewire_stream_node_id(uint32_t stream_index)
+{
+	if (stream_index >= pipewire_state.streams.size())
+		return SPA_ID_INVALID;
+	return pipewire_state.streams[stream_index]->stream_node_id;
+}
+
+bool pipewire_is_streaming(uint32_t stream_index)
+{
+	if (stream_index >= pipewire_state.streams.size())
+		return false;
+	return pipewire_state.streams[stream_index]->streaming;
 }
 
 bool pipewire_is_streaming()
 {
-	struct pipewire_state *state = &pipewire_state;
-	return state->streaming;
+	for (auto &stream : pipewire_state.streams) {
+		if (stream->streaming)
+			return true;
+	}
+	return false;
 }
 
-struct pipewire_buffer *dequeue_pipewire_buffer(void)
+struct pipewire_buffer *dequeue_pipewire_buffer(uint32_t stream_index)
 {
-	struct pipewire_state *state = &pipewire_state;
-	if (state->streaming) {
-		request_buffer(state);
+	if (stream_index >= pipewire_state.streams.size())
+		return nullptr;
+
+	struct pipewire_stream *stream = pipewire_state.streams[stream_index].get();
+	if (stream->streaming) {
+		request_buffer(stream);
 	}
-	return out_buffer.exchange(nullptr);
+	return stream->out_buffer.exchange(nullptr);
 }
 
 void push_pipewire_buffer(struct pipewire_buffer *buffer)
 {
-	struct pipewire_buffer *old = in_buffer.exchange(buffer);
+	struct pipewire_buffer *old = buffer->stream->in_buffer.exchange(buffer);
 	if ( old != nullptr )
 	{
 		pwr_log.errorf_errno("push_pipewire_buffer: Already had a buffer?!");
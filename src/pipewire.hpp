@@ -1,27 +1,54 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include <pipewire/pipewire.h>
 #include <spa/param/video/format-utils.h>
 
 #include "rendervulkan.hpp"
 #include "pipewire_gamescope.hpp"
+#include "CaptureDamage.h"
 
-struct pipewire_state {
-	struct pw_loop *loop;
-	struct pw_context *context;
-	struct pw_core *core;
-	bool running;
+struct pipewire_buffer;
+
+/**
+ * One PipeWire video source. Each stream negotiates its own size, format,
+ * focus appid and frame-rate divisor with its consumer.
+ */
+struct pipewire_stream {
+	struct pipewire_state *state;
+	uint32_t index;
 
 	struct pw_stream *stream;
+	struct spa_hook stream_hook;
 	uint32_t stream_node_id;
 	std::atomic<bool> streaming;
 	struct spa_video_info_raw video_info;
 	struct spa_gamescope gamescope_info;
-	uint64_t focus_appid;
 	bool dmabuf;
 	int shm_stride;
 	uint64_t seq;
+
+	// Requested capture size
+	uint32_t requested_width;
+	uint32_t requested_height;
+	uint32_t capture_width;
+	uint32_t capture_height;
+
+	// Pending buffer for PipeWire → steamcompmgr
+	std::atomic<struct pipewire_buffer *> out_buffer;
+	// Pending buffer for steamcompmgr → PipeWire
+	std::atomic<struct pipewire_buffer *> in_buffer;
+};
+
+struct pipewire_state {
+	struct pw_loop *loop;
+	struct pw_context *context;
+	struct pw_core *core;
+	bool running;
+
+	// Created in init_pipewire, fixed afterwards.
+	std::vector<std::unique_ptr<pipewire_stream>> streams;
 };
 
 /**
@@ -33,8 +60,18 @@ struct pipewire_buffer {
 	enum spa_data_type type; // SPA_DATA_MemFd or SPA_DATA_DmaBuf
 	struct spa_video_info_raw video_info;
 	struct spa_gamescope gamescope_info;
+	struct pipewire_stream *stream;
 	gamescope::OwningRc<CVulkanTexture> texture;
 
+	// Set by steamcompmgr before pushing: what changed in the texture since
+	// this buffer was last sent, or nullopt if the whole frame should be
+	// considered damaged.
+	std::optional<gamescope::DamageRect_t> damage;
+	// Capture cache and frame serial the texture contents came from, only
+	// touched by steamcompmgr.
+	uint64_t capture_cache_id;
+	uint64_t capture_serial;
+
 	// Only used for SPA_DATA_MemFd
 	struct {
 		int stride;
@@ -56,9 +93,11 @@ struct pipewire_buffer {
 };
 
 bool init_pipewire(void);
-uint32_t get_pipewire_stream_node_id(void);
-struct pipewire_buffer *dequeue_pipewire_buffer(void);
+uint32_t get_pipewire_stream_count(void);
+uint32_t get_pipewire_stream_node_id(uint32_t stream_index);
+struct pipewire_buffer *dequeue_pipewire_buffer(uint32_t stream_index);
 bool pipewire_is_streaming();
+bool pipewire_is_streaming(uint32_t stream_index);
 void pipewire_destroy_buffer(struct pipewire_buffer *buffer);
 void push_pipewire_buffer(struct pipewire_buffer *buffer);
 void nudge_pipewire(void);
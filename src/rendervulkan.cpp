@@ -1,6 +1,7 @@
 // Initialize Vulkan and composite stuff with a compute queue
 
 #include <cassert>
+#include <cinttypes>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -8,8 +9,10 @@
 #include <sys/stat.h>
 #include <algorithm>
 #include <array>
+#include <bit>
 #include <bitset>
 #include <thread>
+#include <filesystem>
 #include <dlfcn.h>
 #include "vulkan_include.h"
 #include "Utils/Algorithm.h"
@@ -37,6 +40,8 @@
 #include "steamcompmgr.hpp"
 #include "log.hpp"
 #include "Utils/Process.h"
+#include "gpuvis_trace_utils.h"
+#include "FrameTrace.h"
 
 #include "cs_composite_blit.h"
 #include "cs_composite_blur.h"
@@ -48,6 +53,7 @@
 #include "cs_nis.h"
 #include "cs_nis_fp16.h"
 #include "cs_rgb_to_nv12.h"
+#include "cs_rgb_to_yuv444.h"
 
 #define A_CPU
 #include "shaders/ffx_a.h"
@@ -81,6 +87,13 @@ static constexpr mat3x4 g_rgb2yuv_srgb_to_bt709_full = {{
   { 0.5000f, -0.4542f, -0.0458f, 0.5f },
 }};
 
+// Input is already PQ-encoded, so this is used with the transfer function passed through.
+static constexpr mat3x4 g_rgb2yuv_bt2020_limited = {{
+  { 0.2256f, 0.5823f, 0.0509f, 0.0625f },
+  { -0.1227f, -0.3166f, 0.4392f, 0.5f },
+  { 0.4392f, -0.4039f, -0.0353f, 0.5f },
+}};
+
 static const mat3x4& colorspace_to_conversion_from_srgb_matrix(EStreamColorspace colorspace) {
 	switch (colorspace) {
 		default:
@@ -88,9 +101,29 @@ static const mat3x4& colorspace_to_conversion_from_srgb_matrix(EStreamColorspace
 		case k_EStreamColorspace_BT601_Full:	return g_rgb2yuv_srgb_to_bt601;
 		case k_EStreamColorspace_BT709:			return g_rgb2yuv_srgb_to_bt709_limited;
 		case k_EStreamColorspace_BT709_Full:	return g_rgb2yuv_srgb_to_bt709_full;
+		case k_EStreamColorspace_BT2020_PQ:		return g_rgb2yuv_bt2020_limited;
 	}
 }
 
+// How the capture conversion encodes the composite before the YUV matrix,
+// must match cs_rgb_to_nv12.comp.
+enum ECaptureEncodeTF : uint32_t
+{
+	k_ECaptureEncodeTF_sRGB = 0,
+	// Composite is already PQ.
+	k_ECaptureEncodeTF_Passthrough = 1,
+	// Linear BT.709 SDR composite, encode it as BT.2020 PQ.
+	k_ECaptureEncodeTF_PQ = 2,
+};
+
+// BT.2020 streams are always PQ, whatever we're outputting.
+static ECaptureEncodeTF colorspace_to_capture_encode_tf(EStreamColorspace colorspace, EOTF compositeTF) {
+	if (colorspace != k_EStreamColorspace_BT2020_PQ)
+		return k_ECaptureEncodeTF_sRGB;
+
+	return compositeTF == EOTF_PQ ? k_ECaptureEncodeTF_Passthrough : k_ECaptureEncodeTF_PQ;
+}
+
 PFN_vkGetInstanceProcAddr g_pfn_vkGetInstanceProcAddr;
 PFN_vkCreateInstance g_pfn_vkCreateInstance;
 
@@ -129,6 +162,10 @@ static struct wlr_drm_format_set sampledDRMFormats = {};
 
 static LogScope vk_log("vulkan");
 
+static gamescope::ConVar<bool> cv_vulkan_pipeline_cache{ "vulkan_pipeline_cache", true, "Whether or not to load and save composite pipelines to an on-disk cache." };
+static gamescope::ConVar<bool> cv_vulkan_pipeline_warmup_all{ "vulkan_pipeline_warmup_all", false, "Compile the full pipeline permutation space in the background even when we have usage history." };
+static gamescope::ConVar<uint32_t> cv_vulkan_pipeline_hot_set_size{ "vulkan_pipeline_hot_set_size", 256, "Maximum number of previously used pipeline permutations to warm up at startup." };
+
 static void vk_errorf(VkResult result, const char *fmt, ...) {
 	static char buf[1024];
 	va_list args;
@@ -200,6 +237,8 @@ struct {
 	{ DRM_FORMAT_XBGR8888, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R8G8B8A8_SRGB, 4, false, false },
 	{ DRM_FORMAT_RGB565, VK_FORMAT_R5G6B5_UNORM_PACK16, VK_FORMAT_R5G6B5_UNORM_PACK16, 1, false, false },
 	{ DRM_FORMAT_NV12, VK_FORMAT_G8_B8R8_2PLANE_420_UNORM, VK_FORMAT_G8_B8R8_2PLANE_420_UNORM, 0, false, false },
+	// Only used as a capture target.
+	{ DRM_FORMAT_P010, VK_FORMAT_G10X6_B10X6R10X6_2PLANE_420_UNORM_3PACK16, VK_FORMAT_G10X6_B10X6R10X6_2PLANE_420_UNORM_3PACK16, 0, false, true },
 	{ DRM_FORMAT_ABGR16161616F, VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT, 8, true, false },
 	{ DRM_FORMAT_XBGR16161616F, VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT, 8, false, false },
 	{ DRM_FORMAT_ABGR16161616, VK_FORMAT_R16G16B16A16_UNORM, VK_FORMAT_R16G16B16A16_UNORM, 8, true, false },
@@ -293,13 +332,14 @@ bool CVulkanDevice::BInit(VkInstance instance, VkSurfaceKHR surface)
 		return false;
 	if (!createShaders())
 		return false;
+	if (!createPipelineCache())
+		return false;
 	if (!createScratchResources())
 		return false;
 
 	m_bInitialized = true;
 
-	std::thread piplelineThread([this](){compileAllPipelines();});
-	piplelineThread.detach();
+	m_pipelineThread = std::thread([this](){pipelineThreadMain();});
 
 	g_reshadeManager.init(this);
 
@@ -435,6 +475,21 @@ bool CVulkanDevice::createDevice()
 	if ( !GetBackend()->ValidPhysicalDevice( physDev() ) )
 		return false;
 
+	{
+		VkPhysicalDeviceProperties props;
+		vk.GetPhysicalDeviceProperties( physDev(), &props );
+
+		uint32_t queueFamilyCount = 0;
+		vk.GetPhysicalDeviceQueueFamilyProperties( physDev(), &queueFamilyCount, nullptr );
+		std::vector<VkQueueFamilyProperties> queueFamilyProperties( queueFamilyCount );
+		vk.GetPhysicalDeviceQueueFamilyProperties( physDev(), &queueFamilyCount, queueFamilyProperties.data() );
+
+		uint32_t uTimestampValidBits = m_queueFamily < queueFamilyCount ? queueFamilyProperties[ m_queueFamily ].timestampValidBits : 0;
+		m_bSupportsTimestamps = uTimestampValidBits != 0 && props.limits.timestampPeriod > 0.0f;
+		m_ulTimestampMask = uTimestampValidBits >= 64 ? ~0ull : ( ( 1ull << uTimestampValidBits ) - 1 );
+		m_flTimestampPeriod = props.limits.timestampPeriod;
+	}
+
 #if HAVE_DRM
 	// XXX(JoshA): Move this to ValidPhysicalDevice.
 	// We need to refactor some Vulkan stuff to do that though.
@@ -678,6 +733,9 @@ static VkSamplerYcbcrModelConversion colorspaceToYCBCRModel( EStreamColorspace c
 		case k_EStreamColorspace_BT709:
 		case k_EStreamColorspace_BT709_Full:
 			return VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_709;
+
+		case k_EStreamColorspace_BT2020_PQ:
+			return VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_2020;
 	}
 }
 
@@ -691,6 +749,7 @@ static VkSamplerYcbcrRange colorspaceToYCBCRRange( EStreamColorspace colorspace
 
 		case k_EStreamColorspace_BT709:
 		case k_EStreamColorspace_BT601:
+		case k_EStreamColorspace_BT2020_PQ:
 			return VK_SAMPLER_YCBCR_RANGE_ITU_NARROW;
 
 		case k_EStreamColorspace_BT601_Full:
@@ -897,6 +956,19 @@ bool CVulkanDevice::createPools()
 	return true;
 }
 
+static constexpr uint64_t k_ulFNV1aOffsetBasis = 0xcbf29ce484222325ull;
+
+static uint64_t fnv1a64( uint64_t ulHash, const void *pData, size_t uSize )
+{
+	const uint8_t *pBytes = reinterpret_cast<const uint8_t *>( pData );
+	for ( size_t i = 0; i < uSize; i++ )
+	{
+		ulHash ^= pBytes[i];
+		ulHash *= 0x100000001b3ull;
+	}
+	return ulHash;
+}
+
 bool CVulkanDevice::createShaders()
 {
 	struct ShaderInfo_t
@@ -923,8 +995,13 @@ bool CVulkanDevice::createShaders()
 		SHADER(NIS, cs_nis);
 	}
 	SHADER(RGB_TO_NV12, cs_rgb_to_nv12);
+	SHADER(RGB_TO_YUV444, cs_rgb_to_yuv444);
 #undef SHADER
 
+	m_ulShaderHash = k_ulFNV1aOffsetBasis;
+	for (uint32_t i = 0; i < shaderInfos.size(); i++)
+		m_ulShaderHash = fnv1a64(m_ulShaderHash, shaderInfos[i].spirv, shaderInfos[i].size);
+
 	for (uint32_t i = 0; i < shaderInfos.size(); i++)
 	{
 		VkShaderModuleCreateInfo shaderCreateInfo = {
@@ -944,6 +1021,184 @@ bool CVulkanDevice::createShaders()
 	return true;
 }
 
+std::string_view GetHomeDir();
+
+static std::string GetPipelineCacheDir()
+{
+	const char *pszCacheHome = getenv( "XDG_CACHE_HOME" );
+	if ( pszCacheHome && *pszCacheHome )
+		return std::string{ pszCacheHome } + "/gamescope";
+
+	return std::string{ GetHomeDir() } + "/.cache/gamescope";
+}
+
+// Wraps the driver's blob so we can reject truncated or stale files
+// before handing them to the driver.
+struct PipelineCacheFileHeader_t
+{
+	static constexpr uint32_t k_uMagic = 0x43505347; // 'GSPC'
+	static constexpr uint32_t k_uVersion = 1;
+
+	uint32_t uMagic;
+	uint32_t uVersion;
+	uint64_t ulShaderHash;
+	uint64_t ulDataSize;
+	uint64_t ulDataHash;
+};
+
+static std::vector<uint8_t> ReadPipelineCacheFile( const std::string &sPath, uint64_t ulShaderHash, const VkPhysicalDeviceProperties &props )
+{
+	FILE *pFile = fopen( sPath.c_str(), "rb" );
+	if ( !pFile )
+		return {};
+
+	std::vector<uint8_t> data;
+
+	PipelineCacheFileHeader_t header;
+	if ( fread( &header, sizeof( header ), 1, pFile ) == 1 &&
+		 header.uMagic == PipelineCacheFileHeader_t::k_uMagic &&
+		 header.uVersion == PipelineCacheFileHeader_t::k_uVersion &&
+		 header.ulShaderHash == ulShaderHash &&
+		 header.ulDataSize >= sizeof( VkPipelineCacheHeaderVersionOne ) &&
+		 header.ulDataSize <= 64ull * 1024 * 1024 )
+	{
+		data.resize( header.ulDataSize );
+		if ( fread( data.data(), 1, data.size(), pFile ) != data.size() ||
+			 fnv1a64( k_ulFNV1aOffsetBasis, data.data(), data.size() ) != header.ulDataHash )
+		{
+			data.clear();
+		}
+	}
+	fclose( pFile );
+
+	if ( data.empty() )
+	{
+		vk_log.infof( "ignoring invalid pipeline cache '%s'", sPath.c_str() );
+		return {};
+	}
+
+	VkPipelineCacheHeaderVersionOne driverHeader;
+	memcpy( &driverHeader, data.data(), sizeof( driverHeader ) );
+	if ( driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+		 driverHeader.vendorID != props.vendorID ||
+		 driverHeader.deviceID != props.deviceID ||
+		 memcmp( driverHeader.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE ) != 0 )
+	{
+		vk_log.infof( "ignoring pipeline cache '%s' from a different driver", sPath.c_str() );
+		return {};
+	}
+
+	return data;
+}
+
+bool CVulkanDevice::createPipelineCache()
+{
+	std::vector<uint8_t> initialData;
+
+	if ( cv_vulkan_pipeline_cache )
+	{
+		VkPhysicalDeviceProperties props;
+		vk.GetPhysicalDeviceProperties( physDev(), &props );
+
+		char szUUID[ VK_UUID_SIZE * 2 + 1 ];
+		for ( uint32_t i = 0; i < VK_UUID_SIZE; i++ )
+			snprintf( &szUUID[ i * 2 ], 3, "%02x", props.pipelineCacheUUID[i] );
+
+		char szFileName[ 128 ];
+		snprintf( szFileName, sizeof( szFileName ), "pipelines-%04x-%04x-%s-%016" PRIx64 ".bin",
+			props.vendorID, props.deviceID, szUUID, m_ulShaderHash );
+
+		m_sPipelineCachePath = GetPipelineCacheDir() + "/" + szFileName;
+		initialData = ReadPipelineCacheFile( m_sPipelineCachePath, m_ulShaderHash, props );
+	}
+
+	VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = initialData.size(),
+		.pInitialData = initialData.data(),
+	};
+
+	VkResult res = vk.CreatePipelineCache( device(), &pipelineCacheCreateInfo, nullptr, &m_pipelineCache );
+	if ( res != VK_SUCCESS && !initialData.empty() )
+	{
+		vk_log.infof( "driver rejected pipeline cache '%s', starting fresh", m_sPipelineCachePath.c_str() );
+
+		pipelineCacheCreateInfo.initialDataSize = 0;
+		pipelineCacheCreateInfo.pInitialData = nullptr;
+		res = vk.CreatePipelineCache( device(), &pipelineCacheCreateInfo, nullptr, &m_pipelineCache );
+	}
+
+	if ( res != VK_SUCCESS )
+	{
+		vk_errorf( res, "vkCreatePipelineCache failed" );
+		return false;
+	}
+
+	if ( !initialData.empty() )
+		vk_log.infof( "loaded pipeline cache '%s' (%zu bytes)", m_sPipelineCachePath.c_str(), initialData.size() );
+
+	return true;
+}
+
+void CVulkanDevice::savePipelineCache()
+{
+	if ( m_pipelineCache == VK_NULL_HANDLE || m_sPipelineCachePath.empty() )
+		return;
+
+	size_t uSize = 0;
+	VkResult res = vk.GetPipelineCacheData( device(), m_pipelineCache, &uSize, nullptr );
+	if ( res != VK_SUCCESS || uSize == 0 )
+		return;
+
+	std::vector<uint8_t> data( uSize );
+	res = vk.GetPipelineCacheData( device(), m_pipelineCache, &uSize, data.data() );
+	if ( res != VK_SUCCESS && res != VK_INCOMPLETE )
+	{
+		vk_errorf( res, "vkGetPipelineCacheData failed" );
+		return;
+	}
+	data.resize( uSize );
+
+	std::error_code ec;
+	std::filesystem::create_directories( GetPipelineCacheDir(), ec );
+	if ( ec )
+	{
+		vk_log.errorf( "failed to create pipeline cache directory: %s", ec.message().c_str() );
+		return;
+	}
+
+	PipelineCacheFileHeader_t header = {
+		.uMagic = PipelineCacheFileHeader_t::k_uMagic,
+		.uVersion = PipelineCacheFileHeader_t::k_uVersion,
+		.ulShaderHash = m_ulShaderHash,
+		.ulDataSize = data.size(),
+		.ulDataHash = fnv1a64( k_ulFNV1aOffsetBasis, data.data(), data.size() ),
+	};
+
+	// Write to a temporary file and rename over the old one, so another
+	// instance starting up never reads a half-written cache.
+	std::string sTmpPath = m_sPipelineCachePath + ".tmp." + std::to_string( getpid() );
+	FILE *pFile = fopen( sTmpPath.c_str(), "wb" );
+	if ( !pFile )
+	{
+		vk_log.errorf_errno( "failed to open '%s'", sTmpPath.c_str() );
+		return;
+	}
+
+	bool bSuccess = fwrite( &header, sizeof( header ), 1, pFile ) == 1 &&
+					fwrite( data.data(), 1, data.size(), pFile ) == data.size();
+	bSuccess = fclose( pFile ) == 0 && bSuccess;
+
+	if ( !bSuccess || rename( sTmpPath.c_str(), m_sPipelineCachePath.c_str() ) != 0 )
+	{
+		vk_log.errorf_errno( "failed to write pipeline cache '%s'", m_sPipelineCachePath.c_str() );
+		unlink( sTmpPath.c_str() );
+		return;
+	}
+
+	vk_log.infof( "saved pipeline cache '%s' (%zu bytes)", m_sPipelineCachePath.c_str(), data.size() );
+}
+
 bool CVulkanDevice::createScratchResources()
 {
 	std::vector<VkDescriptorSetLayout> descriptorSetLayouts(m_descriptorSets.size(), m_descriptorSetLayout);
@@ -1130,7 +1385,7 @@ VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMas
 
 	VkPipeline result;
 
-	VkResult res = vk.CreateComputePipelines(device(), VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &result);
+	VkResult res = vk.CreateComputePipelines(device(), m_pipelineCache, 1, &computePipelineCreateInfo, nullptr, &result);
 	if (res != VK_SUCCESS) {
 		vk_errorf( res, "vkCreateComputePipelines failed" );
 		return VK_NULL_HANDLE;
@@ -1139,10 +1394,44 @@ VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMas
 	return result;
 }
 
-void CVulkanDevice::compileAllPipelines()
+void CVulkanDevice::queuePipelineLocked(const PipelineInfo_t &info, EPipelinePriority ePriority, uint64_t ulHits)
 {
-	pthread_setname_np( pthread_self(), "gamescope-shdr" );
+	if (m_pipelineMap.contains(info) || m_pipelinesInFlight.contains(info))
+		return;
+
+	m_pipelineQueue.push(PipelineCompileRequest_t{ info, ePriority, ulHits, m_ulPipelineQueueOrder++ });
+}
+
+void CVulkanDevice::queueAdjacentPipelinesLocked(const PipelineInfo_t &info)
+{
+	// A miss usually means a window just appeared or went away, so the
+	// permutations with one layer more or less are likely to be next.
+	if (info.layerCount > 1)
+	{
+		PipelineInfo_t fewer = info;
+		fewer.layerCount--;
+		fewer.ycbcrMask &= (1u << fewer.layerCount) - 1;
+		fewer.blurLayerCount = std::min(fewer.blurLayerCount, fewer.layerCount);
+		fewer.colorspaceMask &= (1u << (fewer.layerCount * GamescopeAppTextureColorspace_Bits)) - 1;
+		queuePipelineLocked(fewer, k_EPipelinePriority_Demand, 0);
+	}
+
+	if (info.layerCount < k_nMaxLayers && (info.shaderType == SHADER_TYPE_BLIT || info.shaderType == SHADER_TYPE_RCAS ||
+		info.shaderType == SHADER_TYPE_BLUR || info.shaderType == SHADER_TYPE_BLUR_COND))
+	{
+		// Assume the new top layer has the same colorspace as the current one.
+		const uint32_t uColorspaceMask = (1u << GamescopeAppTextureColorspace_Bits) - 1;
+		uint32_t uTopColorspace = (info.colorspaceMask >> ((info.layerCount - 1) * GamescopeAppTextureColorspace_Bits)) & uColorspaceMask;
+
+		PipelineInfo_t more = info;
+		more.colorspaceMask |= uTopColorspace << (info.layerCount * GamescopeAppTextureColorspace_Bits);
+		more.layerCount++;
+		queuePipelineLocked(more, k_EPipelinePriority_Demand, 0);
+	}
+}
 
+void CVulkanDevice::queueAllPipelines()
+{
 	std::array<PipelineInfo_t, SHADER_TYPE_COUNT> pipelineInfos;
 #define SHADER(type, layer_count, max_ycbcr, blur_layers) pipelineInfos[SHADER_TYPE_##type] = {SHADER_TYPE_##type, layer_count, max_ycbcr, blur_layers}
 	SHADER(BLIT, k_nMaxLayers, k_nMaxYcbcrMask_ToPreCompile, 1);
@@ -1153,8 +1442,10 @@ void CVulkanDevice::compileAllPipelines()
 	SHADER(EASU, 1, 1, 1);
 	SHADER(NIS, 1, 1, 1);
 	SHADER(RGB_TO_NV12, 1, 1, 1);
+	SHADER(RGB_TO_YUV444, 1, 1, 1);
 #undef SHADER
 
+	std::lock_guard<std::mutex> lock(m_pipelineMutex);
 	for (auto& info : pipelineInfos) {
 		for (uint32_t layerCount = 1; layerCount <= info.layerCount; layerCount++) {
 			for (uint32_t ycbcrMask = 0; ycbcrMask < info.ycbcrMask; ycbcrMask++) {
@@ -1164,20 +1455,230 @@ void CVulkanDevice::compileAllPipelines()
 					if (blur_layers > layerCount)
 						continue;
 
-					VkPipeline newPipeline = compilePipeline(layerCount, ycbcrMask, info.shaderType, blur_layers, info.compositeDebug, info.colorspaceMask, info.outputEOTF, info.itmEnable);
-					{
-						std::lock_guard<std::mutex> lock(m_pipelineMutex);
-						PipelineInfo_t key = {info.shaderType, layerCount, ycbcrMask, blur_layers, info.compositeDebug};
-						auto result = m_pipelineMap.emplace(std::make_pair(key, newPipeline));
-						if (!result.second)
-							vk.DestroyPipeline(device(), newPipeline, nullptr);
-					}
+					PipelineInfo_t key = {info.shaderType, layerCount, ycbcrMask, blur_layers, info.compositeDebug};
+					queuePipelineLocked(key, k_EPipelinePriority_Warmup, 0);
 				}
 			}
 		}
 	}
 }
 
+static std::string GetPipelineUsagePath()
+{
+	return GetPipelineCacheDir() + "/pipeline-usage.bin";
+}
+
+static constexpr uint32_t k_uPipelineUsageMagic = 0x55505347; // 'GSPU'
+static constexpr uint32_t k_uPipelineUsageVersion = 1;
+
+struct PipelineUsageEntry_t
+{
+	uint32_t uShaderType;
+	uint32_t uLayerCount;
+	uint32_t uYcbcrMask;
+	uint32_t uBlurLayerCount;
+	uint32_t uCompositeDebug;
+	uint32_t uColorspaceMask;
+	uint32_t uOutputEOTF;
+	uint32_t uItmEnable;
+	uint64_t ulHits;
+};
+
+bool CVulkanDevice::loadPipelineUsage()
+{
+	if ( !cv_vulkan_pipeline_cache )
+		return false;
+
+	FILE *pFile = fopen( GetPipelineUsagePath().c_str(), "rb" );
+	if ( !pFile )
+		return false;
+
+	std::vector<PipelineUsageEntry_t> entries;
+
+	uint32_t uHeader[3];
+	if ( fread( uHeader, sizeof( uHeader ), 1, pFile ) == 1 &&
+		 uHeader[0] == k_uPipelineUsageMagic &&
+		 uHeader[1] == k_uPipelineUsageVersion &&
+		 uHeader[2] <= 65536 )
+	{
+		entries.resize( uHeader[2] );
+		if ( fread( entries.data(), sizeof( PipelineUsageEntry_t ), entries.size(), pFile ) != entries.size() )
+			entries.clear();
+	}
+	fclose( pFile );
+
+	std::sort( entries.begin(), entries.end(), []( const PipelineUsageEntry_t &a, const PipelineUsageEntry_t &b ){ return a.ulHits > b.ulHits; } );
+	if ( entries.size() > cv_vulkan_pipeline_hot_set_size )
+		entries.resize( cv_vulkan_pipeline_hot_set_size );
+
+	std::lock_guard<std::mutex> lock( m_pipelineMutex );
+	for ( const PipelineUsageEntry_t &entry : entries )
+	{
+		if ( entry.uShaderType >= SHADER_TYPE_COUNT || entry.uLayerCount == 0 || entry.uLayerCount > k_nMaxLayers )
+			continue;
+
+		PipelineInfo_t info = {
+			.shaderType = ShaderType( entry.uShaderType ),
+			.layerCount = entry.uLayerCount,
+			.ycbcrMask = entry.uYcbcrMask,
+			.blurLayerCount = entry.uBlurLayerCount,
+			.compositeDebug = entry.uCompositeDebug,
+			.colorspaceMask = entry.uColorspaceMask,
+			.outputEOTF = entry.uOutputEOTF,
+			.itmEnable = !!entry.uItmEnable,
+		};
+
+		// Age the history so permutations we stop using eventually fall out of the hot set.
+		uint64_t ulHits = entry.ulHits / 2;
+		if ( ulHits )
+			m_pipelineHits[ info ] = ulHits;
+
+		queuePipelineLocked( info, k_EPipelinePriority_Hot, entry.ulHits );
+	}
+
+	vk_log.infof( "warming %zu pipeline permutations from previous sessions", m_pipelineQueue.size() );
+
+	return !entries.empty();
+}
+
+void CVulkanDevice::savePipelineUsage()
+{
+	if ( !cv_vulkan_pipeline_cache )
+		return;
+
+	std::vector<PipelineUsageEntry_t> entries;
+	{
+		std::lock_guard<std::mutex> lock( m_pipelineMutex );
+		m_bPipelineUsageChanged = false;
+		entries.reserve( m_pipelineHits.size() );
+		for ( const auto &[ info, ulHits ] : m_pipelineHits )
+		{
+			entries.push_back( PipelineUsageEntry_t{
+				.uShaderType = uint32_t( info.shaderType ),
+				.uLayerCount = info.layerCount,
+				.uYcbcrMask = info.ycbcrMask,
+				.uBlurLayerCount = info.blurLayerCount,
+				.uCompositeDebug = info.compositeDebug,
+				.uColorspaceMask = info.colorspaceMask,
+				.uOutputEOTF = info.outputEOTF,
+				.uItmEnable = info.itmEnable,
+				.ulHits = ulHits,
+			} );
+		}
+	}
+
+	std::error_code ec;
+	std::filesystem::create_directories( GetPipelineCacheDir(), ec );
+
+	std::string sPath = GetPipelineUsagePath();
+	std::string sTmpPath = sPath + ".tmp." + std::to_string( getpid() );
+	FILE *pFile = fopen( sTmpPath.c_str(), "wb" );
+	if ( !pFile )
+	{
+		vk_log.errorf_errno( "failed to open '%s'", sTmpPath.c_str() );
+		return;
+	}
+
+	uint32_t uHeader[3] = { k_uPipelineUsageMagic, k_uPipelineUsageVersion, uint32_t( entries.size() ) };
+	bool bSuccess = fwrite( uHeader, sizeof( uHeader ), 1, pFile ) == 1 &&
+					fwrite( entries.data(), sizeof( PipelineUsageEntry_t ), entries.size(), pFile ) == entries.size();
+	bSuccess = fclose( pFile ) == 0 && bSuccess;
+
+	if ( !bSuccess || rename( sTmpPath.c_str(), sPath.c_str() ) != 0 )
+	{
+		vk_log.errorf_errno( "failed to write pipeline usage '%s'", sPath.c_str() );
+		unlink( sTmpPath.c_str() );
+	}
+}
+
+void CVulkanDevice::pipelineThreadMain()
+{
+	pthread_setname_np( pthread_self(), "gamescope-shdr" );
+
+	bool bHasHistory = loadPipelineUsage();
+	if ( !bHasHistory || cv_vulkan_pipeline_warmup_all )
+		queueAllPipelines();
+
+	for (;;)
+	{
+		std::unique_lock<std::mutex> lock(m_pipelineMutex);
+		bool bHasWork = m_pipelineCond.wait_for(lock, std::chrono::seconds(10), [this]{ return !m_pipelineQueue.empty() || m_bPipelineThreadExit; });
+		if (m_bPipelineThreadExit)
+			return;
+
+		if (!bHasWork)
+		{
+			// Idle, flush anything new to disk.
+			bool bSaveCache = std::exchange(m_bPipelineCacheDirty, false);
+			bool bSaveUsage = std::exchange(m_bPipelineUsageDirty, false);
+			lock.unlock();
+
+			if (bSaveCache)
+				savePipelineCache();
+			if (bSaveUsage)
+				savePipelineUsage();
+			continue;
+		}
+
+		PipelineCompileRequest_t request = m_pipelineQueue.top();
+		m_pipelineQueue.pop();
+
+		const PipelineInfo_t &info = request.info;
+		if (m_pipelineMap.contains(info) || m_pipelinesInFlight.contains(info))
+			continue;
+
+		m_pipelinesInFlight.insert(info);
+		lock.unlock();
+
+		VkPipeline newPipeline = compilePipeline(info.layerCount, info.ycbcrMask, info.shaderType, info.blurLayerCount, info.compositeDebug, info.colorspaceMask, info.outputEOTF, info.itmEnable);
+
+		lock.lock();
+		m_pipelinesInFlight.erase(info);
+		if (newPipeline != VK_NULL_HANDLE)
+		{
+			m_pipelineMap.emplace(info, newPipeline);
+			m_pipelineStats.ulAsyncCompiles++;
+			m_bPipelineCacheDirty = true;
+		}
+		lock.unlock();
+
+		// Wake up anyone in CVulkanDevice::pipeline waiting on this one.
+		m_pipelineCond.notify_all();
+	}
+}
+
+CVulkanDevice::~CVulkanDevice()
+{
+	// Exiting without vulkan_shutdown, the shader thread dies with the process.
+	if (m_pipelineThread.joinable())
+		m_pipelineThread.detach();
+}
+
+void CVulkanDevice::shutdown()
+{
+	if (!m_bInitialized)
+		return;
+
+	{
+		std::unique_lock<std::mutex> lock(m_pipelineMutex);
+		m_bPipelineThreadExit = true;
+	}
+	m_pipelineCond.notify_all();
+	if (m_pipelineThread.joinable())
+		m_pipelineThread.join();
+
+	if (std::exchange(m_bPipelineCacheDirty, false))
+		savePipelineCache();
+	if (std::exchange(m_bPipelineUsageDirty, false) || m_bPipelineUsageChanged)
+		savePipelineUsage();
+
+	if (m_pipelineCache != VK_NULL_HANDLE)
+	{
+		vk.DestroyPipelineCache(device(), m_pipelineCache, nullptr);
+		m_pipelineCache = VK_NULL_HANDLE;
+	}
+}
+
 extern bool g_bSteamIsActiveWindow;
 
 VkPipeline CVulkanDevice::pipeline(ShaderType type, uint32_t layerCount, uint32_t ycbcrMask, uint32_t blur_layers, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable)
@@ -1186,21 +1687,136 @@ VkPipeline CVulkanDevice::pipeline(ShaderType type, uint32_t layerCount, uint32_
 	if ( g_bSteamIsActiveWindow )
 		effective_debug &= ~(CompositeDebugFlag::Heatmap | CompositeDebugFlag::Heatmap_MSWCG | CompositeDebugFlag::Heatmap_Hard);
 
-	std::lock_guard<std::mutex> lock(m_pipelineMutex);
+	std::unique_lock<std::mutex> lock(m_pipelineMutex);
 	PipelineInfo_t key = {type, layerCount, ycbcrMask, blur_layers, effective_debug, colorspace_mask, output_eotf, itm_enable};
+
+	m_pipelineStats.ulLookups++;
+	// Counts feed next launch's warmup order, which only needs them
+	// roughly right. New keys and counts reaching a power of two get
+	// flushed by the shader thread while idle, the rest on shutdown.
+	uint64_t &ulHits = m_pipelineHits[key];
+	ulHits++;
+	m_bPipelineUsageChanged = true;
+	if (std::has_single_bit(ulHits))
+		m_bPipelineUsageDirty = true;
+
 	auto search = m_pipelineMap.find(key);
-	if (search == m_pipelineMap.end())
+	if (search != m_pipelineMap.end())
+		return search->second;
+
+	// Synchronous fallback, this stalls the frame we are recording.
+	uint64_t ulStallStart = get_time_in_nanos();
+
+	if (m_pipelinesInFlight.contains(key))
 	{
-		VkPipeline result = compilePipeline(layerCount, ycbcrMask, type, blur_layers, effective_debug, colorspace_mask, output_eotf, itm_enable);
-		m_pipelineMap[key] = result;
-		return result;
+		// The shader thread is already on it, don't compile it twice.
+		m_pipelineCond.wait(lock, [&]{ return !m_pipelinesInFlight.contains(key); });
+		search = m_pipelineMap.find(key);
+	}
+
+	VkPipeline result = VK_NULL_HANDLE;
+	if (search != m_pipelineMap.end())
+	{
+		result = search->second;
 	}
 	else
 	{
-		return search->second;
+		result = compilePipeline(layerCount, ycbcrMask, type, blur_layers, effective_debug, colorspace_mask, output_eotf, itm_enable);
+		m_pipelineMap[key] = result;
+		m_bPipelineCacheDirty = true;
 	}
+
+	queueAdjacentPipelinesLocked(key);
+
+	uint64_t ulStallTime = get_time_in_nanos() - ulStallStart;
+	m_pipelineStats.ulStalls++;
+	m_pipelineStats.ulStallTimeNs += ulStallTime;
+	m_pipelineStats.ulMaxStallTimeNs = std::max(m_pipelineStats.ulMaxStallTimeNs, ulStallTime);
+	lock.unlock();
+
+	m_pipelineCond.notify_all();
+
+	vk_log.debugf( "pipeline stall: type %u layers %u ycbcr %x blur %u colorspace %x eotf %u took %.2fms",
+		type, layerCount, ycbcrMask, blur_layers, colorspace_mask, output_eotf, ulStallTime / 1'000'000.0 );
+
+	return result;
+}
+
+PipelineStats_t CVulkanDevice::pipelineStats()
+{
+	std::lock_guard<std::mutex> lock(m_pipelineMutex);
+	PipelineStats_t stats = m_pipelineStats;
+	stats.ulQueued = m_pipelineQueue.size();
+	return stats;
+}
+
+static gamescope::ConCommand cc_vulkan_pipeline_stats("vulkan_pipeline_stats", "Print composite pipeline cache hit/stall counters",
+[]( std::span<std::string_view> args )
+{
+	PipelineStats_t stats = g_device.pipelineStats();
+	console_log.infof( "pipeline lookups: %" PRIu64 ", synchronous stalls: %" PRIu64 " (total %.2fms, max %.2fms), background compiles: %" PRIu64 ", queued: %" PRIu64,
+		stats.ulLookups, stats.ulStalls, stats.ulStallTimeNs / 1'000'000.0, stats.ulMaxStallTimeNs / 1'000'000.0, stats.ulAsyncCompiles, stats.ulQueued );
+});
+
+static const char *s_pszGPUPassNames[GPU_PASS_COUNT] =
+{
+	"easu",
+	"rcas",
+	"nis",
+	"blur_first_pass",
+	"blur",
+	"composite",
+	"capture",
+};
+
+static void print_gpu_timing( const char *pszName, std::vector<uint64_t> &values )
+{
+	if ( values.empty() )
+		return;
+
+	std::sort( values.begin(), values.end() );
+
+	uint64_t ulSum = 0;
+	for ( uint64_t ulValue : values )
+		ulSum += ulValue;
+
+	console_log.infof( "%-16s n %4zu  avg %7.3fms  p50 %7.3fms  p99 %7.3fms  max %7.3fms", pszName, values.size(),
+		ulSum / double( values.size() ) / 1'000'000.0,
+		values[ ( values.size() - 1 ) / 2 ] / 1'000'000.0,
+		values[ size_t( ( values.size() - 1 ) * 0.99 ) ] / 1'000'000.0,
+		values.back() / 1'000'000.0 );
 }
 
+static gamescope::ConCommand cc_vulkan_gpu_timings("vulkan_gpu_timings", "Print GPU time per composite pass over the last 256 submissions",
+[]( std::span<std::string_view> args )
+{
+	if ( !g_device.supportsTimestamps() )
+	{
+		console_log.errorf( "Device does not support timestamp queries." );
+		return;
+	}
+
+	std::vector<GPUTimings_t> history = g_device.gpuTimingsHistory();
+
+	std::vector<uint64_t> values;
+	values.reserve( history.size() );
+
+	for ( const GPUTimings_t &timings : history )
+		values.push_back( timings.ulTotalNs );
+	print_gpu_timing( "submission", values );
+
+	for ( uint32_t i = 0; i < GPU_PASS_COUNT; i++ )
+	{
+		values.clear();
+		for ( const GPUTimings_t &timings : history )
+		{
+			if ( timings.uPassMask & ( 1u << i ) )
+				values.push_back( timings.ulPassNs[ i ] );
+		}
+		print_gpu_timing( s_pszGPUPassNames[ i ], values );
+	}
+});
+
 
 int32_t CVulkanDevice::findMemoryType( VkMemoryPropertyFlags properties, uint32_t requiredTypeBits )
 {
@@ -1306,7 +1922,9 @@ uint64_t CVulkanDevice::submitInternal( CVulkanCmdBuffer* cmdBuffer )
 		.pSignalSemaphores = pSignalSemaphores.data(),
 	};
 
+	uint64_t ulSubmitStart = get_time_in_nanos();
 	vk_check( vk.QueueSubmit( cmdBuffer->queue(), 1, &submitInfo, VK_NULL_HANDLE ) );
+	m_ulLastSubmitTimeNs = get_time_in_nanos() - ulSubmitStart;
 
 	return nextSeqNo;
 }
@@ -1468,6 +2086,18 @@ void CVulkanDevice::wait(uint64_t sequence, bool reset)
 		resetCmdBuffers(sequence);
 }
 
+void CVulkanDevice::waitTimeline(uint64_t sequence)
+{
+	VkSemaphoreWaitInfo waitInfo = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.semaphoreCount = 1,
+		.pSemaphores = &m_scratchTimelineSemaphore,
+		.pValues = &sequence,
+	} ;
+
+	vk_check( vk.WaitSemaphores( device(), &waitInfo, ~0ull ) );
+}
+
 void CVulkanDevice::waitIdle(bool reset)
 {
 	wait(m_submissionSeqNo, reset);
@@ -1481,6 +2111,12 @@ void CVulkanDevice::resetCmdBuffers(uint64_t sequence)
 
 	for (auto it = m_pendingCmdBufs.begin(); ; it++)
 	{
+		if (std::optional<GPUTimings_t> oTimings = it->second->resolveGpuTimings())
+		{
+			oTimings->ulSequence = it->first;
+			recordGpuTimings(*oTimings);
+		}
+
 		it->second->reset();
 		m_unusedCmdBufs.push_back(std::move(it->second));
 		if (it == last)
@@ -1490,6 +2126,83 @@ void CVulkanDevice::resetCmdBuffers(uint64_t sequence)
 	m_pendingCmdBufs.erase(m_pendingCmdBufs.begin(), ++last);
 }
 
+void CVulkanDevice::recordGpuTimings(const GPUTimings_t &timings)
+{
+	{
+		std::unique_lock lock(m_gpuTimingsLock);
+		m_gpuTimings[timings.ulSequence % m_gpuTimings.size()] = timings;
+		m_ulLastGpuTimingsSequence = timings.ulSequence;
+	}
+
+	// The GPU work is long done by now, so these land at retire time
+	// rather than where the work actually ran.
+	gpuvis_trace_duration_printf( timings.ulTotalNs / 1'000'000.0f, "gpu submission %" PRIu64, timings.ulSequence );
+	for (uint32_t i = 0; i < GPU_PASS_COUNT; i++)
+	{
+		if (timings.uPassMask & (1u << i))
+			gpuvis_trace_duration_printf( timings.ulPassNs[i] / 1'000'000.0f, "gpu %s %" PRIu64, s_pszGPUPassNames[i], timings.ulSequence );
+	}
+}
+
+std::optional<GPUTimings_t> CVulkanDevice::gpuTimings(uint64_t sequence)
+{
+	std::unique_lock lock(m_gpuTimingsLock);
+	return gpuTimingsLocked(sequence);
+}
+
+std::optional<GPUTimings_t> CVulkanDevice::gpuTimingsLocked(uint64_t sequence)
+{
+	const GPUTimings_t &timings = m_gpuTimings[sequence % m_gpuTimings.size()];
+	if (!sequence || timings.ulSequence != sequence)
+		return std::nullopt;
+
+	return timings;
+}
+
+std::optional<GPUTimings_t> CVulkanDevice::lastGpuTimings()
+{
+	std::unique_lock lock(m_gpuTimingsLock);
+	return gpuTimingsLocked(m_ulLastGpuTimingsSequence);
+}
+
+std::optional<uint64_t> CVulkanDevice::gpuTime(uint64_t sequence)
+{
+	std::optional<GPUTimings_t> oTimings = gpuTimings(sequence);
+	if (!oTimings)
+		return std::nullopt;
+
+	return oTimings->ulTotalNs;
+}
+
+std::vector<GPUTimings_t> CVulkanDevice::gpuTimingsHistory()
+{
+	std::unique_lock lock(m_gpuTimingsLock);
+
+	std::vector<GPUTimings_t> history;
+	history.reserve(m_gpuTimings.size());
+	for (const GPUTimings_t &timings : m_gpuTimings)
+	{
+		if (timings.ulSequence)
+			history.push_back(timings);
+	}
+	std::sort(history.begin(), history.end(), [](const GPUTimings_t &a, const GPUTimings_t &b) { return a.ulSequence < b.ulSequence; });
+
+	return history;
+}
+
+uint64_t CVulkanDevice::timestampToNanos(uint64_t ulBegin, uint64_t ulEnd)
+{
+	return uint64_t(double((ulEnd - ulBegin) & m_ulTimestampMask) * m_flTimestampPeriod);
+}
+
+// Queries 0 and 1 bracket the whole command buffer, then a begin/end pair per GPUPass.
+static constexpr uint32_t k_uTimestampQueryCount = 2 + 2 * GPU_PASS_COUNT;
+
+static uint32_t timestampPassQuery(GPUPass ePass)
+{
+	return 2 + 2 * uint32_t(ePass);
+}
+
 CVulkanCmdBuffer::CVulkanCmdBuffer(CVulkanDevice *parent, VkCommandBuffer cmdBuffer, VkQueue queue, uint32_t queueFamily)
 	: m_cmdBuffer(cmdBuffer), m_device(parent), m_queue(queue), m_queueFamily(queueFamily)
 {
@@ -1497,6 +2210,8 @@ CVulkanCmdBuffer::CVulkanCmdBuffer(CVulkanDevice *parent, VkCommandBuffer cmdBuf
 
 CVulkanCmdBuffer::~CVulkanCmdBuffer()
 {
+	if (m_queryPool != VK_NULL_HANDLE)
+		m_device->vk.DestroyQueryPool(m_device->device(), m_queryPool, nullptr);
 	m_device->vk.FreeCommandBuffers(m_device->device(), m_device->commandPool(), 1, &m_cmdBuffer);
 }
 
@@ -1508,6 +2223,9 @@ void CVulkanCmdBuffer::reset()
 
 	m_ExternalDependencies.clear();
 	m_ExternalSignals.clear();
+
+	m_bTimestampsWritten = false;
+	m_uPassesWritten = 0;
 }
 
 void CVulkanCmdBuffer::begin()
@@ -1520,14 +2238,85 @@ void CVulkanCmdBuffer::begin()
 	vk_check( m_device->vk.BeginCommandBuffer(m_cmdBuffer, &commandBufferBeginInfo) );
 
 	clearState();
+
+	if (m_device->supportsTimestamps())
+	{
+		if (m_queryPool == VK_NULL_HANDLE)
+		{
+			VkQueryPoolCreateInfo queryPoolCreateInfo = {
+				.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+				.queryType = VK_QUERY_TYPE_TIMESTAMP,
+				.queryCount = k_uTimestampQueryCount,
+			};
+
+			vk_check( m_device->vk.CreateQueryPool(m_device->device(), &queryPoolCreateInfo, nullptr, &m_queryPool) );
+		}
+
+		m_device->vk.CmdResetQueryPool(m_cmdBuffer, m_queryPool, 0, k_uTimestampQueryCount);
+		m_device->vk.CmdWriteTimestamp(m_cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPool, 0);
+		m_bTimestampsWritten = true;
+	}
 }
 
 void CVulkanCmdBuffer::end()
 {
 	insertBarrier(true);
+	if (m_bTimestampsWritten)
+		m_device->vk.CmdWriteTimestamp(m_cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, 1);
 	vk_check( m_device->vk.EndCommandBuffer(m_cmdBuffer) );
 }
 
+void CVulkanCmdBuffer::beginPass(GPUPass ePass)
+{
+	if (!m_bTimestampsWritten)
+		return;
+
+	// Bottom of pipe so the begin marks when earlier work finished,
+	// and the end covers copies as well as dispatches.
+	m_device->vk.CmdWriteTimestamp(m_cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, timestampPassQuery(ePass));
+}
+
+void CVulkanCmdBuffer::endPass(GPUPass ePass)
+{
+	if (!m_bTimestampsWritten)
+		return;
+
+	m_device->vk.CmdWriteTimestamp(m_cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, timestampPassQuery(ePass) + 1);
+	m_uPassesWritten |= 1u << ePass;
+}
+
+std::optional<GPUTimings_t> CVulkanCmdBuffer::resolveGpuTimings()
+{
+	if (!m_bTimestampsWritten)
+		return std::nullopt;
+
+	// Don't wait, the submission has already retired by the time we get here.
+	std::array<uint64_t, 2> ulTimestamps;
+	VkResult res = m_device->vk.GetQueryPoolResults(m_device->device(), m_queryPool, 0, 2,
+		sizeof(ulTimestamps), ulTimestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (res != VK_SUCCESS)
+		return std::nullopt;
+
+	GPUTimings_t timings;
+	timings.ulTotalNs = m_device->timestampToNanos(ulTimestamps[0], ulTimestamps[1]);
+
+	for (uint32_t i = 0; i < GPU_PASS_COUNT; i++)
+	{
+		if (!(m_uPassesWritten & (1u << i)))
+			continue;
+
+		res = m_device->vk.GetQueryPoolResults(m_device->device(), m_queryPool, timestampPassQuery(GPUPass(i)), 2,
+			sizeof(ulTimestamps), ulTimestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (res != VK_SUCCESS)
+			continue;
+
+		timings.ulPassNs[i] = m_device->timestampToNanos(ulTimestamps[0], ulTimestamps[1]);
+		timings.uPassMask |= 1u << i;
+	}
+
+	return timings;
+}
+
 void CVulkanCmdBuffer::bindTexture(uint32_t slot, gamescope::Rc<CVulkanTexture> texture)
 {
 	m_boundTextures[slot] = texture.get();
@@ -1749,31 +2538,75 @@ void CVulkanCmdBuffer::dispatch(uint32_t x, uint32_t y, uint32_t z)
 	markDirty(m_target);
 }
 
-void CVulkanCmdBuffer::copyImage(gamescope::Rc<CVulkanTexture> src, gamescope::Rc<CVulkanTexture> dst)
+void CVulkanCmdBuffer::copyImage(gamescope::Rc<CVulkanTexture> src, gamescope::Rc<CVulkanTexture> dst, std::optional<VkRect2D> oRegion)
 {
 	assert(src->width() == dst->width());
 	assert(src->height() == dst->height());
+	assert(src->isYcbcr() == dst->isYcbcr());
 	prepareSrcImage(src.get());
-	prepareDestImage(dst.get());
+	if (oRegion)
+		prepareSrcImage(dst.get());
+	else
+		prepareDestImage(dst.get());
 	insertBarrier();
 
-	VkImageCopy region = {
-		.srcSubresource = {
-			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.layerCount = 1
-		},
-		.dstSubresource = {
-			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.layerCount = 1
-		},
-		.extent = {
-			.width = src->width(),
-			.height = src->height(),
-			.depth = 1
-		},
-	};
+	const VkRect2D region = oRegion.value_or(VkRect2D{ { 0, 0 }, { src->width(), src->height() } });
+
+	VkImageCopy regions[2] = {};
+	uint32_t regionCount = 0;
+
+	if (src->isYcbcr())
+	{
+		// 4:2:0, the chroma plane is half size.
+		const VkImageAspectFlagBits planeAspects[] = { VK_IMAGE_ASPECT_PLANE_0_BIT, VK_IMAGE_ASPECT_PLANE_1_BIT };
+		for (uint32_t i = 0; i < 2; i++)
+		{
+			const uint32_t uDivisor = i == 0 ? 1 : 2;
+			const VkOffset3D planeOffset = {
+				.x = region.offset.x / int32_t(uDivisor),
+				.y = region.offset.y / int32_t(uDivisor),
+			};
+			regions[regionCount++] = {
+				.srcSubresource = {
+					.aspectMask = planeAspects[i],
+					.layerCount = 1
+				},
+				.srcOffset = planeOffset,
+				.dstSubresource = {
+					.aspectMask = planeAspects[i],
+					.layerCount = 1
+				},
+				.dstOffset = planeOffset,
+				.extent = {
+					.width = (region.extent.width + uDivisor - 1) / uDivisor,
+					.height = (region.extent.height + uDivisor - 1) / uDivisor,
+					.depth = 1
+				},
+			};
+		}
+	}
+	else
+	{
+		regions[regionCount++] = {
+			.srcSubresource = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.layerCount = 1
+			},
+			.srcOffset = { region.offset.x, region.offset.y, 0 },
+			.dstSubresource = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.layerCount = 1
+			},
+			.dstOffset = { region.offset.x, region.offset.y, 0 },
+			.extent = {
+				.width = region.extent.width,
+				.height = region.extent.height,
+				.depth = 1
+			},
+		};
+	}
 
-	m_device->vk.CmdCopyImage(m_cmdBuffer, src->vkImage(), VK_IMAGE_LAYOUT_GENERAL, dst->vkImage(), VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+	m_device->vk.CmdCopyImage(m_cmdBuffer, src->vkImage(), VK_IMAGE_LAYOUT_GENERAL, dst->vkImage(), VK_IMAGE_LAYOUT_GENERAL, regionCount, regions);
 
 	markDirty(dst.get());
 	m_textureRefs.emplace_back(std::move(src));
@@ -2079,6 +2912,11 @@ bool CVulkanTexture::BInit( uint32_t width, uint32_t height, uint32_t depth, uin
 		imageInfo.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
 	}
 
+	// The P010 planes are written through R16/R16G16 views, which aren't the
+	// plane formats themselves (R10X6...) and can't be storage images as-is.
+	if ( drmFormat == DRM_FORMAT_P010 )
+		imageInfo.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT | VK_IMAGE_CREATE_EXTENDED_USAGE_BIT;
+
 	if ( pDMA != nullptr )
 	{
 		assert( drmFormat == pDMA->format );
@@ -2425,6 +3263,39 @@ bool CVulkanTexture::BInit( uint32_t width, uint32_t height, uint32_t depth, uin
 				}
 			}
 		}
+		else if ( isYcbcr() && tiling == VK_IMAGE_TILING_LINEAR )
+		{
+			// Linear multi-planar images have a layout per plane within the one allocation,
+			// so export them as multi-planar DMA-BUFs rather than assuming the chroma
+			// plane directly follows the luma rows.
+			const VkImageAspectFlagBits planeAspects[] = {
+				VK_IMAGE_ASPECT_PLANE_0_BIT,
+				VK_IMAGE_ASPECT_PLANE_1_BIT,
+			};
+
+			dmabuf.n_planes = 2;
+			dmabuf.modifier = DRM_FORMAT_MOD_LINEAR;
+
+			for ( int i = 0; i < dmabuf.n_planes; i++ )
+			{
+				const VkImageSubresource subresource = {
+					.aspectMask = planeAspects[i],
+				};
+				VkSubresourceLayout subresourceLayout = {};
+				g_device.vk.GetImageSubresourceLayout( g_device.device(), m_vkImage, &subresource, &subresourceLayout );
+				dmabuf.offset[i] = subresourceLayout.offset;
+				dmabuf.stride[i] = subresourceLayout.rowPitch;
+
+				if ( i > 0 )
+				{
+					dmabuf.fd[i] = dup( dmabuf.fd[0] );
+					if ( dmabuf.fd[i] < 0 ) {
+						vk_log.errorf_errno( "dup failed" );
+						return false;
+					}
+				}
+			}
+		}
 		else
 		{
 			const VkImageSubresource subresource = {
@@ -2499,8 +3370,10 @@ bool CVulkanTexture::BInit( uint32_t width, uint32_t height, uint32_t depth, uin
 
 		if ( isYcbcr() )
 		{
+			const bool b16Bit = drmFormat == DRM_FORMAT_P010;
+
 			createInfo.pNext = NULL;
-			createInfo.format = VK_FORMAT_R8_UNORM;
+			createInfo.format = b16Bit ? VK_FORMAT_R16_UNORM : VK_FORMAT_R8_UNORM;
 
 			createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_PLANE_0_BIT;
 			res = g_device.vk.CreateImageView(g_device.device(), &createInfo, nullptr, &m_lumaView);
@@ -2510,7 +3383,7 @@ bool CVulkanTexture::BInit( uint32_t width, uint32_t height, uint32_t depth, uin
 			}
 
 			createInfo.pNext = NULL;
-			createInfo.format = VK_FORMAT_R8G8_UNORM;
+			createInfo.format = b16Bit ? VK_FORMAT_R16G16_UNORM : VK_FORMAT_R8G8_UNORM;
 			createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_PLANE_1_BIT;
 			res = g_device.vk.CreateImageView(g_device.device(), &createInfo, nullptr, &m_chromaView);
 			if ( res != VK_SUCCESS ) {
@@ -2632,12 +3505,17 @@ bool CVulkanTexture::IsInUse()
 	return GetRefCount() != 0;
 }
 
+static std::atomic<uint64_t> s_ulNextTextureSerial = { 1 };
+
 CVulkanTexture::CVulkanTexture( void )
+	: m_ulSerial( s_ulNextTextureSerial++ )
 {
 }
 
 CVulkanTexture::~CVulkanTexture( void )
 {
+	gamescope::CFrameTraceRecorder::Get().ForgetTexture( m_ulSerial );
+
 	wlr_dmabuf_attributes_finish( &m_dmabuf );
 
 	if ( m_pMappedData != nullptr && m_vkImageMemory )
@@ -3025,21 +3903,36 @@ gamescope::Rc<CVulkanTexture> vulkan_create_3d_lut(uint32_t width, uint32_t heig
 
 void vulkan_update_luts(const gamescope::Rc<CVulkanTexture>& lut1d, const gamescope::Rc<CVulkanTexture>& lut3d, void* lut1d_data, void* lut3d_data)
 {
-	size_t lut1d_size = lut1d->width() * sizeof(uint16_t) * 4;
-	size_t lut3d_size = lut3d->width() * lut3d->height() * lut3d->depth() * sizeof(uint16_t) * 4;
+	LutUpload_t upload = { lut1d, lut3d, lut1d_data, lut3d_data };
+	g_device.wait( vulkan_upload_luts( &upload, 1 ) );
+}
+
+uint64_t vulkan_upload_luts( const LutUpload_t *pUploads, uint32_t uCount )
+{
+	auto cmdBuffer = g_device.commandBuffer();
+	for ( uint32_t i = 0; i < uCount; i++ )
+	{
+		const LutUpload_t &upload = pUploads[i];
 
-	auto [base_dst, base_offset] = g_device.uploadBufferData(lut1d_size + lut3d_size);
+		size_t lut1d_size = upload.pLut1d->width() * sizeof(uint16_t) * 4;
+		size_t lut3d_size = upload.pLut3d->width() * upload.pLut3d->height() * upload.pLut3d->depth() * sizeof(uint16_t) * 4;
 
-	void* lut1d_dst = base_dst;
-	void *lut3d_dst = ((uint8_t*)base_dst) + lut1d_size;
-	memcpy(lut1d_dst, lut1d_data, lut1d_size);
-	memcpy(lut3d_dst, lut3d_data, lut3d_size);
+		auto [base_dst, base_offset] = g_device.uploadBufferData(lut1d_size + lut3d_size);
 
-	auto cmdBuffer = g_device.commandBuffer();
-	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), base_offset, 0, lut1d);
-	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), base_offset + lut1d_size, 0, lut3d);
-	g_device.submit(std::move(cmdBuffer));
-	g_device.waitIdle(); // TODO: Sync this better
+		void* lut1d_dst = base_dst;
+		void *lut3d_dst = ((uint8_t*)base_dst) + lut1d_size;
+		memcpy(lut1d_dst, upload.pLut1dData, lut1d_size);
+		memcpy(lut3d_dst, upload.pLut3dData, lut3d_size);
+
+		cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), base_offset, 0, upload.pLut1d);
+		cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), base_offset + lut1d_size, 0, upload.pLut3d);
+	}
+	return g_device.submit(std::move(cmdBuffer));
+}
+
+uint64_t vulkan_get_last_submission( void )
+{
+	return g_device.lastSubmissionSeqNo();
 }
 
 gamescope::Rc<CVulkanTexture> vulkan_get_hacky_blank_texture()
@@ -3222,6 +4115,7 @@ bool vulkan_remake_swapchain( void )
 	// Delete screenshot image to be remade if needed
 	for (auto& pScreenshotImage : pOutput->pScreenshotImages)
 		pScreenshotImage = nullptr;
+	pOutput->pScreenshotIntermediate = nullptr;
 
 	bool bRet = vulkan_make_swapchain( pOutput );
 	assert( bRet ); // Something has gone horribly wrong!
@@ -3318,6 +4212,7 @@ bool vulkan_remake_output_images()
 	// Delete screenshot image to be remade if needed
 	for (auto& pScreenshotImage : pOutput->pScreenshotImages)
 		pScreenshotImage = nullptr;
+	pOutput->pScreenshotIntermediate = nullptr;
 
 	bool bRet = vulkan_make_output_images( pOutput );
 	assert( bRet );
@@ -3551,6 +4446,11 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_bits( uint32_t wi
 
 static uint32_t s_frameId = 0;
 
+void vulkan_shutdown( void )
+{
+	g_device.shutdown();
+}
+
 void vulkan_garbage_collect( void )
 {
 	g_device.garbageCollect();
@@ -3558,38 +4458,89 @@ void vulkan_garbage_collect( void )
 
 gamescope::Rc<CVulkanTexture> vulkan_acquire_screenshot_texture(uint32_t width, uint32_t height, bool exportable, uint32_t drmFormat, EStreamColorspace colorspace)
 {
+	gamescope::OwningRc<CVulkanTexture> *pEmptySlot = nullptr;
+	gamescope::OwningRc<CVulkanTexture> *pIdleSlot = nullptr;
+
 	for (auto& pScreenshotImage : g_output.pScreenshotImages)
 	{
 		if (pScreenshotImage == nullptr)
 		{
-			pScreenshotImage = new CVulkanTexture();
-
-			CVulkanTexture::createFlags screenshotImageFlags;
-			screenshotImageFlags.bMappable = true;
-			screenshotImageFlags.bTransferDst = true;
-			screenshotImageFlags.bStorage = true;
-			if (exportable || drmFormat == DRM_FORMAT_NV12) {
-				screenshotImageFlags.bExportable = true;
-				screenshotImageFlags.bLinear = true; // TODO: support multi-planar DMA-BUF export via PipeWire
-			}
+			if (!pEmptySlot)
+				pEmptySlot = &pScreenshotImage;
+			continue;
+		}
 
-			bool bSuccess = pScreenshotImage->BInit( width, height, 1u, drmFormat, screenshotImageFlags );
-			pScreenshotImage->setStreamColorspace(colorspace);
+		// Still being encoded.
+		if (pScreenshotImage->GetRefCount() != 0)
+			continue;
 
-			assert( bSuccess );
+		if (width == pScreenshotImage->width() &&
+			height == pScreenshotImage->height() &&
+			drmFormat == pScreenshotImage->drmFormat())
+		{
+			pScreenshotImage->setStreamColorspace(colorspace);
+			return pScreenshotImage.get();
 		}
 
-		if (pScreenshotImage->GetRefCount() != 0 ||
-			width != pScreenshotImage->width() ||
-			height != pScreenshotImage->height() ||
-			drmFormat != pScreenshotImage->drmFormat())
-			continue;
+		if (!pIdleSlot)
+			pIdleSlot = &pScreenshotImage;
+	}
 
-		return pScreenshotImage.get();
+	// Nothing matching, recycle an idle image of the wrong size or format
+	// if all the slots are taken.
+	gamescope::OwningRc<CVulkanTexture> *pSlot = pEmptySlot ? pEmptySlot : pIdleSlot;
+	if (!pSlot)
+	{
+		vk_log.errorf("Unable to acquire screenshot texture. Out of textures.");
+		return nullptr;
 	}
 
-	vk_log.errorf("Unable to acquire screenshot texture. Out of textures.");
-	return nullptr;
+	gamescope::OwningRc<CVulkanTexture> pScreenshotImage = new CVulkanTexture();
+
+	CVulkanTexture::createFlags screenshotImageFlags;
+	screenshotImageFlags.bMappable = true;
+	screenshotImageFlags.bTransferDst = true;
+	screenshotImageFlags.bStorage = true;
+	if (exportable || drmFormat == DRM_FORMAT_NV12) {
+		screenshotImageFlags.bExportable = true;
+		screenshotImageFlags.bLinear = true;
+	}
+
+	bool bSuccess = pScreenshotImage->BInit( width, height, 1u, drmFormat, screenshotImageFlags );
+	if (!bSuccess)
+	{
+		vk_log.errorf("Failed to create %ux%u screenshot texture.", width, height);
+		return nullptr;
+	}
+	pScreenshotImage->setStreamColorspace(colorspace);
+
+	*pSlot = std::move(pScreenshotImage);
+	return pSlot->get();
+}
+
+gamescope::Rc<CVulkanTexture> vulkan_acquire_screenshot_intermediate_texture(uint32_t width, uint32_t height, uint32_t drmFormat)
+{
+	gamescope::OwningRc<CVulkanTexture> &pIntermediate = g_output.pScreenshotIntermediate;
+	if (pIntermediate != nullptr &&
+		pIntermediate->width() == width &&
+		pIntermediate->height() == height &&
+		pIntermediate->drmFormat() == drmFormat)
+		return pIntermediate.get();
+
+	gamescope::OwningRc<CVulkanTexture> pTexture = new CVulkanTexture();
+
+	CVulkanTexture::createFlags texCreateFlags;
+	texCreateFlags.bStorage = true;
+	texCreateFlags.bSampled = true;
+
+	if (!pTexture->BInit( width, height, 1u, drmFormat, texCreateFlags ))
+	{
+		vk_log.errorf("Failed to create %ux%u screenshot intermediate texture.", width, height);
+		return nullptr;
+	}
+
+	pIntermediate = std::move(pTexture);
+	return pIntermediate.get();
 }
 
 // Internal display's native brightness.
@@ -3617,10 +4568,15 @@ struct BlitPushData_t
     float u_itmSdrNits; // unset
     float u_itmTargetNits; // unset
 
+	// First pixel written, for partial updates.
+	uint32_t dispatchOffset[2];
+
 	explicit BlitPushData_t(const struct FrameInfo_t *frameInfo)
 	{
 		u_shaderFilter = 0;
 		u_alphaMode = 0;
+		dispatchOffset[0] = 0;
+		dispatchOffset[1] = 0;
 
 		for (int i = 0; i < frameInfo->layerCount; i++) {
 			const FrameInfo_t::Layer_t *layer = &frameInfo->layers[i];
@@ -3665,6 +4621,8 @@ struct BlitPushData_t
 		opacity[0] = 1.0f;
         u_shaderFilter = (uint32_t)GamescopeUpscaleFilter::LINEAR;
 		u_alphaMode = 0;
+		dispatchOffset[0] = 0;
+		dispatchOffset[1] = 0;
 		ctm[0] = glm::mat3x4
 		{
 			1, 0, 0, 0,
@@ -3690,12 +4648,18 @@ struct CaptureConvertBlitData_t
 	mat3x4 outputCTM;
 	uint32_t borderMask;
 	uint32_t halfExtent[2];
+	uint32_t encodeTF;
+	// First chroma sample written, for partial updates.
+	uint32_t dispatchOffset[2];
 
-	explicit CaptureConvertBlitData_t(float blit_scale, const mat3x4 &color_matrix) {
+	explicit CaptureConvertBlitData_t(float blit_scale, const mat3x4 &color_matrix, ECaptureEncodeTF eEncodeTF = k_ECaptureEncodeTF_sRGB) {
 		scale[0] = { blit_scale, blit_scale };
 		offset[0] = { 0.0f, 0.0f };
 		opacity[0] = 1.0f;
 		borderMask = 0;
+		encodeTF = eEncodeTF;
+		dispatchOffset[0] = 0;
+		dispatchOffset[1] = 0;
 		ctm[0] = glm::mat3x4
 		{
 			1, 0, 0, 0,
@@ -3706,6 +4670,16 @@ struct CaptureConvertBlitData_t
 	}
 };
 
+struct ScreenshotPlanarData_t
+{
+	uint32_t extent[2];
+
+	ScreenshotPlanarData_t(uint32_t width, uint32_t height) {
+		extent[0] = width;
+		extent[1] = height;
+	}
+};
+
 struct uvec4_t
 {
 	uint32_t  x;
@@ -3844,6 +4818,15 @@ void bind_all_layers(CVulkanCmdBuffer* cmdBuffer, const struct FrameInfo_t *fram
 }
 
 std::optional<uint64_t> vulkan_screenshot( const struct FrameInfo_t *frameInfo, gamescope::Rc<CVulkanTexture> pScreenshotTexture, gamescope::Rc<CVulkanTexture> pYUVOutTexture )
+{
+	std::vector<ScreenshotOutput_t> outputs;
+	if ( pYUVOutTexture != nullptr )
+		outputs.push_back( ScreenshotOutput_t{ std::move( pYUVOutTexture ) } );
+
+	return vulkan_screenshot( frameInfo, std::move( pScreenshotTexture ), std::nullopt, outputs );
+}
+
+std::optional<uint64_t> vulkan_screenshot( const struct FrameInfo_t *frameInfo, gamescope::Rc<CVulkanTexture> pScreenshotTexture, std::optional<VkRect2D> oCompositeRegion, const std::vector<ScreenshotOutput_t> &outputs )
 {
 	EOTF outputTF = frameInfo->outputEncodingEOTF;
 	if (!frameInfo->applyOutputColorMgmt)
@@ -3851,25 +4834,85 @@ std::optional<uint64_t> vulkan_screenshot( const struct FrameInfo_t *frameInfo,
 
 	auto cmdBuffer = g_device.commandBuffer();
 
-	for (uint32_t i = 0; i < EOTF_Count; i++)
-		cmdBuffer->bindColorMgmtLuts(i, frameInfo->shaperLut[i], frameInfo->lut3D[i]);
+	const int pixelsPerGroup = 8;
 
-	cmdBuffer->bindPipeline( g_device.pipeline(SHADER_TYPE_BLIT, frameInfo->layerCount, frameInfo->ycbcrMask(), 0u, frameInfo->colorspaceMask(), outputTF ));
-	bind_all_layers(cmdBuffer.get(), frameInfo);
-	cmdBuffer->bindTarget(pScreenshotTexture);
-	cmdBuffer->uploadConstants<BlitPushData_t>(frameInfo);
+	const VkRect2D compositeRect = oCompositeRegion.value_or( VkRect2D{ { 0, 0 }, { currentOutputWidth, currentOutputHeight } } );
+	if ( compositeRect.extent.width && compositeRect.extent.height )
+	{
+		for (uint32_t i = 0; i < EOTF_Count; i++)
+			cmdBuffer->bindColorMgmtLuts(i, frameInfo->shaperLut[i], frameInfo->lut3D[i]);
 
-	const int pixelsPerGroup = 8;
+		cmdBuffer->bindPipeline( g_device.pipeline(SHADER_TYPE_BLIT, frameInfo->layerCount, frameInfo->ycbcrMask(), 0u, frameInfo->colorspaceMask(), outputTF ));
+		bind_all_layers(cmdBuffer.get(), frameInfo);
+		// Keep what's outside of the region.
+		if ( oCompositeRegion )
+			cmdBuffer->prepareSrcImage( pScreenshotTexture.get() );
+		cmdBuffer->bindTarget(pScreenshotTexture);
 
-	cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		BlitPushData_t blitConstants( frameInfo );
+		blitConstants.dispatchOffset[0] = compositeRect.offset.x;
+		blitConstants.dispatchOffset[1] = compositeRect.offset.y;
+		cmdBuffer->uploadConstants<BlitPushData_t>(blitConstants);
 
-	if ( pYUVOutTexture != nullptr )
+		cmdBuffer->dispatch(div_roundup(compositeRect.extent.width, pixelsPerGroup), div_roundup(compositeRect.extent.height, pixelsPerGroup));
+	}
+
+	auto RegionContains = []( const std::optional<VkRect2D> &oOuter, const std::optional<VkRect2D> &oInner )
 	{
+		if ( !oOuter )
+			return true;
+		if ( !oInner )
+			return false;
+
+		return oOuter->offset.x <= oInner->offset.x &&
+			oOuter->offset.y <= oInner->offset.y &&
+			oOuter->offset.x + oOuter->extent.width >= oInner->offset.x + oInner->extent.width &&
+			oOuter->offset.y + oOuter->extent.height >= oInner->offset.y + oInner->extent.height;
+	};
+
+	for ( size_t uOut = 0; uOut < outputs.size(); uOut++ )
+	{
+		const gamescope::Rc<CVulkanTexture> &pOutTexture = outputs[uOut].pTexture;
+		const std::optional<VkRect2D> &oRegion = outputs[uOut].oRegion;
+		if ( pOutTexture == pScreenshotTexture )
+			continue;
+
+		if ( oRegion && ( !oRegion->extent.width || !oRegion->extent.height ) )
+			continue;
+
+		if ( !pOutTexture->isYcbcr() )
+		{
+			cmdBuffer->copyImage( pScreenshotTexture, pOutTexture, oRegion );
+			continue;
+		}
+
+		// Only convert once per format, colorspace and size, copy for the rest.
+		auto existingIter = std::find_if( outputs.begin(), outputs.begin() + uOut, [&]( const ScreenshotOutput_t &other )
+		{
+			return other.pTexture->isYcbcr() &&
+				other.pTexture->drmFormat() == pOutTexture->drmFormat() &&
+				other.pTexture->streamColorspace() == pOutTexture->streamColorspace() &&
+				other.pTexture->width() == pOutTexture->width() &&
+				other.pTexture->height() == pOutTexture->height() &&
+				RegionContains( other.oRegion, oRegion );
+		});
+		if ( existingIter != outputs.begin() + uOut )
+		{
+			cmdBuffer->copyImage( existingIter->pTexture, pOutTexture, oRegion );
+			continue;
+		}
+
+		const gamescope::Rc<CVulkanTexture> &pYUVOutTexture = pOutTexture;
 		float scale = (float)pScreenshotTexture->width() / pYUVOutTexture->width();
 
-		CaptureConvertBlitData_t constants( scale, colorspace_to_conversion_from_srgb_matrix( pYUVOutTexture->streamColorspace() ) );
+		const VkRect2D convertRect = oRegion.value_or( VkRect2D{ { 0, 0 }, { pYUVOutTexture->width(), pYUVOutTexture->height() } } );
+
+		CaptureConvertBlitData_t constants( scale, colorspace_to_conversion_from_srgb_matrix( pYUVOutTexture->streamColorspace() ),
+			colorspace_to_capture_encode_tf( pYUVOutTexture->streamColorspace(), frameInfo->outputEncodingEOTF ) );
 		constants.halfExtent[0] = pYUVOutTexture->width() / 2.0f;
 		constants.halfExtent[1] = pYUVOutTexture->height() / 2.0f;
+		constants.dispatchOffset[0] = convertRect.offset.x / 2;
+		constants.dispatchOffset[1] = convertRect.offset.y / 2;
 		cmdBuffer->uploadConstants<CaptureConvertBlitData_t>(constants);
 
 		for (uint32_t i = 0; i < EOTF_Count; i++)
@@ -3884,20 +4927,49 @@ std::optional<uint64_t> vulkan_screenshot( const struct FrameInfo_t *frameInfo,
 		{
 			cmdBuffer->bindTexture(i, nullptr);
 		}
+		if ( oRegion )
+			cmdBuffer->prepareSrcImage( pYUVOutTexture.get() );
 		cmdBuffer->bindTarget(pYUVOutTexture);
 
-		const int pixelsPerGroup = 8;
-
 		// For ycbcr, we operate on 2 pixels at a time, so use the half-extent.
 		const int dispatchSize = pixelsPerGroup * 2;
 
-		cmdBuffer->dispatch(div_roundup(pYUVOutTexture->width(), dispatchSize), div_roundup(pYUVOutTexture->height(), dispatchSize));
+		cmdBuffer->dispatch(div_roundup(convertRect.extent.width, dispatchSize), div_roundup(convertRect.extent.height, dispatchSize));
 	}
 
 	uint64_t sequence = g_device.submit(std::move(cmdBuffer));
 	return sequence;
 }
 
+std::optional<uint64_t> vulkan_screenshot_to_planar_gbr( gamescope::Rc<CVulkanTexture> pSrc, gamescope::Rc<CVulkanTexture> pPlanarOut )
+{
+	assert( pPlanarOut->width() == pSrc->width() && pPlanarOut->height() == pSrc->height() * 3 );
+
+	auto cmdBuffer = g_device.commandBuffer();
+
+	cmdBuffer->uploadConstants<ScreenshotPlanarData_t>( pSrc->width(), pSrc->height() );
+
+	for (uint32_t i = 0; i < EOTF_Count; i++)
+		cmdBuffer->bindColorMgmtLuts(i, nullptr, nullptr);
+
+	cmdBuffer->bindPipeline(g_device.pipeline( SHADER_TYPE_RGB_TO_YUV444, 1, 0, 0, GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB, EOTF_Count ));
+	// The source is already encoded, read it back raw.
+	cmdBuffer->bindTexture(0, pSrc);
+	cmdBuffer->setTextureSrgb(0, false);
+	cmdBuffer->setSamplerNearest(0, true);
+	cmdBuffer->setSamplerUnnormalized(0, true);
+	for (uint32_t i = 1; i < VKR_SAMPLER_SLOTS; i++)
+	{
+		cmdBuffer->bindTexture(i, nullptr);
+	}
+	cmdBuffer->bindTarget(pPlanarOut);
+
+	const int pixelsPerGroup = 8;
+	cmdBuffer->dispatch(div_roundup(pSrc->width(), pixelsPerGroup), div_roundup(pSrc->height(), pixelsPerGroup));
+
+	return g_device.submit(std::move(cmdBuffer));
+}
+
 extern std::string g_reshade_effect;
 extern uint32_t g_reshade_technique_idx;
 
@@ -3970,7 +5042,9 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 
 		int pixelsPerGroup = 16;
 
+		cmdBuffer->beginPass(GPU_PASS_EASU);
 		cmdBuffer->dispatch(div_roundup(tempX, pixelsPerGroup), div_roundup(tempY, pixelsPerGroup));
+		cmdBuffer->endPass(GPU_PASS_EASU);
 
 		cmdBuffer->bindPipeline(g_device.pipeline(SHADER_TYPE_RCAS, frameInfo->layerCount, frameInfo->ycbcrMask() & ~1, 0u, frameInfo->colorspaceMask(), outputTF ));
 		bind_all_layers(cmdBuffer.get(), frameInfo);
@@ -3981,7 +5055,9 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 		cmdBuffer->bindTarget(compositeImage);
 		cmdBuffer->uploadConstants<RcasPushData_t>(frameInfo, g_upscaleFilterSharpness / 10.0f);
 
+		cmdBuffer->beginPass(GPU_PASS_RCAS);
 		cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		cmdBuffer->endPass(GPU_PASS_RCAS);
 	}
 	else if ( frameInfo->useNISLayer0 )
 	{
@@ -4012,7 +5088,9 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 		int pixelsPerGroupX = 32;
 		int pixelsPerGroupY = 24;
 
+		cmdBuffer->beginPass(GPU_PASS_NIS);
 		cmdBuffer->dispatch(div_roundup(tempX, pixelsPerGroupX), div_roundup(tempY, pixelsPerGroupY));
+		cmdBuffer->endPass(GPU_PASS_NIS);
 
 		struct FrameInfo_t nisFrameInfo = *frameInfo;
 		nisFrameInfo.layers[0].tex = g_output.tmpOutput;
@@ -4026,7 +5104,9 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 
 		int pixelsPerGroup = 8;
 
+		cmdBuffer->beginPass(GPU_PASS_COMPOSITE);
 		cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		cmdBuffer->endPass(GPU_PASS_COMPOSITE);
 	}
 	else if ( frameInfo->blurLayer0 )
 	{
@@ -4052,7 +5132,9 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 
 		int pixelsPerGroup = 8;
 
+		cmdBuffer->beginPass(GPU_PASS_BLUR_FIRST_PASS);
 		cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		cmdBuffer->endPass(GPU_PASS_BLUR_FIRST_PASS);
 
 		bool useSrgbView = frameInfo->layers[0].colorspace == GAMESCOPE_APP_TEXTURE_COLORSPACE_LINEAR;
 
@@ -4065,7 +5147,9 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 		cmdBuffer->setSamplerUnnormalized(VKR_BLUR_EXTRA_SLOT, true);
 		cmdBuffer->setSamplerNearest(VKR_BLUR_EXTRA_SLOT, false);
 
+		cmdBuffer->beginPass(GPU_PASS_BLUR);
 		cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		cmdBuffer->endPass(GPU_PASS_BLUR);
 	}
 	else
 	{
@@ -4076,11 +5160,14 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 
 		const int pixelsPerGroup = 8;
 
+		cmdBuffer->beginPass(GPU_PASS_COMPOSITE);
 		cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		cmdBuffer->endPass(GPU_PASS_COMPOSITE);
 	}
 
 	if ( pPipewireTexture != nullptr )
 	{
+		cmdBuffer->beginPass(GPU_PASS_CAPTURE);
 
 		if (compositeImage->format() == pPipewireTexture->format() &&
 			compositeImage->width() == pPipewireTexture->width() &&
@@ -4092,7 +5179,8 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 			float scale = (float)compositeImage->width() / pPipewireTexture->width();
 			if ( ycbcr )
 			{
-				CaptureConvertBlitData_t constants( scale, colorspace_to_conversion_from_srgb_matrix( pPipewireTexture->streamColorspace() ) );
+				CaptureConvertBlitData_t constants( scale, colorspace_to_conversion_from_srgb_matrix( pPipewireTexture->streamColorspace() ),
+					colorspace_to_capture_encode_tf( pPipewireTexture->streamColorspace(), outputTF ) );
 				constants.halfExtent[0] = pPipewireTexture->width() / 2.0f;
 				constants.halfExtent[1] = pPipewireTexture->height() / 2.0f;
 				cmdBuffer->uploadConstants<CaptureConvertBlitData_t>(constants);
@@ -4124,6 +5212,7 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 
 			cmdBuffer->dispatch(div_roundup(pPipewireTexture->width(), dispatchSize), div_roundup(pPipewireTexture->height(), dispatchSize));
 		}
+		cmdBuffer->endPass(GPU_PASS_CAPTURE);
 	}
 
 	uint64_t sequence = g_device.submit(std::move(cmdBuffer));
@@ -4141,6 +5230,11 @@ void vulkan_wait( uint64_t ulSeqNo, bool bReset )
 	return g_device.wait( ulSeqNo, bReset );
 }
 
+void vulkan_wait_timeline( uint64_t ulSeqNo )
+{
+	return g_device.waitTimeline( ulSeqNo );
+}
+
 gamescope::Rc<CVulkanTexture> vulkan_get_last_output_image( bool partial, bool defer )
 {
 	// Get previous image ( +2 )
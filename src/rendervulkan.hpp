@@ -10,7 +10,12 @@
 #include <array>
 #include <bitset>
 #include <mutex>
+#include <condition_variable>
 #include <optional>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_set>
 
 #include "main.hpp"
 
@@ -56,7 +61,9 @@ enum EStreamColorspace : int
 	k_EStreamColorspace_BT601 = 1,
 	k_EStreamColorspace_BT601_Full = 2,
 	k_EStreamColorspace_BT709 = 3,
-	k_EStreamColorspace_BT709_Full = 4
+	k_EStreamColorspace_BT709_Full = 4,
+	// PQ-encoded BT.2020, limited range. Only for 10-bit streams of an HDR output.
+	k_EStreamColorspace_BT2020_PQ = 5,
 };
 
 #include <memory>
@@ -185,6 +192,8 @@ public:
 	inline bool externalImage() { return m_bExternal; }
 	inline VkDeviceSize totalSize() const { return m_size; }
 	inline uint32_t drmFormat() const { return m_drmFormat; }
+	// Unique for the life of the process, unlike the address.
+	inline uint64_t serial() const { return m_ulSerial; }
 
 	inline uint32_t lumaOffset() const { return m_lumaOffset; }
 	inline uint32_t lumaRowPitch() const { return m_lumaPitch; }
@@ -196,7 +205,8 @@ public:
 
 	inline bool isYcbcr() const
 	{
-		return format() == VK_FORMAT_G8_B8R8_2PLANE_420_UNORM;
+		return format() == VK_FORMAT_G8_B8R8_2PLANE_420_UNORM ||
+		       format() == VK_FORMAT_G10X6_B10X6R10X6_2PLANE_420_UNORM_3PACK16;
 	}
 
 	int memoryFence();
@@ -207,6 +217,8 @@ public:
 	uint32_t queueFamily = VK_QUEUE_FAMILY_IGNORED;
 
 private:
+	const uint64_t m_ulSerial;
+
 	bool m_bInitialized = false;
 	bool m_bExternal = false;
 	bool m_bOutputImage = false;
@@ -401,6 +413,7 @@ namespace CompositeDebugFlag
 
 VkInstance vulkan_get_instance(void);
 bool vulkan_init(VkInstance instance, VkSurfaceKHR surface);
+void vulkan_shutdown(void);
 bool vulkan_init_formats(void);
 bool vulkan_make_output();
 
@@ -410,8 +423,13 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_wlr_buffer( struc
 
 std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamescope::Rc<CVulkanTexture> pScreenshotTexture, bool partial, gamescope::Rc<CVulkanTexture> pOutputOverride = nullptr, bool increment = true, std::unique_ptr<CVulkanCmdBuffer> pInCommandBuffer = nullptr );
 void vulkan_wait( uint64_t ulSeqNo, bool bReset );
+// Thread-safe, for waiting on submissions from worker threads.
+void vulkan_wait_timeline( uint64_t ulSeqNo );
 gamescope::Rc<CVulkanTexture> vulkan_get_last_output_image( bool partial, bool defer );
 gamescope::Rc<CVulkanTexture> vulkan_acquire_screenshot_texture(uint32_t width, uint32_t height, bool exportable, uint32_t drmFormat, EStreamColorspace colorspace = k_EStreamColorspace_Unknown);
+// GPU-only scratch image to composite a screenshot into before converting it.
+// Only one exists, it can be reused as soon as the conversion is submitted.
+gamescope::Rc<CVulkanTexture> vulkan_acquire_screenshot_intermediate_texture(uint32_t width, uint32_t height, uint32_t drmFormat);
 
 void vulkan_present_to_window( void );
 
@@ -426,10 +444,39 @@ bool vulkan_supports_modifiers(void);
 gamescope::Rc<CVulkanTexture> vulkan_create_1d_lut(uint32_t size);
 gamescope::Rc<CVulkanTexture> vulkan_create_3d_lut(uint32_t width, uint32_t height, uint32_t depth);
 void vulkan_update_luts(const gamescope::Rc<CVulkanTexture>& lut1d, const gamescope::Rc<CVulkanTexture>& lut3d, void* lut1d_data, void* lut3d_data);
+struct LutUpload_t
+{
+	gamescope::Rc<CVulkanTexture> pLut1d;
+	gamescope::Rc<CVulkanTexture> pLut3d;
+	const void *pLut1dData;
+	const void *pLut3dData;
+};
+// Records all the uploads into one command buffer and submits it without
+// waiting. Later submissions on the queue are ordered after the copies.
+uint64_t vulkan_upload_luts( const LutUpload_t *pUploads, uint32_t uCount );
+// Sequence number of the newest submission, ie. the last one that can still
+// be using a texture taken out of circulation now.
+uint64_t vulkan_get_last_submission( void );
 
 gamescope::Rc<CVulkanTexture> vulkan_get_hacky_blank_texture();
 
 std::optional<uint64_t> vulkan_screenshot( const struct FrameInfo_t *frameInfo, gamescope::Rc<CVulkanTexture> pScreenshotTexture, gamescope::Rc<CVulkanTexture> pYUVOutTexture );
+struct ScreenshotOutput_t
+{
+	gamescope::Rc<CVulkanTexture> pTexture;
+	// Only refresh this part of pTexture and keep the rest.
+	// Must be 2-pixel aligned for YCbCr outputs.
+	std::optional<VkRect2D> oRegion;
+};
+// Composites once into pScreenshotTexture, then fills each output from it.
+// YCbCr outputs are converted, RGB outputs are copied and must match its size.
+// With oCompositeRegion, only that part of pScreenshotTexture is recomposited
+// and the rest is left as it was. An empty region skips the composite.
+std::optional<uint64_t> vulkan_screenshot( const struct FrameInfo_t *frameInfo, gamescope::Rc<CVulkanTexture> pScreenshotTexture, std::optional<VkRect2D> oCompositeRegion, const std::vector<ScreenshotOutput_t> &outputs );
+// Splits an encoded RGB screenshot into 10-bit G, B and R planes stacked in
+// pPlanarOut, an R16 image three times as tall, ready for an identity-matrix
+// 4:4:4 AVIF without any CPU-side conversion.
+std::optional<uint64_t> vulkan_screenshot_to_planar_gbr( gamescope::Rc<CVulkanTexture> pSrc, gamescope::Rc<CVulkanTexture> pPlanarOut );
 
 struct wlr_renderer *vulkan_renderer_create( void );
 
@@ -537,7 +584,9 @@ struct VulkanOutput_t
 	uint32_t uOutputFormat = DRM_FORMAT_INVALID;
 	uint32_t uOutputFormatOverlay = DRM_FORMAT_INVALID;
 
-	std::array<gamescope::OwningRc<CVulkanTexture>, 2> pScreenshotImages;
+	// Enough to keep the screenshot encoder pool busy during bursts.
+	std::array<gamescope::OwningRc<CVulkanTexture>, 4> pScreenshotImages;
+	gamescope::OwningRc<CVulkanTexture> pScreenshotIntermediate;
 
 	// NIS and FSR
 	gamescope::OwningRc<CVulkanTexture> tmpOutput;
@@ -557,10 +606,33 @@ enum ShaderType {
 	SHADER_TYPE_RCAS,
 	SHADER_TYPE_NIS,
 	SHADER_TYPE_RGB_TO_NV12,
+	SHADER_TYPE_RGB_TO_YUV444,
 
 	SHADER_TYPE_COUNT
 };
 
+// Passes vulkan_composite brackets with timestamp queries.
+enum GPUPass {
+	GPU_PASS_EASU = 0,
+	GPU_PASS_RCAS,
+	GPU_PASS_NIS,
+	GPU_PASS_BLUR_FIRST_PASS,
+	GPU_PASS_BLUR,
+	GPU_PASS_COMPOSITE,
+	GPU_PASS_CAPTURE,
+
+	GPU_PASS_COUNT
+};
+
+struct GPUTimings_t
+{
+	uint64_t ulSequence = 0;
+	uint64_t ulTotalNs = 0;
+	std::array<uint64_t, GPU_PASS_COUNT> ulPassNs = {};
+	// Bit per GPUPass that was recorded in this submission.
+	uint32_t uPassMask = 0;
+};
+
 extern VulkanOutput_t g_output;
 
 struct SamplerState
@@ -645,6 +717,43 @@ namespace std
 	};
 }
 
+enum EPipelinePriority
+{
+	// Full permutation space, only walked when we have no usage history.
+	k_EPipelinePriority_Warmup = 0,
+	// Permutations that were hit in previous sessions.
+	k_EPipelinePriority_Hot,
+	// Permutations adjacent to one vulkan_composite just asked for.
+	k_EPipelinePriority_Demand,
+};
+
+struct PipelineCompileRequest_t
+{
+	PipelineInfo_t info;
+	EPipelinePriority ePriority;
+	uint64_t ulHits;
+	uint64_t ulOrder;
+
+	bool operator<(const PipelineCompileRequest_t& o) const {
+		if (ePriority != o.ePriority)
+			return ePriority < o.ePriority;
+		if (ulHits != o.ulHits)
+			return ulHits < o.ulHits;
+		// FIFO within the same priority.
+		return ulOrder > o.ulOrder;
+	}
+};
+
+struct PipelineStats_t
+{
+	uint64_t ulLookups = 0;
+	uint64_t ulStalls = 0;
+	uint64_t ulStallTimeNs = 0;
+	uint64_t ulMaxStallTimeNs = 0;
+	uint64_t ulAsyncCompiles = 0;
+	uint64_t ulQueued = 0;
+};
+
 static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 {
 	return (x + (y - 1)) / y;
@@ -687,6 +796,8 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(CmdEndRendering) \
 	VK_FUNC(CmdPipelineBarrier) \
 	VK_FUNC(CmdPushConstants) \
+	VK_FUNC(CmdResetQueryPool) \
+	VK_FUNC(CmdWriteTimestamp) \
 	VK_FUNC(CreateBuffer) \
 	VK_FUNC(CreateCommandPool) \
 	VK_FUNC(CreateComputePipelines) \
@@ -696,7 +807,9 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(CreateGraphicsPipelines) \
 	VK_FUNC(CreateImage) \
 	VK_FUNC(CreateImageView) \
+	VK_FUNC(CreatePipelineCache) \
 	VK_FUNC(CreatePipelineLayout) \
+	VK_FUNC(CreateQueryPool) \
 	VK_FUNC(CreateSampler) \
 	VK_FUNC(CreateSamplerYcbcrConversion) \
 	VK_FUNC(CreateSemaphore) \
@@ -710,8 +823,10 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(DestroyImage) \
 	VK_FUNC(DestroyImageView) \
 	VK_FUNC(DestroyPipeline) \
+	VK_FUNC(DestroyPipelineCache) \
 	VK_FUNC(DestroySemaphore) \
 	VK_FUNC(DestroyPipelineLayout) \
+	VK_FUNC(DestroyQueryPool) \
 	VK_FUNC(DestroySampler) \
 	VK_FUNC(DestroySwapchainKHR) \
 	VK_FUNC(EndCommandBuffer) \
@@ -724,6 +839,8 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(GetImageMemoryRequirements) \
 	VK_FUNC(GetImageSubresourceLayout) \
 	VK_FUNC(GetMemoryFdKHR) \
+	VK_FUNC(GetPipelineCacheData) \
+	VK_FUNC(GetQueryPoolResults) \
 	VK_FUNC(GetSemaphoreCounterValue) \
 	VK_FUNC(GetSwapchainImagesKHR) \
 	VK_FUNC(MapMemory) \
@@ -766,6 +883,10 @@ class CVulkanDevice
 {
 public:
 	bool BInit(VkInstance instance, VkSurfaceKHR surface);
+	~CVulkanDevice();
+
+	// Stops the shader thread and flushes the pipeline cache to disk.
+	void shutdown();
 
 	VkSampler sampler(SamplerState key);
 	VkPipeline pipeline(ShaderType type, uint32_t layerCount = 1, uint32_t ycbcrMask = 0, uint32_t blur_layers = 0, uint32_t colorspace_mask = 0, uint32_t output_eotf = EOTF_Gamma22, bool itm_enable = false);
@@ -774,8 +895,12 @@ public:
 	uint64_t submit( std::unique_ptr<CVulkanCmdBuffer> cmdBuf);
 	uint64_t submitInternal( CVulkanCmdBuffer* cmdBuf );
 	void wait(uint64_t sequence, bool reset = true);
+	// Only waits on the timeline, doesn't touch any other device state so it's
+	// fine to call off the steamcompmgr thread.
+	void waitTimeline(uint64_t sequence);
 	void waitIdle(bool reset = true);
 	void garbageCollect();
+	inline uint64_t lastSubmissionSeqNo() { return m_submissionSeqNo; }
 	inline VkDescriptorSet descriptorSet()
 	{
 		VkDescriptorSet ret = m_descriptorSets[m_currentDescriptorSet];
@@ -804,6 +929,18 @@ public:
 	inline bool hasDrmPrimaryDevId() {return m_bHasDrmPrimaryDevId;}
 	inline dev_t primaryDevId() {return m_drmPrimaryDevId;}
 	inline bool supportsFp16() {return m_bSupportsFp16;}
+	inline bool supportsTimestamps() {return m_bSupportsTimestamps;}
+	inline uint64_t lastSubmitTime() {return m_ulLastSubmitTimeNs;}
+
+	// GPU execution time of a retired submission, if timestamps are supported
+	// and it is recent enough.
+	std::optional<uint64_t> gpuTime(uint64_t sequence);
+	std::optional<GPUTimings_t> gpuTimings(uint64_t sequence);
+	// Most recently retired submission that had timestamps.
+	std::optional<GPUTimings_t> lastGpuTimings();
+	// Copies out every retained submission, oldest first.
+	std::vector<GPUTimings_t> gpuTimingsHistory();
+	uint64_t timestampToNanos(uint64_t ulBegin, uint64_t ulEnd);
 
 	inline std::pair<void *, uint32_t> uploadBufferData(uint32_t size)
 	{
@@ -832,6 +969,9 @@ public:
 	#undef VK_FUNC
 
 	void resetCmdBuffers(uint64_t sequence);
+	void recordGpuTimings(const GPUTimings_t &timings);
+
+	PipelineStats_t pipelineStats();
 
 protected:
 	friend class CVulkanCmdBuffer;
@@ -841,9 +981,17 @@ protected:
 	bool createLayouts();
 	bool createPools();
 	bool createShaders();
+	bool createPipelineCache();
+	void savePipelineCache();
 	bool createScratchResources();
 	VkPipeline compilePipeline(uint32_t layerCount, uint32_t ycbcrMask, ShaderType type, uint32_t blur_layer_count, uint32_t composite_debug, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable);
-	void compileAllPipelines();
+	std::optional<GPUTimings_t> gpuTimingsLocked(uint64_t sequence);
+	void pipelineThreadMain();
+	void queuePipelineLocked(const PipelineInfo_t &info, EPipelinePriority ePriority, uint64_t ulHits);
+	void queueAdjacentPipelinesLocked(const PipelineInfo_t &info);
+	void queueAllPipelines();
+	bool loadPipelineUsage();
+	void savePipelineUsage();
 
 	VkDevice m_device = nullptr;
 	VkPhysicalDevice m_physDev = nullptr;
@@ -865,6 +1013,7 @@ protected:
 	dev_t m_drmPrimaryDevId = 0;
 
 	bool m_bSupportsFp16 = false;
+	bool m_bSupportsTimestamps = false;
 	bool m_bHasDrmPrimaryDevId = false;
 	bool m_bSupportsModifiers = false;
 	bool m_bInitialized = false;
@@ -872,11 +1021,44 @@ protected:
 
 	VkPhysicalDeviceMemoryProperties m_memoryProperties;
 
+	float m_flTimestampPeriod = 1.0f;
+	uint64_t m_ulTimestampMask = 0;
+	std::atomic<uint64_t> m_ulLastSubmitTimeNs = { 0 };
+	// Indexed by sequence % size.
+	std::mutex m_gpuTimingsLock;
+	std::array<GPUTimings_t, 256> m_gpuTimings = {};
+	uint64_t m_ulLastGpuTimingsSequence = 0;
+
 	std::unordered_map< SamplerState, VkSampler > m_samplerCache;
 	std::array<VkShaderModule, SHADER_TYPE_COUNT> m_shaderModules;
 	std::unordered_map<PipelineInfo_t, VkPipeline> m_pipelineMap;
 	std::mutex m_pipelineMutex;
 
+	// Compile scheduler for the "gamescope-shdr" thread, all protected by
+	// m_pipelineMutex.
+	std::condition_variable m_pipelineCond;
+	std::priority_queue<PipelineCompileRequest_t> m_pipelineQueue;
+	std::unordered_set<PipelineInfo_t> m_pipelinesInFlight;
+	uint64_t m_ulPipelineQueueOrder = 0;
+	bool m_bPipelineCacheDirty = false;
+	bool m_bPipelineThreadExit = false;
+	std::thread m_pipelineThread;
+
+	// Per-session usage histogram, persisted so the next launch warms the hot set.
+	std::unordered_map<PipelineInfo_t, uint64_t> m_pipelineHits;
+	// Worth writing out while idle: a new key or a count crossing a power of two.
+	bool m_bPipelineUsageDirty = false;
+	// Any count changed since the last save, only written on shutdown.
+	bool m_bPipelineUsageChanged = false;
+
+	PipelineStats_t m_pipelineStats;
+
+	// Persisted across launches, keyed by the driver's pipelineCacheUUID
+	// and a hash of all of our SPIR-V.
+	VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
+	uint64_t m_ulShaderHash = 0;
+	std::string m_sPipelineCachePath;
+
 	static constexpr uint32_t k_uMaxConcurrentSubmits = 8;
 
 	// currently just one set, no need to double buffer because we
@@ -940,7 +1122,8 @@ public:
 	void uploadConstants(Args&&... args);
 	void bindPipeline(VkPipeline pipeline);
 	void dispatch(uint32_t x, uint32_t y = 1, uint32_t z = 1);
-	void copyImage(gamescope::Rc<CVulkanTexture> src, gamescope::Rc<CVulkanTexture> dst);
+	// With a region, only that part of dst is written and the rest is kept.
+	void copyImage(gamescope::Rc<CVulkanTexture> src, gamescope::Rc<CVulkanTexture> dst, std::optional<VkRect2D> oRegion = std::nullopt);
 	void copyBufferToImage(VkBuffer buffer, VkDeviceSize offset, uint32_t stride, gamescope::Rc<CVulkanTexture> dst);
 
 
@@ -959,6 +1142,10 @@ public:
 	const std::vector<VulkanTimelinePoint_t> &GetExternalDependencies() const { return m_ExternalDependencies; }
 	const std::vector<VulkanTimelinePoint_t> &GetExternalSignals() const { return m_ExternalSignals; }
 
+	void beginPass(GPUPass ePass);
+	void endPass(GPUPass ePass);
+	std::optional<GPUTimings_t> resolveGpuTimings();
+
 private:
 	VkCommandBuffer m_cmdBuffer;
 	CVulkanDevice *m_device;
@@ -982,6 +1169,10 @@ private:
 	std::vector<VulkanTimelinePoint_t> m_ExternalDependencies;
 	std::vector<VulkanTimelinePoint_t> m_ExternalSignals;
 
+	VkQueryPool m_queryPool = VK_NULL_HANDLE;
+	bool m_bTimestampsWritten = false;
+	uint32_t m_uPassesWritten = 0;
+
 	uint32_t m_renderBufferOffset = 0;
 };
 
@@ -16,5 +16,8 @@ uniform layers_t {
     float u_nitsToLinear; // hdr -> sdr
     float u_itmSdrNits;
     float u_itmTargetNits;
+
+    // First pixel written, for partial updates.
+    uvec2 u_dispatchOffset;
 };
 
@@ -33,6 +33,7 @@
 #include "xwayland_ctx.hpp"
 #include <X11/X.h>
 #include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xcursor/Xcursor.h>
 #include <X11/extensions/xfixeswire.h>
 #include <X11/extensions/XInput2.h>
@@ -49,6 +50,9 @@
 #include <fstream>
 #include <string>
 #include <queue>
+#include <deque>
+#include <list>
+#include <cinttypes>
 #include <filesystem>
 #include <variant>
 #include <unordered_set>
@@ -76,6 +80,7 @@
 #include <signal.h>
 #include <linux/input-event-codes.h>
 #include <X11/Xmu/CurUtil.h>
+#include <xcb/xcb.h>
 #include "waitable.h"
 
 #include "main.hpp"
@@ -85,7 +90,6 @@
 #include "vblankmanager.hpp"
 #include "log.hpp"
 #include "Utils/Defer.h"
-#include "win32_styles.h"
 #include "edid.h"
 #include "hdmi.h"
 #include "convar.h"
@@ -93,17 +97,18 @@
 #include "commit.h"
 #include "reshade_effect_manager.hpp"
 #include "BufferMemo.h"
+#include "FrameTrace.h"
+#include "FrameLatency.h"
+#include "FocusPriority.h"
+#include "ScreenshotEncoder.h"
 #include "Utils/Process.h"
 #include "Utils/Algorithm.h"
+#include "Utils/SPSCRing.h"
 
 #include "wlr_begin.hpp"
 #include "wlr/types/wlr_pointer_constraints_v1.h"
 #include "wlr_end.hpp"
 
-#if HAVE_AVIF
-#include "avif/avif.h"
-#endif
-
 static const int g_nBaseCursorScale = 36;
 
 #if HAVE_PIPEWIRE
@@ -254,7 +259,7 @@ static int set_memory_low(const char *unit_path, bool focused) {
 
 #endif
 
-static std::vector< steamcompmgr_win_t* > GetGlobalPossibleFocusWindows();
+static const std::vector< steamcompmgr_win_t* > &GetGlobalPossibleFocusWindows();
 static bool
 pick_primary_focus_and_override(
 	focus_t *out,
@@ -297,6 +302,8 @@ gamescope::ConVar<int> cv_adaptive_sync_overlay_cycles( "adaptive_sync_overlay_c
 
 gamescope::ConVar<bool> cv_upscale_preemptive( "upscale_preemptive", true, "Allow pre-emptive upscaling" );
 gamescope::ConVar<bool> cv_upscale_preemptive_debug_force_sync( "upscale_preemptive_debug_force_sync", false, "Force synchronize pre-emptive upscaling" );
+gamescope::ConVar<int> cv_upscale_image_pool_sizes( "upscale_image_pool_sizes", 3, "How many output sizes/formats to keep pre-emptive upscale images around for." );
+gamescope::ConVar<int> cv_upscale_image_pool_images( "upscale_image_pool_images", 8, "Most pre-emptive upscale images to allocate for one output size/format." );
 
 uint64_t g_SteamCompMgrLimitedAppRefreshCycle = 16'666'666;
 uint64_t g_SteamCompMgrAppRefreshCycle = 16'666'666;
@@ -322,24 +329,22 @@ static const gamescope_color_mgmt_t k_ScreenshotColorMgmtHDR =
 //#define COLOR_MGMT_MICROBENCH
 // sudo cpupower frequency-set --governor performance
 
+// Fills in the CPU side of outColorMgmtLuts. Only touches its arguments,
+// so it's safe to call from the LUT worker.
+// pOverrideLuts, if set, replace the computed LUTs for EOTFs that have both.
 static void
-create_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, gamescope_color_mgmt_luts outColorMgmtLuts[ EOTF_Count ])
+calc_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, const gamescope_color_mgmt_luts *pOverrideLuts, const std::shared_ptr<lut3d_t> pLooks[ EOTF_Count ],
+	gamescope_color_mgmt_luts outColorMgmtLuts[ EOTF_Count ], lut1d_t *pTmpLut1d, lut3d_t *pTmpLut3d)
 {
 	const displaycolorimetry_t& displayColorimetry = newColorMgmt.displayColorimetry;
 	const displaycolorimetry_t& outputEncodingColorimetry = newColorMgmt.outputEncodingColorimetry;
 
 	for ( uint32_t nInputEOTF = 0; nInputEOTF < EOTF_Count; nInputEOTF++ )
 	{
-		if (!outColorMgmtLuts[nInputEOTF].vk_lut1d)
-			outColorMgmtLuts[nInputEOTF].vk_lut1d = vulkan_create_1d_lut(s_nLutSize1d);
-
-		if (!outColorMgmtLuts[nInputEOTF].vk_lut3d)
-			outColorMgmtLuts[nInputEOTF].vk_lut3d = vulkan_create_3d_lut(s_nLutEdgeSize3d, s_nLutEdgeSize3d, s_nLutEdgeSize3d);
-
-		if ( g_ColorMgmtLutsOverride[nInputEOTF].HasLuts() )
+		if ( pOverrideLuts && pOverrideLuts[nInputEOTF].HasLuts() )
 		{
-			memcpy(g_ColorMgmtLuts[nInputEOTF].lut1d, g_ColorMgmtLutsOverride[nInputEOTF].lut1d, sizeof(g_ColorMgmtLutsOverride[nInputEOTF].lut1d));
-			memcpy(g_ColorMgmtLuts[nInputEOTF].lut3d, g_ColorMgmtLutsOverride[nInputEOTF].lut3d, sizeof(g_ColorMgmtLutsOverride[nInputEOTF].lut3d));
+			memcpy(outColorMgmtLuts[nInputEOTF].lut1d, pOverrideLuts[nInputEOTF].lut1d, sizeof(pOverrideLuts[nInputEOTF].lut1d));
+			memcpy(outColorMgmtLuts[nInputEOTF].lut3d, pOverrideLuts[nInputEOTF].lut3d, sizeof(pOverrideLuts[nInputEOTF].lut3d));
 		}
 		else
 		{
@@ -351,7 +356,7 @@ create_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, gamescope_col
 
 			EOTF inputEOTF = static_cast<EOTF>( nInputEOTF );
 			float flGain = 1.f;
-			std::shared_ptr<lut3d_t> pSharedLook = g_ColorMgmtLooks[ nInputEOTF ];
+			const std::shared_ptr<lut3d_t> &pSharedLook = pLooks[ nInputEOTF ];
 			lut3d_t * pLook = pSharedLook && pSharedLook->lutEdgeSize > 0 ? pSharedLook.get() : nullptr;
 
 			if ( inputEOTF == EOTF_Gamma22 )
@@ -421,36 +426,267 @@ create_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, gamescope_col
 				buildPQColorimetry( &inputColorimetry, &colorMapping, displayColorimetry );
 			}
 
-			calcColorTransform<s_nLutEdgeSize3d>( &g_tmpLut1d, s_nLutSize1d, &g_tmpLut3d, inputColorimetry, inputEOTF,
+			calcColorTransform<s_nLutEdgeSize3d>( pTmpLut1d, s_nLutSize1d, pTmpLut3d, inputColorimetry, inputEOTF,
 				outputEncodingColorimetry, newColorMgmt.outputEncodingEOTF,
 				newColorMgmt.outputVirtualWhite, newColorMgmt.chromaticAdaptationMode,
 				colorMapping, newColorMgmt.nightmode, tonemapping, pLook, flGain );
 
 			// Create quantized output luts
-			for ( size_t i=0, end = g_tmpLut1d.dataR.size(); i<end; ++i )
+			for ( size_t i=0, end = pTmpLut1d->dataR.size(); i<end; ++i )
 			{
-				outColorMgmtLuts[nInputEOTF].lut1d[4*i+0] = quantize_lut_value_16bit( g_tmpLut1d.dataR[i] );
-				outColorMgmtLuts[nInputEOTF].lut1d[4*i+1] = quantize_lut_value_16bit( g_tmpLut1d.dataG[i] );
-				outColorMgmtLuts[nInputEOTF].lut1d[4*i+2] = quantize_lut_value_16bit( g_tmpLut1d.dataB[i] );
+				outColorMgmtLuts[nInputEOTF].lut1d[4*i+0] = quantize_lut_value_16bit( pTmpLut1d->dataR[i] );
+				outColorMgmtLuts[nInputEOTF].lut1d[4*i+1] = quantize_lut_value_16bit( pTmpLut1d->dataG[i] );
+				outColorMgmtLuts[nInputEOTF].lut1d[4*i+2] = quantize_lut_value_16bit( pTmpLut1d->dataB[i] );
 				outColorMgmtLuts[nInputEOTF].lut1d[4*i+3] = 0;
 			}
 
-			for ( size_t i=0, end = g_tmpLut3d.data.size(); i<end; ++i )
+			for ( size_t i=0, end = pTmpLut3d->data.size(); i<end; ++i )
 			{
-				outColorMgmtLuts[nInputEOTF].lut3d[4*i+0] = quantize_lut_value_16bit( g_tmpLut3d.data[i].r );
-				outColorMgmtLuts[nInputEOTF].lut3d[4*i+1] = quantize_lut_value_16bit( g_tmpLut3d.data[i].g );
-				outColorMgmtLuts[nInputEOTF].lut3d[4*i+2] = quantize_lut_value_16bit( g_tmpLut3d.data[i].b );
+				outColorMgmtLuts[nInputEOTF].lut3d[4*i+0] = quantize_lut_value_16bit( pTmpLut3d->data[i].r );
+				outColorMgmtLuts[nInputEOTF].lut3d[4*i+1] = quantize_lut_value_16bit( pTmpLut3d->data[i].g );
+				outColorMgmtLuts[nInputEOTF].lut3d[4*i+2] = quantize_lut_value_16bit( pTmpLut3d->data[i].b );
 				outColorMgmtLuts[nInputEOTF].lut3d[4*i+3] = 0;
 			}
 		}
 
 		outColorMgmtLuts[nInputEOTF].bHasLut1D = true;
 		outColorMgmtLuts[nInputEOTF].bHasLut3D = true;
+	}
+}
+
+static void
+snapshot_color_mgmt_looks( std::shared_ptr<lut3d_t> outLooks[ EOTF_Count ] )
+{
+	for ( uint32_t i = 0; i < EOTF_Count; i++ )
+		outLooks[i] = g_ColorMgmtLooks[i];
+}
+
+static void
+create_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, const gamescope_color_mgmt_luts *pOverrideLuts, gamescope_color_mgmt_luts outColorMgmtLuts[ EOTF_Count ])
+{
+	std::shared_ptr<lut3d_t> looks[ EOTF_Count ];
+	snapshot_color_mgmt_looks( looks );
+
+	calc_color_mgmt_luts( newColorMgmt, pOverrideLuts, looks, outColorMgmtLuts, &g_tmpLut1d, &g_tmpLut3d );
+
+	for ( uint32_t nInputEOTF = 0; nInputEOTF < EOTF_Count; nInputEOTF++ )
+	{
+		if (!outColorMgmtLuts[nInputEOTF].vk_lut1d)
+			outColorMgmtLuts[nInputEOTF].vk_lut1d = vulkan_create_1d_lut(s_nLutSize1d);
+
+		if (!outColorMgmtLuts[nInputEOTF].vk_lut3d)
+			outColorMgmtLuts[nInputEOTF].vk_lut3d = vulkan_create_3d_lut(s_nLutEdgeSize3d, s_nLutEdgeSize3d, s_nLutEdgeSize3d);
 
 		vulkan_update_luts(outColorMgmtLuts[nInputEOTF].vk_lut1d, outColorMgmtLuts[nInputEOTF].vk_lut3d, outColorMgmtLuts[nInputEOTF].lut1d, outColorMgmtLuts[nInputEOTF].lut3d);
 	}
 }
 
+// Recomputes the colour management LUTs off the steamcompmgr thread, so dragging
+// a colour slider can't make us miss a vblank. Requests coalesce: the worker
+// only ever picks up the newest one. update_color_mgmt swaps finished LUTs
+// in at the start of a frame.
+class CColorMgmtLutWorker
+{
+public:
+	struct Request_t
+	{
+		uint64_t ulGeneration = 0;
+		gamescope_color_mgmt_t colorMgmt{};
+		gamescope_color_mgmt_luts overrideLuts[ EOTF_Count ];
+		std::shared_ptr<lut3d_t> looks[ EOTF_Count ];
+	};
+
+	struct Result_t
+	{
+		uint64_t ulGeneration = 0;
+		gamescope_color_mgmt_t colorMgmt{};
+		gamescope_color_mgmt_luts luts[ EOTF_Count ];
+	};
+
+	~CColorMgmtLutWorker()
+	{
+		Shutdown();
+	}
+
+	void Shutdown()
+	{
+		{
+			std::unique_lock lock( m_Mutex );
+			m_bStopping = true;
+		}
+		m_RequestAvailable.notify_one();
+
+		if ( m_Thread.joinable() )
+			m_Thread.join();
+	}
+
+	void Request( uint64_t ulGeneration, const gamescope_color_mgmt_t &colorMgmt )
+	{
+		std::unique_lock lock( m_Mutex );
+
+		if ( m_bStopping )
+			return;
+
+		if ( !m_Thread.joinable() )
+			m_Thread = std::thread( [this]() { WorkerThread(); } );
+
+		// Overwrites anything the worker hasn't started on yet.
+		if ( !m_pRequest )
+			m_pRequest = std::make_unique<Request_t>();
+
+		m_pRequest->ulGeneration = ulGeneration;
+		m_pRequest->colorMgmt = colorMgmt;
+		for ( uint32_t i = 0; i < EOTF_Count; i++ )
+			m_pRequest->overrideLuts[i] = g_ColorMgmtLutsOverride[i];
+		snapshot_color_mgmt_looks( m_pRequest->looks );
+
+		m_bHasRequest = true;
+		m_RequestAvailable.notify_one();
+	}
+
+	// Newest finished LUTs, if there are any we haven't taken yet.
+	std::unique_ptr<Result_t> TakeResult()
+	{
+		std::unique_lock lock( m_Mutex );
+		return std::move( m_pResult );
+	}
+
+	// Hand a taken result back to be filled again.
+	void RecycleResult( std::unique_ptr<Result_t> pResult )
+	{
+		std::unique_lock lock( m_Mutex );
+		m_pSpareResult = std::move( pResult );
+	}
+
+private:
+	void WorkerThread()
+	{
+		pthread_setname_np( pthread_self(), "gamescope-luts" );
+
+		std::unique_ptr<Request_t> pRequest = std::make_unique<Request_t>();
+		lut1d_t tmpLut1d;
+		lut3d_t tmpLut3d;
+
+		while ( true )
+		{
+			std::unique_ptr<Result_t> pResult;
+			{
+				std::unique_lock lock( m_Mutex );
+				m_RequestAvailable.wait( lock, [this]{ return m_bHasRequest || m_bStopping; } );
+				if ( m_bStopping )
+					return;
+
+				std::swap( pRequest, m_pRequest );
+				m_bHasRequest = false;
+
+				pResult = m_pSpareResult ? std::move( m_pSpareResult ) : std::make_unique<Result_t>();
+			}
+
+#ifdef COLOR_MGMT_MICROBENCH
+			struct timespec t0, t1;
+			clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+#endif
+
+			calc_color_mgmt_luts( pRequest->colorMgmt, pRequest->overrideLuts, pRequest->looks, pResult->luts, &tmpLut1d, &tmpLut3d );
+
+#ifdef COLOR_MGMT_MICROBENCH
+			clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+
+			double delta = (timespec_to_nanos(t1) - timespec_to_nanos(t0)) / 1000000.0;
+
+			static uint32_t iter = 0;
+			static const uint32_t iter_count = 120;
+			static double accum = 0;
+
+			accum += delta;
+
+			if (iter++ == iter_count)
+			{
+				printf("update_color_mgmt: %.3fms\n", accum / iter_count);
+
+				iter = 0;
+				accum = 0;
+			}
+#endif
+
+			pResult->ulGeneration = pRequest->ulGeneration;
+			pResult->colorMgmt = pRequest->colorMgmt;
+
+			std::unique_lock lock( m_Mutex );
+			// A result nobody took in time is stale, reuse its storage.
+			if ( m_pResult )
+				m_pSpareResult = std::move( m_pResult );
+			m_pResult = std::move( pResult );
+		}
+	}
+
+	std::mutex m_Mutex;
+	std::condition_variable m_RequestAvailable;
+	std::thread m_Thread;
+	bool m_bStopping = false;
+
+	bool m_bHasRequest = false;
+	std::unique_ptr<Request_t> m_pRequest;
+	std::unique_ptr<Result_t> m_pResult;
+	std::unique_ptr<Result_t> m_pSpareResult;
+};
+
+static CColorMgmtLutWorker s_ColorMgmtLutWorker;
+
+// The LUT textures not currently in g_ColorMgmtLuts. New LUTs get uploaded
+// into these and then swapped in, rather than overwriting textures the last
+// frame sampled from.
+static gamescope::Rc<CVulkanTexture> s_ColorMgmtSpareLut1d[ EOTF_Count ];
+static gamescope::Rc<CVulkanTexture> s_ColorMgmtSpareLut3d[ EOTF_Count ];
+// Last submission that could have sampled each spare before it was swapped out.
+static uint64_t s_ulColorMgmtSpareLutLastUse[ EOTF_Count ];
+
+static void
+swap_in_color_mgmt_luts( const gamescope_color_mgmt_luts newLuts[ EOTF_Count ] )
+{
+	// Anything submitted up to now may reference the LUTs we swap out below.
+	const uint64_t ulLastUse = vulkan_get_last_submission();
+
+	LutUpload_t uploads[ EOTF_Count ];
+	for ( uint32_t nInputEOTF = 0; nInputEOTF < EOTF_Count; nInputEOTF++ )
+	{
+		gamescope_color_mgmt_luts &luts = g_ColorMgmtLuts[ nInputEOTF ];
+
+		memcpy( luts.lut1d, newLuts[ nInputEOTF ].lut1d, sizeof( luts.lut1d ) );
+		memcpy( luts.lut3d, newLuts[ nInputEOTF ].lut3d, sizeof( luts.lut3d ) );
+		luts.bHasLut1D = newLuts[ nInputEOTF ].bHasLut1D;
+		luts.bHasLut3D = newLuts[ nInputEOTF ].bHasLut3D;
+
+		if ( !s_ColorMgmtSpareLut1d[ nInputEOTF ] )
+			s_ColorMgmtSpareLut1d[ nInputEOTF ] = vulkan_create_1d_lut( s_nLutSize1d );
+
+		if ( !s_ColorMgmtSpareLut3d[ nInputEOTF ] )
+			s_ColorMgmtSpareLut3d[ nInputEOTF ] = vulkan_create_3d_lut( s_nLutEdgeSize3d, s_nLutEdgeSize3d, s_nLutEdgeSize3d );
+
+		// Only the frames that sampled this spare need to be done, not the whole device.
+		vulkan_wait_timeline( s_ulColorMgmtSpareLutLastUse[ nInputEOTF ] );
+
+		uploads[ nInputEOTF ] = LutUpload_t
+		{
+			.pLut1d     = s_ColorMgmtSpareLut1d[ nInputEOTF ],
+			.pLut3d     = s_ColorMgmtSpareLut3d[ nInputEOTF ],
+			.pLut1dData = luts.lut1d,
+			.pLut3dData = luts.lut3d,
+		};
+	}
+
+	vulkan_upload_luts( uploads, EOTF_Count );
+
+	for ( uint32_t nInputEOTF = 0; nInputEOTF < EOTF_Count; nInputEOTF++ )
+	{
+		gamescope_color_mgmt_luts &luts = g_ColorMgmtLuts[ nInputEOTF ];
+
+		std::swap( luts.vk_lut1d, s_ColorMgmtSpareLut1d[ nInputEOTF ] );
+		std::swap( luts.vk_lut3d, s_ColorMgmtSpareLut3d[ nInputEOTF ] );
+		s_ulColorMgmtSpareLutLastUse[ nInputEOTF ] = ulLastUse;
+	}
+}
+
 gamescope::ConVar<bool> cv_tearing_enabled{ "tearing_enabled", false, "Whether or not tearing is enabled." };
 int g_nSteamMaxHeight = 0;
 bool g_bVRRCapable_CachedValue = false;
@@ -475,61 +711,62 @@ update_color_mgmt()
 	g_ColorMgmt.pending.flInternalDisplayBrightness =
 		GetBackend()->GetCurrentConnector()->GetHDRInfo().uMaxContentLightLevel;
 
-#ifdef COLOR_MGMT_MICROBENCH
-	struct timespec t0, t1;
-#else
-	// check if any part of our color mgmt stack is dirty
-	if ( g_ColorMgmt.pending == g_ColorMgmt.current && g_ColorMgmt.serial != 0 )
-		return;
-#endif
-
-#ifdef COLOR_MGMT_MICROBENCH
-	clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
-#endif
+	static uint32_t s_NextColorMgmtSerial = 0;
+	static gamescope_color_mgmt_t s_RequestedColorMgmt{};
+	static uint64_t s_ulRequestGeneration = 0;
 
-	if (g_ColorMgmt.pending.enabled)
-	{
-		create_color_mgmt_luts(g_ColorMgmt.pending, g_ColorMgmtLuts);
-	}
-	else
+	// LUTs the worker finished since the last frame go in now, at the frame boundary.
+	if ( std::unique_ptr<CColorMgmtLutWorker::Result_t> pResult = s_ColorMgmtLutWorker.TakeResult() )
 	{
-		for ( uint32_t i = 0; i < EOTF_Count; i++ )
-			g_ColorMgmtLuts[i].reset();
-	}
+		// Drop anything superseded, eg. by turning color mgmt off meanwhile.
+		if ( pResult->ulGeneration == s_ulRequestGeneration )
+		{
+			swap_in_color_mgmt_luts( pResult->luts );
 
-#ifdef COLOR_MGMT_MICROBENCH
-	clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
-#endif
+			g_ColorMgmt.serial = ++s_NextColorMgmtSerial;
+			g_ColorMgmt.current = pResult->colorMgmt;
+		}
 
-#ifdef COLOR_MGMT_MICROBENCH
-	double delta = (timespec_to_nanos(t1) - timespec_to_nanos(t0)) / 1000000.0;
+		s_ColorMgmtLutWorker.RecycleResult( std::move( pResult ) );
+	}
 
-	static uint32_t iter = 0;
-	static const uint32_t iter_count = 120;
-	static double accum = 0;
+#ifndef COLOR_MGMT_MICROBENCH
+	// check if any part of our color mgmt stack is dirty
+	if ( g_ColorMgmt.pending == s_RequestedColorMgmt && g_ColorMgmt.serial != 0 )
+		return;
+#endif
 
-	accum += delta;
+	s_RequestedColorMgmt = g_ColorMgmt.pending;
+	s_ulRequestGeneration++;
 
-	if (iter++ == iter_count)
+	// Build the first LUTs right here, there is nothing to show until then.
+	// Turning color mgmt off needs no LUTs at all.
+	if ( !g_ColorMgmt.pending.enabled || g_ColorMgmt.serial == 0 )
 	{
-		printf("update_color_mgmt: %.3fms\n", accum / iter_count);
+		if (g_ColorMgmt.pending.enabled)
+		{
+			create_color_mgmt_luts(g_ColorMgmt.pending, g_ColorMgmtLutsOverride, g_ColorMgmtLuts);
+		}
+		else
+		{
+			for ( uint32_t i = 0; i < EOTF_Count; i++ )
+				g_ColorMgmtLuts[i].reset();
+		}
 
-		iter = 0;
-		accum = 0;
+		g_ColorMgmt.serial = ++s_NextColorMgmtSerial;
+		g_ColorMgmt.current = g_ColorMgmt.pending;
+		return;
 	}
-#endif
-
-	static uint32_t s_NextColorMgmtSerial = 0;
 
-	g_ColorMgmt.serial = ++s_NextColorMgmtSerial;
-	g_ColorMgmt.current = g_ColorMgmt.pending;
+	// Keep compositing with the current LUTs until the new ones are ready.
+	s_ColorMgmtLutWorker.Request( s_ulRequestGeneration, g_ColorMgmt.pending );
 }
 
 static void
 update_screenshot_color_mgmt()
 {
-	create_color_mgmt_luts(k_ScreenshotColorMgmt, g_ScreenshotColorMgmtLuts);
-	create_color_mgmt_luts(k_ScreenshotColorMgmtHDR, g_ScreenshotColorMgmtLutsHDR);
+	create_color_mgmt_luts(k_ScreenshotColorMgmt, nullptr, g_ScreenshotColorMgmtLuts);
+	create_color_mgmt_luts(k_ScreenshotColorMgmtHDR, nullptr, g_ScreenshotColorMgmtLutsHDR);
 }
 
 bool set_color_sdr_gamut_wideness( float flVal )
@@ -1010,6 +1247,36 @@ gamescope::ConCommand cc_debug_set_fps_limit( "debug_set_fps_limit", "Set refres
 	steamcompmgr_set_app_refresh_cycle_override( GetBackend()->GetScreenType(), nFps, true, true );
 });
 
+static gamescope::ConCommand cc_frametrace_record( "frametrace_record", "Record every presented frame to a trace file for --composite-bench. Usage: frametrace_record <path> [max frames]",
+[](std::span<std::string_view> svArgs)
+{
+	if ( svArgs.size() < 2 )
+	{
+		console_log.errorf( "Usage: frametrace_record <path> [max frames]" );
+		return;
+	}
+
+	uint32_t uCapacity = 7200;
+	if ( svArgs.size() >= 3 )
+	{
+		std::optional<uint32_t> ouCapacity = gamescope::Parse<uint32_t>( svArgs[2] );
+		if ( !ouCapacity || !*ouCapacity )
+		{
+			console_log.errorf( "Failed to parse frame count." );
+			return;
+		}
+		uCapacity = *ouCapacity;
+	}
+
+	gamescope::CFrameTraceRecorder::Get().StartRecording( std::string( svArgs[1] ).c_str(), uCapacity );
+});
+
+static gamescope::ConCommand cc_frametrace_stop( "frametrace_stop", "Stop recording frames started by frametrace_record",
+[](std::span<std::string_view> svArgs)
+{
+	gamescope::CFrameTraceRecorder::Get().StopRecording();
+});
+
 static int g_nRuntimeInfoFd = -1;
 
 bool g_bFSRActive = false;
@@ -1117,6 +1384,8 @@ extern bool		steamMode;
 gamescope::ConVar<bool> cv_composite_force{ "composite_force", false, "Force composition always, never use scanout" };
 static bool		useXRes = true;
 
+gamescope::ConVar<bool> cv_screenshot_avif_gpu_convert{ "screenshot_avif_gpu_convert", true, "Split AVIF screenshots into 10-bit planes on the GPU instead of unpacking them on the encoder threads." };
+
 namespace gamescope
 {
 	CScreenshotManager &CScreenshotManager::Get()
@@ -1125,7 +1394,51 @@ namespace gamescope
 		return s_Instance;
 	}
 
-	static ConCommand cc_screenshot( "screenshot", "Take a screenshot to a given path.",
+	// /tmp/shot.png -> /tmp/shot_0003.png
+	static std::string GetBurstScreenshotPath( const std::string &szPath, uint32_t uIndex )
+	{
+		size_t uNameStart = szPath.find_last_of( '/' );
+		uNameStart = uNameStart == std::string::npos ? 0 : uNameStart + 1;
+		size_t uExtensionStart = szPath.find( '.', uNameStart );
+		if ( uExtensionStart == std::string::npos )
+			uExtensionStart = szPath.size();
+
+		char szIndex[16];
+		snprintf( szIndex, sizeof( szIndex ), "_%04u", uIndex );
+		return szPath.substr( 0, uExtensionStart ) + szIndex + szPath.substr( uExtensionStart );
+	}
+
+	void CScreenshotManager::TakeScreenshot( GamescopeScreenshotInfo info )
+	{
+		const uint32_t uBurstCount = std::max( info.uBurstCount, 1u );
+		info.uBurstCount = 1;
+
+		{
+			std::unique_lock lock{ m_ScreenshotInfoMutex };
+			for ( uint32_t i = 0; i < uBurstCount; i++ )
+			{
+				if ( m_PendingScreenshots.size() >= k_uMaxPendingScreenshots )
+				{
+					xwm_log.errorf( "Too many pending screenshots, skipping the rest of %s", info.szScreenshotPath.c_str() );
+					break;
+				}
+
+				GamescopeScreenshotInfo shot = info;
+				if ( uBurstCount > 1 )
+				{
+					shot.szScreenshotPath = GetBurstScreenshotPath( info.szScreenshotPath, i );
+					// Only clear the property once the whole burst is done.
+					shot.bX11PropertyRequested = info.bX11PropertyRequested && i == uBurstCount - 1;
+				}
+				m_PendingScreenshots.push_back( std::move( shot ) );
+			}
+		}
+
+		// Screenshots come from the next painted frames, make sure there are some.
+		force_repaint();
+	}
+
+	static ConCommand cc_screenshot( "screenshot", "Take a screenshot to a given path. Usage: screenshot [path] [type] [burst count]",
 	[]( std::span<std::string_view> args )
 	{
 		std::string_view szPath = "/tmp/gamescope.png";
@@ -1140,12 +1453,17 @@ namespace gamescope
 				eScreenshotType = static_cast<gamescope_control_screenshot_type>( *oType );
 		}
 
+		uint32_t uBurstCount = 1;
+		if ( args.size() > 3 )
+			uBurstCount = Parse<uint32_t>( args[3] ).value_or( 1 );
+
 		gamescope::CScreenshotManager::Get().TakeScreenshot( gamescope::GamescopeScreenshotInfo
 		{
 			.szScreenshotPath      = std::string( szPath ),
 			.eScreenshotType       = eScreenshotType,
 			.uScreenshotFlags      = 0,
 			.bX11PropertyRequested = false,
+			.uBurstCount           = uBurstCount,
 		} );
 	});
 }
@@ -1155,41 +1473,47 @@ static std::atomic<bool> g_bForceRepaint{false};
 
 extern int g_nCursorScaleHeight;
 
-// poor man's semaphore
-class sem
+enum StatsEventType_t : uint32_t
 {
-public:
-	void wait( void )
-	{
-		std::unique_lock<std::mutex> lock(mtx);
-
-		while(count == 0){
-			cv.wait(lock);
-		}
-		count--;
-	}
-
-	void signal( void )
-	{
-		std::unique_lock<std::mutex> lock(mtx);
-		count++;
-		cv.notify_one();
-	}
+	STATS_EVENT_FPS,
+	STATS_EVENT_FOCUS_STEAM,
+	STATS_EVENT_FOCUS_APP,
+};
 
-private:
-	std::mutex mtx;
-	std::condition_variable cv;
-	int count = 0;
+// Formatted on the stats thread, so nothing here may point to compositor state.
+struct StatsEvent_t
+{
+	StatsEventType_t eType;
+	float flFPS;
+	uint32_t uAppID;
 };
 
-sem statsThreadSem;
-std::mutex statsEventQueueLock;
-std::vector< std::string > statsEventQueue;
+// Written from paint_all, read by statsThreadMain.
+gamescope::CSPSCRing<StatsEvent_t, 64> statsEventRing;
+// Bumped on every push so the stats thread can futex-wait on it.
+std::atomic<uint32_t> statsEventSignal = { 0 };
+std::atomic<uint64_t> statsEventsDropped = { 0 };
 
 std::string statsThreadPath;
 int			statsPipeFD = -1;
 
-bool statsThreadRun;
+std::atomic<bool> statsThreadRun = { false };
+
+static void stats_write_event( const StatsEvent_t &event )
+{
+	switch ( event.eType )
+	{
+		case STATS_EVENT_FPS:
+			dprintf( statsPipeFD, "fps=%f\n", event.flFPS );
+			break;
+		case STATS_EVENT_FOCUS_STEAM:
+			dprintf( statsPipeFD, "focus=steam\n" );
+			break;
+		case STATS_EVENT_FOCUS_APP:
+			dprintf( statsPipeFD, "focus=%i\n", event.uAppID );
+			break;
+	}
+}
 
 void statsThreadMain( void )
 {
@@ -1206,61 +1530,39 @@ void statsThreadMain( void )
 		}
 	}
 
-wait:
-	statsThreadSem.wait();
+	uint64_t ulReportedDropped = 0;
 
-	if ( statsThreadRun == false )
+	while ( statsThreadRun )
 	{
-		return;
-	}
+		uint32_t uSignal = statsEventSignal.load();
 
-	std::string event;
-
-retry:
-	{
-		std::unique_lock< std::mutex > lock( statsEventQueueLock );
+		while ( std::optional<StatsEvent_t> oEvent = statsEventRing.Pop() )
+			stats_write_event( *oEvent );
 
-		if( statsEventQueue.empty() )
+		uint64_t ulDropped = statsEventsDropped.load( std::memory_order_relaxed );
+		if ( ulDropped != ulReportedDropped )
 		{
-			goto wait;
+			xwm_log.warnf( "stats: dropped %lu events, %lu total", ulDropped - ulReportedDropped, ulDropped );
+			ulReportedDropped = ulDropped;
 		}
 
-		event = statsEventQueue[ 0 ];
-		statsEventQueue.erase( statsEventQueue.begin() );
+		statsEventSignal.wait( uSignal );
 	}
-
-	dprintf( statsPipeFD, "%s", event.c_str() );
-
-	goto retry;
 }
 
-static inline void stats_printf( const char* format, ...)
+static inline void stats_push_event( const StatsEvent_t &event )
 {
-	static char buffer[256];
-	static std::string eventstr;
-
-	va_list args;
-	va_start(args, format);
-	vsprintf(buffer,format, args);
-	va_end(args);
-
-	eventstr = buffer;
+	if ( !statsThreadRun )
+		return;
 
+	if ( !statsEventRing.Push( event ) )
 	{
-		{
-			std::unique_lock< std::mutex > lock( statsEventQueueLock );
-
-			if( statsEventQueue.size() > 50 )
-			{
-				// overflow, drop event
-				return;
-			}
-
-			statsEventQueue.push_back( eventstr );
-
-			statsThreadSem.signal();
-		}
+		statsEventsDropped.fetch_add( 1, std::memory_order_relaxed );
+		return;
 	}
+
+	statsEventSignal.fetch_add( 1 );
+	statsEventSignal.notify_one();
 }
 
 uint64_t get_time_in_nanos()
@@ -1301,24 +1603,33 @@ bool xwayland_ctx_t::HasQueuedEvents()
 static steamcompmgr_win_t *
 find_win(xwayland_ctx_t *ctx, Window id, bool find_children = true)
 {
-	steamcompmgr_win_t	*w;
-
 	if (id == None)
 	{
 		return NULL;
 	}
 
-	for (w = ctx->list; w; w = w->xwayland().next)
 	{
-		if (w->xwayland().id == id)
+		std::unique_lock lock( ctx->win_index_mutex );
+
+		auto iter = ctx->win_index.find( id );
+		if ( iter != ctx->win_index.end() )
+			return iter->second;
+
+		if ( !find_children )
+			return nullptr;
+
+		auto childIter = ctx->child_toplevels.find( id );
+		if ( childIter != ctx->child_toplevels.end() )
 		{
-			return w;
+			iter = ctx->win_index.find( childIter->second );
+			if ( iter != ctx->win_index.end() )
+				return iter->second;
+
+			// That toplevel is gone, ask the server again.
+			ctx->child_toplevels.erase( childIter );
 		}
 	}
 
-	if ( !find_children )
-		return nullptr;
-
 	// Didn't find, must be a children somewhere; try again with parent.
 	Window root = None;
 	Window parent = None;
@@ -1333,25 +1644,75 @@ find_win(xwayland_ctx_t *ctx, Window id, bool find_children = true)
 		return NULL;
 	}
 
-	return find_win(ctx, parent);
+	steamcompmgr_win_t *w = find_win(ctx, parent);
+	if ( w )
+	{
+		std::unique_lock lock( ctx->win_index_mutex );
+		ctx->child_toplevels[ id ] = w->xwayland().id;
+	}
+
+	return w;
+}
+
+static bool win_has_surface( steamcompmgr_win_t *w, struct wlr_surface *surf )
+{
+	return w->xwayland().surface.main_surface == surf || w->xwayland().surface.override_surface == surf;
 }
 
 static steamcompmgr_win_t * find_win( xwayland_ctx_t *ctx, struct wlr_surface *surf )
 {
 	steamcompmgr_win_t	*w = nullptr;
 
-	for (w = ctx->list; w; w = w->xwayland().next)
+	auto iter = ctx->surface_index.find( surf );
+	if ( iter != ctx->surface_index.end() )
 	{
-		if ( w->xwayland().surface.main_surface == surf )
+		w = find_win( ctx, iter->second, false );
+		if ( w && win_has_surface( w, surf ) )
 			return w;
+	}
 
-		if ( w->xwayland().surface.override_surface == surf )
+	for (w = ctx->list; w; w = w->xwayland().next)
+	{
+		if ( win_has_surface( w, surf ) )
+		{
+			ctx->surface_index[ surf ] = w->xwayland().id;
 			return w;
+		}
 	}
 
 	return nullptr;
 }
 
+// Remember a direct child of a toplevel, from Create/ReparentNotify.
+static void
+note_child_win( xwayland_ctx_t *ctx, Window id, Window parent )
+{
+	std::unique_lock lock( ctx->win_index_mutex );
+
+	auto iter = ctx->child_toplevels.find( parent );
+	Window toplevel = iter != ctx->child_toplevels.end() ? iter->second : parent;
+
+	if ( ctx->win_index.contains( toplevel ) )
+		ctx->child_toplevels[ id ] = toplevel;
+	else
+		ctx->child_toplevels.erase( id );
+}
+
+static void
+forget_child_win( xwayland_ctx_t *ctx, Window id )
+{
+	std::unique_lock lock( ctx->win_index_mutex );
+
+	auto iter = ctx->child_toplevels.find( id );
+	if ( iter == ctx->child_toplevels.end() )
+		return;
+
+	// We don't hear about grandchildren, and they may have moved along
+	// with it. Drop everything under the old toplevel to be safe.
+	Window toplevel = iter->second;
+	std::erase_if( ctx->child_toplevels, [=]( const auto &entry ) { return entry.second == toplevel; } );
+}
+
 static gamescope::CBufferMemoizer s_BufferMemos;
 
 // This really needs cleanup, this function is so silly...
@@ -1365,7 +1726,8 @@ import_commit (
 	std::vector<struct wl_resource*> presentation_feedbacks,
 	std::optional<uint32_t> present_id,
 	uint64_t desired_present_time,
-	bool fifo )
+	bool fifo,
+	uint64_t arrival_time )
 {
 	gamescope::Rc<commit_t> commit = new commit_t;
 
@@ -1380,6 +1742,7 @@ import_commit (
 		commit->feedback = *swapchain_feedback;
 	commit->present_id = present_id;
 	commit->desired_present_time = desired_present_time;
+	commit->arrival_time = arrival_time;
 
 	if ( gamescope::OwningRc<CVulkanTexture> pTexture = s_BufferMemos.LookupVulkanTexture( buf ) )
 	{
@@ -1545,21 +1908,10 @@ MouseCursor::MouseCursor(xwayland_ctx_t *ctx)
 
 void MouseCursor::UpdatePosition()
 {
-	wlserver_lock();
-	struct wlr_pointer_constraint_v1 *pConstraint = wlserver.GetCursorConstraint();
-	if ( pConstraint && pConstraint->current.cursor_hint.enabled )
-	{
-		m_x = pConstraint->current.cursor_hint.x;
-		m_y = pConstraint->current.cursor_hint.y;
-		m_bConstrained = true;
-	}
-	else
-	{
-		m_x = wlserver.mouse_surface_cursorx;
-		m_y = wlserver.mouse_surface_cursory;
-		m_bConstrained = false;
-	}
-	wlserver_unlock();
+	wlserver_cursor_state_t cursorState = wlserver_get_cursor_state();
+	m_x = cursorState.x;
+	m_y = cursorState.y;
+	m_bConstrained = cursorState.bConstrained;
 }
 
 void MouseCursor::checkSuspension()
@@ -2266,61 +2618,48 @@ static void update_touch_scaling( const struct FrameInfo_t *frameInfo )
 }
 
 #if HAVE_PIPEWIRE
-static void paint_pipewire()
+struct PipewireStreamPaintState_t
 {
-	static struct pipewire_buffer *s_pPipewireBuffer = nullptr;
-
-	// If the stream stopped/changed, and the underlying pw_buffer was thus
-	// destroyed, then destroy this buffer and grab a new one.
-	if ( s_pPipewireBuffer && s_pPipewireBuffer->IsStale() )
-	{
-		pipewire_destroy_buffer( s_pPipewireBuffer );
-		s_pPipewireBuffer = nullptr;
-	}
+	struct pipewire_buffer *pBuffer = nullptr;
 
-	// Queue up a buffer with some metadata.
-	if ( !s_pPipewireBuffer )
-		s_pPipewireBuffer = dequeue_pipewire_buffer();
+	uint64_t ulLastFocusAppId = 0;
+	focus_t focus{};
 
-	if ( !s_pPipewireBuffer || !s_pPipewireBuffer->texture )
-		return;
+	// If the commits are the same as they were last time, don't repaint and don't push a new buffer on the stream.
+	uint64_t ulLastFocusCommitId = 0;
+	uint64_t ulLastOverrideCommitId = 0;
 
-	struct FrameInfo_t frameInfo = {};
-	frameInfo.applyOutputColorMgmt = true;
-	frameInfo.outputEncodingEOTF   = EOTF_Gamma22;
-	frameInfo.allowVRR             = false;
-	frameInfo.bFadingOut           = false;
+	// New frames seen, for the stream's frame-rate divisor.
+	uint32_t uNewFrames = 0;
 
-	// Apply screenshot-style color management.
-	for ( uint32_t nInputEOTF = 0; nInputEOTF < EOTF_Count; nInputEOTF++ )
-	{
-		frameInfo.lut3D[nInputEOTF]     = g_ScreenshotColorMgmtLuts[nInputEOTF].vk_lut3d;
-		frameInfo.shaperLut[nInputEOTF] = g_ScreenshotColorMgmtLuts[nInputEOTF].vk_lut1d;
-	}
+	// Capture cache frame we last sent, for the damage we report to the consumer.
+	uint64_t ulLastSentCacheId = 0;
+	uint64_t ulLastSentSerial = 0;
+};
 
-	const uint64_t ulFocusAppId = s_pPipewireBuffer->gamescope_info.focus_appid;
+// Picks what a stream should show, or nullptr if it has nothing new to send this time.
+static focus_t *pipewire_stream_focus( uint32_t uStream, PipewireStreamPaintState_t *pState )
+{
+	const uint64_t ulFocusAppId = pState->pBuffer->gamescope_info.focus_appid;
 
 	focus_t *pFocus = nullptr;
 	if ( ulFocusAppId )
 	{
-		static uint64_t s_ulLastFocusAppId = 0;
-
-		bool bAppIdChange = ulFocusAppId != s_ulLastFocusAppId;
+		bool bAppIdChange = ulFocusAppId != pState->ulLastFocusAppId;
 		if ( bAppIdChange )
 		{
-			xwm_log.infof( "Exposing appid %lu (%u 32-bit) focus-wise on pipewire stream.", ulFocusAppId, uint32_t( ulFocusAppId ) );
-			s_ulLastFocusAppId = ulFocusAppId;
+			xwm_log.infof( "Exposing appid %lu (%u 32-bit) focus-wise on pipewire stream %u.", ulFocusAppId, uint32_t( ulFocusAppId ), uStream );
+			pState->ulLastFocusAppId = ulFocusAppId;
 		}
 
-		static focus_t s_PipewireFocus{};
-		if ( s_PipewireFocus.IsDirty() || bAppIdChange )
+		if ( pState->focus.IsDirty() || bAppIdChange )
 		{
 			std::vector<steamcompmgr_win_t *> vecPossibleFocusWindows = GetGlobalPossibleFocusWindows();
 
 			std::vector<uint32_t> vecAppIds{ uint32_t( ulFocusAppId ) };
-			pick_primary_focus_and_override( &s_PipewireFocus, None, vecPossibleFocusWindows, false, vecAppIds );
+			pick_primary_focus_and_override( &pState->focus, None, vecPossibleFocusWindows, false, vecAppIds );
 		}
-		pFocus = &s_PipewireFocus;
+		pFocus = &pState->focus;
 	}
 	else
 	{
@@ -2328,65 +2667,409 @@ static void paint_pipewire()
 	}
 
 	if ( !pFocus->focusWindow )
-		return;
+		return nullptr;
 
 	const bool bAppIdMatches = !ulFocusAppId || pFocus->focusWindow->appID == ulFocusAppId;
 	if ( !bAppIdMatches )
-		return;
-
-	// If the commits are the same as they were last time, don't repaint and don't push a new buffer on the stream.
-	static uint64_t s_ulLastFocusCommitId = 0;
-	static uint64_t s_ulLastOverrideCommitId = 0;
+		return nullptr;
 
 	uint64_t ulFocusCommitId = window_last_done_commit_id( pFocus->focusWindow );
 	uint64_t ulOverrideCommitId = window_last_done_commit_id( pFocus->overrideWindow );
 
-	if ( ulFocusCommitId == s_ulLastFocusCommitId &&
-	     ulOverrideCommitId == s_ulLastOverrideCommitId )
-		return;
+	if ( ulFocusCommitId == pState->ulLastFocusCommitId &&
+	     ulOverrideCommitId == pState->ulLastOverrideCommitId )
+		return nullptr;
+
+	pState->ulLastFocusCommitId = ulFocusCommitId;
+	pState->ulLastOverrideCommitId = ulOverrideCommitId;
+
+	const uint32_t uDivisor = std::max( pState->pBuffer->gamescope_info.framerate_divisor, 1 );
+	if ( pState->uNewFrames++ % uDivisor != 0 )
+		return nullptr;
+
+	return pFocus;
+}
+
+gamescope::ConVar<bool> cv_pipewire_damage_tracking{ "pipewire_damage_tracking", true, "Only recomposite the parts of PipeWire capture frames that changed, and tell consumers about it." };
+// Damage is rounded out to whole tiles, so small updates don't turn into lots of tiny dispatches.
+static constexpr int32_t k_nPipewireDamageTileSize = 32;
+// Capture caches nobody has used for this many paints get freed.
+static constexpr uint64_t k_ulPipewireCaptureCacheMaxIdle = 120;
+
+// What a window's layers looked like the last time we composited it into a capture cache.
+struct PipewireLayerSnapshot_t
+{
+	uint32_t uTexWidth = 0;
+	uint32_t uTexHeight = 0;
+	vec2_t offset{};
+	vec2_t scale{};
+	float flOpacity = 0.0f;
+	GamescopeUpscaleFilter eFilter = GamescopeUpscaleFilter::LINEAR;
+	GamescopeAppTextureColorspace eColorspace = GAMESCOPE_APP_TEXTURE_COLORSPACE_LINEAR;
+	AlphaBlendingMode_t eAlphaBlendingMode = ALPHA_BLENDING_MODE_PREMULTIPLIED;
+	bool bBlackBorder = false;
+
+	static PipewireLayerSnapshot_t FromLayer( const FrameInfo_t::Layer_t &layer )
+	{
+		return PipewireLayerSnapshot_t
+		{
+			.uTexWidth          = layer.tex ? layer.tex->width() : 0,
+			.uTexHeight         = layer.tex ? layer.tex->height() : 0,
+			.offset             = layer.offset,
+			.scale              = layer.scale,
+			.flOpacity          = layer.opacity,
+			.eFilter            = layer.filter,
+			.eColorspace        = layer.colorspace,
+			.eAlphaBlendingMode = layer.eAlphaBlendingMode,
+			.bBlackBorder       = layer.blackBorder,
+		};
+	}
+
+	bool operator == ( const PipewireLayerSnapshot_t &other ) const
+	{
+		return uTexWidth == other.uTexWidth &&
+		       uTexHeight == other.uTexHeight &&
+		       offset.x == other.offset.x &&
+		       offset.y == other.offset.y &&
+		       scale.x == other.scale.x &&
+		       scale.y == other.scale.y &&
+		       flOpacity == other.flOpacity &&
+		       eFilter == other.eFilter &&
+		       eColorspace == other.eColorspace &&
+		       eAlphaBlendingMode == other.eAlphaBlendingMode &&
+		       bBlackBorder == other.bBlackBorder;
+	}
+};
+
+struct PipewireCapturedWindow_t
+{
+	uint64_t ulCommitId = 0;
+	std::vector<PipewireLayerSnapshot_t> layers;
+};
+
+// A persistent composite of some windows at some size, shared by every stream
+// showing them. Frames only recomposite what changed since the previous one.
+struct PipewireCaptureCache_t
+{
+	uint64_t ulId = 0;
+
+	steamcompmgr_win_t *pFocusWindow = nullptr;
+	uint64_t ulFocusWindowSeq = 0;
+	steamcompmgr_win_t *pOverrideWindow = nullptr;
+	uint64_t ulOverrideWindowSeq = 0;
+	uint32_t uWidth = 0;
+	uint32_t uHeight = 0;
+	uint32_t uDrmFormat = 0;
+
+	gamescope::OwningRc<CVulkanTexture> pTexture;
+
+	PipewireCapturedWindow_t focusCapture;
+	PipewireCapturedWindow_t overrideCapture;
+	std::array<CVulkanTexture *, EOTF_Count> pLut3Ds{};
 
-	s_ulLastFocusCommitId = ulFocusCommitId;
-	s_ulLastOverrideCommitId = ulOverrideCommitId;
+	// Serial of the last frame composited into pTexture, 0 if it has no contents yet.
+	uint64_t ulSerial = 0;
+	gamescope::CDamageHistory frameDamage;
+
+	uint64_t ulLastUsed = 0;
+};
 
-	uint32_t uWidth = s_pPipewireBuffer->texture->width();
-	uint32_t uHeight = s_pPipewireBuffer->texture->height();
+static gamescope::DamageRect_t pipewire_layer_damage( const FrameInfo_t::Layer_t &layer, const gamescope::DamageRect_t &bufferDamage )
+{
+	// The blit shader samples (screen + offset) * scale, go the other way.
+	// Grow by a texel's footprint to cover linear filtering spilling over.
+	const float flMarginX = ceilf( 1.0f / layer.scale.x ) + 1.0f;
+	const float flMarginY = ceilf( 1.0f / layer.scale.y ) + 1.0f;
 
-	const uint32_t uCompositeDebugBackup = g_uCompositeDebug;
-	const uint32_t uBackupWidth = currentOutputWidth;
-	const uint32_t uBackupHeight = currentOutputHeight;
+	return gamescope::DamageRect_t
+	{
+		int32_t( floorf( bufferDamage.nX0 / layer.scale.x - layer.offset.x - flMarginX ) ),
+		int32_t( floorf( bufferDamage.nY0 / layer.scale.y - layer.offset.y - flMarginY ) ),
+		int32_t( ceilf( bufferDamage.nX1 / layer.scale.x - layer.offset.x + flMarginX ) ),
+		int32_t( ceilf( bufferDamage.nY1 / layer.scale.y - layer.offset.y + flMarginY ) ),
+	};
+}
 
-	g_uCompositeDebug = 0;
-	currentOutputWidth = uWidth;
-	currentOutputHeight = uHeight;
+// What a window's layers [nFirstLayer, nEndLayer) changed on screen since it was
+// last composited into the cache, or nullopt if we can't tell.
+static std::optional<gamescope::DamageRect_t> pipewire_window_damage( PipewireCapturedWindow_t *pCaptured, steamcompmgr_win_t *w, const FrameInfo_t *frameInfo, int nFirstLayer, int nEndLayer )
+{
+	std::vector<PipewireLayerSnapshot_t> layers;
+	for ( int i = nFirstLayer; i < nEndLayer; i++ )
+		layers.push_back( PipewireLayerSnapshot_t::FromLayer( frameInfo->layers[i] ) );
 
-	// Paint the windows we have onto the Pipewire stream.
-	paint_window( pFocus->focusWindow, pFocus->focusWindow, &frameInfo, nullptr, 0, 1.0f, pFocus->overrideWindow );
+	const uint64_t ulCommitId = window_last_done_commit_id( w );
 
-	if ( pFocus->overrideWindow && !pFocus->focusWindow->isSteamStreamingClient )
-		paint_window( pFocus->overrideWindow, pFocus->focusWindow, &frameInfo, nullptr, PaintWindowFlag::NoFilter, 1.0f, pFocus->overrideWindow );
+	std::optional<gamescope::DamageRect_t> oDamage;
+	if ( layers == pCaptured->layers )
+	{
+		if ( layers.empty() || ulCommitId == pCaptured->ulCommitId )
+		{
+			oDamage = gamescope::DamageRect_t{};
+		}
+		else if ( layers.size() == 1 && w &&
+		          ( layers[0].eFilter == GamescopeUpscaleFilter::LINEAR || layers[0].eFilter == GamescopeUpscaleFilter::NEAREST ) )
+		{
+			std::optional<gamescope::DamageRect_t> oCommitDamage = w->commitDamage.GetDamageSince( pCaptured->ulCommitId, ulCommitId );
+			if ( oCommitDamage )
+				oDamage = pipewire_layer_damage( frameInfo->layers[ nFirstLayer ], *oCommitDamage );
+		}
+	}
 
-	gamescope::Rc<CVulkanTexture> pRGBTexture = s_pPipewireBuffer->texture->isYcbcr()
-		? vulkan_acquire_screenshot_texture( uWidth, uHeight, false, DRM_FORMAT_XRGB2101010 )
-		: gamescope::Rc<CVulkanTexture>{ s_pPipewireBuffer->texture };
+	pCaptured->ulCommitId = ulCommitId;
+	pCaptured->layers = std::move( layers );
+	return oDamage;
+}
 
-	gamescope::Rc<CVulkanTexture> pYUVTexture = s_pPipewireBuffer->texture->isYcbcr() ? s_pPipewireBuffer->texture : nullptr;
+static std::optional<VkRect2D> pipewire_damage_to_region( const std::optional<gamescope::DamageRect_t> &oDamage )
+{
+	if ( !oDamage )
+		return std::nullopt;
 
+	if ( oDamage->IsEmpty() )
+		return VkRect2D{};
 
-	std::optional<uint64_t> oPipewireSequence = vulkan_screenshot( &frameInfo, pRGBTexture, pYUVTexture );
-	// If we ever want the fat compositing path, use this.
-	//std::optional<uint64_t> oPipewireSequence = vulkan_composite( &frameInfo, s_pPipewireBuffer->texture, false, pRGBTexture, false );
+	return VkRect2D
+	{
+		.offset = { oDamage->nX0, oDamage->nY0 },
+		.extent = { uint32_t( oDamage->Width() ), uint32_t( oDamage->Height() ) },
+	};
+}
 
-	g_uCompositeDebug = uCompositeDebugBackup;
+static PipewireCaptureCache_t *pipewire_get_capture_cache( std::vector<PipewireCaptureCache_t> &caches, focus_t *pFocus, uint32_t uWidth, uint32_t uHeight, uint32_t uDrmFormat, uint64_t ulPaintCount )
+{
+	static uint64_t s_ulNextCacheId = 1;
 
-	currentOutputWidth = uBackupWidth;
-	currentOutputHeight = uBackupHeight;
+	steamcompmgr_win_t *pFocusWindow = pFocus->focusWindow;
+	steamcompmgr_win_t *pOverrideWindow = pFocus->overrideWindow;
+	const uint64_t ulFocusWindowSeq = pFocusWindow ? pFocusWindow->seq : 0;
+	const uint64_t ulOverrideWindowSeq = pOverrideWindow ? pOverrideWindow->seq : 0;
 
-	if ( oPipewireSequence )
+	for ( PipewireCaptureCache_t &cache : caches )
 	{
+		// Windows can get freed and their addresses reused, so check the seq too.
+		if ( cache.pFocusWindow == pFocusWindow && cache.ulFocusWindowSeq == ulFocusWindowSeq &&
+		     cache.pOverrideWindow == pOverrideWindow && cache.ulOverrideWindowSeq == ulOverrideWindowSeq &&
+		     cache.uWidth == uWidth && cache.uHeight == uHeight && cache.uDrmFormat == uDrmFormat )
+		{
+			cache.ulLastUsed = ulPaintCount;
+			return &cache;
+		}
+	}
+
+	gamescope::OwningRc<CVulkanTexture> pTexture = new CVulkanTexture();
+	CVulkanTexture::createFlags flags;
+	flags.bStorage = true;
+	flags.bSampled = true;
+	flags.bTransferSrc = true;
+	flags.bTransferDst = true;
+	if ( !pTexture->BInit( uWidth, uHeight, 1u, uDrmFormat, flags ) )
+	{
+		xwm_log.errorf( "Failed to create %ux%u pipewire capture texture", uWidth, uHeight );
+		return nullptr;
+	}
+
+	PipewireCaptureCache_t &cache = caches.emplace_back();
+	cache.ulId = s_ulNextCacheId++;
+	cache.pFocusWindow = pFocusWindow;
+	cache.ulFocusWindowSeq = ulFocusWindowSeq;
+	cache.pOverrideWindow = pOverrideWindow;
+	cache.ulOverrideWindowSeq = ulOverrideWindowSeq;
+	cache.uWidth = uWidth;
+	cache.uHeight = uHeight;
+	cache.uDrmFormat = uDrmFormat;
+	cache.pTexture = std::move( pTexture );
+	cache.ulLastUsed = ulPaintCount;
+	return &cache;
+}
+
+static void paint_pipewire()
+{
+	static std::vector<PipewireStreamPaintState_t> s_PipewireStreams;
+	if ( s_PipewireStreams.size() != get_pipewire_stream_count() )
+		s_PipewireStreams.resize( get_pipewire_stream_count() );
+
+	static std::vector<PipewireCaptureCache_t> s_CaptureCaches;
+	static uint64_t s_ulPaintCount = 0;
+	s_ulPaintCount++;
+	std::erase_if( s_CaptureCaches, []( const PipewireCaptureCache_t &cache )
+	{
+		return cache.ulLastUsed + k_ulPipewireCaptureCacheMaxIdle < s_ulPaintCount;
+	});
+
+	struct ReadyStream_t
+	{
+		PipewireStreamPaintState_t *pState;
+		focus_t *pFocus;
+	};
+	std::vector<ReadyStream_t> readyStreams;
+
+	for ( uint32_t i = 0; i < s_PipewireStreams.size(); i++ )
+	{
+		PipewireStreamPaintState_t *pState = &s_PipewireStreams[i];
+
+		// If the stream stopped/changed, and the underlying pw_buffer was thus
+		// destroyed, then destroy this buffer and grab a new one.
+		if ( pState->pBuffer && pState->pBuffer->IsStale() )
+		{
+			pipewire_destroy_buffer( pState->pBuffer );
+			pState->pBuffer = nullptr;
+		}
+
+		if ( !pipewire_is_streaming( i ) )
+			continue;
+
+		// Queue up a buffer with some metadata.
+		if ( !pState->pBuffer )
+			pState->pBuffer = dequeue_pipewire_buffer( i );
+
+		if ( !pState->pBuffer || !pState->pBuffer->texture )
+			continue;
+
+		focus_t *pFocus = pipewire_stream_focus( i, pState );
+		if ( !pFocus )
+			continue;
+
+		readyStreams.push_back( ReadyStream_t{ pState, pFocus } );
+	}
+
+	// Streams showing the same windows at the same size share one capture cache,
+	// and vulkan_screenshot converts to each YUV format once.
+	std::vector<bool> vecPainted( readyStreams.size(), false );
+	for ( size_t uFirst = 0; uFirst < readyStreams.size(); uFirst++ )
+	{
+		if ( vecPainted[ uFirst ] )
+			continue;
+
+		focus_t *pFocus = readyStreams[ uFirst ].pFocus;
+		uint32_t uWidth = readyStreams[ uFirst ].pState->pBuffer->texture->width();
+		uint32_t uHeight = readyStreams[ uFirst ].pState->pBuffer->texture->height();
+
+		// RGB streams get copies of the cache, so they all need its format,
+		// copying from a different one would just reinterpret the bits.
+		uint32_t uRGBFormat = DRM_FORMAT_INVALID;
+
+		std::vector<PipewireStreamPaintState_t *> vecGroup;
+		for ( size_t i = uFirst; i < readyStreams.size(); i++ )
+		{
+			const gamescope::OwningRc<CVulkanTexture> &pTexture = readyStreams[i].pState->pBuffer->texture;
+			if ( vecPainted[i] ||
+			     readyStreams[i].pFocus->focusWindow != pFocus->focusWindow ||
+			     readyStreams[i].pFocus->overrideWindow != pFocus->overrideWindow ||
+			     pTexture->width() != uWidth ||
+			     pTexture->height() != uHeight )
+				continue;
+
+			if ( !pTexture->isYcbcr() )
+			{
+				if ( uRGBFormat == DRM_FORMAT_INVALID )
+					uRGBFormat = pTexture->drmFormat();
+				else if ( pTexture->drmFormat() != uRGBFormat )
+					continue;
+			}
+
+			vecPainted[i] = true;
+			vecGroup.push_back( readyStreams[i].pState );
+		}
+
+		const uint32_t uCacheFormat = uRGBFormat != DRM_FORMAT_INVALID ? uRGBFormat : DRM_FORMAT_XRGB2101010;
+		PipewireCaptureCache_t *pCache = pipewire_get_capture_cache( s_CaptureCaches, pFocus, uWidth, uHeight, uCacheFormat, s_ulPaintCount );
+		if ( !pCache )
+			continue;
+
+		struct FrameInfo_t frameInfo = {};
+		frameInfo.applyOutputColorMgmt = true;
+		frameInfo.outputEncodingEOTF   = EOTF_Gamma22;
+		frameInfo.allowVRR             = false;
+		frameInfo.bFadingOut           = false;
+
+		// Apply screenshot-style color management.
+		bool bLutsChanged = false;
+		for ( uint32_t nInputEOTF = 0; nInputEOTF < EOTF_Count; nInputEOTF++ )
+		{
+			frameInfo.lut3D[nInputEOTF]     = g_ScreenshotColorMgmtLuts[nInputEOTF].vk_lut3d;
+			frameInfo.shaperLut[nInputEOTF] = g_ScreenshotColorMgmtLuts[nInputEOTF].vk_lut1d;
+
+			bLutsChanged |= pCache->pLut3Ds[nInputEOTF] != frameInfo.lut3D[nInputEOTF].get();
+			pCache->pLut3Ds[nInputEOTF] = frameInfo.lut3D[nInputEOTF].get();
+		}
+
+		const uint32_t uCompositeDebugBackup = g_uCompositeDebug;
+		const uint32_t uBackupWidth = currentOutputWidth;
+		const uint32_t uBackupHeight = currentOutputHeight;
+
+		g_uCompositeDebug = 0;
+		currentOutputWidth = uWidth;
+		currentOutputHeight = uHeight;
+
+		// Paint the windows we have onto the Pipewire stream.
+		const int nFocusFirstLayer = frameInfo.layerCount;
+		paint_window( pFocus->focusWindow, pFocus->focusWindow, &frameInfo, nullptr, 0, 1.0f, pFocus->overrideWindow );
+
+		const int nOverrideFirstLayer = frameInfo.layerCount;
+		if ( pFocus->overrideWindow && !pFocus->focusWindow->isSteamStreamingClient )
+			paint_window( pFocus->overrideWindow, pFocus->focusWindow, &frameInfo, nullptr, PaintWindowFlag::NoFilter, 1.0f, pFocus->overrideWindow );
+
+		// Work out what needs recompositing, everything unless we can prove otherwise.
+		std::optional<gamescope::DamageRect_t> oFocusDamage = pipewire_window_damage( &pCache->focusCapture, pFocus->focusWindow, &frameInfo, nFocusFirstLayer, nOverrideFirstLayer );
+		std::optional<gamescope::DamageRect_t> oOverrideDamage = pipewire_window_damage( &pCache->overrideCapture, pFocus->overrideWindow, &frameInfo, nOverrideFirstLayer, frameInfo.layerCount );
+
+		std::optional<gamescope::DamageRect_t> oFrameDamage;
+		if ( cv_pipewire_damage_tracking && pCache->ulSerial != 0 && !bLutsChanged && oFocusDamage && oOverrideDamage )
+			oFrameDamage = oFocusDamage->Union( *oOverrideDamage ).SnapToTiles( k_nPipewireDamageTileSize, uWidth, uHeight );
+
+		pCache->ulSerial++;
+		pCache->frameDamage.Add( pCache->ulSerial, oFrameDamage.value_or( gamescope::DamageRect_t::FromSize( uWidth, uHeight ) ) );
+
+		// Each buffer only needs what changed since it was last filled from this cache.
+		std::vector<ScreenshotOutput_t> outputs;
+		for ( PipewireStreamPaintState_t *pState : vecGroup )
+		{
+			struct pipewire_buffer *pBuffer = pState->pBuffer;
+
+			std::optional<gamescope::DamageRect_t> oBufferDamage;
+			if ( cv_pipewire_damage_tracking && pBuffer->capture_cache_id == pCache->ulId )
+				oBufferDamage = pCache->frameDamage.GetDamageSince( pBuffer->capture_serial );
+
+			outputs.push_back( ScreenshotOutput_t{ pBuffer->texture, pipewire_damage_to_region( oBufferDamage ) } );
+		}
+
+		std::optional<uint64_t> oPipewireSequence = vulkan_screenshot( &frameInfo, pCache->pTexture, pipewire_damage_to_region( oFrameDamage ), outputs );
+		// If we ever want the fat compositing path, use this.
+		//std::optional<uint64_t> oPipewireSequence = vulkan_composite( &frameInfo, s_pPipewireBuffer->texture, false, pRGBTexture, false );
+
+		g_uCompositeDebug = uCompositeDebugBackup;
+
+		currentOutputWidth = uBackupWidth;
+		currentOutputHeight = uBackupHeight;
+
+		if ( !oPipewireSequence )
+		{
+			// Don't know what made it into the cache, start over.
+			s_CaptureCaches.erase( s_CaptureCaches.begin() + ( pCache - s_CaptureCaches.data() ) );
+			continue;
+		}
+
 		vulkan_wait( *oPipewireSequence, true );
 
-		push_pipewire_buffer( s_pPipewireBuffer );
-		s_pPipewireBuffer = nullptr;
+		for ( PipewireStreamPaintState_t *pState : vecGroup )
+		{
+			struct pipewire_buffer *pBuffer = pState->pBuffer;
+
+			// Consumers want damage relative to the previous frame on the stream,
+			// not to what this particular buffer last held.
+			pBuffer->damage = std::nullopt;
+			if ( cv_pipewire_damage_tracking && pState->ulLastSentCacheId == pCache->ulId )
+				pBuffer->damage = pCache->frameDamage.GetDamageSince( pState->ulLastSentSerial );
+
+			pBuffer->capture_cache_id = pCache->ulId;
+			pBuffer->capture_serial = pCache->ulSerial;
+			pState->ulLastSentCacheId = pCache->ulId;
+			pState->ulLastSentSerial = pCache->ulSerial;
+
+			push_pipewire_buffer( pBuffer );
+			pState->pBuffer = nullptr;
+		}
 	}
 }
 #endif
@@ -2459,15 +3142,15 @@ paint_all( global_focus_t *pFocus, bool async )
 		lastSampledFrameTime = currentTime;
 		frameCounter = 0;
 
-		stats_printf( "fps=%f\n", currentFrameRate );
+		stats_push_event( StatsEvent_t{ .eType = STATS_EVENT_FPS, .flFPS = currentFrameRate } );
 
 		if ( window_is_steam( w ) )
 		{
-			stats_printf( "focus=steam\n" );
+			stats_push_event( StatsEvent_t{ .eType = STATS_EVENT_FOCUS_STEAM } );
 		}
 		else
 		{
-			stats_printf( "focus=%i\n", w ? w->appID : 0 );
+			stats_push_event( StatsEvent_t{ .eType = STATS_EVENT_FOCUS_APP, .uAppID = w ? w->appID : 0 } );
 		}
 	}
 
@@ -2759,13 +3442,30 @@ paint_all( global_focus_t *pFocus, bool async )
 		}
 	}
 
+	// Only the first present of each app frame counts, repaints for overlays etc. don't.
+	if ( const auto &pBaseCommit = g_HeldCommits[ HELD_COMMIT_BASE ]; pBaseCommit && !pBaseCommit->latency_submitted && pBaseCommit->arrival_time )
+	{
+		gamescope::CFrameLatencyTracker::Get().SubmitFrame( gamescope::FrameLatencyStamps_t
+		{
+			.ulArrivalTime     = pBaseCommit->arrival_time,
+			.ulFenceSignalTime = pBaseCommit->fence_signal_time,
+			.ulLatchTime       = pBaseCommit->latch_time,
+			.ulSubmitTime      = get_time_in_nanos(),
+		} );
+		pBaseCommit->latency_submitted = true;
+	}
+
 	if ( pConnector && pConnector->Present( &frameInfo, async ) != 0 )
 	{
 		return;
 	}
 
-	std::optional<gamescope::GamescopeScreenshotInfo> oScreenshotInfo =
-		gamescope::CScreenshotManager::Get().ProcessPendingScreenshot();
+	gamescope::CFrameTraceRecorder::Get().RecordFrame( &frameInfo, get_time_in_nanos(), currentOutputWidth, currentOutputHeight );
+
+	std::optional<gamescope::GamescopeScreenshotInfo> oScreenshotInfo;
+	// Leave screenshots queued while the encoders are backed up rather than dropping them.
+	if ( !gamescope::CScreenshotEncoder::Get().BIsQueueFull() )
+		oScreenshotInfo = gamescope::CScreenshotManager::Get().ProcessPendingScreenshot();
 
 	if ( oScreenshotInfo )
 	{
@@ -2780,11 +3480,34 @@ paint_all( global_focus_t *pFocus, bool async )
 		else if ( path.extension() == ".nv12.bin" )
 			drmCaptureFormat = DRM_FORMAT_NV12;
 
+		// Composite AVIF shots into a float intermediate and split that into planes
+		// on the GPU, so the encoder can hand the mapped image to libavif as-is.
+		gamescope::Rc<CVulkanTexture> pScreenshotIntermediate;
+		if ( drmCaptureFormat == DRM_FORMAT_XRGB2101010 && cv_screenshot_avif_gpu_convert )
+			pScreenshotIntermediate = vulkan_acquire_screenshot_intermediate_texture( g_nOutputWidth, g_nOutputHeight, DRM_FORMAT_XBGR16161616F );
+
 		gamescope::Rc<CVulkanTexture> pScreenshotTexture;
-		if ( drmCaptureFormat != DRM_FORMAT_INVALID )
+		if ( pScreenshotIntermediate )
+			pScreenshotTexture = vulkan_acquire_screenshot_texture( g_nOutputWidth, g_nOutputHeight * 3, false, DRM_FORMAT_R16 );
+		else if ( drmCaptureFormat != DRM_FORMAT_INVALID )
 			pScreenshotTexture = vulkan_acquire_screenshot_texture( g_nOutputWidth, g_nOutputHeight, false, drmCaptureFormat );
 
-		if ( pScreenshotTexture )
+		if ( drmCaptureFormat == DRM_FORMAT_INVALID )
+		{
+			xwm_log.errorf( "Unsupported screenshot format: %s", oScreenshotInfo->szScreenshotPath.c_str() );
+			if ( oScreenshotInfo->bX11PropertyRequested )
+			{
+				XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeScreenShotAtom );
+				XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeDebugScreenShotAtom );
+			}
+		}
+		else if ( !pScreenshotTexture )
+		{
+			// Every staging texture is still being encoded, try again next frame.
+			xwm_log.debugf( "Out of screenshot images, deferring %s", oScreenshotInfo->szScreenshotPath.c_str() );
+			gamescope::CScreenshotManager::Get().DeferScreenshot( std::move( *oScreenshotInfo ) );
+		}
+		else
 		{
 			bool bHDRScreenshot = path.extension() == ".avif" &&
 								  frameInfo.layerCount > 0 &&
@@ -2842,14 +3565,19 @@ paint_all( global_focus_t *pFocus, bool async )
 				g_uCompositeDebug = 0;
 			}
 
+			gamescope::Rc<CVulkanTexture> pCompositeTarget = pScreenshotIntermediate ? pScreenshotIntermediate : pScreenshotTexture;
+
 			std::optional<uint64_t> oScreenshotSeq;
 			if ( drmCaptureFormat == DRM_FORMAT_NV12 )
 				oScreenshotSeq = vulkan_composite( &frameInfo, pScreenshotTexture, false, nullptr );
 			else if ( oScreenshotInfo->eScreenshotType == GAMESCOPE_CONTROL_SCREENSHOT_TYPE_FULL_COMPOSITION ||
 					  oScreenshotInfo->eScreenshotType == GAMESCOPE_CONTROL_SCREENSHOT_TYPE_SCREEN_BUFFER )
-				oScreenshotSeq = vulkan_composite( &frameInfo, nullptr, false, pScreenshotTexture );
+				oScreenshotSeq = vulkan_composite( &frameInfo, nullptr, false, pCompositeTarget );
 			else
-				oScreenshotSeq = vulkan_screenshot( &frameInfo, pScreenshotTexture, nullptr );
+				oScreenshotSeq = vulkan_screenshot( &frameInfo, pCompositeTarget, nullptr );
+
+			if ( oScreenshotSeq && pScreenshotIntermediate )
+				oScreenshotSeq = vulkan_screenshot_to_planar_gbr( pScreenshotIntermediate, pScreenshotTexture );
 
 			if ( oScreenshotInfo->eScreenshotType != GAMESCOPE_CONTROL_SCREENSHOT_TYPE_SCREEN_BUFFER )
 			{
@@ -2862,8 +3590,6 @@ paint_all( global_focus_t *pFocus, bool async )
 				return;
 			}
 
-			vulkan_wait( *oScreenshotSeq, false );
-
 			uint16_t maxCLLNits = 0;
 			uint16_t maxFALLNits = 0;
 
@@ -2878,205 +3604,60 @@ paint_all( global_focus_t *pFocus, bool async )
 				//	maxFALLNits = g_ColorMgmt.current.appHDRMetadata->metadata.hdmi_metadata_type1.max_fall;
 				//}
 
-				if ( !maxCLLNits && !maxFALLNits )
-				{
-					if ( pConnector )
-					{
-						maxCLLNits = pConnector->GetHDRInfo().uMaxContentLightLevel;
-						maxFALLNits = pConnector->GetHDRInfo().uMaxFrameAverageLuminance;
-					}
-				}
-
-				if ( !maxCLLNits && !maxFALLNits )
-				{
-					maxCLLNits = g_ColorMgmt.pending.flInternalDisplayBrightness;
-					maxFALLNits = g_ColorMgmt.pending.flInternalDisplayBrightness * 0.8f;
-				}
-			}
-
-			std::thread screenshotThread = std::thread([=] {
-				pthread_setname_np( pthread_self(), "gamescope-scrsh" );
-
-				const uint8_t *mappedData = pScreenshotTexture->mappedData();
-
-				bool bScreenshotSuccess = false;
-
-				if ( pScreenshotTexture->format() == VK_FORMAT_A2R10G10B10_UNORM_PACK32 )
-				{
-					// Make our own copy of the image to remove the alpha channel.
-					constexpr uint32_t kCompCnt = 3;
-					auto imageData = std::vector<uint16_t>( g_nOutputWidth * g_nOutputHeight * kCompCnt );
-
-					for (uint32_t y = 0; y < g_nOutputHeight; y++)
-					{
-						for (uint32_t x = 0; x < g_nOutputWidth; x++)
-						{
-							uint32_t *pInPixel = (uint32_t *)&mappedData[(y * pScreenshotTexture->rowPitch()) + x * (32 / 8)];
-							uint32_t uInPixel = *pInPixel;
-
-							imageData[y * g_nOutputWidth * kCompCnt + x * kCompCnt + 0] = (uInPixel & (0b1111111111 << 20)) >> 20;
-							imageData[y * g_nOutputWidth * kCompCnt + x * kCompCnt + 1] = (uInPixel & (0b1111111111 << 10)) >> 10;
-							imageData[y * g_nOutputWidth * kCompCnt + x * kCompCnt + 2] = (uInPixel & (0b1111111111 << 0))  >> 0;
-						}
-					}
-
-					assert( HAVE_AVIF );
-#if HAVE_AVIF
-					avifResult avifResult = AVIF_RESULT_OK;
-
-					avifImage *pAvifImage = avifImageCreate( g_nOutputWidth, g_nOutputHeight, 10, AVIF_PIXEL_FORMAT_YUV444 );
-					defer( avifImageDestroy( pAvifImage ) );
-					pAvifImage->yuvRange = AVIF_RANGE_FULL;
-					pAvifImage->colorPrimaries = bHDRScreenshot ? AVIF_COLOR_PRIMARIES_BT2020 : AVIF_COLOR_PRIMARIES_BT709;
-					pAvifImage->transferCharacteristics = bHDRScreenshot ? AVIF_TRANSFER_CHARACTERISTICS_SMPTE2084 : AVIF_TRANSFER_CHARACTERISTICS_SRGB;
-					// We are not actually using YUV, but storing raw GBR (yes not RGB) data
-					// This does not compress as well, but is always lossless!
-					pAvifImage->matrixCoefficients = AVIF_MATRIX_COEFFICIENTS_IDENTITY;
-
-					if ( oScreenshotInfo->eScreenshotType == GAMESCOPE_CONTROL_SCREENSHOT_TYPE_SCREEN_BUFFER )
-					{
-						// When dumping the screen output buffer for debugging,
-						// mark the primaries as UNKNOWN as stuff has likely been transformed
-						// to native if HDR on Deck OLED etc.
-						// We want everything to be seen unadulterated by a viewer/image editor.
-						pAvifImage->colorPrimaries = AVIF_COLOR_PRIMARIES_UNKNOWN;
-					}
-
-					if ( bHDRScreenshot )
-					{
-						pAvifImage->clli.maxCLL = maxCLLNits;
-						pAvifImage->clli.maxPALL = maxFALLNits;
-					}
-
-					avifRGBImage rgbAvifImage{};
-					avifRGBImageSetDefaults( &rgbAvifImage, pAvifImage );
-					rgbAvifImage.format = AVIF_RGB_FORMAT_RGB;
-					rgbAvifImage.ignoreAlpha = AVIF_TRUE;
-
-					rgbAvifImage.pixels = (uint8_t *)imageData.data();
-					rgbAvifImage.rowBytes = g_nOutputWidth * kCompCnt * sizeof( uint16_t );
-
-					if ( ( avifResult = avifImageRGBToYUV( pAvifImage, &rgbAvifImage ) ) != AVIF_RESULT_OK ) // Not really! See Matrix Coefficients IDENTITY above.
-					{
-						xwm_log.errorf( "Failed to convert RGB to YUV: %u", avifResult );
-						return;
-					}
-
-					avifEncoder *pEncoder = avifEncoderCreate();
-					defer( avifEncoderDestroy( pEncoder ) );
-					pEncoder->quality = AVIF_QUALITY_LOSSLESS;
-					pEncoder->qualityAlpha = AVIF_QUALITY_LOSSLESS;
-					pEncoder->speed = AVIF_SPEED_FASTEST;
-
-					if ( ( avifResult = avifEncoderAddImage( pEncoder, pAvifImage, 1, AVIF_ADD_IMAGE_FLAG_SINGLE ) ) != AVIF_RESULT_OK )
-					{
-						xwm_log.errorf( "Failed to add image to avif encoder: %u", avifResult );
-						return;
-					}
-
-					avifRWData avifOutput = AVIF_DATA_EMPTY;
-					defer( avifRWDataFree( &avifOutput ) );
-					if ( ( avifResult = avifEncoderFinish( pEncoder, &avifOutput ) ) != AVIF_RESULT_OK )
-					{
-						xwm_log.errorf( "Failed to finish encoder: %u", avifResult );
-						return;
-					}
-
-					FILE *pScreenshotFile = nullptr;
-					if ( ( pScreenshotFile = fopen( oScreenshotInfo->szScreenshotPath.c_str(), "wb" ) ) == nullptr )
-					{
-						xwm_log.errorf( "Failed to fopen file: %s", oScreenshotInfo->szScreenshotPath.c_str() );
-						return;
-					}
-
-					fwrite( avifOutput.data, 1, avifOutput.size, pScreenshotFile );
-					fclose( pScreenshotFile );
-
-					xwm_log.infof( "Screenshot saved to %s", oScreenshotInfo->szScreenshotPath.c_str() );
-					bScreenshotSuccess = true;
-#endif
-				}
-				else if (pScreenshotTexture->format() == VK_FORMAT_B8G8R8A8_UNORM)
-				{
-					// Make our own copy of the image to remove the alpha channel.
-					auto imageData = std::vector<uint8_t>(currentOutputWidth * currentOutputHeight * 4);
-					const uint32_t comp = 4;
-					const uint32_t pitch = currentOutputWidth * comp;
-					for (uint32_t y = 0; y < currentOutputHeight; y++)
-					{
-						for (uint32_t x = 0; x < currentOutputWidth; x++)
-						{
-							// BGR...
-							imageData[y * pitch + x * comp + 0] = mappedData[y * pScreenshotTexture->rowPitch() + x * comp + 2];
-							imageData[y * pitch + x * comp + 1] = mappedData[y * pScreenshotTexture->rowPitch() + x * comp + 1];
-							imageData[y * pitch + x * comp + 2] = mappedData[y * pScreenshotTexture->rowPitch() + x * comp + 0];
-							imageData[y * pitch + x * comp + 3] = 255;
-						}
-					}
-					if ( stbi_write_png( oScreenshotInfo->szScreenshotPath.c_str(), currentOutputWidth, currentOutputHeight, 4, imageData.data(), pitch ) )
-					{
-						xwm_log.infof( "Screenshot saved to %s", oScreenshotInfo->szScreenshotPath.c_str() );
-						bScreenshotSuccess = true;
-					}
-					else
-					{
-						xwm_log.errorf( "Failed to save screenshot to %s", oScreenshotInfo->szScreenshotPath.c_str() );
-					}
-				}
-				else if (pScreenshotTexture->format() == VK_FORMAT_G8_B8R8_2PLANE_420_UNORM)
-				{
-					FILE *file = fopen( oScreenshotInfo->szScreenshotPath.c_str(), "wb" );
-					if (file)
-					{
-						fwrite(mappedData, 1, pScreenshotTexture->totalSize(), file );
-						fclose(file);
-
-						char cmd[4096];
-						sprintf(cmd, "ffmpeg -f rawvideo -pixel_format nv12 -video_size %dx%d -i %s %s_encoded.png", pScreenshotTexture->width(), pScreenshotTexture->height(), oScreenshotInfo->szScreenshotPath.c_str(), oScreenshotInfo->szScreenshotPath.c_str() );
-
-						int ret = system(cmd);
-
-						/* Above call may fail, ffmpeg returns 0 on success */
-						if (ret) {
-							xwm_log.infof("Ffmpeg call return status %i", ret);
-							xwm_log.errorf( "Failed to save screenshot to %s", oScreenshotInfo->szScreenshotPath.c_str() );
-						} else {
-							xwm_log.infof("Screenshot saved to %s", oScreenshotInfo->szScreenshotPath.c_str());
-							bScreenshotSuccess = true;
-						}
-					}
-					else
+				if ( !maxCLLNits && !maxFALLNits )
+				{
+					if ( pConnector )
 					{
-						xwm_log.errorf( "Failed to save screenshot to %s", oScreenshotInfo->szScreenshotPath.c_str() );
+						maxCLLNits = pConnector->GetHDRInfo().uMaxContentLightLevel;
+						maxFALLNits = pConnector->GetHDRInfo().uMaxFrameAverageLuminance;
 					}
 				}
 
-				if ( oScreenshotInfo->bX11PropertyRequested )
+				if ( !maxCLLNits && !maxFALLNits )
 				{
-					XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeScreenShotAtom );
-					XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeDebugScreenShotAtom );
+					maxCLLNits = g_ColorMgmt.pending.flInternalDisplayBrightness;
+					maxFALLNits = g_ColorMgmt.pending.flInternalDisplayBrightness * 0.8f;
 				}
+			}
 
-				if ( bScreenshotSuccess && oScreenshotInfo->bWaylandRequested )
+			// The encoder waits for the GPU and does the slow part off this thread.
+			bool bQueued = gamescope::CScreenshotEncoder::Get().BQueueJob( gamescope::ScreenshotJob_t
+			{
+				.szPath        = oScreenshotInfo->szScreenshotPath,
+				.pTexture      = pScreenshotTexture,
+				.ulSequence    = *oScreenshotSeq,
+				.bHDR          = bHDRScreenshot,
+				.bScreenBuffer = oScreenshotInfo->eScreenshotType == GAMESCOPE_CONTROL_SCREENSHOT_TYPE_SCREEN_BUFFER,
+				.uMaxCLLNits   = maxCLLNits,
+				.uMaxFALLNits  = maxFALLNits,
+				.fnFinished    = [ info = *oScreenshotInfo, root_ctx ]( bool bScreenshotSuccess )
 				{
+					if ( info.bX11PropertyRequested )
+					{
+						XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeScreenShotAtom );
+						XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeDebugScreenShotAtom );
+					}
+
+					if ( bScreenshotSuccess && info.bWaylandRequested )
+					{
 						wlserver_lock();
 						for ( const auto &control : wlserver.gamescope_controls )
 						{
-							gamescope_control_send_screenshot_taken( control, oScreenshotInfo->szScreenshotPath.c_str() );
+							gamescope_control_send_screenshot_taken( control, info.szScreenshotPath.c_str() );
 						}
 						wlserver_unlock();
-				}
-			});
+					}
+				},
+			} );
 
-			screenshotThread.detach();
-		}
-		else
-		{
-			xwm_log.errorf( "Oh no, we ran out of screenshot images. Not actually writing a screenshot." );
-			if ( oScreenshotInfo->bX11PropertyRequested )
+			if ( !bQueued )
 			{
-				XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeScreenShotAtom );
-				XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeDebugScreenShotAtom );
+				xwm_log.errorf( "Failed to queue screenshot %s for encoding", oScreenshotInfo->szScreenshotPath.c_str() );
+				if ( oScreenshotInfo->bX11PropertyRequested )
+				{
+					XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeScreenShotAtom );
+					XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeDebugScreenShotAtom );
+				}
 			}
 		}
 	}
@@ -3086,63 +3667,165 @@ paint_all( global_focus_t *pFocus, bool async )
 	gpuvis_trace_printf( "paint_all %i layers", (int)frameInfo.layerCount );
 }
 
+static uint64_t
+prop_cache_key( Window win, Atom prop )
+{
+	return ( uint64_t( win ) << 32 ) | uint32_t( prop );
+}
+
+static xcb_get_property_cookie_t
+request_prop( xwayland_ctx_t *ctx, Window win, Atom prop )
+{
+	return xcb_get_property( XGetXCBConnection( ctx->dpy ), false, win, prop, XCB_ATOM_CARDINAL, 0, UINT32_MAX / 4 );
+}
+
+static xwayland_ctx_t::cached_prop_t
+receive_prop( xwayland_ctx_t *ctx, xcb_get_property_cookie_t cookie )
+{
+	xwayland_ctx_t::cached_prop_t result = { .uSequence = cookie.sequence };
+
+	// Windows going away under us is expected, don't bother the error handler.
+	xcb_generic_error_t *pError = nullptr;
+	xcb_get_property_reply_t *pReply = xcb_get_property_reply( XGetXCBConnection( ctx->dpy ), cookie, &pError );
+	free( pError );
+	if ( !pReply )
+		return result;
+	defer( free( pReply ) );
+
+	if ( pReply->type == XCB_ATOM_NONE )
+		return result;
+
+	result.bExists = true;
+
+	// Some other type, we get no data then.
+	const void *pData = xcb_get_property_value( pReply );
+	uint32_t uCount = pReply->value_len;
+	result.values.reserve( uCount );
+	for ( uint32_t i = 0; i < uCount; i++ )
+	{
+		switch ( pReply->format )
+		{
+			case 8:  result.values.push_back( reinterpret_cast<const uint8_t *>( pData )[i] ); break;
+			case 16: result.values.push_back( reinterpret_cast<const uint16_t *>( pData )[i] ); break;
+			case 32: result.values.push_back( reinterpret_cast<const uint32_t *>( pData )[i] ); break;
+		}
+	}
+
+	return result;
+}
+
+static bool
+prop_is_newer( const xwayland_ctx_t::cached_prop_t &prop, unsigned long ulEventSerial )
+{
+	// An event's serial is the last request the server had processed
+	// when it was sent. Compare like X does, allowing for wraparound.
+	return int32_t( prop.uSequence - uint32_t( ulEventSerial ) ) > 0;
+}
+
+// Returns the cached value if there is one, or fetches it. For windows we
+// don't get PropertyNotify for, it goes to uncached and isn't kept.
+static const xwayland_ctx_t::cached_prop_t &
+fetch_prop( xwayland_ctx_t *ctx, Window win, Atom prop, xwayland_ctx_t::cached_prop_t &uncached )
+{
+	if ( !ctx->prop_cache_windows.contains( win ) )
+	{
+		uncached = receive_prop( ctx, request_prop( ctx, win, prop ) );
+		return uncached;
+	}
+
+	uint64_t ulKey = prop_cache_key( win, prop );
+	auto iter = ctx->prop_cache.find( ulKey );
+	if ( iter != ctx->prop_cache.end() )
+		return iter->second;
+
+	return ctx->prop_cache[ ulKey ] = receive_prop( ctx, request_prop( ctx, win, prop ) );
+}
+
+static void
+watch_props( xwayland_ctx_t *ctx, Window win )
+{
+	ctx->prop_cache_windows.insert( win );
+}
+
+static void
+forget_props( xwayland_ctx_t *ctx, Window win )
+{
+	if ( !ctx->prop_cache_windows.erase( win ) )
+		return;
+
+	std::erase_if( ctx->prop_cache, [=]( const auto &entry ) { return Window( entry.first >> 32 ) == win; } );
+}
+
+// Drop a cached property the PropertyNotify says has changed since.
+static void
+invalidate_prop( xwayland_ctx_t *ctx, const XPropertyEvent *ev )
+{
+	auto iter = ctx->prop_cache.find( prop_cache_key( ev->window, ev->atom ) );
+	if ( iter != ctx->prop_cache.end() && !prop_is_newer( iter->second, ev->serial ) )
+		ctx->prop_cache.erase( iter );
+}
+
+// Looks ahead at queued PropertyNotify events and fetches everything they
+// changed at once, so handling a burst of them costs one round-trip
+// rather than one per get_prop.
+static void
+prefetch_notified_props( xwayland_ctx_t *ctx )
+{
+	std::vector<XPropertyEvent> events;
+
+	XEvent dummy;
+	XCheckIfEvent( ctx->dpy, &dummy, []( Display *, XEvent *pEvent, XPointer pUserData ) -> Bool
+	{
+		if ( pEvent->type == PropertyNotify )
+			reinterpret_cast<std::vector<XPropertyEvent> *>( pUserData )->push_back( pEvent->xproperty );
+		// Leave everything in the queue.
+		return False;
+	}, reinterpret_cast<XPointer>( &events ) );
+
+	std::unordered_map<uint64_t, xcb_get_property_cookie_t> requests;
+	for ( const XPropertyEvent &ev : events )
+	{
+		if ( !ctx->prop_cache_windows.contains( ev.window ) )
+			continue;
+
+		invalidate_prop( ctx, &ev );
+
+		uint64_t ulKey = prop_cache_key( ev.window, ev.atom );
+		if ( !ctx->prop_cache.contains( ulKey ) && !requests.contains( ulKey ) )
+			requests[ ulKey ] = request_prop( ctx, ev.window, ev.atom );
+	}
+
+	// Everything was sent above, so this waits for a single round-trip.
+	for ( auto &[ ulKey, cookie ] : requests )
+		ctx->prop_cache[ ulKey ] = receive_prop( ctx, cookie );
+}
+
 /* Get prop from window
  *   not found: default
  *   otherwise the value
  */
-__attribute__((__no_sanitize_address__)) // x11 broken, returns format 32 even when it only malloc'ed one byte. :(
 static unsigned int
 get_prop(xwayland_ctx_t *ctx, Window win, Atom prop, unsigned int def, bool *found = nullptr )
 {
-	Atom actual;
-	int format;
-	unsigned long n, left;
+	xwayland_ctx_t::cached_prop_t uncached;
+	const xwayland_ctx_t::cached_prop_t &value = fetch_prop( ctx, win, prop, uncached );
 
-	unsigned char *data;
-	int result = XGetWindowProperty(ctx->dpy, win, prop, 0L, 1L, false,
-									XA_CARDINAL, &actual, &format,
-								 &n, &left, &data);
-	if (result == Success && data != NULL)
-	{
-		unsigned int i;
-		memcpy(&i, data, sizeof(unsigned int));
-		XFree((void *) data);
-		if ( found != nullptr )
-		{
-			*found = true;
-		}
-		return i;
-	}
+	bool bFound = value.bExists && !value.values.empty();
 	if ( found != nullptr )
 	{
-		*found = false;
+		*found = bFound;
 	}
-	return def;
+	return bFound ? value.values[0] : def;
 }
 
 // vectored version, return value is whether anything was found
-__attribute__((__no_sanitize_address__)) // x11 broken :(
 bool get_prop( xwayland_ctx_t *ctx, Window win, Atom prop, std::vector< uint32_t > &vecResult )
 {
-	Atom actual;
-	int format;
-	unsigned long n, left;
+	xwayland_ctx_t::cached_prop_t uncached;
+	const xwayland_ctx_t::cached_prop_t &value = fetch_prop( ctx, win, prop, uncached );
 
-	vecResult.clear();
-	uint64_t *data;
-	int result = XGetWindowProperty(ctx->dpy, win, prop, 0L, ~0UL, false,
-									XA_CARDINAL, &actual, &format,
-									&n, &left, ( unsigned char** )&data);
-	if (result == Success && data != NULL)
-	{
-		for ( uint32_t i = 0; i < n; i++ )
-		{
-			vecResult.push_back( data[ i ] );
-		}
-		XFree((void *) data);
-		return true;
-	}
-	return false;
+	vecResult = value.values;
+	return value.bExists;
 }
 
 std::string get_string_prop( xwayland_ctx_t *ctx, Window win, Atom prop )
@@ -3175,175 +3858,126 @@ void clear_prop( xwayland_ctx_t *ctx, Atom prop )
 	XFlush( ctx->dpy );
 }
 
-static bool
-win_has_game_id( steamcompmgr_win_t *w )
+static gamescope::FocusWindowState_t
+get_focus_state( steamcompmgr_win_t *w )
 {
-	return w->appID != 0;
+	Rect geometry = w->GetGeometry();
+
+	gamescope::FocusWindowState_t state =
+	{
+		.uAppID = w->appID,
+		.bXWayland = w->type == steamcompmgr_win_type_t::XWAYLAND,
+
+		.bSysTrayIcon = w->isSysTrayIcon,
+		.bOverlay = w->isOverlay,
+		.bExternalOverlay = w->isExternalOverlay,
+		.bSteam = window_is_steam( w ),
+		.bSteamStreamingClient = w->isSteamStreamingClient,
+		.uOpacity = w->opacity,
+
+		.nWidth = geometry.nWidth,
+		.nHeight = geometry.nHeight,
+		.bIgnoreOverrideRedirect = w->ignoreOverrideRedirect,
+		.bMaybeADropdown = w->maybe_a_dropdown,
+		.bDialog = w->is_dialog,
+		.bSkipTaskbar = w->skipTaskbar,
+		.bSkipPager = w->skipPager,
+		.bFullscreen = w->isFullscreen,
+		.bHasHwndStyle = w->hasHwndStyle,
+		.uHwndStyle = w->hwndStyle,
+		.bHasHwndStyleEx = w->hasHwndStyleEx,
+		.uHwndStyleEx = w->hwndStyleEx,
+	};
+
+	if ( w->type == steamcompmgr_win_type_t::XWAYLAND )
+	{
+		const steamcompmgr_xwayland_win_t &xwayland = w->xwayland();
+		state.bViewable = xwayland.a.map_state == IsViewable;
+		state.bInputOutput = xwayland.a.c_class == InputOutput;
+		state.bOverrideRedirect = xwayland.a.override_redirect;
+		state.ulTransientFor = xwayland.transientFor;
+		state.ulMapSequence = xwayland.map_sequence;
+		state.ulDamageSequence = xwayland.damage_sequence;
+		state.ulStackKey = xwayland.stack_key;
+	}
+
+	return state;
 }
 
 static bool
 win_is_useless( steamcompmgr_win_t *w )
 {
-	// Windows that are 1x1 are pretty useless for override redirects.
-	// Just ignore them.
-	// Fixes the Xbox Login in Age of Empires 2: DE.
-	return w->GetGeometry().nWidth == 1 && w->GetGeometry().nHeight == 1;
+	return gamescope::FocusWindowIsUseless( get_focus_state( w ) );
 }
 
 static bool
 win_is_override_redirect( steamcompmgr_win_t *w )
 {
-	if (w->type != steamcompmgr_win_type_t::XWAYLAND)
-		return false;
-
-	return w->xwayland().a.override_redirect && !w->ignoreOverrideRedirect && !win_is_useless( w );
-}
-
-static bool
-win_skip_taskbar_and_pager( steamcompmgr_win_t *w )
-{
-	return w->skipTaskbar && w->skipPager;
+	return gamescope::FocusWindowIsOverrideRedirect( get_focus_state( w ) );
 }
 
 static bool
 win_skip_and_not_fullscreen( steamcompmgr_win_t *w )
 {
-	return win_skip_taskbar_and_pager( w ) && !w->isFullscreen;
+	return gamescope::FocusWindowSkipAndNotFullscreen( get_focus_state( w ) );
 }
 
 static bool
 win_maybe_a_dropdown( steamcompmgr_win_t *w )
 {
-	if ( w->type != steamcompmgr_win_type_t::XWAYLAND )
-		return false;
-
-	// Josh:
-	// Right now we don't get enough info from Wine
-	// about the true nature of windows to distringuish
-	// something like the Fallout 4 Options menu from the
-	// Warframe language dropdown. Until we get more stuff
-	// exposed for that, there is this workaround to let that work.
-	if ( w->appID == 230410 && w->maybe_a_dropdown && w->xwayland().transientFor && ( w->skipPager || w->skipTaskbar ) )
-		return !win_is_useless( w );
-
-	// Work around Antichamber splash screen until we hook up
-	// the Proton window style deduction.
-	if ( w->appID == 219890 )
-		return false;
-
-	// The Launcher in Witcher 2 (20920) has a clear window with WS_EX_LAYERED on top of it.
-	//
-	// The Age of Empires 2 Launcher also has a WS_EX_LAYERED window to separate controls
-	// from its backing, which this seems to handle, although we seemingly don't handle
-	// it's transparency yet, which I do not understand.
-	//
-	// Layered windows are windows that are meant to be transparent
-	// with alpha blending + visual fx.
-	// https://docs.microsoft.com/en-us/windows/win32/winmsg/window-features
-	//
-	// TODO: Come back to me for original Age of Empires HD launcher.
-	// Does that use it? It wants blending!
-	// 
-	// Only do this if we have CONTROLPARENT right now. Some other apps, such as the
-	// Street Fighter V (310950) Splash Screen also use LAYERED and TOOLWINDOW, and we don't
-	// want that to be overlayed.
-	// Ignore LAYERED if it's marked as top-level with WS_EX_APPWINDOW.
-	// TODO: Find more apps using LAYERED.
-	const uint32_t validLayered = WS_EX_CONTROLPARENT | WS_EX_LAYERED;
-	const uint32_t invalidLayered = WS_EX_APPWINDOW;
-	if ( w->hasHwndStyleEx &&
-		( ( w->hwndStyleEx & validLayered   ) == validLayered ) &&
-		( ( w->hwndStyleEx & invalidLayered ) == 0 ) )
-		return true;
-
-	// Josh:
-	// The logic here is as follows. The window will be treated as a dropdown if:
-	// 
-	// If this window has a fixed position on the screen + static gravity:
-	//  - If the window has either skipPage or skipTaskbar
-	//    - If the window isn't a dialog, always treat it as a dropdown, as it's
-	//      probably meant to be some form of popup.
-	//    - If the window is a dialog 
-	// 		- If the window has transient for, disregard it, as it is trying to redirecting us elsewhere
-	//        ie. a settings menu dialog popup or something.
-	//      - If the window has both skip taskbar and pager, treat it as a dialog.
-	bool valid_maybe_a_dropdown =
-		w->maybe_a_dropdown && ( ( !w->is_dialog || ( !w->xwayland().transientFor && win_skip_and_not_fullscreen( w ) ) ) && ( w->skipPager || w->skipTaskbar ) );
-	return ( valid_maybe_a_dropdown || win_is_override_redirect( w ) ) && !win_is_useless( w );
+	return gamescope::FocusWindowMaybeADropdown( get_focus_state( w ) );
 }
 
-static bool
-win_is_disabled( steamcompmgr_win_t *w )
+// Something that can change w's focus candidacy or priority changed.
+static void
+MakeWindowFocusDirty( steamcompmgr_win_t *w )
 {
-	if ( !w->hasHwndStyle )
-		return false;
+	if ( w->type == steamcompmgr_win_type_t::XWAYLAND )
+		w->xwayland().ctx->focusCandidates.MarkDirty( w );
 
-	return !!(w->hwndStyle & WS_DISABLED);
+	MakeFocusDirty();
 }
 
-/* Returns true if a's focus priority > b's.
- *
- * This function establishes a list of criteria to decide which window should
- * have focus. The first criteria has higher priority. If the first criteria
- * is a tie, fallback to the second one, then the third, and so on.
- *
- * The general workflow is:
- *
- *     if ( windows don't have the same criteria value )
- *         return true if a should be focused;
- *     // This is a tie, fallback to the next criteria
- */
-static bool
-is_focus_priority_greater( steamcompmgr_win_t *a, steamcompmgr_win_t *b )
-{
-	if ( win_has_game_id( a ) != win_has_game_id( b ) )
-		return win_has_game_id( a );
-
-	// We allow using an override redirect window in some cases, but if we have
-	// a choice between two windows we always prefer the non-override redirect
-	// one.
-	if ( win_is_override_redirect( a ) != win_is_override_redirect( b ) )
-		return !win_is_override_redirect( a );
-
-	// If the window is 1x1 then prefer anything else we have.
-	if ( win_is_useless( a ) != win_is_useless( b ) )
-		return !win_is_useless( a );
+static constexpr uint64_t k_ulStackKeyGap = 1ull << 32;
 
-	if ( win_maybe_a_dropdown( a ) != win_maybe_a_dropdown( b ) )
-		return !win_maybe_a_dropdown( a );
-
-	if ( win_is_disabled( a ) != win_is_disabled( b ) )
-		return !win_is_disabled( a );
+static void
+renumber_stack_keys( xwayland_ctx_t *ctx )
+{
+	uint64_t ulStackKey = 1ull << 62;
+	for ( steamcompmgr_win_t *w = ctx->list; w; w = w->xwayland().next )
+	{
+		w->xwayland().stack_key = ulStackKey;
+		ulStackKey += k_ulStackKeyGap;
 
-	// Wine sets SKIP_TASKBAR and SKIP_PAGER hints for WS_EX_NOACTIVATE windows.
-	// See https://github.com/Plagman/gamescope/issues/87
-	if ( win_skip_and_not_fullscreen( a ) != win_skip_and_not_fullscreen( b ) )
-		return !win_skip_and_not_fullscreen( a );
+		ctx->focusCandidates.MarkDirty( w );
+	}
+}
 
-	// Prefer normal windows over dialogs
-	// if we are an override redirect/dropdown window.
-	if ( win_maybe_a_dropdown( a ) && win_maybe_a_dropdown( b ) &&
-		a->is_dialog != b->is_dialog )
-		return !a->is_dialog;
+// Gives w a stack key between its neighbours' after it has been (re)linked,
+// so only w needs re-ranking. Renumbers the whole list once they run out.
+static void
+update_stack_key( xwayland_ctx_t *ctx, steamcompmgr_win_t *w )
+{
+	steamcompmgr_win_t *above = nullptr;
+	for ( steamcompmgr_win_t *iter = ctx->list; iter && iter != w; iter = iter->xwayland().next )
+		above = iter;
+	steamcompmgr_win_t *below = w->xwayland().next;
 
-	if (a->type != steamcompmgr_win_type_t::XWAYLAND)
+	const uint64_t ulLow = above ? above->xwayland().stack_key : 0;
+	const uint64_t ulHigh = below ? below->xwayland().stack_key : UINT64_MAX;
+	if ( ulHigh <= ulLow || ulHigh - ulLow < 2 )
 	{
-		return true;
+		renumber_stack_keys( ctx );
+		return;
 	}
 
-	// Attempt to tie-break dropdowns by transient-for.
-	if ( win_maybe_a_dropdown( a ) && win_maybe_a_dropdown( b ) &&
-		!a->xwayland().transientFor != !b->xwayland().transientFor )
-		return !a->xwayland().transientFor;
-
-	if ( win_has_game_id( a ) && a->xwayland().map_sequence != b->xwayland().map_sequence )
-		return a->xwayland().map_sequence > b->xwayland().map_sequence;
-
-	// The damage sequences are only relevant for game windows.
-	if ( win_has_game_id( a ) && a->xwayland().damage_sequence != b->xwayland().damage_sequence )
-		return a->xwayland().damage_sequence > b->xwayland().damage_sequence;
-
-	return false;
+	const uint64_t ulSpace = std::min( k_ulStackKeyGap, ( ulHigh - ulLow ) / 2 );
+	if ( !above && below )
+		w->xwayland().stack_key = ulHigh - ulSpace;
+	else if ( above && !below )
+		w->xwayland().stack_key = ulLow + ulSpace;
+	else
+		w->xwayland().stack_key = ulLow + ( ulHigh - ulLow ) / 2;
 }
 
 static bool is_good_override_candidate( steamcompmgr_win_t *override, steamcompmgr_win_t* focus )
@@ -3574,29 +4208,17 @@ found:;
 	return localGameFocused;
 }
 
- std::vector< steamcompmgr_win_t* > xwayland_ctx_t::GetPossibleFocusWindows()
+ const std::vector< steamcompmgr_win_t* > &xwayland_ctx_t::GetPossibleFocusWindows()
  {
-	std::vector<steamcompmgr_win_t*> vecPossibleFocusWindows;
-
-	for (steamcompmgr_win_t *w = this->list; w; w = w->xwayland().next)
+	// Focus is only re-picked once it's dirty. Until then keep the order,
+	// and then only re-rank the windows that changed since.
+	if ( ulPossibleFocusWindowsSerial != GetFocusSerial() )
 	{
-		// Always skip system tray icons and overlays
-		if ( w->isSysTrayIcon || w->isOverlay || w->isExternalOverlay )
-		{
-			continue;
-		}
-
-		if ( w->xwayland().a.map_state == IsViewable && w->xwayland().a.c_class == InputOutput &&
-			( win_has_game_id( w ) || window_is_steam( w ) || w->isSteamStreamingClient ) &&
-			 (w->opacity > TRANSLUCENT || w->isSteamStreamingClient ) )
-		{
-			vecPossibleFocusWindows.push_back( w );
-		}
+		focusCandidates.Update( get_focus_state );
+		ulPossibleFocusWindowsSerial = GetFocusSerial();
 	}
 
-	std::stable_sort( vecPossibleFocusWindows.begin(), vecPossibleFocusWindows.end(), is_focus_priority_greater );
-
-	return vecPossibleFocusWindows;
+	return focusCandidates.GetWindows();
  }
 
 static void set_wm_state( xwayland_ctx_t *ctx, Window win, uint32_t state )
@@ -3845,26 +4467,56 @@ steamcompmgr_xdg_get_possible_focus_windows()
 	return windows;
 }
 
-static std::vector< steamcompmgr_win_t* > GetGlobalPossibleFocusWindows()
+static const std::vector< steamcompmgr_win_t* > &GetGlobalPossibleFocusWindows()
 {
-	std::vector< steamcompmgr_win_t* > vecPossibleFocusWindows;
+	static std::vector< steamcompmgr_win_t* > s_vecPossibleFocusWindows;
+	static uint64_t s_ulPossibleFocusWindowsSerial = UINT64_MAX;
+
+	// Called for every frame on some paths, only redo it when focus changed.
+	if ( s_ulPossibleFocusWindowsSerial == GetFocusSerial() )
+		return s_vecPossibleFocusWindows;
+
+	std::vector< steamcompmgr_win_t* > &vecPossibleFocusWindows = s_vecPossibleFocusWindows;
+	vecPossibleFocusWindows.clear();
+
+	// Each context's list is already sorted, the xdg one isn't.
+	uint32_t uSortedLists = 0;
+	bool bUnsortedWindows = false;
 
 	{
 		gamescope_xwayland_server_t *server = NULL;
 		for (size_t i = 0; (server = wlserver_get_xwayland_server(i)); i++)
 		{
-			std::vector< steamcompmgr_win_t* > vecLocalPossibleFocusWindows = server->ctx->GetPossibleFocusWindows();
+			const std::vector< steamcompmgr_win_t* > &vecLocalPossibleFocusWindows = server->ctx->GetPossibleFocusWindows();
 			vecPossibleFocusWindows.insert( vecPossibleFocusWindows.end(), vecLocalPossibleFocusWindows.begin(), vecLocalPossibleFocusWindows.end() );
+			if ( !vecLocalPossibleFocusWindows.empty() )
+				uSortedLists++;
 		}
 	}
 
 	{
 		std::vector< steamcompmgr_win_t* > vecLocalPossibleFocusWindows = steamcompmgr_xdg_get_possible_focus_windows();
 		vecPossibleFocusWindows.insert( vecPossibleFocusWindows.end(), vecLocalPossibleFocusWindows.begin(), vecLocalPossibleFocusWindows.end() );
+		bUnsortedWindows = !vecLocalPossibleFocusWindows.empty();
 	}
 
 	// Determine global primary focus
-	std::stable_sort( vecPossibleFocusWindows.begin(), vecPossibleFocusWindows.end(), is_focus_priority_greater );
+	if ( bUnsortedWindows || uSortedLists > 1 )
+	{
+		std::vector< std::pair< gamescope::FocusWindowState_t, steamcompmgr_win_t* > > vecRanked;
+		vecRanked.reserve( vecPossibleFocusWindows.size() );
+		for ( steamcompmgr_win_t *w : vecPossibleFocusWindows )
+			vecRanked.emplace_back( get_focus_state( w ), w );
+
+		std::stable_sort( vecRanked.begin(), vecRanked.end(), []( const auto &a, const auto &b )
+		{
+			return gamescope::IsFocusPriorityGreater( a.first, b.first );
+		});
+
+		for ( size_t i = 0; i < vecRanked.size(); i++ )
+			vecPossibleFocusWindows[ i ] = vecRanked[ i ].second;
+	}
+	s_ulPossibleFocusWindowsSerial = GetFocusSerial();
 
 	return vecPossibleFocusWindows;
 }
@@ -4420,6 +5072,7 @@ map_win(xwayland_ctx_t* ctx, Window id, unsigned long sequence)
 	/* This needs to be here or else we lose transparency messages */
 	XSelectInput(ctx->dpy, id, PropertyChangeMask | SubstructureNotifyMask |
 		LeaveWindowMask | FocusChangeMask);
+	watch_props(ctx, id);
 
 	XFlush(ctx->dpy);
 
@@ -4501,7 +5154,7 @@ map_win(xwayland_ctx_t* ctx, Window id, unsigned long sequence)
 		XSetInputFocus(ctx->dpy, w->xwayland().id, RevertToNone, CurrentTime);
 	}
 
-	MakeFocusDirty();
+	MakeWindowFocusDirty( w );
 
 	set_wm_state( ctx, w->xwayland().id, ICCCM_NORMAL_STATE );
 }
@@ -4513,6 +5166,15 @@ finish_unmap_win(xwayland_ctx_t *ctx, steamcompmgr_win_t *w)
 
 	/* don't care about properties anymore */
 	XSelectInput(ctx->dpy, w->xwayland().id, 0);
+	forget_props(ctx, w->xwayland().id);
+
+	// Without SubstructureNotifyMask we won't hear about its children being
+	// reparented or destroyed, so stop trusting what we cached for them.
+	{
+		const Window id = w->xwayland().id;
+		std::unique_lock lock( ctx->win_index_mutex );
+		std::erase_if( ctx->child_toplevels, [=]( const auto &entry ) { return entry.second == id; } );
+	}
 
 	ctx->clipChanged = true;
 }
@@ -4525,7 +5187,7 @@ unmap_win(xwayland_ctx_t *ctx, Window id, bool fade)
 		return;
 	w->xwayland().a.map_state = IsUnmapped;
 
-	MakeFocusDirty();
+	MakeWindowFocusDirty( w );
 
 	finish_unmap_win(ctx, w);
 	set_wm_state( ctx, w->xwayland().id, ICCCM_WITHDRAWN_STATE );
@@ -4758,11 +5420,16 @@ add_win(xwayland_ctx_t *ctx, Window id, Window prev, unsigned long sequence)
 		std::unique_lock lock( ctx->list_mutex );
 		new_win->xwayland().next = *p;
 		*p = new_win;
+		update_stack_key( ctx, new_win );
+
+		std::unique_lock indexLock( ctx->win_index_mutex );
+		ctx->win_index[ id ] = new_win;
+		ctx->child_toplevels.erase( id );
 	}
 	if (new_win->xwayland().a.map_state == IsViewable)
 		map_win(ctx, id, sequence);
 
-	MakeFocusDirty();
+	MakeWindowFocusDirty( new_win );
 }
 
 static void
@@ -4797,7 +5464,8 @@ restack_win(xwayland_ctx_t *ctx, steamcompmgr_win_t *w, Window new_above)
 
 		w->xwayland().next = *prev;
 		*prev = w;
-		MakeFocusDirty();
+		update_stack_key( ctx, w );
+		MakeWindowFocusDirty( w );
 	}
 }
 
@@ -4830,7 +5498,7 @@ configure_win(xwayland_ctx_t *ctx, XConfigureEvent *ce)
 	w->xwayland().a.override_redirect = ce->override_redirect;
 	restack_win(ctx, w, ce->above);
 
-	MakeFocusDirty();
+	MakeWindowFocusDirty( w );
 }
 
 static void
@@ -4888,9 +5556,17 @@ finish_destroy_win(xwayland_ctx_t *ctx, Window id, bool gone)
 				finish_unmap_win (ctx, w);
 			
 			{
+				// Unlink and unindex together, wlserver looks windows up under list_mutex
+				// and mustn't find one that's no longer in the list.
 				std::unique_lock lock( ctx->list_mutex );
 				*prev = w->xwayland().next;
+
+				std::unique_lock indexLock( ctx->win_index_mutex );
+				ctx->win_index.erase( id );
+				std::erase_if( ctx->child_toplevels, [=]( const auto &entry ) { return entry.second == id; } );
 			}
+			std::erase_if( ctx->surface_index, [=]( const auto &entry ) { return entry.second == id; } );
+			forget_props( ctx, id );
 			if (w->xwayland().damage != None)
 			{
 				XDamageDestroy(ctx->dpy, w->xwayland().damage);
@@ -4906,6 +5582,7 @@ finish_destroy_win(xwayland_ctx_t *ctx, Window id, bool gone)
 			wlserver_lock();
 			wlserver_x11_surface_info_finish( &w->xwayland().surface );
 			wlserver_unlock();
+			ctx->focusCandidates.Remove( w );
 			delete w;
 			break;
 		}
@@ -4971,6 +5648,10 @@ damage_win(xwayland_ctx_t *ctx, XDamageNotifyEvent *de)
 		MakeFocusDirty();
 
 	w->xwayland().damage_sequence = damageSequence++;
+	// Only game windows rank by damage. Re-rank whenever focus is next picked,
+	// which the checks here may or may not ask for.
+	if ( w->appID )
+		ctx->focusCandidates.MarkDirty( w );
 
 	// If we just passed the focused window, we might be eliglible to take over
 	if ( focus && focus != w && w->appID &&
@@ -5056,13 +5737,13 @@ handle_net_wm_state(xwayland_ctx_t *ctx, steamcompmgr_win_t *w, XClientMessageEv
 	for (size_t i = 0; i < 2; i++) {
 		if (props[i] == ctx->atoms.netWMStateFullscreenAtom) {
 			update_net_wm_state(action, &w->isFullscreen);
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		} else if (props[i] == ctx->atoms.netWMStateSkipTaskbarAtom) {
 			update_net_wm_state(action, &w->skipTaskbar);
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		} else if (props[i] == ctx->atoms.netWMStateSkipPagerAtom) {
 			update_net_wm_state(action, &w->skipPager);
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		} else if (props[i] != None) {
 			xwm_log.debugf("Unhandled NET_WM_STATE property change: %s", XGetAtomName(ctx->dpy, props[i]));
 		}
@@ -5088,6 +5769,7 @@ handle_system_tray_opcode(xwayland_ctx_t *ctx, XClientMessageEvent *ev)
 			steamcompmgr_win_t *w = find_win(ctx, embed_id);
 			if (w) {
 				w->isSysTrayIcon = true;
+				ctx->focusCandidates.MarkDirty( w );
 			}
 			break;
 		}
@@ -5435,6 +6117,8 @@ static inline float santitize_float( float f )
 static void
 handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 {
+	invalidate_prop(ctx, ev);
+
 	/* check if Trans property was changed */
 	if (ev->atom == ctx->atoms.opacityAtom)
 	{
@@ -5446,6 +6130,10 @@ handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 
 			if (newOpacity != w->opacity)
 			{
+				// Only windows above TRANSLUCENT can take focus.
+				if ( ( newOpacity > TRANSLUCENT ) != ( w->opacity > TRANSLUCENT ) )
+					MakeWindowFocusDirty( w );
+
 				w->opacity = newOpacity;
 
 				if ( gameFocused && ( w == ctx->focus.overlayWindow || w == ctx->focus.notificationWindow ) )
@@ -5488,7 +6176,7 @@ handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 		if (w)
 		{
 			w->isSteamLegacyBigPicture = get_prop(ctx, w->xwayland().id, ctx->atoms.steamAtom, 0);
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		}
 	}
 	if (ev->atom == ctx->atoms.steamInputFocusAtom )
@@ -5510,7 +6198,7 @@ handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 		if (w)
 		{
 			w->isSteamStreamingClient = get_prop(ctx, w->xwayland().id, ctx->atoms.steamStreamingClientAtom, 0);
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		}
 	}
 	if (ev->atom == ctx->atoms.steamStreamingClientVideoAtom)
@@ -5573,7 +6261,7 @@ handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 			if ( w->isExternalOverlay )
 				w->appID = 0;
 
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		}
 	}
 	if (ev->atom == ctx->atoms.overlayAtom)
@@ -5584,7 +6272,7 @@ handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 			w->isOverlay = get_prop(ctx, w->xwayland().id, ctx->atoms.overlayAtom, 0);
 			if ( w->isExternalOverlay )
 				w->appID = 0;
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		}
 	}
 	if (ev->atom == ctx->atoms.externalOverlayAtom)
@@ -5595,7 +6283,7 @@ handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 			w->isExternalOverlay = get_prop(ctx, w->xwayland().id, ctx->atoms.externalOverlayAtom, 0);
 			if ( w->isExternalOverlay )
 				w->appID = 0;
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		}
 	}
 	if (ev->atom == ctx->atoms.winTypeAtom)
@@ -5604,7 +6292,7 @@ handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 		if (w)
 		{
 			get_win_type(ctx, w);
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		}		
 	}
 	if (ev->atom == ctx->atoms.sizeHintsAtom)
@@ -5613,7 +6301,7 @@ handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 		if (w)
 		{
 			get_size_hints(ctx, w);
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		}
 	}
 	if (ev->atom == ctx->atoms.gamesRunningAtom)
@@ -5672,7 +6360,7 @@ handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 			}
 			get_win_type( ctx, w );
 
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		}
 	}
 	if (ev->atom == XA_WM_NAME || ev->atom == ctx->atoms.netWMNameAtom)
@@ -6214,7 +6902,7 @@ handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 		{
 			w->hasHwndStyle = true;
 			w->hwndStyle = get_prop(ctx, w->xwayland().id, ctx->atoms.wineHwndStyle, 0);
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		}
 	}
 	if (ev->atom == ctx->atoms.wineHwndStyleEx)
@@ -6224,7 +6912,7 @@ handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 		{
 			w->hasHwndStyleEx = true;
 			w->hwndStyleEx = get_prop(ctx, w->xwayland().id, ctx->atoms.wineHwndStyleEx, 0);
-			MakeFocusDirty();
+			MakeWindowFocusDirty( w );
 		}
 	}
 }
@@ -6240,6 +6928,8 @@ static void
 steamcompmgr_exit(void)
 {
 	g_ImageWaiter.Shutdown();
+	gamescope::CScreenshotEncoder::Get().Shutdown();
+	gamescope::CFrameTraceRecorder::Get().StopRecording();
 
 	// Clean up any commits.
 	{
@@ -6254,15 +6944,21 @@ steamcompmgr_exit(void)
 	g_HeldCommits[ HELD_COMMIT_BASE ] = nullptr;
 	g_HeldCommits[ HELD_COMMIT_FADE ] = nullptr;
 
+	s_ColorMgmtLutWorker.Shutdown();
 	for ( auto &lut : g_ColorMgmtLuts ) lut.shutdown();
+	for ( auto &lut : s_ColorMgmtSpareLut1d ) lut = nullptr;
+	for ( auto &lut : s_ColorMgmtSpareLut3d ) lut = nullptr;
 	for ( auto &lut : g_ColorMgmtLutsOverride ) lut.shutdown();
 	for ( auto &lut : g_ScreenshotColorMgmtLuts ) lut.shutdown();
 	for ( auto &lut : g_ScreenshotColorMgmtLutsHDR ) lut.shutdown();
 
+	vulkan_shutdown();
+
 	if ( statsThreadRun == true )
 	{
 		statsThreadRun = false;
-		statsThreadSem.signal();
+		statsEventSignal.fetch_add( 1 );
+		statsEventSignal.notify_one();
 	}
 
 	{
@@ -6391,6 +7087,7 @@ bool handle_done_commit( steamcompmgr_win_t *w, xwayland_ctx_t *ctx, uint64_t co
 			w->commit_queue[ j ]->done = true;
 			w->commit_queue[ j ]->earliest_present_time = earliestPresentTime;
 			w->commit_queue[ j ]->present_margin = earliestPresentTime - earliestLatchTime;
+			w->commit_queue[ j ]->latch_time = get_time_in_nanos();
 			bFoundWindow = true;
 
 			// Window just got a new available commit, determine if that's worth a repaint
@@ -6687,52 +7384,143 @@ struct TempUpscaleImage_t
 	uint64_t ulLastPoint = 0ul;
 };
 
-static std::vector<TempUpscaleImage_t> g_pUpscaleImages;
-void ClearUpscaleImages()
-{
-	g_pUpscaleImages.clear();
-}
-
-static TempUpscaleImage_t *GetTempUpscaleImage( uint32_t uWidth, uint32_t uHeight, uint32_t uDrmFormat )
+// Upscale targets, grouped by size and format. Switching resolution or
+// output format keeps the previous group around, so switching back
+// doesn't have to reallocate. Least recently used groups go first.
+class CUpscaleImagePool
 {
-	if ( g_pUpscaleImages.size() )
+public:
+	TempUpscaleImage_t *Get( uint32_t uWidth, uint32_t uHeight, uint32_t uDrmFormat )
 	{
-		// Mixing and matching sizes to only do the min required would be nice
-		// but massively complicates caching.
-		if ( g_pUpscaleImages[0].pTexture->width() != uWidth ||
-			 g_pUpscaleImages[0].pTexture->height() != uHeight ||
-			 g_pUpscaleImages[0].pTexture->drmFormat() != uDrmFormat )
+		ImageClass_t &imageClass = FindOrCreateClass( uWidth, uHeight, uDrmFormat );
+		imageClass.ulLastUsed = ++m_ulUseCounter;
+
+		// The commit holds a ref while it's in flight, the backend FB while it's
+		// on screen, so an image nobody refs has also finished its upscale.
+		for ( TempUpscaleImage_t &image : imageClass.images )
+		{
+			if ( !image.pTexture->IsInUse() )
+			{
+				m_ulHits++;
+				return &image;
+			}
+		}
+
+		if ( imageClass.images.size() >= size_t( std::max( int( cv_upscale_image_pool_images ), 1 ) ) )
 		{
-			g_pUpscaleImages.clear();
+			m_ulExhausted++;
+			xwm_log.warnf( "No upscale images free! (%zu %ux%u images in use)", imageClass.images.size(), uWidth, uHeight );
+			return nullptr;
 		}
+
+		std::shared_ptr<gamescope::CTimeline> pTimeline = gamescope::CTimeline::Create();
+		if ( !pTimeline )
+			return nullptr;
+
+		gamescope::OwningRc<CVulkanTexture> pTexture = new CVulkanTexture();
+
+		CVulkanTexture::createFlags imageFlags;
+		imageFlags.bSampled = true;
+		imageFlags.bStorage = true;
+		imageFlags.bFlippable = true;
+		if ( !pTexture->BInit( uWidth, uHeight, 1, uDrmFormat, imageFlags ) )
+			return nullptr;
+
+		m_ulAllocations++;
+		m_uImageCount++;
+		TempUpscaleImage_t &image = imageClass.images.emplace_back( std::move( pTexture ), std::move( pTimeline ) );
+		m_uPeakImages = std::max( m_uPeakImages.load(), imageClass.images.size() );
+
+		return &image;
 	}
 
-	for ( TempUpscaleImage_t &image : g_pUpscaleImages )
+	void Clear()
 	{
-		if ( !image.pTexture->IsInUse() )
-			return &image;
+		m_Classes.clear();
+		m_uClassCount = 0;
+		m_uImageCount = 0;
 	}
 
-	if ( g_pUpscaleImages.size() > 8 )
+	// Counters only, as commands can come in from the wlserver thread.
+	void PrintStats() const
 	{
-		xwm_log.warnf( "No upscale images free!\n" );
-		return {};
+		xwm_log.infof( "upscale image pool: %zu sizes, %zu images (peak %zu for one size), hits: %" PRIu64 ", allocations: %" PRIu64 ", exhausted: %" PRIu64 ", evicted sizes: %" PRIu64,
+			m_uClassCount.load(), m_uImageCount.load(), m_uPeakImages.load(),
+			m_ulHits.load(), m_ulAllocations.load(), m_ulExhausted.load(), m_ulEvictions.load() );
 	}
 
-	gamescope::OwningRc<CVulkanTexture> pTexture = new CVulkanTexture();
+private:
+	struct ImageClass_t
+	{
+		uint32_t uWidth;
+		uint32_t uHeight;
+		uint32_t uDrmFormat;
+		uint64_t ulLastUsed = 0;
+		// Deque so handed out pointers stay put as it grows.
+		std::deque<TempUpscaleImage_t> images;
+	};
 
-	std::shared_ptr<gamescope::CTimeline> pTimeline = gamescope::CTimeline::Create();
-	if ( !pTimeline )
-		return nullptr;
+	ImageClass_t &FindOrCreateClass( uint32_t uWidth, uint32_t uHeight, uint32_t uDrmFormat )
+	{
+		for ( ImageClass_t &imageClass : m_Classes )
+		{
+			if ( imageClass.uWidth == uWidth && imageClass.uHeight == uHeight && imageClass.uDrmFormat == uDrmFormat )
+				return imageClass;
+		}
+
+		// Make room, but never free images that are still being used.
+		size_t uMaxClasses = size_t( std::max( int( cv_upscale_image_pool_sizes ), 1 ) );
+		while ( m_Classes.size() >= uMaxClasses )
+		{
+			auto oldest = m_Classes.end();
+			for ( auto iter = m_Classes.begin(); iter != m_Classes.end(); iter++ )
+			{
+				bool bInUse = std::any_of( iter->images.begin(), iter->images.end(), []( TempUpscaleImage_t &image ) { return image.pTexture->IsInUse(); } );
+				if ( !bInUse && ( oldest == m_Classes.end() || iter->ulLastUsed < oldest->ulLastUsed ) )
+					oldest = iter;
+			}
+
+			if ( oldest == m_Classes.end() )
+				break;
+
+			m_uImageCount -= oldest->images.size();
+			m_Classes.erase( oldest );
+			m_ulEvictions++;
+		}
+
+		m_uClassCount = m_Classes.size() + 1;
+		return m_Classes.emplace_back( ImageClass_t{ .uWidth = uWidth, .uHeight = uHeight, .uDrmFormat = uDrmFormat } );
+	}
+
+	// Only a handful of entries, a list keeps references to them stable.
+	std::list<ImageClass_t> m_Classes;
+	uint64_t m_ulUseCounter = 0;
+
+	std::atomic<size_t> m_uClassCount = { 0 };
+	std::atomic<size_t> m_uImageCount = { 0 };
+	std::atomic<size_t> m_uPeakImages = { 0 };
+	std::atomic<uint64_t> m_ulHits = { 0 };
+	std::atomic<uint64_t> m_ulAllocations = { 0 };
+	std::atomic<uint64_t> m_ulExhausted = { 0 };
+	std::atomic<uint64_t> m_ulEvictions = { 0 };
+};
+
+static CUpscaleImagePool g_UpscaleImagePool;
+
+static gamescope::ConCommand cc_upscale_image_pool_stats( "upscale_image_pool_stats", "Print pre-emptive upscale image pool usage",
+[]( std::span<std::string_view> args )
+{
+	g_UpscaleImagePool.PrintStats();
+});
 
-	CVulkanTexture::createFlags imageFlags;
-	imageFlags.bSampled = true;
-	imageFlags.bStorage = true;
-	imageFlags.bFlippable = true;
-	pTexture->BInit( g_nOutputWidth, g_nOutputHeight, 1, uDrmFormat, imageFlags );
-	TempUpscaleImage_t &image = g_pUpscaleImages.emplace_back( std::move( pTexture ), std::move( pTimeline ) );
+void ClearUpscaleImages()
+{
+	g_UpscaleImagePool.Clear();
+}
 
-	return &image;
+static TempUpscaleImage_t *GetTempUpscaleImage( uint32_t uWidth, uint32_t uHeight, uint32_t uDrmFormat )
+{
+	return g_UpscaleImagePool.Get( uWidth, uHeight, uDrmFormat );
 }
 
 gamescope::ConVar<bool> cv_surface_update_force_only_current_surface( "surface_update_force_only_current_surface", false, "Force updates to apply only to the current surface, ignoring commits for other surfaces." );
@@ -6823,11 +7611,18 @@ void update_wayland_res(CommitDoneList_t *doneCommits, steamcompmgr_win_t *w, Re
 		std::move(reslistentry.presentation_feedbacks),
 		reslistentry.present_id,
 		reslistentry.desired_present_time,
-		reslistentry.fifo );
+		reslistentry.fifo,
+		reslistentry.ulArrivalTime );
 
 	int fence = -1;
 	if ( newCommit != nullptr )
 	{
+		// No damage means the client didn't tell us, assume the whole buffer changed.
+		const wlr_box &damage = reslistentry.bufferDamage;
+		w->commitDamage.Add( newCommit->commitID, damage.width > 0 && damage.height > 0
+			? gamescope::DamageRect_t{ damage.x, damage.y, damage.x + damage.width, damage.y + damage.height }
+			: gamescope::DamageRect_t::FromSize( buf->width, buf->height ) );
+
 		global_focus_t *pCurrentFocus = GetCurrentFocus();
 
 		static bool bMangoappSocketDisable = env_to_bool( getenv( "GAMESCOPE_MANGOAPP_SOCKET_DISABLE" ));
@@ -7015,6 +7810,8 @@ void xwayland_ctx_t::Dispatch()
 	MouseCursor *cursor = ctx->cursor.get();
 	bool bSetFocus = false;
 
+	prefetch_notified_props(ctx);
+
 	while (XPending(ctx->dpy))
 	{
 		XEvent ev;
@@ -7033,6 +7830,8 @@ void xwayland_ctx_t::Dispatch()
 			case CreateNotify:
 				if (ev.xcreatewindow.parent == ctx->root)
 					add_win(ctx, ev.xcreatewindow.window, 0, ev.xcreatewindow.serial);
+				else
+					note_child_win(ctx, ev.xcreatewindow.window, ev.xcreatewindow.parent);
 				break;
 			case ConfigureNotify:
 				configure_win(ctx, &ev.xconfigure);
@@ -7043,6 +7842,8 @@ void xwayland_ctx_t::Dispatch()
 
 				if (w && w->xwayland().id == ev.xdestroywindow.window)
 					destroy_win(ctx, ev.xdestroywindow.window, true, true);
+				else
+					forget_child_win(ctx, ev.xdestroywindow.window);
 				break;
 			}
 			case MapNotify:
@@ -7111,9 +7912,12 @@ void xwayland_ctx_t::Dispatch()
 						if (w)
 						{
 							get_size_hints(ctx, w);
-							MakeFocusDirty();
+							MakeWindowFocusDirty( w );
 						}
 					}
+
+					forget_child_win(ctx, ev.xreparent.window);
+					note_child_win(ctx, ev.xreparent.window, ev.xreparent.parent);
 				}
 				break;
 			case CirculateNotify:
@@ -7477,6 +8281,7 @@ void init_xwayland_ctx(uint32_t serverId, gamescope_xwayland_server_t *xwayland_
 				  PointerMotionMask|
 				  LeaveWindowMask|
 				  PropertyChangeMask);
+	watch_props(ctx, ctx->root);
 	XShapeSelectInput(ctx->dpy, ctx->root, ShapeNotifyMask);
 	XFixesSelectCursorInput(ctx->dpy, ctx->root, XFixesDisplayCursorNotifyMask);
 	XFixesSelectSelectionInput(ctx->dpy, ctx->root, ctx->atoms.clipboard, XFixesSetSelectionOwnerNotifyMask);
@@ -8462,7 +9267,8 @@ steamcompmgr_main(int argc, char **argv)
 
 			// If we are running behind, allow tearing.
 
-			const bool bForceRepaint = g_bForceRepaint.exchange(false);
+			// Keep painting every vblank while screenshots (eg. a burst) are queued.
+			const bool bForceRepaint = g_bForceRepaint.exchange(false) || gamescope::CScreenshotManager::Get().HasPendingScreenshots();
 			const bool bForceSyncFlip = bForceRepaint || is_fading_out();
 
 			// If we are compositing, always force sync flips because we currently wait
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <deque>
 #include <variant>
 #include <string>
 #include <utility>
@@ -8,6 +9,7 @@
 
 #include "xwayland_ctx.hpp"
 #include "gamescope-control-protocol.h"
+#include "CaptureDamage.h"
 
 struct commit_t;
 struct wlserver_vk_swapchain_feedback;
@@ -73,6 +75,8 @@ struct steamcompmgr_xwayland_win_t
 	Damage		damage;
 	unsigned long	map_sequence;
 	unsigned long	damage_sequence;
+	// Increases along ctx->list, breaks focus priority ties by stacking order.
+	uint64_t	stack_key;
 
 	Window transientFor;
 
@@ -151,6 +155,8 @@ struct steamcompmgr_win_t {
 	std::shared_ptr<std::string> engineName;
 
 	std::vector< gamescope::Rc<commit_t> > commit_queue;
+	// Buffer damage of recent commits, by commit ID. Used for partial PipeWire capture.
+	gamescope::CDamageHistory commitDamage;
 	std::shared_ptr<std::vector< uint32_t >> icon;
 
 	steamcompmgr_win_type_t		type;
@@ -245,16 +251,17 @@ namespace gamescope
 		uint32_t uScreenshotFlags = 0;
 		bool bX11PropertyRequested = false;
 		bool bWaylandRequested = false;
+		// Capture this many consecutive frames, numbering the files.
+		uint32_t uBurstCount = 1;
 	};
 
 	class CScreenshotManager
 	{
 	public:
-		void TakeScreenshot( GamescopeScreenshotInfo info = GamescopeScreenshotInfo{} )
-		{
-			std::unique_lock lock{ m_ScreenshotInfoMutex };
-			m_ScreenshotInfo = std::move( info );
-		}
+		static constexpr size_t k_uMaxPendingScreenshots = 64;
+
+		// Screenshots are taken one per painted frame, in the order they were asked for.
+		void TakeScreenshot( GamescopeScreenshotInfo info = GamescopeScreenshotInfo{} );
 
 		void TakeScreenshot( bool bAVIF )
 		{
@@ -272,13 +279,31 @@ namespace gamescope
 		std::optional<GamescopeScreenshotInfo> ProcessPendingScreenshot()
 		{
 			std::unique_lock lock{ m_ScreenshotInfoMutex };
-			return std::exchange( m_ScreenshotInfo, std::nullopt );
+			if ( m_PendingScreenshots.empty() )
+				return std::nullopt;
+
+			GamescopeScreenshotInfo info = std::move( m_PendingScreenshots.front() );
+			m_PendingScreenshots.pop_front();
+			return info;
+		}
+
+		// Puts back a screenshot we couldn't take this frame, to be retried on the next one.
+		void DeferScreenshot( GamescopeScreenshotInfo info )
+		{
+			std::unique_lock lock{ m_ScreenshotInfoMutex };
+			m_PendingScreenshots.push_front( std::move( info ) );
+		}
+
+		bool HasPendingScreenshots()
+		{
+			std::unique_lock lock{ m_ScreenshotInfoMutex };
+			return !m_PendingScreenshots.empty();
 		}
 
 		static CScreenshotManager &Get();
 	private:
 		std::mutex m_ScreenshotInfoMutex;
-		std::optional<GamescopeScreenshotInfo> m_ScreenshotInfo;
+		std::deque<GamescopeScreenshotInfo> m_PendingScreenshots;
 	};
 
 	extern CScreenshotManager g_ScreenshotMgr;
@@ -0,0 +1,341 @@
+// Offline simulator for the vblank wakeup scheduler.
+//
+// Drives CVBlankScheduler with synthetic or recorded per-frame timings on a
+// perfect vblank clock and reports how often we miss vblank, how long a frame
+// takes from wakeup to scanout, and how much the wakeup point jitters.
+// Everything is deterministic for a given seed, so policies can be compared
+// on any machine.
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+
+#include "VBlankScheduler.h"
+#include "refresh_rate.h"
+
+using namespace gamescope;
+
+struct SimFrame_t
+{
+    uint64_t ulCPUTime;
+    // Non-zero if this frame was composited.
+    uint64_t ulGPUTime;
+    uint64_t ulCommitTime;
+    // Scheduler quantum etc. between the timer firing and us running.
+    uint64_t ulWakeupLatency;
+};
+
+struct SimWorkload_t
+{
+    std::string sName;
+    std::vector<SimFrame_t> frames;
+};
+
+struct SimPolicy_t
+{
+    const char *pszName;
+    std::function<void( VBlankSchedulerTunables_t & )> fnSetup;
+};
+
+struct SimResult_t
+{
+    uint64_t ulFrames = 0;
+    uint64_t ulMissed = 0;
+    std::vector<uint64_t> latencies;
+    std::vector<double> wakeupOffsets;
+};
+
+static const SimPolicy_t s_Policies[] =
+{
+    { "legacy", []( VBlankSchedulerTunables_t &) {} },
+    { "split-p99", []( VBlankSchedulerTunables_t &tunables ) { tunables.bSplitTiming = true; } },
+    { "split-p95", []( VBlankSchedulerTunables_t &tunables )
+    {
+        tunables.bSplitTiming = true;
+        tunables.uSplitCPUPercentile = 95;
+        tunables.uSplitGPUPercentile = 95;
+        tunables.uSplitCommitPercentile = 95;
+    } },
+};
+
+static uint64_t SampleNormal( std::mt19937_64 &rng, double flMeanUs, double flStdDevUs )
+{
+    std::normal_distribution<double> dist( flMeanUs, flStdDevUs );
+    return uint64_t( std::max( dist( rng ), 0.0 ) * 1'000.0 );
+}
+
+static uint64_t SampleWakeupLatency( std::mt19937_64 &rng )
+{
+    std::exponential_distribution<double> dist( 1.0 / 30.0 );
+    return uint64_t( dist( rng ) * 1'000.0 );
+}
+
+static SimFrame_t MakeFrame( std::mt19937_64 &rng, bool bComposite, double flCPUSpikeChance )
+{
+    std::uniform_real_distribution<double> spike( 0.0, 1.0 );
+
+    SimFrame_t frame =
+    {
+        .ulCPUTime = SampleNormal( rng, 450.0, 80.0 ),
+        .ulGPUTime = bComposite ? std::max<uint64_t>( SampleNormal( rng, 900.0, 150.0 ), 1 ) : 0,
+        .ulCommitTime = SampleNormal( rng, 150.0, 40.0 ),
+        .ulWakeupLatency = SampleWakeupLatency( rng ),
+    };
+
+    if ( spike( rng ) < flCPUSpikeChance )
+        frame.ulCPUTime += SampleNormal( rng, 3'000.0, 500.0 );
+
+    return frame;
+}
+
+static std::vector<SimWorkload_t> MakeSyntheticWorkloads( uint32_t uFrames, uint64_t ulSeed )
+{
+    std::vector<SimWorkload_t> workloads;
+
+    auto fnAdd = [&]( const char *pszName, std::function<SimFrame_t( std::mt19937_64 &, uint32_t )> fnFrame )
+    {
+        // Same seed per workload so they don't depend on each other's order.
+        std::mt19937_64 rng( ulSeed );
+
+        SimWorkload_t workload;
+        workload.sName = pszName;
+        workload.frames.reserve( uFrames );
+        for ( uint32_t i = 0; i < uFrames; i++ )
+            workload.frames.push_back( fnFrame( rng, i ) );
+        workloads.push_back( std::move( workload ) );
+    };
+
+    fnAdd( "scanout", []( std::mt19937_64 &rng, uint32_t ) { return MakeFrame( rng, false, 0.0 ); } );
+    fnAdd( "composite", []( std::mt19937_64 &rng, uint32_t ) { return MakeFrame( rng, true, 0.0 ); } );
+    fnAdd( "composite-spiky", []( std::mt19937_64 &rng, uint32_t ) { return MakeFrame( rng, true, 0.02 ); } );
+    // Overlay popping in and out every couple of seconds.
+    fnAdd( "mixed", []( std::mt19937_64 &rng, uint32_t i ) { return MakeFrame( rng, ( i / 120 ) % 2, 0.005 ); } );
+
+    return workloads;
+}
+
+// One frame per line: cpu_ns gpu_ns commit_ns [wakeup_latency_ns]
+// gpu_ns is 0 for frames that were scanned out directly. '#' starts a comment.
+static bool ReadTrace( const char *pszPath, SimWorkload_t *pOutWorkload )
+{
+    FILE *pFile = fopen( pszPath, "r" );
+    if ( !pFile )
+    {
+        fprintf( stderr, "Failed to open '%s': %s\n", pszPath, strerror( errno ) );
+        return false;
+    }
+
+    pOutWorkload->sName = pszPath;
+
+    char szLine[256];
+    uint32_t uLine = 0;
+    while ( fgets( szLine, sizeof( szLine ), pFile ) )
+    {
+        uLine++;
+
+        if ( char *pszComment = strchr( szLine, '#' ) )
+            *pszComment = '\0';
+
+        unsigned long long ulCPU = 0, ulGPU = 0, ulCommit = 0, ulLatency = 0;
+        int nFields = sscanf( szLine, "%llu %llu %llu %llu", &ulCPU, &ulGPU, &ulCommit, &ulLatency );
+        if ( nFields <= 0 )
+            continue;
+
+        if ( nFields < 3 )
+        {
+            fprintf( stderr, "%s:%u: expected at least 3 fields\n", pszPath, uLine );
+            fclose( pFile );
+            return false;
+        }
+
+        pOutWorkload->frames.push_back( SimFrame_t
+        {
+            .ulCPUTime = ulCPU,
+            .ulGPUTime = ulGPU,
+            .ulCommitTime = ulCommit,
+            .ulWakeupLatency = ulLatency,
+        } );
+    }
+
+    fclose( pFile );
+    return true;
+}
+
+static SimResult_t Simulate( const SimWorkload_t &workload, const SimPolicy_t &policy, int32_t nRefreshmHz, bool bInternalDisplay )
+{
+    CVBlankScheduler scheduler;
+    policy.fnSetup( scheduler.Tunables() );
+
+    const uint64_t ulInterval = mHzToRefreshCycle( nRefreshmHz );
+
+    SimResult_t result;
+    result.latencies.reserve( workload.frames.size() );
+    result.wakeupOffsets.reserve( workload.frames.size() );
+
+    uint64_t ulNow = 0;
+    for ( const SimFrame_t &frame : workload.frames )
+    {
+        VBlankSchedulerState_t state =
+        {
+            .nRefreshmHz = nRefreshmHz,
+            .bVRR = false,
+            .bInternalDisplay = bInternalDisplay,
+            .bCompositing = frame.ulGPUTime != 0,
+        };
+
+        VBlankOffset_t offset = scheduler.CalcWakeupOffset( state, false );
+
+        // Same as CVBlankTimer::GetNextVBlank on a perfect clock.
+        uint64_t ulLastVBlank = ( ulNow / ulInterval ) * ulInterval;
+        uint64_t ulWakeup = ulLastVBlank + ulInterval - std::min( offset.ulOffset, ulInterval );
+        while ( ulWakeup < ulNow )
+            ulWakeup += ulInterval;
+        const uint64_t ulTargetVBlank = ulWakeup + offset.ulOffset;
+
+        const uint64_t ulActualWakeup = ulWakeup + frame.ulWakeupLatency;
+        const uint64_t ulDone = ulActualWakeup + frame.ulCPUTime + frame.ulGPUTime + frame.ulCommitTime;
+
+        // A late commit lands on the first vblank after it completes.
+        uint64_t ulScanout = ulTargetVBlank;
+        if ( ulDone > ulTargetVBlank )
+        {
+            result.ulMissed++;
+            ulScanout += ( ( ulDone - ulTargetVBlank + ulInterval - 1 ) / ulInterval ) * ulInterval;
+        }
+
+        result.ulFrames++;
+        result.latencies.push_back( ulScanout - ulActualWakeup );
+        result.wakeupOffsets.push_back( double( ulTargetVBlank ) - double( ulActualWakeup ) );
+
+        // Draw time is measured from the scheduled wakeup, like the timerfd path.
+        if ( frame.ulGPUTime )
+            scheduler.UpdateLastGPUTime( frame.ulGPUTime );
+        scheduler.UpdateLastCommitTime( frame.ulCommitTime );
+        scheduler.UpdateLastDrawTime( ulDone - ulWakeup );
+
+        ulNow = std::max( ulDone, ulScanout );
+    }
+
+    return result;
+}
+
+static void PrintResult( const SimWorkload_t &workload, const SimPolicy_t &policy, SimResult_t &result )
+{
+    if ( !result.ulFrames )
+        return;
+
+    std::sort( result.latencies.begin(), result.latencies.end() );
+
+    double flLatencySum = 0.0;
+    for ( uint64_t ulLatency : result.latencies )
+        flLatencySum += ulLatency;
+
+    double flOffsetMean = 0.0;
+    for ( double flOffset : result.wakeupOffsets )
+        flOffsetMean += flOffset;
+    flOffsetMean /= result.wakeupOffsets.size();
+
+    double flOffsetVariance = 0.0;
+    for ( double flOffset : result.wakeupOffsets )
+        flOffsetVariance += ( flOffset - flOffsetMean ) * ( flOffset - flOffsetMean );
+    flOffsetVariance /= result.wakeupOffsets.size();
+
+    fprintf( stdout, "%-20s %-10s %8.3f%% %10.3f %10.3f %10.1f\n",
+        workload.sName.c_str(),
+        policy.pszName,
+        100.0 * result.ulMissed / result.ulFrames,
+        flLatencySum / result.ulFrames / 1'000'000.0,
+        result.latencies[ size_t( ( result.latencies.size() - 1 ) * 0.99 ) ] / 1'000'000.0,
+        std::sqrt( flOffsetVariance ) / 1'000.0 );
+}
+
+static void PrintUsage( const char *pszArgv0 )
+{
+    fprintf( stderr,
+        "usage: %s [options]\n"
+        "  --refresh <mHz>     refresh rate to simulate. Default: 60000\n"
+        "  --frames <n>        frames per synthetic workload. Default: 3600\n"
+        "  --seed <n>          seed for synthetic workloads. Default: 1\n"
+        "  --trace <path>      simulate a recorded trace instead of the synthetic workloads.\n"
+        "                      One frame per line: cpu_ns gpu_ns commit_ns [wakeup_latency_ns]\n"
+        "  --external          treat the display as external (scales the red zone by refresh)\n",
+        pszArgv0 );
+}
+
+int main( int argc, char *argv[] )
+{
+    static const struct option s_Options[] =
+    {
+        { "refresh", required_argument, nullptr, 'r' },
+        { "frames", required_argument, nullptr, 'f' },
+        { "seed", required_argument, nullptr, 's' },
+        { "trace", required_argument, nullptr, 't' },
+        { "external", no_argument, nullptr, 'e' },
+        { "help", no_argument, nullptr, 'h' },
+        {},
+    };
+
+    int32_t nRefreshmHz = 60'000;
+    uint32_t uFrames = 3600;
+    uint64_t ulSeed = 1;
+    const char *pszTrace = nullptr;
+    bool bInternalDisplay = true;
+
+    int nOpt;
+    while ( ( nOpt = getopt_long( argc, argv, "r:f:s:t:eh", s_Options, nullptr ) ) != -1 )
+    {
+        switch ( nOpt )
+        {
+            case 'r': nRefreshmHz = atoi( optarg ); break;
+            case 'f': uFrames = uint32_t( strtoul( optarg, nullptr, 10 ) ); break;
+            case 's': ulSeed = strtoull( optarg, nullptr, 10 ); break;
+            case 't': pszTrace = optarg; break;
+            case 'e': bInternalDisplay = false; break;
+            default:
+                PrintUsage( argv[0] );
+                return nOpt == 'h' ? 0 : 1;
+        }
+    }
+
+    if ( nRefreshmHz <= 0 )
+    {
+        fprintf( stderr, "Invalid refresh rate\n" );
+        return 1;
+    }
+
+    std::vector<SimWorkload_t> workloads;
+    if ( pszTrace )
+    {
+        SimWorkload_t workload;
+        if ( !ReadTrace( pszTrace, &workload ) )
+            return 1;
+        workloads.push_back( std::move( workload ) );
+    }
+    else
+    {
+        workloads = MakeSyntheticWorkloads( uFrames, ulSeed );
+    }
+
+    fprintf( stdout, "%.3fHz, %s display\n", nRefreshmHz / 1'000.0, bInternalDisplay ? "internal" : "external" );
+    fprintf( stdout, "%-20s %-10s %9s %10s %10s %10s\n", "workload", "policy", "missed", "avg ms", "p99 ms", "jitter us" );
+
+    for ( const SimWorkload_t &workload : workloads )
+    {
+        for ( const SimPolicy_t &policy : s_Policies )
+        {
+            SimResult_t result = Simulate( workload, policy, nRefreshmHz, bInternalDisplay );
+            PrintResult( workload, policy, result );
+        }
+    }
+
+    return 0;
+}
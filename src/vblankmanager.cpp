@@ -1,5 +1,6 @@
 // Try to figure out when vblank is and notify steamcompmgr to render some time before it
 
+#include <algorithm>
 #include <cstdint>
 #include <mutex>
 #include <thread>
@@ -25,6 +26,12 @@ namespace gamescope
 {
 	ConVar<bool> vblank_debug( "vblank_debug", false, "Enable vblank debug spew to stderr." );
 
+	ConVar<bool> vblank_split_timing( "vblank_split_timing", false, "Schedule vblank wakeups from separate CPU, GPU composite and KMS commit time percentiles instead of the rolling peak draw time and fixed red zones." );
+	ConVar<uint32_t> vblank_split_cpu_percentile( "vblank_split_cpu_percentile", 99, "Percentile of CPU time (wakeup to commit, minus GPU composite and commit) to reserve with vblank_split_timing." );
+	ConVar<uint32_t> vblank_split_gpu_percentile( "vblank_split_gpu_percentile", 99, "Percentile of GPU composite time to reserve when compositing with vblank_split_timing." );
+	ConVar<uint32_t> vblank_split_commit_percentile( "vblank_split_commit_percentile", 99, "Percentile of KMS commit time to reserve with vblank_split_timing." );
+	ConVar<uint64_t> vblank_split_margin( "vblank_split_margin", 500'000ul, "Leeway added on top of the percentiles with vblank_split_timing, in nanoseconds." );
+
 	CVBlankTimer::CVBlankTimer()
 	{
 		m_ulTargetVBlank = get_time_in_nanos();
@@ -95,86 +102,26 @@ namespace gamescope
 
 	VBlankScheduleTime CVBlankTimer::CalcNextWakeupTime( bool bPreemptive )
 	{
-		const GamescopeScreenType eScreenType = GetBackend()->GetScreenType();
-
-		const int nRefreshRate = GetRefresh();
-		const uint64_t ulRefreshInterval = mHzToRefreshCycle( nRefreshRate );
-
-		bool bVRR = GetBackend()->GetCurrentConnector() && GetBackend()->GetCurrentConnector()->IsVRRActive();
-		uint64_t ulOffset = 0;
-		if ( !bVRR )
-		{
-			// The redzone is relative to 60Hz for external displays.
-			// Scale it by our target refresh so we don't miss submitting for
-			// vblank in DRM.
-			// (This fixes wonky frame-pacing on 4K@30Hz screens)
-			//
-			// TODO(Josh): Is this fudging still needed with our SteamOS kernel patches
-			// to not account for vertical front porch when dealing with the vblank
-			// drm_commit is going to target?
-			// Need to re-test that.
-			const uint64_t ulRedZone = eScreenType == GAMESCOPE_SCREEN_TYPE_INTERNAL
-				? m_ulVBlankDrawBufferRedZone
-				: std::min<uint64_t>( m_ulVBlankDrawBufferRedZone, ( m_ulVBlankDrawBufferRedZone * 60'000 * nRefreshRate ) / 60'000 );
-
-			const uint64_t ulDecayAlpha = m_ulVBlankRateOfDecayPercentage; // eg. 980 = 98%
-
-			uint64_t ulDrawTime = m_ulLastDrawTime;
-			/// See comment of m_ulVBlankDrawTimeMinCompositing.
-			if ( m_bCurrentlyCompositing )
-				ulDrawTime = std::max( ulDrawTime, m_ulVBlankDrawTimeMinCompositing );
-
-			uint64_t ulNewRollingDrawTime;
-			// This is a rolling average when ulDrawTime < m_ulRollingMaxDrawTime,
-			// and a maximum when ulDrawTime > m_ulRollingMaxDrawTime.
-			//
-			// This allows us to deal with spikes in the draw buffer time very easily.
-			// eg. if we suddenly spike up (eg. because of test commits taking a stupid long time),
-			// we will then be able to deal with spikes in the long term, even if several commits after
-			// we get back into a good state and then regress again.
-
-			// If we go over half of our deadzone, be more defensive about things and
-			// spike up back to our current drawtime (sawtooth).
-			if ( int64_t( ulDrawTime ) - int64_t( ulRedZone / 2 ) > int64_t( m_ulRollingMaxDrawTime ) )
-				ulNewRollingDrawTime = ulDrawTime;
-			else
-				ulNewRollingDrawTime = ( ( ulDecayAlpha * m_ulRollingMaxDrawTime ) + ( kVBlankRateOfDecayMax - ulDecayAlpha ) * ulDrawTime ) / kVBlankRateOfDecayMax;
-
-			// If we need to offset for our draw more than half of our vblank, something is very wrong.
-			// Clamp our max time to half of the vblank if we can.
-			ulNewRollingDrawTime = std::min( ulNewRollingDrawTime, ulRefreshInterval - ulRedZone );
-
-			// If this is not a pre-emptive re-arming, then update
-			// the rolling internal max draw time for next time.
-			if ( !bPreemptive )
-				m_ulRollingMaxDrawTime = ulNewRollingDrawTime;
-
-			ulOffset = ulNewRollingDrawTime + ulRedZone;
-
-			if ( vblank_debug && !bPreemptive )
-				VBlankDebugSpew( ulOffset, ulDrawTime, ulRedZone );
-		}
-		else
+		VBlankSchedulerTunables_t &tunables = m_Scheduler.Tunables();
+		tunables.bSplitTiming = vblank_split_timing;
+		tunables.uSplitCPUPercentile = vblank_split_cpu_percentile;
+		tunables.uSplitGPUPercentile = vblank_split_gpu_percentile;
+		tunables.uSplitCommitPercentile = vblank_split_commit_percentile;
+		tunables.ulSplitMargin = vblank_split_margin;
+
+		VBlankSchedulerState_t state =
 		{
-			// See above.
-			if ( !bPreemptive )
-			{
-				// Reset the max draw time to default, it is unused for VRR.
-				m_ulRollingMaxDrawTime = kStartingVBlankDrawTime;
-			}
-
-			uint64_t ulRedZone = kVRRFlushingTime;
-
-			uint64_t ulDrawTime = 0;
-			/// See comment of m_ulVBlankDrawTimeMinCompositing.
-			if ( m_bCurrentlyCompositing )
-				ulDrawTime = std::max( ulDrawTime, m_ulVBlankDrawTimeMinCompositing );
+			.nRefreshmHz = GetRefresh(),
+			.bVRR = GetBackend()->GetCurrentConnector() && GetBackend()->GetCurrentConnector()->IsVRRActive(),
+			.bInternalDisplay = GetBackend()->GetScreenType() == GAMESCOPE_SCREEN_TYPE_INTERNAL,
+			.bCompositing = m_bCurrentlyCompositing,
+		};
 
-			ulOffset = ulDrawTime + ulRedZone;
+		VBlankOffset_t offset = m_Scheduler.CalcWakeupOffset( state, bPreemptive );
+		const uint64_t ulOffset = offset.ulOffset;
 
-			if ( vblank_debug && !bPreemptive )
-				VBlankDebugSpew( ulOffset, ulDrawTime, ulRedZone );
-		}
+		if ( vblank_debug && !bPreemptive )
+			VBlankDebugSpew( offset.ulOffset, offset.ulDrawTime, offset.ulRedZone );
 
 		const uint64_t ulScheduledWakeupPoint = GetNextVBlank( ulOffset );
 		const uint64_t ulTargetVBlank = ulScheduledWakeupPoint + ulOffset;
@@ -214,7 +161,17 @@ namespace gamescope
 
 	void CVBlankTimer::UpdateLastDrawTime( uint64_t ulNanos )
 	{
-		m_ulLastDrawTime = ulNanos;
+		m_Scheduler.UpdateLastDrawTime( ulNanos );
+	}
+
+	void CVBlankTimer::UpdateLastGPUTime( uint64_t ulNanos )
+	{
+		m_Scheduler.UpdateLastGPUTime( ulNanos );
+	}
+
+	void CVBlankTimer::UpdateLastCommitTime( uint64_t ulNanos )
+	{
+		m_Scheduler.UpdateLastCommitTime( ulNanos );
 	}
 
 	void CVBlankTimer::WaitToBeArmed()
@@ -325,8 +282,8 @@ namespace gamescope
 	void CVBlankTimer::VBlankDebugSpew( uint64_t ulOffset, uint64_t ulDrawTime, uint64_t ulRedZone )
 	{
 		static uint64_t s_ulVBlankID = 0;
-		static uint64_t s_ulLastDrawTime = kStartingVBlankDrawTime;
-		static uint64_t s_ulLastOffset = kStartingVBlankDrawTime + ulRedZone;
+		static uint64_t s_ulLastDrawTime = CVBlankScheduler::kStartingVBlankDrawTime;
+		static uint64_t s_ulLastOffset = CVBlankScheduler::kStartingVBlankDrawTime + ulRedZone;
 
 		if ( s_ulVBlankID++ % 300 == 0 || ulDrawTime > s_ulLastOffset )
 		{
@@ -335,8 +292,8 @@ namespace gamescope
 
 			g_VBlankLog.infof( "redZone: %.2fms decayRate: %lu%% - rollingMaxDrawTime: %.2fms lastDrawTime: %.2fms lastOffset: %.2fms - drawTime: %.2fms offset: %.2fms",
 				ulRedZone / 1'000'000.0,
-				m_ulVBlankRateOfDecayPercentage,
-				m_ulRollingMaxDrawTime / 1'000'000.0,
+				m_Scheduler.Tunables().ulRateOfDecayPercentage,
+				m_Scheduler.GetRollingMaxDrawTime() / 1'000'000.0,
 				s_ulLastDrawTime / 1'000'000.0,
 				s_ulLastOffset / 1'000'000.0,
 				ulDrawTime / 1'000'000.0,
@@ -2,6 +2,7 @@
 
 #include <optional>
 #include "waitable.h"
+#include "VBlankScheduler.h"
 
 namespace gamescope
 {
@@ -27,18 +28,6 @@ namespace gamescope
     class CVBlankTimer : public ITimerWaitable
     {
     public:
-        static constexpr uint64_t kMilliSecInNanoSecs = 1'000'000ul;
-        // VBlank timer defaults and starting values.
-        // Anything time-related is nanoseconds unless otherwise specified.
-        static constexpr uint64_t kStartingVBlankDrawTime = 3'000'000ul;
-        static constexpr uint64_t kDefaultMinVBlankTime = 350'000ul;
-        static constexpr uint64_t kDefaultVBlankRedZone = 1'650'000ul;
-        static constexpr uint64_t kDefaultVBlankDrawTimeMinCompositing = 2'400'000ul;
-        static constexpr uint64_t kDefaultVBlankRateOfDecayPercentage = 980ul; // 98%
-        static constexpr uint64_t kVBlankRateOfDecayMax = 1000ul; // 100%
-
-        static constexpr uint64_t kVRRFlushingTime = 300'000;
-
         CVBlankTimer();
         ~CVBlankTimer();
 
@@ -55,6 +44,10 @@ namespace gamescope
         bool WasCompositing() const;
         void UpdateWasCompositing( bool bCompositing );
         void UpdateLastDrawTime( uint64_t ulNanos );
+        // Optional breakdown of the next UpdateLastDrawTime, used by
+        // the split timing model. Reset after every draw.
+        void UpdateLastGPUTime( uint64_t ulNanos );
+        void UpdateLastCommitTime( uint64_t ulNanos );
 
         void WaitToBeArmed();
         void ArmNextVBlank( bool bPreemptive );
@@ -92,41 +85,10 @@ namespace gamescope
         // to push back to avoid clock feedback loops if so.
         // This is fed-back from steamcompmgr.
         std::atomic<bool> m_bCurrentlyCompositing = { false };
-        // This is the last time a 'draw' took from wake-up to page flip.
-        // 3ms by default to get the ball rolling.
-        // This is calculated by steamcompmgr/drm and fed-back to the vblank timer.
-        std::atomic<uint64_t> m_ulLastDrawTime = { kStartingVBlankDrawTime };
-
-        //////////////////////////////////
-        // VBlank timing tuneables below!
-        //////////////////////////////////
-
-        // Internal rolling peak exponential avg. draw time.
-        // This is updated in CalcNextWakeupTime when not
-        // doing pre-emptive timer re-arms.
-        uint64_t m_ulRollingMaxDrawTime = kStartingVBlankDrawTime;
-
-        // This accounts for some time we cannot account for (which (I think) is the drm_commit -> triggering the pageflip)
-        // It would be nice to make this lower if we can find a way to track that effectively
-        // Perhaps the missing time is spent elsewhere, but given we track from the pipe write
-        // to after the return from `drm_commit` -- I am very doubtful.
-        // 1.3ms by default. (kDefaultMinVBlankTime)
-        uint64_t m_ulMinVBlankTime = kDefaultMinVBlankTime;
-
-        // The leeway we always apply to our buffer.
-        // 0.3ms by default. (kDefaultVBlankRedZone)
-        uint64_t m_ulVBlankDrawBufferRedZone = kDefaultVBlankRedZone;
-
-        // The minimum drawtime to use when we are compositing.
-        // Getting closer and closer to vblank when compositing means that we can get into
-        // a feedback loop with our GPU clocks. Pick a sane minimum draw time.
-        // 2.4ms by default. (kDefaultVBlankDrawTimeMinCompositing)
-        uint64_t m_ulVBlankDrawTimeMinCompositing = kDefaultVBlankDrawTimeMinCompositing;
-
-        // The rate of decay (as a percentage) of the rolling average -> current draw time
-        // 930 = 93%.
-        // 93% by default. (kDefaultVBlankRateOfDecayPercentage)
-        uint64_t m_ulVBlankRateOfDecayPercentage = kDefaultVBlankRateOfDecayPercentage;
+
+        // Draw time feedback -> wakeup offset, and all the
+        // tuneables that go with it.
+        CVBlankScheduler m_Scheduler;
 
         void NudgeThread();
     };
@@ -65,8 +65,10 @@
 #include "refresh_rate.h"
 #include "InputEmulation.h"
 #include "commit.h"
+#include "FrameLatency.h"
 #include "Timeline.h"
 #include "Utils/NonCopyable.h"
+#include "Utils/SeqLock.h"
 
 #if HAVE_PIPEWIRE
 #include "pipewire.hpp"
@@ -75,7 +77,11 @@
 #include "gpuvis_trace_utils.h"
 
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <cinttypes>
 #include <list>
+#include <map>
 #include <set>
 
 static LogScope wl_log("wlserver");
@@ -163,7 +169,15 @@ std::optional<ResListEntry_t> PrepareCommit( struct wlr_surface *surf, struct wl
 		wl_surf->present_id,
 		wl_surf->desired_present_time,
 		std::move( pAcquirePoint ),
-		std::move( pReleasePoint )
+		std::move( pReleasePoint ),
+		get_time_in_nanos(),
+		wlr_box
+		{
+			surf->buffer_damage.extents.x1,
+			surf->buffer_damage.extents.y1,
+			surf->buffer_damage.extents.x2 - surf->buffer_damage.extents.x1,
+			surf->buffer_damage.extents.y2 - surf->buffer_damage.extents.y1,
+		},
 	};
 	wl_surf->present_id = std::nullopt;
 	wl_surf->desired_present_time = 0;
@@ -1009,12 +1023,18 @@ static void gamescope_pipewire_bind( struct wl_client *client, void *data, uint3
 	struct wl_resource *resource = wl_resource_create( client, &gamescope_pipewire_interface, version, id );
 	wl_resource_set_implementation( resource, &gamescope_pipewire_impl, NULL, NULL );
 
-	gamescope_pipewire_send_stream_node( resource, get_pipewire_stream_node_id() );
+	gamescope_pipewire_send_stream_node( resource, get_pipewire_stream_node_id( 0 ) );
+
+	if ( version >= GAMESCOPE_PIPEWIRE_EXTRA_STREAM_NODE_SINCE_VERSION )
+	{
+		for ( uint32_t i = 1; i < get_pipewire_stream_count(); i++ )
+			gamescope_pipewire_send_extra_stream_node( resource, i, get_pipewire_stream_node_id( i ) );
+	}
 }
 
 static void create_gamescope_pipewire( void )
 {
-	uint32_t version = 1;
+	uint32_t version = 2;
 	wl_global_create( wlserver.display, &gamescope_pipewire_interface, version, NULL, gamescope_pipewire_bind );
 }
 #endif
@@ -1173,6 +1193,42 @@ static void gamescope_control_unset_look( struct wl_client *client, struct wl_re
 	hasRepaint = true;
 }
 
+static void gamescope_control_request_frame_latency( struct wl_client *client, struct wl_resource *resource, uint32_t frames )
+{
+	auto histograms = gamescope::CFrameLatencyTracker::Get().GetHistograms( frames );
+
+	for ( uint32_t i = 0; i < histograms.size(); i++ )
+	{
+		const gamescope::CLatencyHistogram &histogram = histograms[i];
+
+		struct wl_array buckets;
+		wl_array_init( &buckets );
+		for ( uint32_t uBucket = 0; uBucket < histogram.GetBuckets().size(); uBucket++ )
+		{
+			if ( !histogram.GetBuckets()[ uBucket ] )
+				continue;
+
+			uint32_t *ptr = (uint32_t *)wl_array_add( &buckets, sizeof( uint32_t ) * 2 );
+			ptr[0] = (uint32_t)gamescope::CLatencyHistogram::BucketUpperBound( uBucket );
+			ptr[1] = histogram.GetBuckets()[ uBucket ];
+		}
+
+		auto ToWire = []( uint64_t ulValue ) { return (uint32_t)std::min<uint64_t>( ulValue, UINT32_MAX ); };
+
+		gamescope_control_send_frame_latency( resource, i,
+			ToWire( histogram.GetCount() ),
+			ToWire( histogram.GetPercentile( 500 ) ),
+			ToWire( histogram.GetPercentile( 900 ) ),
+			ToWire( histogram.GetPercentile( 990 ) ),
+			ToWire( histogram.GetPercentile( 999 ) ),
+			ToWire( histogram.GetMax() ),
+			&buckets );
+		wl_array_release( &buckets );
+	}
+
+	gamescope_control_send_frame_latency_done( resource );
+}
+
 static void gamescope_control_handle_destroy( struct wl_client *client, struct wl_resource *resource )
 {
 	wl_resource_destroy( resource );
@@ -1185,6 +1241,7 @@ static const struct gamescope_control_interface gamescope_control_impl = {
 	.display_sleep = gamescope_control_display_sleep,
 	.set_look = gamescope_control_set_look,
 	.unset_look = gamescope_control_unset_look,
+	.request_frame_latency = gamescope_control_request_frame_latency,
 };
 
 static uint32_t get_conn_display_info_flags()
@@ -1250,6 +1307,7 @@ static void gamescope_control_bind( struct wl_client *client, void *data, uint32
 	gamescope_control_send_feature_support( resource, GAMESCOPE_CONTROL_FEATURE_REFRESH_CYCLE_ONLY_CHANGE_REFRESH_RATE, 1, 0 );
 	gamescope_control_send_feature_support( resource, GAMESCOPE_CONTROL_FEATURE_MURA_CORRECTION, 1, 0 );
 	gamescope_control_send_feature_support( resource, GAMESCOPE_CONTROL_FEATURE_LOOK, 1, 0 );
+	gamescope_control_send_feature_support( resource, GAMESCOPE_CONTROL_FEATURE_FRAME_LATENCY, 1, 0 );
 	gamescope_control_send_feature_support( resource, GAMESCOPE_CONTROL_FEATURE_DONE, 0, 0 );
 
 	wlserver_send_gamescope_control( resource );
@@ -1259,7 +1317,7 @@ static void gamescope_control_bind( struct wl_client *client, void *data, uint32
 
 static void create_gamescope_control( void )
 {
-	uint32_t version = 5;
+	uint32_t version = 6;
 	wl_global_create( wlserver.display, &gamescope_control_interface, version, NULL, gamescope_control_bind );
 }
 
@@ -2038,6 +2096,68 @@ bool wlserver_init( void ) {
 
 pthread_mutex_t waylock = PTHREAD_MUTEX_INITIALIZER;
 
+static gamescope::ConVar<bool> cv_wlserver_lock_stats( "wlserver_lock_stats", false, "Record how long each wlserver_lock call site waits for and holds the lock. Print with wlserver_lock_stats_print." );
+
+// Log2 buckets in microseconds: <1us, <2us, <4us ... and a last one for everything longer.
+static constexpr uint32_t k_uLockHistogramBuckets = 20;
+
+struct WLServerLockSiteStats_t
+{
+	uint64_t ulCount = 0;
+	uint64_t ulWaitTotal = 0;
+	uint64_t ulWaitMax = 0;
+	uint64_t ulHoldTotal = 0;
+	uint64_t ulHoldMax = 0;
+	std::array<uint64_t, k_uLockHistogramBuckets> waitHistogram{};
+	std::array<uint64_t, k_uLockHistogramBuckets> holdHistogram{};
+};
+
+static void RecordLockTime( uint64_t ulNanos, uint64_t &ulTotal, uint64_t &ulMax, std::array<uint64_t, k_uLockHistogramBuckets> &histogram )
+{
+	ulTotal += ulNanos;
+	ulMax = std::max( ulMax, ulNanos );
+	histogram[ std::min<uint32_t>( std::bit_width( ulNanos / 1'000 ), k_uLockHistogramBuckets - 1 ) ]++;
+}
+
+// All of these are only touched with waylock held.
+static std::map<std::pair<std::string_view, uint32_t>, WLServerLockSiteStats_t> s_LockSiteStats;
+static WLServerLockSiteStats_t *s_pLockHolderStats = nullptr;
+static uint64_t s_ulLockAcquireTime = 0;
+
+static gamescope::CSeqLock<wlserver_cursor_state_t> s_CursorState;
+static wlserver_cursor_state_t s_LastCursorState = {};
+
+// Called with the lock held, so there is only ever one writer.
+static void wlserver_publish_cursor_state()
+{
+	wlserver_cursor_state_t state = {};
+
+	struct wlr_pointer_constraint_v1 *pConstraint = wlserver.GetCursorConstraint();
+	if ( pConstraint && pConstraint->current.cursor_hint.enabled )
+	{
+		state.x = pConstraint->current.cursor_hint.x;
+		state.y = pConstraint->current.cursor_hint.y;
+		state.bConstrained = true;
+	}
+	else
+	{
+		state.x = wlserver.mouse_surface_cursorx;
+		state.y = wlserver.mouse_surface_cursory;
+		state.bConstrained = false;
+	}
+
+	if ( state.x == s_LastCursorState.x && state.y == s_LastCursorState.y && state.bConstrained == s_LastCursorState.bConstrained )
+		return;
+
+	s_CursorState.Store( state );
+	s_LastCursorState = state;
+}
+
+wlserver_cursor_state_t wlserver_get_cursor_state()
+{
+	return s_CursorState.Load();
+}
+
 bool wlserver_is_lock_held(void)
 {
 	int err = pthread_mutex_trylock(&waylock);
@@ -2049,18 +2169,100 @@ bool wlserver_is_lock_held(void)
 	return true;
 }
 
-void wlserver_lock(void)
+void wlserver_lock( std::source_location location )
 {
+	if ( !cv_wlserver_lock_stats )
+	{
+		pthread_mutex_lock(&waylock);
+		s_pLockHolderStats = nullptr;
+		return;
+	}
+
+	uint64_t ulWaitStart = get_time_in_nanos();
 	pthread_mutex_lock(&waylock);
+	uint64_t ulAcquireTime = get_time_in_nanos();
+
+	WLServerLockSiteStats_t &stats = s_LockSiteStats[ { location.file_name(), location.line() } ];
+	stats.ulCount++;
+	RecordLockTime( ulAcquireTime - ulWaitStart, stats.ulWaitTotal, stats.ulWaitMax, stats.waitHistogram );
+
+	s_pLockHolderStats = &stats;
+	s_ulLockAcquireTime = ulAcquireTime;
 }
 
 void wlserver_unlock(bool flush)
 {
     if (flush)
 	    wl_display_flush_clients(wlserver.display);
+
+	if ( wlserver.display )
+		wlserver_publish_cursor_state();
+
+	if ( s_pLockHolderStats )
+	{
+		RecordLockTime( get_time_in_nanos() - s_ulLockAcquireTime, s_pLockHolderStats->ulHoldTotal, s_pLockHolderStats->ulHoldMax, s_pLockHolderStats->holdHistogram );
+		s_pLockHolderStats = nullptr;
+	}
+
 	pthread_mutex_unlock(&waylock);
 }
 
+static std::string FormatLockHistogram( const std::array<uint64_t, k_uLockHistogramBuckets> &histogram )
+{
+	std::string sHistogram;
+	for ( uint32_t i = 0; i < k_uLockHistogramBuckets; i++ )
+	{
+		if ( !histogram[i] )
+			continue;
+
+		char szBucket[64];
+		if ( i == k_uLockHistogramBuckets - 1 )
+			snprintf( szBucket, sizeof( szBucket ), " >=%uus:%" PRIu64, 1u << ( i - 1 ), histogram[i] );
+		else
+			snprintf( szBucket, sizeof( szBucket ), " <%uus:%" PRIu64, 1u << i, histogram[i] );
+		sHistogram += szBucket;
+	}
+	return sHistogram;
+}
+
+static gamescope::ConCommand cc_wlserver_lock_stats_print( "wlserver_lock_stats_print", "Print wlserver lock wait/hold times per call site, busiest first. Pass 'reset' to clear them.",
+[]( std::span<std::string_view> args )
+{
+	// Commands come in through gamescope_private, inside the wlserver dispatch.
+	assert( wlserver_is_lock_held() );
+
+	if ( args.size() > 1 && args[1] == "reset" )
+	{
+		// Keep the entries, the current holder points into one.
+		for ( auto &iter : s_LockSiteStats )
+			iter.second = WLServerLockSiteStats_t{};
+	}
+	else
+	{
+		std::vector<std::pair<const std::pair<std::string_view, uint32_t>, WLServerLockSiteStats_t> *> sites;
+		for ( auto &iter : s_LockSiteStats )
+		{
+			if ( iter.second.ulCount )
+				sites.push_back( &iter );
+		}
+		std::sort( sites.begin(), sites.end(), []( const auto *a, const auto *b ) { return a->second.ulHoldTotal > b->second.ulHoldTotal; } );
+
+		if ( sites.empty() )
+			wl_log.infof( "No wlserver lock stats, enable them with wlserver_lock_stats 1" );
+
+		for ( const auto *pSite : sites )
+		{
+			const WLServerLockSiteStats_t &stats = pSite->second;
+			wl_log.infof( "%.*s:%u: %" PRIu64 " locks, wait avg %.1fus max %.1fus, hold avg %.1fus max %.1fus",
+				int( pSite->first.first.size() ), pSite->first.first.data(), pSite->first.second, stats.ulCount,
+				stats.ulWaitTotal / 1'000.0 / stats.ulCount, stats.ulWaitMax / 1'000.0,
+				stats.ulHoldTotal / 1'000.0 / stats.ulCount, stats.ulHoldMax / 1'000.0 );
+			wl_log.infof( "    wait:%s", FormatLockHistogram( stats.waitHistogram ).c_str() );
+			wl_log.infof( "    hold:%s", FormatLockHistogram( stats.holdHistogram ).c_str() );
+		}
+	}
+});
+
 extern std::mutex g_SteamCompMgrXWaylandServerMutex;
 
 static int g_wlserverNudgePipe[2] = {-1, -1};
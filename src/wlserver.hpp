@@ -12,6 +12,7 @@
 #include <list>
 #include <unordered_map>
 #include <optional>
+#include <source_location>
 
 #include "WaylandServer/WaylandDecls.h"
 #include "WaylandServer/WaylandServerLegacy.h"
@@ -48,6 +49,9 @@ struct ResListEntry_t {
 	uint64_t desired_present_time;
 	std::shared_ptr<gamescope::CAcquireTimelinePoint> pAcquirePoint;
 	std::shared_ptr<gamescope::CReleaseTimelinePoint> pReleasePoint;
+	uint64_t ulArrivalTime;
+	// Extents of the damage for this commit, in buffer coordinates.
+	struct wlr_box bufferDamage;
 };
 
 struct wlserver_content_override;
@@ -225,10 +229,22 @@ bool wlserver_init( void );
 
 void wlserver_run(void);
 
-void wlserver_lock(void);
+// The call site is only used for the wlserver_lock_stats instrumentation.
+void wlserver_lock( std::source_location location = std::source_location::current() );
 void wlserver_unlock(bool flush = true);
 bool wlserver_is_lock_held(void);
 
+struct wlserver_cursor_state_t
+{
+	double x;
+	double y;
+	bool bConstrained;
+};
+
+// Cursor position as of the last wlserver_unlock. Doesn't take the lock,
+// so the compositor can read it every frame without waiting on wlserver.
+wlserver_cursor_state_t wlserver_get_cursor_state();
+
 void wlserver_keyboardfocus( struct wlr_surface *surface, bool bConstrain = true );
 void wlserver_key( uint32_t key, bool press, uint32_t time );
 
@@ -2,9 +2,12 @@
 
 #include "backend.h"
 #include "waitable.h"
+#include "FocusPriority.h"
 
 #include <mutex>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <X11/Xlib.h>
@@ -20,6 +23,7 @@
 class gamescope_xwayland_server_t;
 struct ignore;
 struct steamcompmgr_win_t;
+struct wlr_surface;
 class MouseCursor;
 
 extern LogScope xwm_log;
@@ -67,6 +71,29 @@ struct xwayland_ctx_t final : public gamescope::IWaitable
 	// wlserver wants it.
 	std::mutex list_mutex;
 	steamcompmgr_win_t				*list;
+
+	// Lookup tables for find_win, so it doesn't have to walk list.
+	// Guarded by win_index_mutex as wlserver looks up windows too.
+	// Taken inside list_mutex when windows are linked/unlinked.
+	std::mutex win_index_mutex;
+	std::unordered_map<Window, steamcompmgr_win_t *> win_index;
+	// Child windows we've already resolved to a toplevel in list.
+	std::unordered_map<Window, Window> child_toplevels;
+	// Window each surface was last found on. Only used on the
+	// steamcompmgr thread, and checked against the window on use.
+	std::unordered_map<struct wlr_surface *, Window> surface_index;
+
+	// CARDINAL properties get_prop has fetched from windows we get
+	// PropertyNotify for, so they can be reused until the next one.
+	struct cached_prop_t
+	{
+		bool bExists = false;
+		// Request sequence of the fetch, to tell which notifies it saw.
+		uint32_t uSequence = 0;
+		std::vector<uint32_t> values;
+	};
+	std::unordered_map<uint64_t, cached_prop_t> prop_cache;
+	std::unordered_set<Window> prop_cache_windows;
 	int				scr;
 	Window			root;
 	XserverRegion	allDamage;
@@ -94,7 +121,11 @@ struct xwayland_ctx_t final : public gamescope::IWaitable
 
 	bool force_windows_fullscreen = false;
 
-	std::vector< steamcompmgr_win_t* > GetPossibleFocusWindows();
+	// Sorted by focus priority. Windows marked dirty with MakeWindowFocusDirty
+	// are re-ranked on the next call after MakeFocusDirty.
+	const std::vector< steamcompmgr_win_t* > &GetPossibleFocusWindows();
+	gamescope::CFocusCandidateSet< steamcompmgr_win_t* > focusCandidates;
+	uint64_t ulPossibleFocusWindowsSerial = UINT64_MAX;
 	void DetermineAndApplyFocus( const std::vector< steamcompmgr_win_t* > &vecPossibleFocusWindows );
 
 	struct {